@@ -57,6 +57,13 @@ public:
         memcpy(&mMappedData[elementIndex*mElementByteSize], &data, sizeof(T));
     }
 
+    // For filling a whole (non constant) buffer in place.  Write it in order: the
+    // memory is write-combined, so reading it back is slow.
+    T* MappedData()
+    {
+        return reinterpret_cast<T*>(mMappedData);
+    }
+
 private:
     Microsoft::WRL::ComPtr<ID3D12Resource> mUploadBuffer;
     BYTE* mMappedData = nullptr;
@@ -0,0 +1,191 @@
+//***************************************************************************************
+// AssetReloader.cpp
+//***************************************************************************************
+
+#include "AssetReloader.h"
+#include "FileWatcher.h"
+#include <algorithm>
+#include <chrono>
+
+using uint32 = AssetReloader::uint32;
+
+AssetReloader::~AssetReloader()
+{
+	Stop();
+}
+
+uint32 AssetReloader::Add(const std::string& name, const std::vector<std::string>& files, BuildFn build)
+{
+	Artifact artifact;
+	artifact.Name = name;
+	artifact.Build = std::move(build);
+	mArtifacts.push_back(std::move(artifact));
+
+	uint32 id = (uint32)mArtifacts.size() - 1;
+	SetFiles(id, files);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mStats.Artifacts = (uint32)mArtifacts.size();
+	return id;
+}
+
+void AssetReloader::SetFiles(uint32 artifact, const std::vector<std::string>& files)
+{
+	std::vector<std::string> normalized;
+	for (const std::string& file : files)
+		normalized.push_back(FileWatcher::NormalizePath(file));
+	std::sort(normalized.begin(), normalized.end());
+	normalized.erase(std::unique(normalized.begin(), normalized.end()), normalized.end());
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mArtifacts[artifact].Files = std::move(normalized);
+}
+
+std::vector<std::string> AssetReloader::Directories()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	std::vector<std::string> directories;
+	for (const Artifact& artifact : mArtifacts)
+	{
+		for (const std::string& file : artifact.Files)
+		{
+			std::size_t slash = file.find_last_of('/');
+			directories.push_back(slash == std::string::npos ? std::string(".") : file.substr(0, slash));
+		}
+	}
+	std::sort(directories.begin(), directories.end());
+	directories.erase(std::unique(directories.begin(), directories.end()), directories.end());
+	return directories;
+}
+
+void AssetReloader::Start()
+{
+	Stop();
+
+	mStop = false;
+	if (!mArtifacts.empty())
+		mThread = std::thread(&AssetReloader::Run, this);
+}
+
+void AssetReloader::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mWake.notify_all();
+	if (mThread.joinable())
+		mThread.join();
+}
+
+void AssetReloader::Invalidate(const std::vector<std::string>& changedFiles)
+{
+	bool queued = false;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (const std::string& changed : changedFiles)
+		{
+			std::string file = FileWatcher::NormalizePath(changed);
+			bool used = false;
+			for (uint32 i = 0; i < (uint32)mArtifacts.size(); ++i)
+			{
+				Artifact& artifact = mArtifacts[i];
+				if (!std::binary_search(artifact.Files.begin(), artifact.Files.end(), file))
+					continue;
+
+				used = true;
+				if (std::find(artifact.Changed.begin(), artifact.Changed.end(), file) == artifact.Changed.end())
+					artifact.Changed.push_back(file);
+				if (!artifact.Queued)
+				{
+					artifact.Queued = true;
+					mQueue.push_back(i);
+					queued = true;
+				}
+			}
+			if (used)
+				mStats.Changes++;
+		}
+	}
+
+	if (queued)
+		mWake.notify_all();
+}
+
+uint32 AssetReloader::Apply()
+{
+	std::vector<ApplyFn> finished;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		finished.swap(mFinished);
+	}
+
+	for (ApplyFn& apply : finished)
+		apply();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mStats.Applied += finished.size();
+	return (uint32)finished.size();
+}
+
+bool AssetReloader::IsBusy()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!mQueue.empty() || !mFinished.empty())
+		return true;
+	return std::any_of(mArtifacts.begin(), mArtifacts.end(), [](const Artifact& a) { return a.Building; });
+}
+
+AssetReloader::Stats AssetReloader::GetStats()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mStats;
+}
+
+void AssetReloader::Run()
+{
+	using Clock = std::chrono::steady_clock;
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	for (;;)
+	{
+		mWake.wait(lock, [this] { return mStop || !mQueue.empty(); });
+		if (mStop)
+			break;
+
+		uint32 id = mQueue.front();
+		mQueue.pop_front();
+
+		// Changes from here on queue the artifact again.
+		Artifact& artifact = mArtifacts[id];
+		std::vector<std::string> changed;
+		changed.swap(artifact.Changed);
+		artifact.Queued = false;
+		artifact.Building = true;
+		const BuildFn& build = artifact.Build;
+		lock.unlock();
+
+		// A build that throws (a ThrowIfFailed, say) fails like one that returns null.
+		Clock::time_point start = Clock::now();
+		ApplyFn apply;
+		try
+		{
+			apply = build(changed);
+		}
+		catch (...)
+		{
+			apply = nullptr;
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		lock.lock();
+		artifact.Building = false;
+		mStats.Builds++;
+		mStats.BuildSeconds += seconds;
+		if (apply)
+			mFinished.push_back(std::move(apply));
+		else
+			mStats.Failed++;
+	}
+}
@@ -0,0 +1,114 @@
+//***************************************************************************************
+// AssetReloader.h
+//
+// Rebuilds what was made from files that changed while the app runs.  Every artifact (a
+// set of shader programs and their pipelines, a texture, the maze) lists the files it
+// was built from; when some of them change only the artifacts that depend on them are
+// rebuilt, one at a time on a worker thread, and the old versions stay in use meanwhile.
+//
+// A rebuild returns what swaps its result in.  The caller runs those at a frame
+// boundary, on its own thread, so it can put GPU objects in place between frames
+// instead of waiting for the GPU to go idle.  A rebuild that fails returns nothing and
+// the artifact keeps its last good version.
+//
+// An artifact that changes again while it is being rebuilt is rebuilt once more after,
+// with every file that changed in between.
+//
+// This class only tracks dependencies and runs the rebuilds, so it has no Direct3D
+// dependency.
+//***************************************************************************************
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class AssetReloader
+{
+public:
+
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	// Puts a rebuilt artifact in place; runs on the thread that calls Apply.
+	using ApplyFn = std::function<void()>;
+
+	// Rebuilds an artifact on the worker thread from the files that changed, which are
+	// normalized (see FileWatcher::NormalizePath).  Returns null if it failed.
+	using BuildFn = std::function<ApplyFn(const std::vector<std::string>& changedFiles)>;
+
+	struct Stats
+	{
+		uint32 Artifacts = 0;
+		uint64 Changes = 0;         // changed files some artifact depends on
+		uint64 Builds = 0;
+		uint64 Applied = 0;
+		uint64 Failed = 0;
+		double BuildSeconds = 0.0;  // worker time spent rebuilding
+	};
+
+public:
+	AssetReloader() = default;
+	AssetReloader(const AssetReloader& rhs) = delete;
+	AssetReloader& operator=(const AssetReloader& rhs) = delete;
+	~AssetReloader();
+
+	// Registers an artifact before Start and returns its id.
+	uint32 Add(const std::string& name, const std::vector<std::string>& files, BuildFn build);
+
+	// Replaces the files of an artifact, when a rebuild found it now reads others.
+	void SetFiles(uint32 artifact, const std::vector<std::string>& files);
+
+	// The directories of every file some artifact depends on, normalized, each once.
+	std::vector<std::string> Directories()const;
+
+	void Start();
+	void Stop();
+
+	///<summary>
+	/// Queues a rebuild of every artifact that depends on one of the changed files.
+	/// Files nothing depends on are ignored.
+	///</summary>
+	void Invalidate(const std::vector<std::string>& changedFiles);
+
+	// Swaps in the rebuilds that finished, in the order they finished.  Returns how many.
+	uint32 Apply();
+
+	// True while rebuilds are queued, running or waiting to be applied.
+	bool IsBusy()const;
+
+	const std::string& Name(uint32 artifact)const { return mArtifacts[artifact].Name; }
+
+	Stats GetStats()const;
+
+private:
+	struct Artifact
+	{
+		std::string Name;
+		std::vector<std::string> Files;
+		BuildFn Build;
+		std::vector<std::string> Changed;   // since the rebuild was queued
+		bool Queued = false;
+		bool Building = false;
+	};
+
+	void Run();
+
+private:
+	std::vector<Artifact> mArtifacts;
+
+	mutable std::mutex mMutex;
+	std::condition_variable mWake;
+	std::deque<uint32> mQueue;
+	std::vector<ApplyFn> mFinished;
+	std::thread mThread;
+	bool mStop = false;
+
+	Stats mStats;
+};
@@ -0,0 +1,170 @@
+//***************************************************************************************
+// BillboardExpander.cpp
+//***************************************************************************************
+
+#include "BillboardExpander.h"
+#include "ParallelFor.h"
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define BILLBOARD_EXPANDER_SSE 1
+#include <emmintrin.h>
+#endif
+
+using uint32 = BillboardExpander::uint32;
+
+namespace
+{
+	// Fills the four corners of one sprite in GS order: right-bottom, right-top,
+	// left-bottom, left-top.
+	inline void WriteQuad(BillboardExpander::QuadVertex* v, float x, float y, float z, float rightX, float rightZ,
+		float halfHeight, float normalX, float normalZ, uint32 slice)
+	{
+		const float xs[4] = { x + rightX, x + rightX, x - rightX, x - rightX };
+		const float ys[4] = { y - halfHeight, y + halfHeight, y - halfHeight, y + halfHeight };
+		const float zs[4] = { z + rightZ, z + rightZ, z - rightZ, z - rightZ };
+		const float us[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+		const float vs[4] = { 1.0f, 0.0f, 1.0f, 0.0f };
+
+		for (int k = 0; k < 4; ++k)
+		{
+			v[k].Position[0] = xs[k];
+			v[k].Position[1] = ys[k];
+			v[k].Position[2] = zs[k];
+			v[k].Slice = slice;
+			v[k].NormalXZ[0] = normalX;
+			v[k].NormalXZ[1] = normalZ;
+			v[k].TexC[0] = us[k];
+			v[k].TexC[1] = vs[k];
+		}
+	}
+}
+
+void BillboardExpander::BuildIndices(uint32 spriteCount, std::vector<uint32>& indices)
+{
+	indices.resize((size_t)spriteCount * IndicesPerSprite);
+	for (uint32 i = 0; i < spriteCount; ++i)
+	{
+		// The GS emits a strip 0-1-2-3; as a list that is (0, 1, 2) and (2, 1, 3).
+		uint32 base = i * VerticesPerSprite;
+		uint32* tri = &indices[(size_t)i * IndicesPerSprite];
+		tri[0] = base + 0;
+		tri[1] = base + 1;
+		tri[2] = base + 2;
+		tri[3] = base + 2;
+		tri[4] = base + 1;
+		tri[5] = base + 3;
+	}
+}
+
+void BillboardExpander::ExpandScalar(const Sprite* sprites, uint32 count, uint32 firstId, uint32 sliceCount,
+	const float eye[3], QuadVertex* out)
+{
+	for (uint32 i = 0; i < count; ++i)
+	{
+		const Sprite& s = sprites[i];
+
+		// Look towards the eye in the XZ plane; right = up x look.
+		float lookX = eye[0] - s.Position[0];
+		float lookZ = eye[2] - s.Position[2];
+		float lengthSq = lookX * lookX + lookZ * lookZ;
+		float invLength = lengthSq > 0.0f ? 1.0f / sqrtf(lengthSq) : 0.0f;
+		lookX *= invLength;
+		lookZ *= invLength;
+
+		float halfWidth = 0.5f * s.Size[0];
+		WriteQuad(out + (size_t)i * VerticesPerSprite, s.Position[0], s.Position[1], s.Position[2],
+			halfWidth * lookZ, -halfWidth * lookX, 0.5f * s.Size[1], lookX, lookZ, (firstId + i) % sliceCount);
+	}
+}
+
+void BillboardExpander::Expand(const Sprite* sprites, uint32 count, uint32 firstId, uint32 sliceCount,
+	const float eye[3], QuadVertex* out)
+{
+#if defined(BILLBOARD_EXPANDER_SSE)
+	// One sprite per iteration, kept in registers as (x, y, z, w) vectors: the first
+	// half of a vertex is position and slice, the second the normal's x, z and the uv.
+	const __m128 eyeXZ = _mm_set_ps(0.0f, eye[2], 0.0f, eye[0]);
+	const __m128 maskXZ = _mm_castsi128_ps(_mm_set_epi32(0, -1, 0, -1));
+	const __m128 maskXYZ = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	const __m128 maskY = _mm_castsi128_ps(_mm_set_epi32(0, 0, -1, 0));
+	const __m128 negateZ = _mm_set_ps(0.0f, -0.0f, 0.0f, 0.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 threeHalves = _mm_set1_ps(1.5f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 texC[4] =
+	{
+		_mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f),
+		_mm_set_ps(0.0f, 0.0f, 0.0f, 0.0f),
+		_mm_set_ps(1.0f, 1.0f, 0.0f, 0.0f),
+		_mm_set_ps(0.0f, 1.0f, 0.0f, 0.0f),
+	};
+
+	float* dst = &out[0].Position[0];
+	uint32 sliceIndex = firstId % sliceCount;
+	for (uint32 i = 0; i < count; ++i)
+	{
+		const Sprite& s = sprites[i];
+
+		// Loads Position and Size[0].
+		__m128 centre = _mm_loadu_ps(s.Position);
+
+		// (lx, 0, lz, 0) towards the eye, normalised with rsqrt plus one Newton step.  A
+		// sprite right under the eye gets a zero look vector, like the scalar path.
+		__m128 look = _mm_and_ps(_mm_sub_ps(eyeXZ, centre), maskXZ);
+		__m128 squares = _mm_mul_ps(look, look);
+		__m128 lengthSq = _mm_add_ps(squares, _mm_shuffle_ps(squares, squares, _MM_SHUFFLE(1, 0, 3, 2)));
+		__m128 inv = _mm_rsqrt_ps(lengthSq);
+		inv = _mm_mul_ps(inv, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, lengthSq), _mm_mul_ps(inv, inv))));
+		inv = _mm_and_ps(inv, _mm_cmpgt_ps(lengthSq, zero));
+		look = _mm_mul_ps(look, inv);
+
+		// right = up x look = (lz, 0, -lx) scaled by half the width.
+		__m128 halfWidth = _mm_set1_ps(0.5f * s.Size[0]);
+		__m128 right = _mm_mul_ps(_mm_xor_ps(_mm_shuffle_ps(look, look, _MM_SHUFFLE(3, 0, 1, 2)), negateZ), halfWidth);
+		__m128 up = _mm_and_ps(_mm_set1_ps(0.5f * s.Size[1]), maskY);
+
+		__m128 slice = _mm_castsi128_ps(_mm_set_epi32((int)sliceIndex, 0, 0, 0));
+		if (++sliceIndex == sliceCount)
+			sliceIndex = 0;
+		__m128 base = _mm_and_ps(centre, maskXYZ);
+		__m128 plusRight = _mm_add_ps(base, right);
+		__m128 minusRight = _mm_sub_ps(base, right);
+
+		__m128 normal = _mm_shuffle_ps(look, look, _MM_SHUFFLE(1, 1, 2, 0));
+
+		_mm_storeu_ps(dst + 0, _mm_or_ps(_mm_sub_ps(plusRight, up), slice));
+		_mm_storeu_ps(dst + 4, _mm_add_ps(normal, texC[0]));
+		_mm_storeu_ps(dst + 8, _mm_or_ps(_mm_add_ps(plusRight, up), slice));
+		_mm_storeu_ps(dst + 12, _mm_add_ps(normal, texC[1]));
+		_mm_storeu_ps(dst + 16, _mm_or_ps(_mm_sub_ps(minusRight, up), slice));
+		_mm_storeu_ps(dst + 20, _mm_add_ps(normal, texC[2]));
+		_mm_storeu_ps(dst + 24, _mm_or_ps(_mm_add_ps(minusRight, up), slice));
+		_mm_storeu_ps(dst + 28, _mm_add_ps(normal, texC[3]));
+		dst += 32;
+	}
+#else
+	ExpandScalar(sprites, count, firstId, sliceCount, eye, out);
+#endif
+}
+
+uint32 BillboardExpander::ExpandRanges(const Sprite* sprites, const Range* ranges, uint32 rangeCount,
+	uint32 sliceCount, const float eye[3], QuadVertex* out, FrameArena* scratch)
+{
+	ArenaVector<uint32> offsets(rangeCount, 0u, ArenaAllocator<uint32>(scratch));
+	uint32 total = 0;
+	for (uint32 r = 0; r < rangeCount; ++r)
+	{
+		offsets[r] = total;
+		total += ranges[r].Count;
+	}
+
+	ParallelFor((int)rangeCount, [&](int r)
+	{
+		const Range& range = ranges[r];
+		Expand(sprites + range.First, range.Count, range.First, sliceCount, eye,
+			out + (size_t)offsets[r] * VerticesPerSprite);
+	});
+
+	return total;
+}
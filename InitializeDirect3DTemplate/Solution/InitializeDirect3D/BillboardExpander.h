@@ -0,0 +1,74 @@
+//***************************************************************************************
+// BillboardExpander.h
+//
+// CPU replacement for the tree sprite geometry shader: expands sprites (centre and size)
+// into y-axis aligned quads facing the eye, exactly as TreeSprite.hlsl's GS does, and
+// writes them as a plain triangle list.
+//
+// The expansion is bound by the bytes it writes, so the vertex is a compact 32 bytes and
+// the SSE path builds each vertex in two registers and stores them directly, strictly in
+// order so the output can go straight into write-combined upload memory.  Lists of
+// sprite ranges (the visible foliage chunks) are expanded across all cores.
+//***************************************************************************************
+
+#pragma once
+
+#include "FrameArena.h"
+#include <cstdint>
+#include <vector>
+
+class BillboardExpander
+{
+public:
+	using uint32 = std::uint32_t;
+
+	static const uint32 VerticesPerSprite = 4;
+	static const uint32 IndicesPerSprite = 6;
+
+	// Same layout as the tree sprite vertex and FoliageScatter::Instance.
+	struct Sprite
+	{
+		float Position[3];
+		float Size[2];
+	};
+
+	// Input of the quad path of TreeSprite.hlsl.  Slice picks the texture array slice
+	// (the GS path uses the primitive id for that); the normal is horizontal, so only its
+	// x and z are stored.
+	struct QuadVertex
+	{
+		float Position[3];
+		uint32 Slice;
+		float NormalXZ[2];
+		float TexC[2];
+	};
+
+	// A run of sprites, e.g. one foliage chunk.
+	struct Range
+	{
+		uint32 First = 0;
+		uint32 Count = 0;
+	};
+
+	// Indices of spriteCount quads: two triangles over each sprite's four vertices.
+	static void BuildIndices(uint32 spriteCount, std::vector<uint32>& indices);
+
+	///<summary>
+	/// Writes VerticesPerSprite * count vertices to out.  Sprite i gets slice
+	/// (firstId + i) % sliceCount, so a sprite keeps its slice however it is batched.
+	///</summary>
+	static void Expand(const Sprite* sprites, uint32 count, uint32 firstId, uint32 sliceCount,
+		const float eye[3], QuadVertex* out);
+
+	// One sprite at a time, without SSE; the reference for Expand.
+	static void ExpandScalar(const Sprite* sprites, uint32 count, uint32 firstId, uint32 sliceCount,
+		const float eye[3], QuadVertex* out);
+
+	///<summary>
+	/// Expands the sprites of every range, the ranges in parallel, writing their quads
+	/// back to back in range order.  Slices follow the sprite index.  Returns the number of
+	/// sprites written.  Temporary storage comes from scratch when one is given.
+	///</summary>
+	static uint32 ExpandRanges(const Sprite* sprites, const Range* ranges, uint32 rangeCount, uint32 sliceCount,
+		const float eye[3], QuadVertex* out, FrameArena* scratch = nullptr);
+};
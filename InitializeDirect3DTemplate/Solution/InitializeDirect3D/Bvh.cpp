@@ -0,0 +1,365 @@
+//***************************************************************************************
+// Bvh.cpp
+//***************************************************************************************
+
+#include "Bvh.h"
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+using uint32 = Bvh::uint32;
+
+namespace
+{
+	const uint32 MaxLeafTriangles = 4;
+	const uint32 BinCount = 12;
+	const uint32 MaxStackDepth = 64;
+
+	struct Bounds
+	{
+		float Min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float Max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		void Grow(const float p[3])
+		{
+			for (int a = 0; a < 3; ++a)
+			{
+				Min[a] = std::min(Min[a], p[a]);
+				Max[a] = std::max(Max[a], p[a]);
+			}
+		}
+
+		void Grow(const Bounds& b)
+		{
+			Grow(b.Min);
+			Grow(b.Max);
+		}
+
+		float HalfArea()const
+		{
+			float dx = Max[0] - Min[0], dy = Max[1] - Min[1], dz = Max[2] - Min[2];
+			return dx < 0.0f ? 0.0f : dx * dy + dy * dz + dz * dx;
+		}
+	};
+
+	struct BuildTask
+	{
+		uint32 Node;
+		uint32 Begin;
+		uint32 End;
+		uint32 Depth;
+	};
+
+	void Cross(const float a[3], const float b[3], float r[3])
+	{
+		r[0] = a[1] * b[2] - a[2] * b[1];
+		r[1] = a[2] * b[0] - a[0] * b[2];
+		r[2] = a[0] * b[1] - a[1] * b[0];
+	}
+
+	float Dot(const float a[3], const float b[3])
+	{
+		return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	}
+}
+
+void Bvh::Build(const float* positions, uint32 vertexCount, const uint32* indices, uint32 triangleCount)
+{
+	mNodes.clear();
+	mTriangles.clear();
+	mTriangleIds.clear();
+	mStats = Stats();
+	mStats.Triangles = triangleCount;
+
+	if (triangleCount == 0)
+		return;
+
+	std::vector<Bounds> triBounds(triangleCount);
+	std::vector<float> centroids((size_t)triangleCount * 3);
+	std::vector<uint32> order(triangleCount);
+
+	for (uint32 t = 0; t < triangleCount; ++t)
+	{
+		for (uint32 k = 0; k < 3; ++k)
+		{
+			uint32 v = indices[3 * t + k];
+			assert(v < vertexCount);
+			triBounds[t].Grow(positions + 3 * (size_t)v);
+		}
+		for (int a = 0; a < 3; ++a)
+			centroids[3 * (size_t)t + a] = 0.5f * (triBounds[t].Min[a] + triBounds[t].Max[a]);
+		order[t] = t;
+	}
+
+	mNodes.reserve(2 * (size_t)triangleCount);
+	mNodes.push_back(Node());
+
+	std::vector<BuildTask> tasks;
+	tasks.push_back({ 0, 0, triangleCount, 1 });
+
+	while (!tasks.empty())
+	{
+		BuildTask task = tasks.back();
+		tasks.pop_back();
+
+		Bounds bounds, centroidBounds;
+		for (uint32 i = task.Begin; i < task.End; ++i)
+		{
+			bounds.Grow(triBounds[order[i]]);
+			centroidBounds.Grow(&centroids[3 * (size_t)order[i]]);
+		}
+
+		Node& node = mNodes[task.Node];
+		for (int a = 0; a < 3; ++a)
+		{
+			node.Min[a] = bounds.Min[a];
+			node.Max[a] = bounds.Max[a];
+		}
+		mStats.MaxDepth = std::max(mStats.MaxDepth, task.Depth);
+
+		uint32 count = task.End - task.Begin;
+		node.First = task.Begin;
+		node.Count = count;
+		if (count <= MaxLeafTriangles)
+			continue;
+
+		// Binned SAH: sort centroids into bins along each axis and evaluate every plane
+		// between bins.  Splitting is only worth it if it beats testing every triangle.
+		float bestCost = (float)count * bounds.HalfArea();
+		int bestAxis = -1;
+		float bestSplit = 0.0f;
+
+		for (int a = 0; a < 3; ++a)
+		{
+			float lo = centroidBounds.Min[a], hi = centroidBounds.Max[a];
+			if (hi - lo <= 0.0f)
+				continue;
+
+			Bounds binBounds[BinCount];
+			uint32 binCounts[BinCount] = {};
+			float scale = BinCount / (hi - lo);
+
+			for (uint32 i = task.Begin; i < task.End; ++i)
+			{
+				uint32 t = order[i];
+				uint32 b = std::min((uint32)((centroids[3 * (size_t)t + a] - lo) * scale), BinCount - 1);
+				binBounds[b].Grow(triBounds[t]);
+				binCounts[b]++;
+			}
+
+			// Sweep from the right to get the cost of every right side, then from the left.
+			float rightArea[BinCount];
+			uint32 rightCount[BinCount];
+			Bounds accum;
+			uint32 accumCount = 0;
+			for (uint32 b = BinCount - 1; b > 0; --b)
+			{
+				accum.Grow(binBounds[b]);
+				accumCount += binCounts[b];
+				rightArea[b] = accum.HalfArea();
+				rightCount[b] = accumCount;
+			}
+
+			accum = Bounds();
+			accumCount = 0;
+			for (uint32 b = 0; b < BinCount - 1; ++b)
+			{
+				accum.Grow(binBounds[b]);
+				accumCount += binCounts[b];
+				if (accumCount == 0 || rightCount[b + 1] == 0)
+					continue;
+
+				float cost = accumCount * accum.HalfArea() + rightCount[b + 1] * rightArea[b + 1];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = a;
+					bestSplit = lo + (b + 1) / scale;
+				}
+			}
+		}
+
+		uint32 mid;
+		if (bestAxis >= 0)
+		{
+			uint32* split = std::partition(order.data() + task.Begin, order.data() + task.End, [&](uint32 t)
+			{
+				return centroids[3 * (size_t)t + bestAxis] < bestSplit;
+			});
+			mid = (uint32)(split - order.data());
+		}
+		else if (count > 2 * MaxLeafTriangles)
+		{
+			// Coincident centroids (or no profitable plane) in a large node: halve it so
+			// the leaf size stays bounded.
+			mid = task.Begin + count / 2;
+		}
+		else
+		{
+			continue;
+		}
+
+		if (mid == task.Begin || mid == task.End)
+			mid = task.Begin + count / 2;
+
+		uint32 left = (uint32)mNodes.size();
+		mNodes.push_back(Node());
+		mNodes.push_back(Node());
+
+		mNodes[task.Node].First = left;
+		mNodes[task.Node].Count = 0;
+
+		tasks.push_back({ left, task.Begin, mid, task.Depth + 1 });
+		tasks.push_back({ left + 1, mid, task.End, task.Depth + 1 });
+	}
+
+	// Store the triangles in leaf order so a leaf reads a contiguous range.
+	mTriangles.resize(triangleCount);
+	mTriangleIds = order;
+	for (uint32 i = 0; i < triangleCount; ++i)
+	{
+		const uint32* tri = indices + 3 * (size_t)order[i];
+		const float* p0 = positions + 3 * (size_t)tri[0];
+		const float* p1 = positions + 3 * (size_t)tri[1];
+		const float* p2 = positions + 3 * (size_t)tri[2];
+
+		Triangle& t = mTriangles[i];
+		for (int a = 0; a < 3; ++a)
+		{
+			t.V0[a] = p0[a];
+			t.E1[a] = p1[a] - p0[a];
+			t.E2[a] = p2[a] - p0[a];
+		}
+	}
+
+	mStats.Nodes = (uint32)mNodes.size();
+	for (const Node& node : mNodes)
+	{
+		if (node.Count > 0)
+			mStats.Leaves++;
+	}
+	assert(mStats.MaxDepth <= MaxStackDepth);
+}
+
+template<bool AnyHit>
+bool Bvh::Traverse(const float origin[3], const float direction[3], float tMax, Hit* hit)const
+{
+	if (mNodes.empty())
+		return false;
+
+	float invDir[3];
+	for (int a = 0; a < 3; ++a)
+		invDir[a] = 1.0f / direction[a];
+
+	// Slab test; returns the entry distance, or FLT_MAX on a miss.
+	auto enter = [&](const Node& node, float limit)
+	{
+		float t0 = 0.0f, t1 = limit;
+		for (int a = 0; a < 3; ++a)
+		{
+			float n = (node.Min[a] - origin[a]) * invDir[a];
+			float f = (node.Max[a] - origin[a]) * invDir[a];
+			if (n > f)
+				std::swap(n, f);
+			t0 = n > t0 ? n : t0;
+			t1 = f < t1 ? f : t1;
+		}
+		return t0 <= t1 ? t0 : FLT_MAX;
+	};
+
+	bool found = false;
+	float closest = tMax;
+
+	uint32 stack[MaxStackDepth];
+	uint32 top = 0;
+	uint32 current = 0;
+
+	if (enter(mNodes[0], closest) == FLT_MAX)
+		return false;
+
+	for (;;)
+	{
+		const Node& node = mNodes[current];
+		if (node.Count > 0)
+		{
+			for (uint32 i = node.First; i < node.First + node.Count; ++i)
+			{
+				const Triangle& tri = mTriangles[i];
+
+				float p[3];
+				Cross(direction, tri.E2, p);
+				float det = Dot(tri.E1, p);
+				if (fabsf(det) < 1e-12f)
+					continue;
+
+				float invDet = 1.0f / det;
+				float s[3] = { origin[0] - tri.V0[0], origin[1] - tri.V0[1], origin[2] - tri.V0[2] };
+				float u = Dot(s, p) * invDet;
+				if (u < 0.0f || u > 1.0f)
+					continue;
+
+				float q[3];
+				Cross(s, tri.E1, q);
+				float v = Dot(direction, q) * invDet;
+				if (v < 0.0f || u + v > 1.0f)
+					continue;
+
+				float t = Dot(tri.E2, q) * invDet;
+				if (t <= 0.0f || t >= closest)
+					continue;
+
+				if (AnyHit)
+					return true;
+
+				found = true;
+				closest = t;
+				hit->T = t;
+				hit->Triangle = mTriangleIds[i];
+				hit->U = u;
+				hit->V = v;
+			}
+		}
+		else
+		{
+			// Visit the nearer child first so closer hits shrink the ray early.
+			uint32 a = node.First, b = node.First + 1;
+			float ta = enter(mNodes[a], closest);
+			float tb = enter(mNodes[b], closest);
+			if (tb < ta)
+			{
+				std::swap(a, b);
+				std::swap(ta, tb);
+			}
+
+			if (ta != FLT_MAX)
+			{
+				if (tb != FLT_MAX)
+					stack[top++] = b;
+				current = a;
+				continue;
+			}
+		}
+
+		if (top == 0)
+			break;
+		current = stack[--top];
+	}
+
+	return found;
+}
+
+bool Bvh::Intersect(const float origin[3], const float direction[3], float tMax, Hit& hit)const
+{
+	return Traverse<false>(origin, direction, tMax, &hit);
+}
+
+bool Bvh::Occluded(const float origin[3], const float direction[3], float tMax)const
+{
+	return Traverse<true>(origin, direction, tMax, nullptr);
+}
+
+const Bvh::Stats& Bvh::GetStats()const
+{
+	return mStats;
+}
@@ -0,0 +1,79 @@
+//***************************************************************************************
+// Bvh.h
+//
+// Bounding volume hierarchy over a triangle soup for CPU ray queries.  Built top-down
+// with a binned surface area heuristic and stored as a flat node array with the two
+// children of a node next to each other, so traversal is a loop with a small stack.
+//
+// Queries only read the tree and may run on any number of threads at once.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class Bvh
+{
+public:
+	using uint32 = std::uint32_t;
+
+	struct Hit
+	{
+		float T = 0.0f;
+		uint32 Triangle = 0;
+		float U = 0.0f;             // barycentrics of vertex 1 and 2
+		float V = 0.0f;
+	};
+
+	struct Stats
+	{
+		uint32 Triangles = 0;
+		uint32 Nodes = 0;
+		uint32 Leaves = 0;
+		uint32 MaxDepth = 0;
+	};
+
+public:
+	Bvh() = default;
+	Bvh(const Bvh& rhs) = delete;
+	Bvh& operator=(const Bvh& rhs) = delete;
+
+	// positions holds vertexCount xyz triples; triangle t uses indices[3t .. 3t + 2].
+	void Build(const float* positions, uint32 vertexCount, const uint32* indices, uint32 triangleCount);
+
+	// Closest hit with T in (0, tMax).  Triangles are double sided.
+	bool Intersect(const float origin[3], const float direction[3], float tMax, Hit& hit)const;
+
+	// True if anything is hit with T in (0, tMax); stops at the first hit found.
+	bool Occluded(const float origin[3], const float direction[3], float tMax)const;
+
+	const Stats& GetStats()const;
+
+private:
+	struct Node
+	{
+		float Min[3];
+		uint32 First;               // first child, or first triangle of a leaf
+		float Max[3];
+		uint32 Count;               // triangles of a leaf; 0 for interior nodes
+	};
+
+	// Precomputed for the Moller-Trumbore test.
+	struct Triangle
+	{
+		float V0[3];
+		float E1[3];
+		float E2[3];
+	};
+
+	template<bool AnyHit>
+	bool Traverse(const float origin[3], const float direction[3], float tMax, Hit* hit)const;
+
+private:
+	std::vector<Node> mNodes;
+	std::vector<Triangle> mTriangles;   // in leaf order
+	std::vector<uint32> mTriangleIds;   // original index of mTriangles[i]
+
+	Stats mStats;
+};
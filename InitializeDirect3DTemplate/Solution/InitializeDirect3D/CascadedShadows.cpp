@@ -0,0 +1,219 @@
+//***************************************************************************************
+// CascadedShadows.cpp
+//***************************************************************************************
+
+#include "CascadedShadows.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+using Float3 = CascadedShadows::Float3;
+using Matrix = CascadedShadows::Matrix;
+
+namespace
+{
+	Float3 Make(float x, float y, float z)
+	{
+		Float3 v;
+		v.x = x;
+		v.y = y;
+		v.z = z;
+		return v;
+	}
+
+	float Dot(const Float3& a, const Float3& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	Float3 Cross(const Float3& a, const Float3& b)
+	{
+		return Make(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+	}
+
+	Float3 Normalize(const Float3& v)
+	{
+		float len = sqrtf(Dot(v, v));
+		return len > 0.0f ? Make(v.x / len, v.y / len, v.z / len) : v;
+	}
+
+	Matrix Multiply(const Matrix& a, const Matrix& b)
+	{
+		Matrix r;
+		for (int i = 0; i < 4; ++i)
+		{
+			for (int j = 0; j < 4; ++j)
+			{
+				r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] +
+					a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+			}
+		}
+		return r;
+	}
+
+	// Same as XMMatrixOrthographicOffCenterLH.
+	Matrix OrthographicOffCenter(float l, float r, float b, float t, float n, float f)
+	{
+		Matrix m;
+		m.m[0][0] = 2.0f / (r - l);
+		m.m[1][1] = 2.0f / (t - b);
+		m.m[2][2] = 1.0f / (f - n);
+		m.m[3][0] = (l + r) / (l - r);
+		m.m[3][1] = (t + b) / (b - t);
+		m.m[3][2] = n / (n - f);
+		m.m[3][3] = 1.0f;
+		return m;
+	}
+}
+
+void CascadedShadows::SetConfig(const Config& config)
+{
+	assert(config.CascadeCount > 0 && config.CascadeCount <= MaxCascades);
+	assert(config.NearZ > 0.0f && config.FarZ > config.NearZ);
+	assert(config.ShadowMapSize > 0);
+
+	mConfig = config;
+}
+
+const CascadedShadows::Config& CascadedShadows::GetConfig()const
+{
+	return mConfig;
+}
+
+void CascadedShadows::ComputeSplits(float nearZ, float farZ, uint32 count, float lambda, float* splits)
+{
+	splits[0] = nearZ;
+	for (uint32 i = 1; i < count; ++i)
+	{
+		float f = (float)i / count;
+		float logSplit = nearZ * powf(farZ / nearZ, f);
+		float uniformSplit = nearZ + (farZ - nearZ) * f;
+		splits[i] = lambda * logSplit + (1.0f - lambda) * uniformSplit;
+	}
+	splits[count] = farZ;
+}
+
+void CascadedShadows::Update(const Camera& camera, const Float3& lightDirection, const Caster* casters, uint32 casterCount)
+{
+	// Light space only depends on the light direction; an up vector that is not parallel
+	// to it keeps the basis fixed while the camera moves.
+	mLightForward = Normalize(lightDirection);
+	Float3 up = fabsf(mLightForward.y) < 0.99f ? Make(0.0f, 1.0f, 0.0f) : Make(0.0f, 0.0f, 1.0f);
+	mLightRight = Normalize(Cross(up, mLightForward));
+	mLightUp = Cross(mLightForward, mLightRight);
+
+	float splits[MaxCascades + 1];
+	ComputeSplits(mConfig.NearZ, mConfig.FarZ, mConfig.CascadeCount, mConfig.SplitLambda, splits);
+
+	mCascades.resize(mConfig.CascadeCount);
+	for (uint32 i = 0; i < mConfig.CascadeCount; ++i)
+	{
+		mCascades[i].SplitNear = splits[i];
+		mCascades[i].SplitFar = splits[i + 1];
+	}
+
+	mStats = Stats();
+	mStats.Casters = casterCount;
+
+	ParallelFor((int)mConfig.CascadeCount, [&](int i)
+	{
+		FitCascade((uint32)i, camera, casters, casterCount);
+	});
+
+	for (uint32 i = 0; i < mConfig.CascadeCount; ++i)
+	{
+		mStats.CastersPerCascade[i] = (uint32)mCascades[i].Casters.size();
+		mStats.CasterTests += casterCount;
+	}
+}
+
+void CascadedShadows::FitCascade(uint32 index, const Camera& camera, const Caster* casters, uint32 casterCount)
+{
+	Cascade& cascade = mCascades[index];
+	float n = cascade.SplitNear;
+	float f = cascade.SplitFar;
+
+	// Smallest sphere around the slice: with k the tangent of the angle to the corner
+	// rays, the centre sits on the view axis at (n + f)(1 + k^2) / 2, or at the far plane
+	// when that lies beyond it.
+	float k2 = camera.TanHalfFovY * camera.TanHalfFovY * (1.0f + camera.AspectRatio * camera.AspectRatio);
+	float t = 0.5f * (n + f) * (1.0f + k2);
+	float radius;
+	if (t < f)
+		radius = sqrtf((t - n) * (t - n) + n * n * k2);
+	else
+	{
+		t = f;
+		radius = f * sqrtf(k2);
+	}
+
+	// Quantize the radius so the projection size does not change from frame to frame.
+	radius = ceilf(radius * 16.0f) / 16.0f;
+
+	Float3 centerW = Make(camera.Position.x + camera.Forward.x * t,
+		camera.Position.y + camera.Forward.y * t,
+		camera.Position.z + camera.Forward.z * t);
+
+	// Snap the centre to whole texels in light space.
+	float texel = 2.0f * radius / mConfig.ShadowMapSize;
+	float cx = floorf(Dot(centerW, mLightRight) / texel) * texel;
+	float cy = floorf(Dot(centerW, mLightUp) / texel) * texel;
+	float cz = Dot(centerW, mLightForward);
+
+	float zNear = cz - radius - mConfig.CasterDistance;
+	float zFar = cz + radius;
+
+	// Rotation only; the translation is folded into the off-centre projection.
+	Matrix& view = cascade.View;
+	view = Matrix();
+	view.m[0][0] = mLightRight.x; view.m[0][1] = mLightUp.x; view.m[0][2] = mLightForward.x;
+	view.m[1][0] = mLightRight.y; view.m[1][1] = mLightUp.y; view.m[1][2] = mLightForward.y;
+	view.m[2][0] = mLightRight.z; view.m[2][1] = mLightUp.z; view.m[2][2] = mLightForward.z;
+	view.m[3][3] = 1.0f;
+
+	cascade.Proj = OrthographicOffCenter(cx - radius, cx + radius, cy - radius, cy + radius, zNear, zFar);
+	cascade.ViewProj = Multiply(cascade.View, cascade.Proj);
+	cascade.TexelSize = texel;
+
+	// Keep the casters whose spheres overlap the light space box, and sort them by depth.
+	std::vector<std::pair<float, uint32>> visible;
+	for (uint32 i = 0; i < casterCount; ++i)
+	{
+		const Caster& c = casters[i];
+		float x = Dot(c.Center, mLightRight);
+		float y = Dot(c.Center, mLightUp);
+		float z = Dot(c.Center, mLightForward);
+
+		float dx = std::max(0.0f, fabsf(x - cx) - radius);
+		float dy = std::max(0.0f, fabsf(y - cy) - radius);
+		if (dx * dx + dy * dy > c.Radius * c.Radius)
+			continue;
+		if (z + c.Radius < zNear || z - c.Radius > zFar)
+			continue;
+
+		visible.push_back({ z - c.Radius, c.Id });
+	}
+
+	std::sort(visible.begin(), visible.end());
+
+	cascade.Casters.resize(visible.size());
+	for (std::size_t i = 0; i < visible.size(); ++i)
+		cascade.Casters[i] = visible[i].second;
+}
+
+CascadedShadows::uint32 CascadedShadows::CascadeCount()const
+{
+	return (uint32)mCascades.size();
+}
+
+const CascadedShadows::Cascade& CascadedShadows::GetCascade(uint32 i)const
+{
+	assert(i < mCascades.size());
+	return mCascades[i];
+}
+
+const CascadedShadows::Stats& CascadedShadows::GetStats()const
+{
+	return mStats;
+}
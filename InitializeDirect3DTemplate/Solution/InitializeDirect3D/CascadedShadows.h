@@ -0,0 +1,135 @@
+//***************************************************************************************
+// CascadedShadows.h
+//
+// CPU side of cascaded shadow maps for one directional light:
+//
+//   - split distances from the practical split scheme, a blend of logarithmic and
+//     uniform splits,
+//   - per cascade, an orthographic light frustum around the bounding sphere of its slice
+//     of the view frustum.  The sphere does not change size as the camera turns, and its
+//     centre is snapped to whole shadow map texels in light space, so the shadow map
+//     does not shimmer when the camera moves or rotates,
+//   - per cascade, the casters whose bounding spheres reach into its light frustum
+//     (including the space between it and the light), sorted front to back along the
+//     light direction.
+//
+// The cascades are processed in parallel.  Nothing here touches the GPU; matrices are
+// row-major for row vectors (v * M) like DirectXMath, ready for XMLoadFloat4x4.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class CascadedShadows
+{
+public:
+	using uint32 = std::uint32_t;
+
+	static const uint32 MaxCascades = 8;
+
+	struct Float3
+	{
+		float x = 0.0f;
+		float y = 0.0f;
+		float z = 0.0f;
+	};
+
+	struct Matrix
+	{
+		float m[4][4] = {};
+	};
+
+	struct Config
+	{
+		uint32 CascadeCount = 4;
+
+		// 0 gives uniform splits, 1 logarithmic ones.
+		float SplitLambda = 0.75f;
+
+		// Part of the view covered by shadows.
+		float NearZ = 1.0f;
+		float FarZ = 200.0f;
+
+		uint32 ShadowMapSize = 2048;
+
+		// How far behind each cascade (towards the light) casters are still kept.
+		float CasterDistance = 100.0f;
+	};
+
+	struct Camera
+	{
+		Float3 Position;
+		Float3 Forward;             // unit length
+		float TanHalfFovY = 0.41421356f;
+		float AspectRatio = 1.0f;
+	};
+
+	// A shadow caster's world space bounding sphere and an id the caller maps back.
+	struct Caster
+	{
+		Float3 Center;
+		float Radius = 0.0f;
+		uint32 Id = 0;
+	};
+
+	struct Cascade
+	{
+		float SplitNear = 0.0f;
+		float SplitFar = 0.0f;
+
+		Matrix View;
+		Matrix Proj;
+		Matrix ViewProj;
+
+		// World units per shadow map texel.
+		float TexelSize = 0.0f;
+
+		// Ids of the casters in this cascade, nearest to the light first.
+		std::vector<uint32> Casters;
+	};
+
+	struct Stats
+	{
+		uint32 Casters = 0;
+		uint32 CasterTests = 0;
+		uint32 CastersPerCascade[MaxCascades] = {};
+	};
+
+public:
+	CascadedShadows() = default;
+	CascadedShadows(const CascadedShadows& rhs) = delete;
+	CascadedShadows& operator=(const CascadedShadows& rhs) = delete;
+
+	void SetConfig(const Config& config);
+	const Config& GetConfig()const;
+
+	///<summary>
+	/// Fits every cascade to the camera and culls and sorts the casters for it.
+	/// lightDirection is the direction the light travels.
+	///</summary>
+	void Update(const Camera& camera, const Float3& lightDirection, const Caster* casters, uint32 casterCount);
+
+	uint32 CascadeCount()const;
+	const Cascade& GetCascade(uint32 i)const;
+
+	// Writes count + 1 split distances, near first.
+	static void ComputeSplits(float nearZ, float farZ, uint32 count, float lambda, float* splits);
+
+	const Stats& GetStats()const;
+
+private:
+	void FitCascade(uint32 index, const Camera& camera, const Caster* casters, uint32 casterCount);
+
+private:
+	Config mConfig;
+	std::vector<Cascade> mCascades;
+
+	// Light space basis: rows are the light's right, up and forward axes.
+	Float3 mLightRight;
+	Float3 mLightUp;
+	Float3 mLightForward;
+
+	Stats mStats;
+};
@@ -0,0 +1,290 @@
+//***************************************************************************************
+// ClusteredLights.cpp
+//***************************************************************************************
+
+#include "ClusteredLights.h"
+#include "ParallelFor.h"
+#include <cassert>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define CLUSTERED_LIGHTS_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+	// Far enough that no sphere reaches a padding box.
+	const float NoBox = 1.0e30f;
+
+	float Min4(float a, float b, float c, float d)
+	{
+		float ab = a < b ? a : b;
+		float cd = c < d ? c : d;
+		return ab < cd ? ab : cd;
+	}
+
+	float Max4(float a, float b, float c, float d)
+	{
+		float ab = a > b ? a : b;
+		float cd = c > d ? c : d;
+		return ab > cd ? ab : cd;
+	}
+}
+
+void ClusteredLights::Configure(const Config& config)
+{
+	assert(config.TilesX > 0 && config.TilesY > 0 && config.Slices > 0);
+	assert(config.NearZ > 0.0f && config.FarZ > config.NearZ);
+
+	if (mConfigured &&
+		config.TilesX == mConfig.TilesX && config.TilesY == mConfig.TilesY && config.Slices == mConfig.Slices &&
+		config.NearZ == mConfig.NearZ && config.FarZ == mConfig.FarZ &&
+		config.TanHalfFovY == mConfig.TanHalfFovY && config.AspectRatio == mConfig.AspectRatio &&
+		config.MaxLightsPerCluster == mConfig.MaxLightsPerCluster)
+	{
+		return;
+	}
+
+	mConfig = config;
+	mConfigured = true;
+
+	float logRange = logf(mConfig.FarZ / mConfig.NearZ);
+	mDepthScale = mConfig.Slices / logRange;
+	mDepthBias = -(float)mConfig.Slices * logf(mConfig.NearZ) / logRange;
+
+	BuildClusterBounds();
+
+	mScratch.assign((std::size_t)ClusterCount() * mConfig.MaxLightsPerCluster, 0);
+	mScratchCounts.assign(ClusterCount(), 0);
+	mSliceDropped.assign(mConfig.Slices, 0);
+	mSliceTests.assign(mConfig.Slices, 0);
+	mRanges.assign(ClusterCount(), ClusterRange());
+	mIndices.clear();
+}
+
+void ClusteredLights::BuildClusterBounds()
+{
+	mTilesPerSlice = mConfig.TilesX * mConfig.TilesY;
+	mPaddedTilesPerSlice = (mTilesPerSlice + 3) & ~3u;
+
+	std::size_t count = (std::size_t)mPaddedTilesPerSlice * mConfig.Slices;
+	mMinX.assign(count, NoBox);
+	mMinY.assign(count, NoBox);
+	mMinZ.assign(count, NoBox);
+	mMaxX.assign(count, -NoBox);
+	mMaxY.assign(count, -NoBox);
+	mMaxZ.assign(count, -NoBox);
+
+	// A point at view depth z on the NDC position (nx, ny) is (nx * sx * z, ny * sy * z, z).
+	float sy = mConfig.TanHalfFovY;
+	float sx = sy * mConfig.AspectRatio;
+
+	for (uint32 s = 0; s < mConfig.Slices; ++s)
+	{
+		float zNear = mConfig.NearZ * powf(mConfig.FarZ / mConfig.NearZ, (float)s / mConfig.Slices);
+		float zFar = mConfig.NearZ * powf(mConfig.FarZ / mConfig.NearZ, (float)(s + 1) / mConfig.Slices);
+
+		for (uint32 y = 0; y < mConfig.TilesY; ++y)
+		{
+			float nyTop = 1.0f - 2.0f * y / mConfig.TilesY;
+			float nyBottom = 1.0f - 2.0f * (y + 1) / mConfig.TilesY;
+
+			for (uint32 x = 0; x < mConfig.TilesX; ++x)
+			{
+				float nxLeft = -1.0f + 2.0f * x / mConfig.TilesX;
+				float nxRight = -1.0f + 2.0f * (x + 1) / mConfig.TilesX;
+
+				std::size_t i = (std::size_t)s * mPaddedTilesPerSlice + y * mConfig.TilesX + x;
+				mMinX[i] = Min4(nxLeft * sx * zNear, nxLeft * sx * zFar, nxRight * sx * zNear, nxRight * sx * zFar);
+				mMaxX[i] = Max4(nxLeft * sx * zNear, nxLeft * sx * zFar, nxRight * sx * zNear, nxRight * sx * zFar);
+				mMinY[i] = Min4(nyBottom * sy * zNear, nyBottom * sy * zFar, nyTop * sy * zNear, nyTop * sy * zFar);
+				mMaxY[i] = Max4(nyBottom * sy * zNear, nyBottom * sy * zFar, nyTop * sy * zNear, nyTop * sy * zFar);
+				mMinZ[i] = zNear;
+				mMaxZ[i] = zFar;
+			}
+		}
+	}
+}
+
+const ClusteredLights::Config& ClusteredLights::GetConfig()const
+{
+	return mConfig;
+}
+
+ClusteredLights::uint32 ClusteredLights::ClusterCount()const
+{
+	return mConfig.TilesX * mConfig.TilesY * mConfig.Slices;
+}
+
+ClusteredLights::uint32 ClusteredLights::MaxIndexCount()const
+{
+	return ClusterCount() * mConfig.MaxLightsPerCluster;
+}
+
+float ClusteredLights::DepthScale()const
+{
+	return mDepthScale;
+}
+
+float ClusteredLights::DepthBias()const
+{
+	return mDepthBias;
+}
+
+ClusteredLights::uint32 ClusteredLights::SliceOfDepth(float viewZ)const
+{
+	if (viewZ <= mConfig.NearZ)
+		return 0;
+
+	float s = floorf(logf(viewZ) * mDepthScale + mDepthBias);
+	if (s >= (float)mConfig.Slices - 1.0f)
+		return mConfig.Slices - 1;
+	return s < 0.0f ? 0 : (uint32)s;
+}
+
+void ClusteredLights::Assign(const LightSphere* lights, uint32 count)
+{
+	assert(mConfigured);
+
+	mStats = Stats();
+	mStats.Lights = count;
+
+	// Depth slices each light spans; empty when it is entirely in front of the near plane
+	// or behind the far plane.
+	mFirstSlice.resize(count);
+	mLastSlice.resize(count);
+	uint32* firstSlice = mFirstSlice.data();
+	uint32* lastSlice = mLastSlice.data();
+	for (uint32 i = 0; i < count; ++i)
+	{
+		const LightSphere& l = lights[i];
+		if (l.Z + l.Radius < mConfig.NearZ || l.Z - l.Radius > mConfig.FarZ)
+		{
+			firstSlice[i] = 1;
+			lastSlice[i] = 0;
+			continue;
+		}
+
+		firstSlice[i] = SliceOfDepth(l.Z - l.Radius);
+		lastSlice[i] = SliceOfDepth(l.Z + l.Radius);
+		mStats.VisibleLights++;
+	}
+
+	const uint32 capacity = mConfig.MaxLightsPerCluster;
+
+	// Each task owns the clusters of one slice, so nothing is shared between them.
+	ParallelFor((int)mConfig.Slices, [&](int slice)
+	{
+		uint32 s = (uint32)slice;
+		uint32 clusterBase = s * mTilesPerSlice;
+		std::size_t boxBase = (std::size_t)s * mPaddedTilesPerSlice;
+
+		uint32* counts = &mScratchCounts[clusterBase];
+		for (uint32 t = 0; t < mTilesPerSlice; ++t)
+			counts[t] = 0;
+
+		uint32 dropped = 0;
+		uint32 tests = 0;
+
+		for (uint32 li = 0; li < count; ++li)
+		{
+			if (s < firstSlice[li] || s > lastSlice[li])
+				continue;
+
+			const LightSphere& l = lights[li];
+			float r2 = l.Radius * l.Radius;
+
+			for (uint32 t = 0; t < mPaddedTilesPerSlice; t += 4)
+			{
+				std::size_t b = boxBase + t;
+				int hits = 0;
+
+#if defined(CLUSTERED_LIGHTS_SSE)
+				// Squared distance from the sphere centre to each of four boxes.
+				const __m128 zero = _mm_setzero_ps();
+				__m128 cx = _mm_set1_ps(l.X);
+				__m128 cy = _mm_set1_ps(l.Y);
+				__m128 cz = _mm_set1_ps(l.Z);
+
+				__m128 dx = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&mMinX[b]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&mMaxX[b]))));
+				__m128 dy = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&mMinY[b]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&mMaxY[b]))));
+				__m128 dz = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&mMinZ[b]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&mMaxZ[b]))));
+
+				__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+				hits = _mm_movemask_ps(_mm_cmple_ps(d2, _mm_set1_ps(r2)));
+#else
+				for (int k = 0; k < 4; ++k)
+				{
+					float dx = fmaxf(0.0f, fmaxf(mMinX[b + k] - l.X, l.X - mMaxX[b + k]));
+					float dy = fmaxf(0.0f, fmaxf(mMinY[b + k] - l.Y, l.Y - mMaxY[b + k]));
+					float dz = fmaxf(0.0f, fmaxf(mMinZ[b + k] - l.Z, l.Z - mMaxZ[b + k]));
+					if (dx * dx + dy * dy + dz * dz <= r2)
+						hits |= 1 << k;
+				}
+#endif
+				tests += 4;
+
+				while (hits != 0)
+				{
+					uint32 k = 0;
+					while ((hits & (1 << k)) == 0)
+						++k;
+					hits &= ~(1 << k);
+
+					uint32 tile = t + k;
+					if (tile >= mTilesPerSlice)
+						continue;
+
+					if (counts[tile] < capacity)
+						mScratch[(std::size_t)(clusterBase + tile) * capacity + counts[tile]++] = li;
+					else
+						dropped++;
+				}
+			}
+		}
+
+		mSliceDropped[s] = dropped;
+		mSliceTests[s] = tests;
+	});
+
+	// Compact the per-cluster lists into one index list.
+	mIndices.clear();
+	uint32 clusterCount = ClusterCount();
+	for (uint32 c = 0; c < clusterCount; ++c)
+	{
+		uint32 n = mScratchCounts[c];
+		mRanges[c].Offset = (uint32)mIndices.size();
+		mRanges[c].Count = n;
+
+		const uint32* list = &mScratch[(std::size_t)c * capacity];
+		mIndices.insert(mIndices.end(), list, list + n);
+
+		if (n > 0)
+			mStats.NonEmptyClusters++;
+		if (n > mStats.MaxPerCluster)
+			mStats.MaxPerCluster = n;
+	}
+
+	for (uint32 s = 0; s < mConfig.Slices; ++s)
+	{
+		mStats.Dropped += mSliceDropped[s];
+		mStats.ClusterTests += mSliceTests[s];
+	}
+	mStats.Indices = (uint32)mIndices.size();
+}
+
+const std::vector<ClusteredLights::ClusterRange>& ClusteredLights::Ranges()const
+{
+	return mRanges;
+}
+
+const std::vector<ClusteredLights::uint32>& ClusteredLights::Indices()const
+{
+	return mIndices;
+}
+
+const ClusteredLights::Stats& ClusteredLights::GetStats()const
+{
+	return mStats;
+}
@@ -0,0 +1,128 @@
+//***************************************************************************************
+// ClusteredLights.h
+//
+// Clustered light culling on the CPU.  The view frustum is cut into screen tiles and
+// exponentially spaced depth slices; every light's view space bounding sphere is tested
+// against the boxes of the clusters in the slices it spans, four clusters per SSE test,
+// with the slices binned in parallel.  The result is one compact list of light indices
+// and an (offset, count) range per cluster, which a pixel shader indexes with its tile
+// and depth slice so it only shades the lights that can reach it.
+//
+// Cluster index = (slice * TilesY + tileY) * TilesX + tileX, tile (0, 0) at the top left
+// of the screen.  The slice of a view space depth z is
+//
+//     floor(log(z) * DepthScale() + DepthBias())
+//
+// clamped to [0, Slices - 1].
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class ClusteredLights
+{
+public:
+	using uint32 = std::uint32_t;
+
+	struct Config
+	{
+		uint32 TilesX = 16;
+		uint32 TilesY = 9;
+		uint32 Slices = 24;
+		float NearZ = 1.0f;
+		float FarZ = 1000.0f;
+		float TanHalfFovY = 0.41421356f;
+		float AspectRatio = 16.0f / 9.0f;
+
+		// Lights past this in one cluster are dropped (and counted in the stats).
+		uint32 MaxLightsPerCluster = 64;
+	};
+
+	// Bounding sphere of a light in view space (+z forward).  For spot lights the sphere
+	// around the cone's reach is good enough.
+	struct LightSphere
+	{
+		float X = 0.0f;
+		float Y = 0.0f;
+		float Z = 0.0f;
+		float Radius = 0.0f;
+	};
+
+	// Matches the uint2 the shader reads.
+	struct ClusterRange
+	{
+		uint32 Offset = 0;
+		uint32 Count = 0;
+	};
+
+	struct Stats
+	{
+		uint32 Lights = 0;
+		uint32 VisibleLights = 0;       // lights overlapping at least one depth slice
+		uint32 ClusterTests = 0;        // sphere/box tests, four per SSE iteration
+		uint32 NonEmptyClusters = 0;
+		uint32 Indices = 0;
+		uint32 MaxPerCluster = 0;
+		uint32 Dropped = 0;
+	};
+
+public:
+	ClusteredLights() = default;
+	ClusteredLights(const ClusteredLights& rhs) = delete;
+	ClusteredLights& operator=(const ClusteredLights& rhs) = delete;
+
+	// Rebuilds the cluster boxes.  Cheap to call every frame; nothing happens unless the
+	// configuration changed.
+	void Configure(const Config& config);
+	const Config& GetConfig()const;
+
+	uint32 ClusterCount()const;
+
+	// Upper bound on Indices().size(), for sizing GPU buffers.
+	uint32 MaxIndexCount()const;
+
+	///<summary>
+	/// Bins the lights into the clusters they overlap, one depth slice per task, and
+	/// rebuilds Ranges() and Indices().  Light i keeps index i in the lists.
+	///</summary>
+	void Assign(const LightSphere* lights, uint32 count);
+
+	const std::vector<ClusterRange>& Ranges()const;
+	const std::vector<uint32>& Indices()const;
+
+	float DepthScale()const;
+	float DepthBias()const;
+	uint32 SliceOfDepth(float viewZ)const;
+
+	const Stats& GetStats()const;
+
+private:
+	void BuildClusterBounds();
+
+private:
+	Config mConfig;
+	bool mConfigured = false;
+
+	float mDepthScale = 0.0f;
+	float mDepthBias = 0.0f;
+
+	// Cluster boxes slice by slice as a structure of arrays, each slice padded to a
+	// multiple of four tiles with boxes nothing can overlap.
+	uint32 mTilesPerSlice = 0;
+	uint32 mPaddedTilesPerSlice = 0;
+	std::vector<float> mMinX, mMinY, mMinZ;
+	std::vector<float> mMaxX, mMaxY, mMaxZ;
+
+	// Per-cluster fixed capacity lists filled by the slice tasks, then compacted.
+	std::vector<uint32> mScratch;
+	std::vector<uint32> mScratchCounts;
+	std::vector<uint32> mSliceDropped;
+	std::vector<uint32> mSliceTests;
+	std::vector<uint32> mFirstSlice, mLastSlice;   // depth slices of each light
+
+	std::vector<ClusterRange> mRanges;
+	std::vector<uint32> mIndices;
+	Stats mStats;
+};
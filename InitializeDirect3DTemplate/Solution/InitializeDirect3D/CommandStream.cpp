@@ -0,0 +1,400 @@
+//***************************************************************************************
+// CommandStream.cpp
+//***************************************************************************************
+
+#include "CommandStream.h"
+#include "ParallelFor.h"
+#include <cassert>
+
+void CommandChunk::Push(const Command& c)
+{
+	mCommands.push_back(c);
+}
+
+void CommandChunk::SetRenderTarget(uint64 rtv, uint64 dsv)
+{
+	Command c;
+	c.Type = CommandType::SetRenderTarget;
+	c.RenderTarget.Rtv = rtv;
+	c.RenderTarget.Dsv = dsv;
+	Push(c);
+}
+
+void CommandChunk::SetViewport(float x, float y, float width, float height, float minDepth, float maxDepth)
+{
+	Command c;
+	c.Type = CommandType::SetViewport;
+	c.Viewport.X = x;
+	c.Viewport.Y = y;
+	c.Viewport.Width = width;
+	c.Viewport.Height = height;
+	c.Viewport.MinDepth = minDepth;
+	c.Viewport.MaxDepth = maxDepth;
+	Push(c);
+}
+
+void CommandChunk::SetScissor(std::int32_t left, std::int32_t top, std::int32_t right, std::int32_t bottom)
+{
+	Command c;
+	c.Type = CommandType::SetScissor;
+	c.Scissor.Left = left;
+	c.Scissor.Top = top;
+	c.Scissor.Right = right;
+	c.Scissor.Bottom = bottom;
+	Push(c);
+}
+
+void CommandChunk::SetDescriptorHeap(uint64 heap)
+{
+	Command c;
+	c.Type = CommandType::SetDescriptorHeap;
+	c.Bind.Object = heap;
+	Push(c);
+}
+
+void CommandChunk::SetRootSignature(uint64 rootSignature)
+{
+	if (mBound.RootSignature == rootSignature)
+	{
+		mFiltered++;
+		return;
+	}
+
+	// Changing the root signature invalidates every root argument.
+	mBound.RootSignature = rootSignature;
+	for (uint64& arg : mBound.RootArgs)
+		arg = 0;
+	mBound.RootConstantMask = 0;
+
+	Command c;
+	c.Type = CommandType::SetRootSignature;
+	c.Bind.Object = rootSignature;
+	Push(c);
+}
+
+void CommandChunk::SetPipeline(uint64 pipeline)
+{
+	if (mBound.Pipeline == pipeline)
+	{
+		mFiltered++;
+		return;
+	}
+	mBound.Pipeline = pipeline;
+
+	Command c;
+	c.Type = CommandType::SetPipeline;
+	c.Bind.Object = pipeline;
+	Push(c);
+}
+
+void CommandChunk::SetDescriptorTable(uint32 slot, uint64 gpuHandle)
+{
+	assert(slot < MaxRootSlots);
+	if (mBound.RootArgs[slot] == gpuHandle)
+	{
+		mFiltered++;
+		return;
+	}
+	mBound.RootArgs[slot] = gpuHandle;
+
+	Command c;
+	c.Type = CommandType::SetDescriptorTable;
+	c.RootArg.Slot = slot;
+	c.RootArg.Handle = gpuHandle;
+	Push(c);
+}
+
+void CommandChunk::SetConstantBuffer(uint32 slot, uint64 gpuAddress)
+{
+	assert(slot < MaxRootSlots);
+	if (mBound.RootArgs[slot] == gpuAddress)
+	{
+		mFiltered++;
+		return;
+	}
+	mBound.RootArgs[slot] = gpuAddress;
+
+	Command c;
+	c.Type = CommandType::SetConstantBuffer;
+	c.RootArg.Slot = slot;
+	c.RootArg.Handle = gpuAddress;
+	Push(c);
+}
+
+void CommandChunk::SetShaderResource(uint32 slot, uint64 gpuAddress)
+{
+	assert(slot < MaxRootSlots);
+	if (mBound.RootArgs[slot] == gpuAddress)
+	{
+		mFiltered++;
+		return;
+	}
+	mBound.RootArgs[slot] = gpuAddress;
+
+	Command c;
+	c.Type = CommandType::SetShaderResource;
+	c.RootArg.Slot = slot;
+	c.RootArg.Handle = gpuAddress;
+	Push(c);
+}
+
+void CommandChunk::SetRootConstants(uint32 slot, uint32 value0, uint32 value1)
+{
+	assert(slot < MaxRootSlots);
+	uint64 values = (uint64)value0 | ((uint64)value1 << 32);
+	if ((mBound.RootConstantMask & (1u << slot)) != 0 && mBound.RootArgs[slot] == values)
+	{
+		mFiltered++;
+		return;
+	}
+	mBound.RootArgs[slot] = values;
+	mBound.RootConstantMask |= 1u << slot;
+
+	Command c;
+	c.Type = CommandType::SetRootConstants;
+	c.Constants.Slot = slot;
+	c.Constants.Values[0] = value0;
+	c.Constants.Values[1] = value1;
+	Push(c);
+}
+
+void CommandChunk::SetVertexBuffer(uint64 gpuAddress, uint32 sizeInBytes, uint32 stride)
+{
+	if (mBound.VertexBuffer == gpuAddress)
+	{
+		mFiltered++;
+		return;
+	}
+	mBound.VertexBuffer = gpuAddress;
+
+	Command c;
+	c.Type = CommandType::SetVertexBuffer;
+	c.Buffer.Address = gpuAddress;
+	c.Buffer.Size = sizeInBytes;
+	c.Buffer.StrideOrFormat = stride;
+	Push(c);
+}
+
+void CommandChunk::SetIndexBuffer(uint64 gpuAddress, uint32 sizeInBytes, uint32 format)
+{
+	if (mBound.IndexBuffer == gpuAddress)
+	{
+		mFiltered++;
+		return;
+	}
+	mBound.IndexBuffer = gpuAddress;
+
+	Command c;
+	c.Type = CommandType::SetIndexBuffer;
+	c.Buffer.Address = gpuAddress;
+	c.Buffer.Size = sizeInBytes;
+	c.Buffer.StrideOrFormat = format;
+	Push(c);
+}
+
+void CommandChunk::SetTopology(uint32 topology)
+{
+	if (mBound.Topology == topology)
+	{
+		mFiltered++;
+		return;
+	}
+	mBound.Topology = topology;
+
+	Command c;
+	c.Type = CommandType::SetTopology;
+	c.Topology.Value = topology;
+	Push(c);
+}
+
+void CommandChunk::DrawIndexed(uint32 indexCount, uint32 startIndex, std::int32_t baseVertex, uint32 instanceCount, uint32 startInstance)
+{
+	Command c;
+	c.Type = CommandType::DrawIndexed;
+	c.Draw.IndexCount = indexCount;
+	c.Draw.InstanceCount = instanceCount;
+	c.Draw.StartIndex = startIndex;
+	c.Draw.BaseVertex = baseVertex;
+	c.Draw.StartInstance = startInstance;
+	Push(c);
+}
+
+void CommandChunk::Clear(const CommandChunk* inherited)
+{
+	mCommands.clear();
+	mBound = inherited != nullptr ? inherited->mBound : BoundState();
+	mFiltered = 0;
+}
+
+const std::vector<Command>& CommandChunk::Commands()const
+{
+	return mCommands;
+}
+
+CommandChunk::uint32 CommandChunk::FilteredCount()const
+{
+	return mFiltered;
+}
+
+void CommandStream::Reset()
+{
+	mPrologue.Clear();
+	for (uint32 i = 0; i < mChunkCount; ++i)
+		mChunks[i].Clear();
+	mChunkCount = 0;
+}
+
+CommandChunk& CommandStream::Prologue()
+{
+	return mPrologue;
+}
+
+const CommandChunk& CommandStream::Prologue()const
+{
+	return mPrologue;
+}
+
+void CommandStream::Record(uint32 itemCount, uint32 maxChunks, uint32 minItemsPerChunk, const RecordFn& record)
+{
+	mChunkCount = 0;
+	if (itemCount == 0)
+		return;
+
+	uint32 chunkCount = minItemsPerChunk > 0 ? itemCount / minItemsPerChunk : itemCount;
+	if (chunkCount > maxChunks)
+		chunkCount = maxChunks;
+	if (chunkCount == 0)
+		chunkCount = 1;
+
+	// Chunks are kept between frames so their command storage is reused.
+	if (mChunks.size() < chunkCount)
+		mChunks.resize(chunkCount);
+	mChunkCount = chunkCount;
+
+	ParallelFor((int)chunkCount, [&](int i)
+	{
+		uint32 begin = (uint32)((std::uint64_t)itemCount * i / chunkCount);
+		uint32 end = (uint32)((std::uint64_t)itemCount * (i + 1) / chunkCount);
+
+		CommandChunk& chunk = mChunks[i];
+		chunk.Clear(&mPrologue);
+		record(chunk, begin, end);
+	});
+}
+
+CommandStream::uint32 CommandStream::ChunkCount()const
+{
+	return mChunkCount;
+}
+
+const CommandChunk& CommandStream::Chunk(uint32 i)const
+{
+	assert(i < mChunkCount);
+	return mChunks[i];
+}
+
+CommandStream::Stats CommandStream::GetStats()const
+{
+	Stats stats;
+	stats.Chunks = mChunkCount;
+	for (uint32 i = 0; i < mChunkCount; ++i)
+	{
+		const CommandChunk& chunk = mChunks[i];
+		stats.Commands += (uint32)chunk.Commands().size();
+		stats.Filtered += chunk.FilteredCount();
+		for (const Command& c : chunk.Commands())
+		{
+			if (c.Type == CommandType::DrawIndexed)
+				stats.Draws++;
+		}
+	}
+	return stats;
+}
+
+void NullCommandBackend::Error(const std::string& message)
+{
+	if (ErrorCount++ == 0)
+		FirstError = message;
+}
+
+void NullCommandBackend::Replay(const CommandStream& stream)
+{
+	struct ListState
+	{
+		bool RenderTarget = false;
+		bool Viewport = false;
+		bool Scissor = false;
+		bool DescriptorHeap = false;
+		bool RootSignature = false;
+		bool Pipeline = false;
+		bool VertexBuffer = false;
+		bool IndexBuffer = false;
+		bool Topology = false;
+	};
+
+	for (CommandStream::uint32 i = 0; i < stream.ChunkCount(); ++i)
+	{
+		// Every chunk goes to a fresh command list.
+		ListState state;
+		ChunkCount++;
+
+		for (const CommandChunk* chunk : { &stream.Prologue(), &stream.Chunk(i) })
+		{
+			for (const Command& c : chunk->Commands())
+			{
+				if ((int)c.Type >= (int)CommandType::Count)
+				{
+					Error("unknown command");
+					continue;
+				}
+				CommandCounts[(int)c.Type]++;
+
+				switch (c.Type)
+				{
+				case CommandType::SetRenderTarget:    state.RenderTarget = c.RenderTarget.Rtv != 0; break;
+				case CommandType::SetViewport:        state.Viewport = c.Viewport.Width > 0.0f && c.Viewport.Height > 0.0f; break;
+				case CommandType::SetScissor:         state.Scissor = c.Scissor.Right > c.Scissor.Left && c.Scissor.Bottom > c.Scissor.Top; break;
+				case CommandType::SetDescriptorHeap:  state.DescriptorHeap = c.Bind.Object != 0; break;
+				case CommandType::SetRootSignature:   state.RootSignature = c.Bind.Object != 0; break;
+				case CommandType::SetPipeline:        state.Pipeline = c.Bind.Object != 0; break;
+				case CommandType::SetVertexBuffer:    state.VertexBuffer = c.Buffer.Address != 0; break;
+				case CommandType::SetIndexBuffer:     state.IndexBuffer = c.Buffer.Address != 0; break;
+				case CommandType::SetTopology:        state.Topology = c.Topology.Value != 0; break;
+
+				case CommandType::SetDescriptorTable:
+					if (!state.DescriptorHeap)
+						Error("descriptor table set without a descriptor heap");
+					// fall through
+				case CommandType::SetConstantBuffer:
+				case CommandType::SetShaderResource:
+					if (!state.RootSignature)
+						Error("root argument set without a root signature");
+					if (c.RootArg.Slot >= CommandChunk::MaxRootSlots)
+						Error("root argument slot out of range");
+					break;
+
+				case CommandType::SetRootConstants:
+					if (!state.RootSignature)
+						Error("root constants set without a root signature");
+					if (c.Constants.Slot >= CommandChunk::MaxRootSlots)
+						Error("root constants slot out of range");
+					break;
+
+				case CommandType::DrawIndexed:
+					if (!state.RenderTarget || !state.Viewport || !state.Scissor)
+						Error("draw without a render target, viewport or scissor");
+					if (!state.RootSignature || !state.Pipeline)
+						Error("draw without a root signature or pipeline");
+					if (!state.VertexBuffer || !state.IndexBuffer || !state.Topology)
+						Error("draw without vertex/index buffers or topology");
+					if (c.Draw.IndexCount == 0 || c.Draw.InstanceCount == 0)
+						Error("empty draw");
+					break;
+
+				default:
+					break;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,186 @@
+//***************************************************************************************
+// CommandStream.h
+//
+// Backend-agnostic draw recording.  Commands are small POD records (bind a pipeline,
+// a constant buffer, vertex/index buffers, draw ...) with every GPU object reduced to an
+// opaque 64-bit handle, so they can be written from any thread without touching the
+// graphics API.
+//
+// A stream is split into chunks covering contiguous ranges of the items being drawn.
+// Each chunk is recorded by one worker and later replayed into its own command list,
+// so replaying the chunks in order reproduces the original draw order.  Native command
+// lists start out with no state, so every chunk is replayed after the stream's
+// prologue (render targets, root signature, per-pass bindings).
+//
+// Chunks drop commands that would rebind what is already bound.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+enum class CommandType : std::uint8_t
+{
+	SetRenderTarget,
+	SetViewport,
+	SetScissor,
+	SetDescriptorHeap,
+	SetRootSignature,
+	SetPipeline,
+	SetDescriptorTable,
+	SetConstantBuffer,
+	SetShaderResource,
+	SetRootConstants,
+	SetVertexBuffer,
+	SetIndexBuffer,
+	SetTopology,
+	DrawIndexed,
+	Count
+};
+
+struct Command
+{
+	CommandType Type;
+
+	union
+	{
+		struct { std::uint64_t Rtv; std::uint64_t Dsv; } RenderTarget;
+		struct { float X, Y, Width, Height, MinDepth, MaxDepth; } Viewport;
+		struct { std::int32_t Left, Top, Right, Bottom; } Scissor;
+		struct { std::uint64_t Object; } Bind;                          // heap, root signature or pipeline
+		struct { std::uint32_t Slot; std::uint64_t Handle; } RootArg;   // descriptor table, constant buffer or buffer SRV
+		struct { std::uint32_t Slot; std::uint32_t Values[2]; } Constants;
+		struct { std::uint64_t Address; std::uint32_t Size; std::uint32_t StrideOrFormat; } Buffer;
+		struct { std::uint32_t Value; } Topology;
+		struct { std::uint32_t IndexCount, InstanceCount, StartIndex; std::int32_t BaseVertex; std::uint32_t StartInstance; } Draw;
+	};
+};
+
+class CommandChunk
+{
+public:
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	static const uint32 MaxRootSlots = 16;
+
+public:
+	void SetRenderTarget(uint64 rtv, uint64 dsv);
+	void SetViewport(float x, float y, float width, float height, float minDepth, float maxDepth);
+	void SetScissor(std::int32_t left, std::int32_t top, std::int32_t right, std::int32_t bottom);
+	void SetDescriptorHeap(uint64 heap);
+	void SetRootSignature(uint64 rootSignature);
+	void SetPipeline(uint64 pipeline);
+	void SetDescriptorTable(uint32 slot, uint64 gpuHandle);
+	void SetConstantBuffer(uint32 slot, uint64 gpuAddress);
+	void SetShaderResource(uint32 slot, uint64 gpuAddress);
+	void SetRootConstants(uint32 slot, uint32 value0, uint32 value1);
+	void SetVertexBuffer(uint64 gpuAddress, uint32 sizeInBytes, uint32 stride);
+	void SetIndexBuffer(uint64 gpuAddress, uint32 sizeInBytes, uint32 format);
+	void SetTopology(uint32 topology);
+	void DrawIndexed(uint32 indexCount, uint32 startIndex, std::int32_t baseVertex, uint32 instanceCount = 1, uint32 startInstance = 0);
+
+	// Drops every command.  When inherited is given, its bindings are treated as already
+	// set, the way the prologue's are when the chunk is replayed.
+	void Clear(const CommandChunk* inherited = nullptr);
+
+	const std::vector<Command>& Commands()const;
+
+	// Commands that were not added because they would not have changed anything.
+	uint32 FilteredCount()const;
+
+private:
+	struct BoundState
+	{
+		uint64 Pipeline = 0;
+		uint64 RootSignature = 0;
+		uint64 VertexBuffer = 0;
+		uint64 IndexBuffer = 0;
+		uint32 Topology = 0;
+		uint64 RootArgs[MaxRootSlots] = {};
+
+		// Root constants can be zero, so the slots whose values are known have a bit here.
+		uint32 RootConstantMask = 0;
+	};
+
+	void Push(const Command& c);
+
+private:
+	std::vector<Command> mCommands;
+	BoundState mBound;
+	uint32 mFiltered = 0;
+};
+
+class CommandStream
+{
+public:
+	using uint32 = std::uint32_t;
+
+	// Records items [begin, end) into chunk.
+	using RecordFn = std::function<void(CommandChunk& chunk, uint32 begin, uint32 end)>;
+
+	struct Stats
+	{
+		uint32 Chunks = 0;
+		uint32 Commands = 0;
+		uint32 Draws = 0;
+		uint32 Filtered = 0;
+	};
+
+public:
+	CommandStream() = default;
+	CommandStream(const CommandStream& rhs) = delete;
+	CommandStream& operator=(const CommandStream& rhs) = delete;
+
+	// Clears the prologue and all chunks.
+	void Reset();
+
+	// Commands replayed at the start of every chunk.  Record it before the chunks.
+	CommandChunk& Prologue();
+	const CommandChunk& Prologue()const;
+
+	///<summary>
+	/// Splits itemCount items into at most maxChunks contiguous ranges of at least
+	/// minItemsPerChunk items and records them concurrently, one chunk per range.
+	///</summary>
+	void Record(uint32 itemCount, uint32 maxChunks, uint32 minItemsPerChunk, const RecordFn& record);
+
+	uint32 ChunkCount()const;
+	const CommandChunk& Chunk(uint32 i)const;
+
+	Stats GetStats()const;
+
+private:
+	CommandChunk mPrologue;
+	std::vector<CommandChunk> mChunks;
+	uint32 mChunkCount = 0;
+};
+
+// Replays a stream into whatever the backend records into.
+class CommandBackend
+{
+public:
+	virtual ~CommandBackend() = default;
+
+	virtual void Replay(const CommandStream& stream) = 0;
+};
+
+// Replays every chunk against a model of the command list state and checks each draw
+// has what it needs bound.  Counts what it sees, so recording can be tested without a
+// GPU.
+class NullCommandBackend : public CommandBackend
+{
+public:
+	void Replay(const CommandStream& stream)override;
+
+	std::uint32_t ChunkCount = 0;
+	std::uint32_t CommandCounts[(int)CommandType::Count] = {};
+	std::uint32_t ErrorCount = 0;
+	std::string FirstError;
+
+private:
+	void Error(const std::string& message);
+};
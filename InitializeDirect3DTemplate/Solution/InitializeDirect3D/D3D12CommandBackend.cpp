@@ -0,0 +1,189 @@
+//***************************************************************************************
+// D3D12CommandBackend.cpp
+//***************************************************************************************
+
+#include "D3D12CommandBackend.h"
+#include "ParallelFor.h"
+
+using Microsoft::WRL::ComPtr;
+
+D3D12CommandBackend::D3D12CommandBackend(ID3D12Device* device) :
+	mDevice(device)
+{
+}
+
+D3D12CommandBackend::~D3D12CommandBackend()
+{
+}
+
+ID3D12GraphicsCommandList* D3D12CommandBackend::AcquireList(std::vector<ComPtr<ID3D12GraphicsCommandList>>& pool,
+	UINT& used, ID3D12CommandAllocator* allocator)
+{
+	// A submitted list may be reset right away, even while the GPU still executes it.
+	if (used == pool.size())
+	{
+		ComPtr<ID3D12GraphicsCommandList> cmdList;
+		ThrowIfFailed(mDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT,
+			allocator, nullptr, IID_PPV_ARGS(cmdList.GetAddressOf())));
+		ThrowIfFailed(cmdList->Close());
+		pool.push_back(cmdList);
+	}
+
+	return pool[used++].Get();
+}
+
+ID3D12GraphicsCommandList* D3D12CommandBackend::OpenPrimary(ID3D12PipelineState* initialState)
+{
+	// Primary lists are recorded one after another, so they can share the frame's allocator.
+	mCurrent = AcquireList(mPrimaryLists, mPrimaryUsed, mFrame->CmdListAlloc.Get());
+	ThrowIfFailed(mCurrent->Reset(mFrame->CmdListAlloc.Get(), initialState));
+	return mCurrent;
+}
+
+void D3D12CommandBackend::BeginFrame(FrameResource& frame, ID3D12PipelineState* initialState)
+{
+	mFrame = &frame;
+	mPrimaryUsed = 0;
+	mWorkerUsed = 0;
+	mSubmission.clear();
+
+	ThrowIfFailed(frame.CmdListAlloc->Reset());
+	for (auto& alloc : frame.WorkerCmdListAllocs)
+		ThrowIfFailed(alloc->Reset());
+
+	OpenPrimary(initialState);
+}
+
+ID3D12GraphicsCommandList* D3D12CommandBackend::CurrentList()const
+{
+	return mCurrent;
+}
+
+void D3D12CommandBackend::Translate(ID3D12GraphicsCommandList* cmdList, const Command& c)
+{
+	switch (c.Type)
+	{
+	case CommandType::SetRenderTarget:
+	{
+		D3D12_CPU_DESCRIPTOR_HANDLE rtv = { (SIZE_T)c.RenderTarget.Rtv };
+		D3D12_CPU_DESCRIPTOR_HANDLE dsv = { (SIZE_T)c.RenderTarget.Dsv };
+		cmdList->OMSetRenderTargets(1, &rtv, true, c.RenderTarget.Dsv != 0 ? &dsv : nullptr);
+		break;
+	}
+	case CommandType::SetViewport:
+	{
+		D3D12_VIEWPORT vp = { c.Viewport.X, c.Viewport.Y, c.Viewport.Width, c.Viewport.Height,
+			c.Viewport.MinDepth, c.Viewport.MaxDepth };
+		cmdList->RSSetViewports(1, &vp);
+		break;
+	}
+	case CommandType::SetScissor:
+	{
+		D3D12_RECT rect = { c.Scissor.Left, c.Scissor.Top, c.Scissor.Right, c.Scissor.Bottom };
+		cmdList->RSSetScissorRects(1, &rect);
+		break;
+	}
+	case CommandType::SetDescriptorHeap:
+	{
+		ID3D12DescriptorHeap* heaps[] = { (ID3D12DescriptorHeap*)c.Bind.Object };
+		cmdList->SetDescriptorHeaps(_countof(heaps), heaps);
+		break;
+	}
+	case CommandType::SetRootSignature:
+		cmdList->SetGraphicsRootSignature((ID3D12RootSignature*)c.Bind.Object);
+		break;
+	case CommandType::SetPipeline:
+		cmdList->SetPipelineState((ID3D12PipelineState*)c.Bind.Object);
+		break;
+	case CommandType::SetDescriptorTable:
+	{
+		D3D12_GPU_DESCRIPTOR_HANDLE handle = { c.RootArg.Handle };
+		cmdList->SetGraphicsRootDescriptorTable(c.RootArg.Slot, handle);
+		break;
+	}
+	case CommandType::SetConstantBuffer:
+		cmdList->SetGraphicsRootConstantBufferView(c.RootArg.Slot, c.RootArg.Handle);
+		break;
+	case CommandType::SetShaderResource:
+		cmdList->SetGraphicsRootShaderResourceView(c.RootArg.Slot, c.RootArg.Handle);
+		break;
+	case CommandType::SetRootConstants:
+		cmdList->SetGraphicsRoot32BitConstants(c.Constants.Slot, 2, c.Constants.Values, 0);
+		break;
+	case CommandType::SetVertexBuffer:
+	{
+		D3D12_VERTEX_BUFFER_VIEW vbv = { c.Buffer.Address, c.Buffer.Size, c.Buffer.StrideOrFormat };
+		cmdList->IASetVertexBuffers(0, 1, &vbv);
+		break;
+	}
+	case CommandType::SetIndexBuffer:
+	{
+		D3D12_INDEX_BUFFER_VIEW ibv = { c.Buffer.Address, c.Buffer.Size, (DXGI_FORMAT)c.Buffer.StrideOrFormat };
+		cmdList->IASetIndexBuffer(&ibv);
+		break;
+	}
+	case CommandType::SetTopology:
+		cmdList->IASetPrimitiveTopology((D3D12_PRIMITIVE_TOPOLOGY)c.Topology.Value);
+		break;
+	case CommandType::DrawIndexed:
+		cmdList->DrawIndexedInstanced(c.Draw.IndexCount, c.Draw.InstanceCount, c.Draw.StartIndex,
+			c.Draw.BaseVertex, c.Draw.StartInstance);
+		break;
+	default:
+		break;
+	}
+}
+
+void D3D12CommandBackend::Replay(const CommandStream& stream)
+{
+	UINT chunkCount = stream.ChunkCount();
+	if (chunkCount == 0)
+		return;
+
+	// Whatever was recorded directly so far runs before the chunks.
+	ThrowIfFailed(mCurrent->Close());
+	mSubmission.push_back(mCurrent);
+
+	// Chunk i always records with worker allocator i; replays within a frame run one after
+	// another, so each allocator only has one list recording at a time.
+	auto& allocs = mFrame->WorkerCmdListAllocs;
+	while (allocs.size() < chunkCount)
+	{
+		ComPtr<ID3D12CommandAllocator> alloc;
+		ThrowIfFailed(mDevice->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT,
+			IID_PPV_ARGS(alloc.GetAddressOf())));
+		allocs.push_back(alloc);
+	}
+
+	mReplayLists.clear();
+	for (UINT i = 0; i < chunkCount; ++i)
+		mReplayLists.push_back(AcquireList(mWorkerLists, mWorkerUsed, allocs[i].Get()));
+
+	ParallelFor((int)chunkCount, [&](int i)
+	{
+		ID3D12GraphicsCommandList* cmdList = mReplayLists[i];
+		ThrowIfFailed(cmdList->Reset(allocs[i].Get(), nullptr));
+
+		for (const Command& c : stream.Prologue().Commands())
+			Translate(cmdList, c);
+		for (const Command& c : stream.Chunk(i).Commands())
+			Translate(cmdList, c);
+
+		ThrowIfFailed(cmdList->Close());
+	});
+
+	mSubmission.insert(mSubmission.end(), mReplayLists.begin(), mReplayLists.end());
+
+	OpenPrimary(nullptr);
+}
+
+void D3D12CommandBackend::EndFrame(ID3D12CommandQueue* queue)
+{
+	ThrowIfFailed(mCurrent->Close());
+	mSubmission.push_back(mCurrent);
+
+	queue->ExecuteCommandLists((UINT)mSubmission.size(), mSubmission.data());
+
+	mCurrent = nullptr;
+	mFrame = nullptr;
+}
@@ -0,0 +1,64 @@
+//***************************************************************************************
+// D3D12CommandBackend.h
+//
+// Replays command streams on Direct3D 12.  A frame is recorded as a sequence of command
+// lists that are submitted together at the end: a primary list for everything recorded
+// directly (barriers, clears), and at each Replay the chunks of the stream, translated in
+// parallel into one list per chunk.  After a Replay recording continues on a fresh
+// primary list, so callers must fetch CurrentList() again.
+//
+// Allocators belong to the FrameResource being recorded; command lists are pooled here
+// and reused once they have been submitted.
+//***************************************************************************************
+
+#pragma once
+
+#include "../../Common/d3dUtil.h"
+#include "CommandStream.h"
+#include "FrameResource.h"
+
+class D3D12CommandBackend : public CommandBackend
+{
+public:
+	D3D12CommandBackend(ID3D12Device* device);
+	D3D12CommandBackend(const D3D12CommandBackend& rhs) = delete;
+	D3D12CommandBackend& operator=(const D3D12CommandBackend& rhs) = delete;
+	~D3D12CommandBackend();
+
+	///<summary>
+	/// Resets the frame's allocators, which the GPU must be done with, and opens the first
+	/// primary list with the given initial pipeline state.
+	///</summary>
+	void BeginFrame(FrameResource& frame, ID3D12PipelineState* initialState);
+
+	// The primary list currently recording.
+	ID3D12GraphicsCommandList* CurrentList()const;
+
+	void Replay(const CommandStream& stream)override;
+
+	// Closes the current primary list and submits every list of the frame in order.
+	void EndFrame(ID3D12CommandQueue* queue);
+
+	static void Translate(ID3D12GraphicsCommandList* cmdList, const Command& c);
+
+private:
+	ID3D12GraphicsCommandList* OpenPrimary(ID3D12PipelineState* initialState);
+	ID3D12GraphicsCommandList* AcquireList(std::vector<Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>>& pool,
+		UINT& used, ID3D12CommandAllocator* allocator);
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> mDevice;
+	FrameResource* mFrame = nullptr;
+
+	std::vector<Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>> mPrimaryLists;
+	std::vector<Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>> mWorkerLists;
+	UINT mPrimaryUsed = 0;
+	UINT mWorkerUsed = 0;
+
+	ID3D12GraphicsCommandList* mCurrent = nullptr;
+
+	// Every list of the frame in submission order.  Both keep their capacity from frame
+	// to frame.
+	std::vector<ID3D12CommandList*> mSubmission;
+	std::vector<ID3D12GraphicsCommandList*> mReplayLists;     // the chunks of the current Replay
+};
@@ -0,0 +1,225 @@
+//***************************************************************************************
+// D3D12PipelineCache.cpp
+//***************************************************************************************
+
+#include "D3D12PipelineCache.h"
+#include "Hash.h"
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+	void AddBytecode(PipelineKey& key, const D3D12_SHADER_BYTECODE& shader)
+	{
+		std::uint64_t h = 0;
+		if (shader.pShaderBytecode != nullptr && shader.BytecodeLength > 0)
+			h = Hash::Fnv1a(shader.pShaderBytecode, shader.BytecodeLength);
+		key.AddValue(h);
+	}
+
+	void AddRenderTargetBlend(PipelineKey& key, const D3D12_RENDER_TARGET_BLEND_DESC& rt)
+	{
+		key.AddValue(rt.BlendEnable);
+		key.AddValue(rt.LogicOpEnable);
+		key.AddValue(rt.RenderTargetWriteMask);
+
+		if (rt.BlendEnable)
+		{
+			key.AddValue(rt.SrcBlend);
+			key.AddValue(rt.DestBlend);
+			key.AddValue(rt.BlendOp);
+			key.AddValue(rt.SrcBlendAlpha);
+			key.AddValue(rt.DestBlendAlpha);
+			key.AddValue(rt.BlendOpAlpha);
+		}
+
+		if (rt.LogicOpEnable)
+			key.AddValue(rt.LogicOp);
+	}
+
+	void AddStencilOp(PipelineKey& key, const D3D12_DEPTH_STENCILOP_DESC& op)
+	{
+		key.AddValue(op.StencilFailOp);
+		key.AddValue(op.StencilDepthFailOp);
+		key.AddValue(op.StencilPassOp);
+		key.AddValue(op.StencilFunc);
+	}
+}
+
+D3D12PipelineCache::D3D12PipelineCache(ID3D12Device* device, const std::string& cachePath) :
+	mDevice(device),
+	mCache(cachePath)
+{
+}
+
+D3D12PipelineCache::~D3D12PipelineCache()
+{
+}
+
+bool D3D12PipelineCache::Load()
+{
+	return mCache.Load();
+}
+
+void D3D12PipelineCache::RegisterRootSignature(ID3D12RootSignature* rootSignature, ID3DBlob* serialized)
+{
+	mRootSignatureHashes[rootSignature] = Hash::Fnv1a(serialized->GetBufferPointer(), serialized->GetBufferSize());
+}
+
+std::uint64_t D3D12PipelineCache::HashDesc(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)const
+{
+	PipelineKey key;
+
+	// An unregistered signature has no stable identity; every one would share a key.
+	auto rootSig = mRootSignatureHashes.find(desc.pRootSignature);
+	if (rootSig == mRootSignatureHashes.end())
+	{
+		OutputDebugStringA("Pipeline cache: the root signature was not registered.\n");
+		ThrowIfFailed(E_INVALIDARG);
+	}
+	key.AddValue(rootSig->second);
+
+	AddBytecode(key, desc.VS);
+	AddBytecode(key, desc.PS);
+	AddBytecode(key, desc.DS);
+	AddBytecode(key, desc.HS);
+	AddBytecode(key, desc.GS);
+
+	key.AddValue(desc.StreamOutput.NumEntries);
+	for (UINT i = 0; i < desc.StreamOutput.NumEntries; ++i)
+	{
+		const D3D12_SO_DECLARATION_ENTRY& e = desc.StreamOutput.pSODeclaration[i];
+		key.AddValue(e.Stream);
+		key.AddString(e.SemanticName);
+		key.AddValue(e.SemanticIndex);
+		key.AddValue(e.StartComponent);
+		key.AddValue(e.ComponentCount);
+		key.AddValue(e.OutputSlot);
+	}
+	if (desc.StreamOutput.NumEntries > 0)
+	{
+		key.AddValue(desc.StreamOutput.NumStrides);
+		key.Add(desc.StreamOutput.pBufferStrides, sizeof(UINT) * desc.StreamOutput.NumStrides);
+		key.AddValue(desc.StreamOutput.RasterizedStream);
+	}
+
+	// Without independent blending only render target 0 is used.
+	const D3D12_BLEND_DESC& blend = desc.BlendState;
+	key.AddValue(blend.AlphaToCoverageEnable);
+	key.AddValue(blend.IndependentBlendEnable);
+	UINT blendTargets = blend.IndependentBlendEnable ? desc.NumRenderTargets : 1;
+	for (UINT i = 0; i < blendTargets; ++i)
+		AddRenderTargetBlend(key, blend.RenderTarget[i]);
+
+	key.AddValue(desc.SampleMask);
+	key.AddValue(desc.RasterizerState);
+
+	const D3D12_DEPTH_STENCIL_DESC& ds = desc.DepthStencilState;
+	key.AddValue(ds.DepthEnable);
+	if (ds.DepthEnable)
+	{
+		key.AddValue(ds.DepthWriteMask);
+		key.AddValue(ds.DepthFunc);
+	}
+	key.AddValue(ds.StencilEnable);
+	if (ds.StencilEnable)
+	{
+		key.AddValue(ds.StencilReadMask);
+		key.AddValue(ds.StencilWriteMask);
+		AddStencilOp(key, ds.FrontFace);
+		AddStencilOp(key, ds.BackFace);
+	}
+
+	key.AddValue(desc.InputLayout.NumElements);
+	for (UINT i = 0; i < desc.InputLayout.NumElements; ++i)
+	{
+		const D3D12_INPUT_ELEMENT_DESC& e = desc.InputLayout.pInputElementDescs[i];
+		key.AddString(e.SemanticName);
+		key.AddValue(e.SemanticIndex);
+		key.AddValue(e.Format);
+		key.AddValue(e.InputSlot);
+		key.AddValue(e.AlignedByteOffset);
+		key.AddValue(e.InputSlotClass);
+		key.AddValue(e.InstanceDataStepRate);
+	}
+
+	key.AddValue(desc.IBStripCutValue);
+	key.AddValue(desc.PrimitiveTopologyType);
+	key.AddValue(desc.NumRenderTargets);
+	key.Add(desc.RTVFormats, sizeof(DXGI_FORMAT) * desc.NumRenderTargets);
+	key.AddValue(desc.DSVFormat);
+	key.AddValue(desc.SampleDesc);
+	key.AddValue(desc.NodeMask);
+	key.AddValue(desc.Flags);
+
+	return key.Value();
+}
+
+std::uint64_t D3D12PipelineCache::Request(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
+{
+	std::uint64_t key = HashDesc(desc);
+
+	ComPtr<ID3D12Device> device = mDevice;
+	mCache.Request(key, [device, desc](const std::vector<std::uint8_t>* cachedBlob, PipelineCache::CreateResult& result)
+	{
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC createDesc = desc;
+		ComPtr<ID3D12PipelineState> pso;
+
+		// A blob from another driver or adapter is rejected; compile from scratch then.
+		if (cachedBlob != nullptr)
+		{
+			createDesc.CachedPSO = { cachedBlob->data(), cachedBlob->size() };
+			if (SUCCEEDED(device->CreateGraphicsPipelineState(&createDesc, IID_PPV_ARGS(&pso))))
+				result.UsedCachedBlob = true;
+			createDesc.CachedPSO = { nullptr, 0 };
+		}
+
+		if (pso == nullptr && FAILED(device->CreateGraphicsPipelineState(&createDesc, IID_PPV_ARGS(&pso))))
+			return false;
+
+		if (!result.UsedCachedBlob)
+		{
+			ComPtr<ID3DBlob> blob;
+			if (SUCCEEDED(pso->GetCachedBlob(&blob)))
+			{
+				const std::uint8_t* data = (const std::uint8_t*)blob->GetBufferPointer();
+				result.Blob.assign(data, data + blob->GetBufferSize());
+			}
+		}
+
+		result.Object = std::shared_ptr<void>(pso.Detach(), [](void* p) { ((ID3D12PipelineState*)p)->Release(); });
+		return true;
+	});
+
+	return key;
+}
+
+ComPtr<ID3D12PipelineState> D3D12PipelineCache::Get(std::uint64_t key)
+{
+	ComPtr<ID3D12PipelineState> pso = Find(key);
+	if (pso == nullptr)
+		ThrowIfFailed(E_FAIL);
+
+	return pso;
+}
+
+ComPtr<ID3D12PipelineState> D3D12PipelineCache::Find(std::uint64_t key)
+{
+	std::shared_ptr<void> object = mCache.Get(key);
+	return ComPtr<ID3D12PipelineState>((ID3D12PipelineState*)object.get());
+}
+
+std::uint32_t D3D12PipelineCache::Evict(const std::vector<std::uint64_t>& liveKeys)
+{
+	return mCache.Evict(liveKeys);
+}
+
+bool D3D12PipelineCache::Flush()
+{
+	return mCache.Flush();
+}
+
+PipelineCache::Stats D3D12PipelineCache::GetStats()const
+{
+	return mCache.GetStats();
+}
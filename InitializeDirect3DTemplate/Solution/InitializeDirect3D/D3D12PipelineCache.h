@@ -0,0 +1,55 @@
+//***************************************************************************************
+// D3D12PipelineCache.h
+//
+// Direct3D 12 front end of the PipelineCache.  Graphics pipeline descriptions are
+// reduced to a canonical key: shaders by a hash of their bytecode instead of their
+// address, input layouts by value, the root signature by a hash of its serialized form,
+// and state that is disabled (blend factors with blending off, stencil ops with stencil
+// off, ...) is left out.  Compiled pipelines are persisted as cached PSO blobs.
+//***************************************************************************************
+
+#pragma once
+
+#include "../../Common/d3dUtil.h"
+#include "PipelineCache.h"
+
+class D3D12PipelineCache
+{
+public:
+	D3D12PipelineCache(ID3D12Device* device, const std::string& cachePath);
+	D3D12PipelineCache(const D3D12PipelineCache& rhs) = delete;
+	D3D12PipelineCache& operator=(const D3D12PipelineCache& rhs) = delete;
+	~D3D12PipelineCache();
+
+	bool Load();
+
+	// Root signatures are identified by the hash of their serialized blob, so the same
+	// signature gets the same key across runs.  Request throws for one that is not registered.
+	void RegisterRootSignature(ID3D12RootSignature* rootSignature, ID3DBlob* serialized);
+
+	///<summary>
+	/// Starts creating the pipeline on a worker thread and returns its key.  Everything
+	/// desc points at (shaders, input layout) must stay alive until Get or Flush.
+	///</summary>
+	std::uint64_t Request(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc);
+
+	// Waits for the pipeline; throws if it could not be created.
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> Get(std::uint64_t key);
+
+	// Waits for the pipeline; null if it could not be created.
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> Find(std::uint64_t key);
+
+	// See PipelineCache::Evict.
+	std::uint32_t Evict(const std::vector<std::uint64_t>& liveKeys);
+
+	bool Flush();
+
+	PipelineCache::Stats GetStats()const;
+
+	std::uint64_t HashDesc(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)const;
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> mDevice;
+	PipelineCache mCache;
+	std::unordered_map<ID3D12RootSignature*, std::uint64_t> mRootSignatureHashes;
+};
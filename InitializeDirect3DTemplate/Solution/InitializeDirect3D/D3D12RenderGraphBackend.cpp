@@ -0,0 +1,259 @@
+//***************************************************************************************
+// D3D12RenderGraphBackend.cpp
+//***************************************************************************************
+
+#include "D3D12RenderGraphBackend.h"
+
+using Microsoft::WRL::ComPtr;
+using namespace RenderGraphState;
+
+namespace
+{
+	bool SamePlacement(const RenderGraphBackend::TransientPlacement& a, const RenderGraphBackend::TransientPlacement& b)
+	{
+		return a.Offset == b.Offset && a.InitialState == b.InitialState && a.UsageStates == b.UsageStates &&
+			a.Desc.Width == b.Desc.Width && a.Desc.Height == b.Desc.Height &&
+			a.Desc.Format == b.Desc.Format && a.Desc.MipLevels == b.Desc.MipLevels;
+	}
+}
+
+D3D12RenderGraphBackend::D3D12RenderGraphBackend(ID3D12Device* device, UINT framesInFlight) :
+	mDevice(device),
+	mFramesInFlight(framesInFlight)
+{
+	D3D12_FEATURE_DATA_D3D12_OPTIONS options = {};
+	if (SUCCEEDED(mDevice->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS, &options, sizeof(options))))
+		mHeapTier = options.ResourceHeapTier;
+}
+
+D3D12RenderGraphBackend::~D3D12RenderGraphBackend()
+{
+}
+
+void D3D12RenderGraphBackend::SetCommandList(ID3D12GraphicsCommandList* cmdList)
+{
+	mCommandList = cmdList;
+}
+
+D3D12_RESOURCE_STATES D3D12RenderGraphBackend::ToD3D12States(uint32 states)
+{
+	// PRESENT and COMMON are 0 in Direct3D 12, so they only stand on their own.
+	if (states == Present)
+		return D3D12_RESOURCE_STATE_PRESENT;
+	if (states == Undefined)
+		return D3D12_RESOURCE_STATE_COMMON;
+
+	D3D12_RESOURCE_STATES result = D3D12_RESOURCE_STATE_COMMON;
+	if (states & RenderTarget)
+		result |= D3D12_RESOURCE_STATE_RENDER_TARGET;
+	if (states & DepthWrite)
+		result |= D3D12_RESOURCE_STATE_DEPTH_WRITE;
+	if (states & DepthRead)
+		result |= D3D12_RESOURCE_STATE_DEPTH_READ;
+	if (states & ShaderResource)
+		result |= D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+	if (states & UnorderedAccess)
+		result |= D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+	if (states & CopySource)
+		result |= D3D12_RESOURCE_STATE_COPY_SOURCE;
+	if (states & CopyDest)
+		result |= D3D12_RESOURCE_STATE_COPY_DEST;
+	return result;
+}
+
+D3D12_RESOURCE_DESC D3D12RenderGraphBackend::MakeResourceDesc(const TextureDesc& desc, uint32 usageStates)const
+{
+	D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE;
+	if (usageStates & RenderTarget)
+		flags |= D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
+	if (usageStates & (DepthWrite | DepthRead))
+		flags |= D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
+	if (usageStates & UnorderedAccess)
+		flags |= D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+
+	return CD3DX12_RESOURCE_DESC::Tex2D((DXGI_FORMAT)desc.Format, desc.Width, desc.Height, 1,
+		(UINT16)desc.MipLevels, 1, 0, flags);
+}
+
+void D3D12RenderGraphBackend::GetAllocationInfo(const TextureDesc& desc, uint32 usageStates, uint64& size, uint64& alignment)
+{
+	D3D12_RESOURCE_DESC resourceDesc = MakeResourceDesc(desc, usageStates);
+	D3D12_RESOURCE_ALLOCATION_INFO info = mDevice->GetResourceAllocationInfo(0, 1, &resourceDesc);
+	size = info.SizeInBytes;
+	alignment = info.Alignment;
+}
+
+D3D12RenderGraphBackend::HeapKind D3D12RenderGraphBackend::HeapKindOf(const D3D12_RESOURCE_DESC& desc)const
+{
+	if (mHeapTier != D3D12_RESOURCE_HEAP_TIER_1)
+		return HeapAnyTexture;
+	return (desc.Flags & (D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL)) ?
+		HeapAnyTexture : HeapOtherTexture;
+}
+
+void D3D12RenderGraphBackend::Retire(ComPtr<ID3D12Pageable> object)
+{
+	if (object != nullptr)
+		mRetired.push_back({ mFrame, object });
+}
+
+void D3D12RenderGraphBackend::ResetTransient(std::size_t i, std::vector<D3D12_RESOURCE_BARRIER>& barriers,
+	std::vector<ID3D12Resource*>& discards)
+{
+	const TransientPlacement& p = mPlacements[i];
+	ID3D12Resource* resource = mResources[i].Get();
+
+	if (mStates[i] != p.InitialState)
+	{
+		barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(resource,
+			ToD3D12States(mStates[i]), ToD3D12States(p.InitialState)));
+		mStates[i] = p.InitialState;
+	}
+
+	// Discarding needs the resource in the state it is written in.
+	D3D12_RESOURCE_FLAGS targetFlags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
+	if ((resource->GetDesc().Flags & targetFlags) != 0 &&
+		(p.InitialState == RenderTarget || p.InitialState == DepthWrite || p.InitialState == UnorderedAccess))
+		discards.push_back(resource);
+}
+
+void D3D12RenderGraphBackend::PrepareTransients(uint64 heapSize, const std::vector<TransientPlacement>& placements,
+	std::vector<void*>& natives)
+{
+	mFrame++;
+
+	// Release what the GPU can no longer be using.
+	mRetired.erase(std::remove_if(mRetired.begin(), mRetired.end(),
+		[this](const std::pair<UINT64, ComPtr<ID3D12Pageable>>& r) { return r.first + mFramesInFlight < mFrame; }),
+		mRetired.end());
+
+	bool sameLayout = placements.size() == mPlacements.size();
+	for (std::size_t i = 0; sameLayout && i < placements.size(); ++i)
+		sameLayout = SamePlacement(placements[i], mPlacements[i]);
+
+	if (!sameLayout)
+	{
+		for (auto& r : mResources)
+			Retire(r);
+		mResources.clear();
+
+		// The graph's offsets hold in every heap; each is sized for the resources it gets.
+		std::vector<D3D12_RESOURCE_DESC> descs;
+		std::vector<UINT64> sizes;
+		UINT64 needed[HeapKindCount] = {};
+		for (const auto& p : placements)
+		{
+			D3D12_RESOURCE_DESC desc = MakeResourceDesc(p.Desc, p.UsageStates);
+			D3D12_RESOURCE_ALLOCATION_INFO info = mDevice->GetResourceAllocationInfo(0, 1, &desc);
+			HeapKind kind = HeapKindOf(desc);
+			if (p.Offset + info.SizeInBytes > needed[kind])
+				needed[kind] = p.Offset + info.SizeInBytes;
+			descs.push_back(desc);
+			sizes.push_back(info.SizeInBytes);
+		}
+
+		for (int kind = 0; kind < HeapKindCount; ++kind)
+		{
+			if (needed[kind] <= mHeapSizes[kind])
+				continue;
+
+			Retire(mHeaps[kind]);
+			mHeaps[kind].Reset();
+
+			D3D12_HEAP_DESC heapDesc = {};
+			heapDesc.SizeInBytes = needed[kind];
+			heapDesc.Properties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+			heapDesc.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+			if (mHeapTier == D3D12_RESOURCE_HEAP_TIER_1)
+				heapDesc.Flags = kind == HeapAnyTexture ? D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES :
+					D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES;
+			else
+				heapDesc.Flags = D3D12_HEAP_FLAG_ALLOW_ALL_BUFFERS_AND_TEXTURES;
+			ThrowIfFailed(mDevice->CreateHeap(&heapDesc, IID_PPV_ARGS(&mHeaps[kind])));
+			mHeapSizes[kind] = needed[kind];
+		}
+
+		mStates.clear();
+		mAliased.clear();
+		for (std::size_t i = 0; i < placements.size(); ++i)
+		{
+			const TransientPlacement& p = placements[i];
+
+			ComPtr<ID3D12Resource> resource;
+			ThrowIfFailed(mDevice->CreatePlacedResource(mHeaps[HeapKindOf(descs[i])].Get(), p.Offset, &descs[i],
+				ToD3D12States(p.InitialState), nullptr, IID_PPV_ARGS(&resource)));
+			mResources.push_back(resource);
+			mStates.push_back(p.InitialState);
+
+			// Like the graph, which places an aliasing barrier before the first use of every
+			// transient whose memory overlaps another's.
+			bool aliased = false;
+			for (std::size_t j = 0; j < placements.size() && !aliased; ++j)
+				aliased = j != i && placements[j].Offset < p.Offset + sizes[i] && p.Offset < placements[j].Offset + sizes[j];
+			mAliased.push_back(aliased);
+		}
+
+		mPlacements = placements;
+	}
+
+	// The transients that share no memory start the frame over right away; the others
+	// once their aliasing barrier made them active (see ResourceBarriers).
+	std::vector<D3D12_RESOURCE_BARRIER> barriers;
+	std::vector<ID3D12Resource*> discards;
+	for (std::size_t i = 0; i < mResources.size(); ++i)
+	{
+		if (!mAliased[i])
+			ResetTransient(i, barriers, discards);
+	}
+	if (!barriers.empty())
+		mCommandList->ResourceBarrier((UINT)barriers.size(), barriers.data());
+	for (ID3D12Resource* resource : discards)
+		mCommandList->DiscardResource(resource, nullptr);
+
+	natives.clear();
+	for (auto& r : mResources)
+		natives.push_back(r.Get());
+}
+
+void D3D12RenderGraphBackend::ResourceBarriers(const RenderGraph& graph, const std::vector<Barrier>& barriers)
+{
+	std::vector<D3D12_RESOURCE_BARRIER> d3dBarriers;
+	d3dBarriers.reserve(barriers.size());
+	std::vector<ID3D12Resource*> discards;
+
+	auto transientIndex = [this](ID3D12Resource* resource)
+	{
+		for (std::size_t i = 0; i < mResources.size(); ++i)
+		{
+			if (mResources[i].Get() == resource)
+				return (int)i;
+		}
+		return -1;
+	};
+
+	for (const Barrier& b : barriers)
+	{
+		ID3D12Resource* resource = (ID3D12Resource*)graph.Native(b.Resource);
+		int transient = transientIndex(resource);
+		if (b.BarrierType == Barrier::Type::Aliasing)
+		{
+			ID3D12Resource* before = b.Before == ~0u ? nullptr : (ID3D12Resource*)graph.Native(b.Before);
+			d3dBarriers.push_back(CD3DX12_RESOURCE_BARRIER::Aliasing(before, resource));
+
+			// Barriers of one batch run in order, so this follows the aliasing barrier.
+			if (transient >= 0)
+				ResetTransient((std::size_t)transient, d3dBarriers, discards);
+		}
+		else
+		{
+			d3dBarriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(resource,
+				ToD3D12States(b.Before), ToD3D12States(b.After)));
+			if (transient >= 0)
+				mStates[transient] = b.After;
+		}
+	}
+
+	mCommandList->ResourceBarrier((UINT)d3dBarriers.size(), d3dBarriers.data());
+	for (ID3D12Resource* resource : discards)
+		mCommandList->DiscardResource(resource, nullptr);
+}
@@ -0,0 +1,75 @@
+//***************************************************************************************
+// D3D12RenderGraphBackend.h
+//
+// Executes a compiled RenderGraph on a Direct3D 12 command list.  Transient textures are
+// placed resources at the offsets the graph chose; they are only recreated when the
+// layout changes, and replaced resources are kept alive until the frames that may still
+// reference them have retired.  Hardware of resource heap tier 1 cannot mix render
+// targets and other textures in one heap, so there each kind gets a heap of its own.
+//
+// Every frame a transient starts over in the state the graph created it in, with
+// undefined contents: a reused resource is transitioned back, and a render target or
+// depth buffer is discarded before its first use, after its aliasing barrier if it
+// shares memory, as Direct3D 12 requires of placed resources.
+//***************************************************************************************
+
+#pragma once
+
+#include "../../Common/d3dUtil.h"
+#include "RenderGraph.h"
+
+class D3D12RenderGraphBackend : public RenderGraphBackend
+{
+public:
+	D3D12RenderGraphBackend(ID3D12Device* device, UINT framesInFlight);
+	D3D12RenderGraphBackend(const D3D12RenderGraphBackend& rhs) = delete;
+	D3D12RenderGraphBackend& operator=(const D3D12RenderGraphBackend& rhs) = delete;
+	~D3D12RenderGraphBackend();
+
+	// The command list the next Execute records into.
+	void SetCommandList(ID3D12GraphicsCommandList* cmdList);
+
+	void GetAllocationInfo(const TextureDesc& desc, uint32 usageStates, uint64& size, uint64& alignment)override;
+	void PrepareTransients(uint64 heapSize, const std::vector<TransientPlacement>& placements,
+		std::vector<void*>& natives)override;
+	void ResourceBarriers(const RenderGraph& graph, const std::vector<Barrier>& barriers)override;
+
+	static D3D12_RESOURCE_STATES ToD3D12States(uint32 states);
+
+private:
+	enum HeapKind
+	{
+		HeapAnyTexture = 0,         // tier 2, and render targets and depth buffers on tier 1
+		HeapOtherTexture = 1,       // tier 1 only
+		HeapKindCount
+	};
+
+	D3D12_RESOURCE_DESC MakeResourceDesc(const TextureDesc& desc, uint32 usageStates)const;
+	HeapKind HeapKindOf(const D3D12_RESOURCE_DESC& desc)const;
+	void Retire(Microsoft::WRL::ComPtr<ID3D12Pageable> object);
+
+	// Brings transient i back to its initial state and discards it when it is a render
+	// target or depth buffer.
+	void ResetTransient(std::size_t i, std::vector<D3D12_RESOURCE_BARRIER>& barriers,
+		std::vector<ID3D12Resource*>& discards);
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> mDevice;
+	ID3D12GraphicsCommandList* mCommandList = nullptr;
+	UINT mFramesInFlight = 0;
+	UINT64 mFrame = 0;
+
+	D3D12_RESOURCE_HEAP_TIER mHeapTier = D3D12_RESOURCE_HEAP_TIER_1;
+	Microsoft::WRL::ComPtr<ID3D12Heap> mHeaps[HeapKindCount];
+	UINT64 mHeapSizes[HeapKindCount] = {};
+
+	// Indexed like the placements.  mStates is the state each resource was left in, and
+	// mAliased marks the ones whose first use comes with an aliasing barrier.
+	std::vector<TransientPlacement> mPlacements;
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> mResources;
+	std::vector<uint32> mStates;
+	std::vector<bool> mAliased;
+
+	// Objects replaced while the GPU may still use them, with the frame they were retired.
+	std::vector<std::pair<UINT64, Microsoft::WRL::ComPtr<ID3D12Pageable>>> mRetired;
+};
@@ -0,0 +1,239 @@
+//***************************************************************************************
+// EntityWorld.cpp
+//***************************************************************************************
+
+#include "EntityWorld.h"
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+
+using uint32 = EntityWorld::uint32;
+using uint64 = EntityWorld::uint64;
+
+namespace
+{
+	struct ComponentInfo
+	{
+		uint32 Size;
+		uint32 Alignment;
+	};
+
+	// Shared by every world, so a component type has the same id everywhere.  Component
+	// ids are first asked for from whichever thread touches a type first, so every access
+	// holds ComponentRegistryMutex.
+	std::vector<ComponentInfo>& ComponentRegistry()
+	{
+		static std::vector<ComponentInfo> registry;
+		return registry;
+	}
+
+	std::mutex& ComponentRegistryMutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	uint32 AlignUp(uint32 value, uint32 alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+uint32 EntityWorld::RegisterComponent(std::size_t size, std::size_t alignment)
+{
+	std::lock_guard<std::mutex> lock(ComponentRegistryMutex());
+	std::vector<ComponentInfo>& registry = ComponentRegistry();
+
+	// Chunks come from new[], which guarantees 16 byte alignment.
+	assert(alignment <= 16);
+	assert(registry.size() < MaxComponentTypes);
+
+	registry.push_back({ (uint32)size, (uint32)alignment });
+	return (uint32)registry.size() - 1;
+}
+
+uint32 EntityWorld::FindOrCreateArchetype(uint64 mask)
+{
+	for (size_t i = 0; i < mArchetypes.size(); ++i)
+	{
+		if (mArchetypes[i].Mask == mask)
+			return (uint32)i;
+	}
+
+	std::vector<ComponentInfo> registry;
+	{
+		std::lock_guard<std::mutex> lock(ComponentRegistryMutex());
+		registry = ComponentRegistry();
+	}
+
+	Archetype archetype;
+	archetype.Mask = mask;
+	std::fill(std::begin(archetype.ColumnOf), std::end(archetype.ColumnOf), -1);
+
+	uint32 rowBytes = sizeof(Entity);
+	for (uint32 c = 0; c < MaxComponentTypes; ++c)
+	{
+		if ((mask & (1ull << c)) == 0)
+			continue;
+
+		Column column;
+		column.Component = c;
+		column.Size = registry[c].Size;
+		archetype.ColumnOf[c] = (int)archetype.Columns.size();
+		archetype.Columns.push_back(column);
+		rowBytes += column.Size;
+	}
+
+	// Columns one after another, each aligned for its type; shrink the capacity until
+	// the padding fits too.  An entity too big for a chunk gets a chunk of its own.
+	auto layout = [&](uint32 capacity)
+	{
+		uint32 offset = 0;
+		for (Column& column : archetype.Columns)
+		{
+			offset = AlignUp(offset, registry[column.Component].Alignment);
+			column.Offset = offset;
+			offset += column.Size * capacity;
+		}
+		offset = AlignUp(offset, alignof(Entity));
+		archetype.EntityOffset = offset;
+		return offset + (uint32)sizeof(Entity) * capacity;
+	};
+
+	uint32 capacity = std::max(ChunkBytes / rowBytes, 1u);
+	uint32 bytes = layout(capacity);
+	while (bytes > ChunkBytes && capacity > 1)
+		bytes = layout(--capacity);
+
+	archetype.Capacity = capacity;
+	archetype.ChunkSize = std::max(bytes, 1u);
+
+	mArchetypes.push_back(std::move(archetype));
+	return (uint32)mArchetypes.size() - 1;
+}
+
+EntityWorld::Entity EntityWorld::Allocate(uint64 mask)
+{
+	uint32 archetypeIndex = FindOrCreateArchetype(mask);
+	Archetype& archetype = mArchetypes[archetypeIndex];
+
+	if (archetype.Chunks.empty() || archetype.Chunks.back()->Count == archetype.Capacity)
+	{
+		auto chunk = std::make_unique<Chunk>();
+		chunk->Data.reset(new unsigned char[archetype.ChunkSize]);
+		chunk->Memory = TrackedMemory(MemoryTag::Scene, archetype.ChunkSize);
+		archetype.Chunks.push_back(std::move(chunk));
+	}
+
+	Entity entity;
+	if (!mFreeRecords.empty())
+	{
+		entity.Index = mFreeRecords.back();
+		mFreeRecords.pop_back();
+	}
+	else
+	{
+		entity.Index = (uint32)mRecords.size();
+		mRecords.emplace_back();
+	}
+
+	Chunk& chunk = *archetype.Chunks.back();
+	Record& record = mRecords[entity.Index];
+	record.Archetype = archetypeIndex;
+	record.Chunk = (uint32)archetype.Chunks.size() - 1;
+	record.Row = chunk.Count++;
+	record.Alive = true;
+	entity.Generation = record.Generation;
+
+	Entity* entities = reinterpret_cast<Entity*>(chunk.Data.get() + archetype.EntityOffset);
+	entities[record.Row] = entity;
+
+	++mEntityCount;
+	return entity;
+}
+
+void* EntityWorld::ComponentPointer(const Record& record, uint32 component)
+{
+	const Archetype& archetype = mArchetypes[record.Archetype];
+	int column = archetype.ColumnOf[component];
+	if (column < 0)
+		return nullptr;
+
+	const Column& c = archetype.Columns[column];
+	return archetype.Chunks[record.Chunk]->Data.get() + c.Offset + (size_t)c.Size * record.Row;
+}
+
+bool EntityWorld::IsAlive(Entity entity)const
+{
+	return entity.Index < mRecords.size() && mRecords[entity.Index].Alive &&
+		mRecords[entity.Index].Generation == entity.Generation;
+}
+
+void EntityWorld::Destroy(Entity entity)
+{
+	if (!IsAlive(entity))
+		return;
+
+	Record& record = mRecords[entity.Index];
+	Archetype& archetype = mArchetypes[record.Archetype];
+	Chunk& chunk = *archetype.Chunks[record.Chunk];
+	Chunk& last = *archetype.Chunks.back();
+	uint32 lastRow = last.Count - 1;
+
+	// Fill the hole with the archetype's last entity.
+	if (&chunk != &last || record.Row != lastRow)
+	{
+		for (const Column& c : archetype.Columns)
+		{
+			memcpy(chunk.Data.get() + c.Offset + (size_t)c.Size * record.Row,
+				last.Data.get() + c.Offset + (size_t)c.Size * lastRow, c.Size);
+		}
+
+		Entity* dstEntities = reinterpret_cast<Entity*>(chunk.Data.get() + archetype.EntityOffset);
+		const Entity* srcEntities = reinterpret_cast<const Entity*>(last.Data.get() + archetype.EntityOffset);
+		Entity moved = srcEntities[lastRow];
+		dstEntities[record.Row] = moved;
+
+		Record& movedRecord = mRecords[moved.Index];
+		movedRecord.Chunk = record.Chunk;
+		movedRecord.Row = record.Row;
+	}
+
+	if (--last.Count == 0)
+		archetype.Chunks.pop_back();
+
+	record.Alive = false;
+	++record.Generation;
+	mFreeRecords.push_back(entity.Index);
+	--mEntityCount;
+}
+
+void EntityWorld::Clear()
+{
+	// The records stay and the live ones move on a generation, so a handle from before
+	// Clear never matches an entity made after it.  Freed in reverse so the lowest
+	// indices are reused first.
+	mArchetypes.clear();
+	mFreeRecords.clear();
+	for (uint32 i = (uint32)mRecords.size(); i-- > 0;)
+	{
+		Record& record = mRecords[i];
+		if (record.Alive)
+		{
+			record.Alive = false;
+			++record.Generation;
+		}
+		mFreeRecords.push_back(i);
+	}
+	mEntityCount = 0;
+}
+
+EntityWorld::Stats EntityWorld::GetStats()const
+{
+	Stats stats;
+	stats.Entities = mEntityCount;
+	stats.Archetypes = (uint32)mArchetypes.size();
+	for (const Archetype& archetype : mArchetypes)
+		stats.Chunks += (uint32)archetype.Chunks.size();
+	return stats;
+}
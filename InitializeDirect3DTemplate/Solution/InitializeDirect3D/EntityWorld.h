@@ -0,0 +1,265 @@
+//***************************************************************************************
+// EntityWorld.h
+//
+// Archetype based entity component system.  Entities with the same set of component
+// types share an archetype, which stores them in fixed size chunks with one array per
+// component type, so a system that reads two components of every entity walks two dense
+// arrays per chunk and nothing else.
+//
+// Components are plain data (trivially copyable): entities move between rows with
+// memcpy.  Destroying an entity moves its archetype's last entity into the hole, so
+// chunks stay dense; handles carry a generation so stale ones are detected.
+//
+// Queries name the component types they need and visit the chunks of every archetype
+// that has them all, one chunk at a time or, with ParallelForEachChunk, across all
+// cores.  Spawning or destroying entities during a query is not allowed.
+//
+// Chunks are charged to MemoryTag::Scene.
+//***************************************************************************************
+
+#pragma once
+
+#include "FrameArena.h"
+#include "MemoryTracker.h"
+#include "ParallelFor.h"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+class EntityWorld
+{
+public:
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	static const uint32 ChunkBytes = 16 * 1024;
+	static const uint32 MaxComponentTypes = 64;
+
+	struct Entity
+	{
+		uint32 Index = ~0u;
+		uint32 Generation = 0;
+
+		bool IsValid()const { return Index != ~0u; }
+		bool operator==(const Entity& rhs)const { return Index == rhs.Index && Generation == rhs.Generation; }
+		bool operator!=(const Entity& rhs)const { return !(*this == rhs); }
+	};
+
+	struct Stats
+	{
+		uint32 Entities = 0;
+		uint32 Archetypes = 0;
+		uint32 Chunks = 0;
+	};
+
+private:
+	struct Archetype;
+	struct Chunk;
+
+public:
+	// The entities of one chunk and their component arrays.
+	class ChunkView
+	{
+	public:
+		uint32 Count()const;
+		const Entity* Entities()const;
+
+		// Array of the chunk's T components, or nullptr if the archetype has no T.
+		template<typename T>
+		T* Get()const;
+
+	private:
+		friend class EntityWorld;
+		ChunkView(const Archetype* archetype, Chunk* chunk) : mArchetype(archetype), mChunk(chunk) {}
+
+		const Archetype* mArchetype;
+		Chunk* mChunk;
+	};
+
+public:
+	EntityWorld() = default;
+	EntityWorld(const EntityWorld& rhs) = delete;
+	EntityWorld& operator=(const EntityWorld& rhs) = delete;
+
+	// Id of component type T, assigned the first time it is asked for.
+	template<typename T>
+	static uint32 ComponentId();
+
+	///<summary>
+	/// Creates an entity with exactly the given components (one of each type).
+	///</summary>
+	template<typename... Ts>
+	Entity Spawn(const Ts&... components);
+
+	void Destroy(Entity entity);
+	bool IsAlive(Entity entity)const;
+
+	// The entity's T, or nullptr if it is dead or has no T.  Valid until the next spawn
+	// or destroy.
+	template<typename T>
+	T* Get(Entity entity);
+
+	// fn(const ChunkView&) for every chunk whose archetype has all of Ts.
+	template<typename... Ts, typename Fn>
+	void ForEachChunk(const Fn& fn);
+
+	// As ForEachChunk, with the chunks spread over all cores.  The list of chunks comes
+	// from scratch when one is given.
+	template<typename... Ts, typename Fn>
+	void ParallelForEachChunk(const Fn& fn, FrameArena* scratch = nullptr);
+
+	// fn(Entity, Ts&...) for every entity that has all of Ts.
+	template<typename... Ts, typename Fn>
+	void ForEach(const Fn& fn);
+
+	// Destroys every entity.  Handles from before stay invalid for good.
+	void Clear();
+
+	uint32 EntityCount()const { return mEntityCount; }
+	Stats GetStats()const;
+
+private:
+	struct Column
+	{
+		uint32 Component = 0;
+		uint32 Offset = 0;
+		uint32 Size = 0;
+	};
+
+	struct Chunk
+	{
+		std::unique_ptr<unsigned char[]> Data;
+		uint32 Count = 0;
+		TrackedMemory Memory;
+	};
+
+	struct Archetype
+	{
+		uint64 Mask = 0;
+		uint32 Capacity = 0;
+		uint32 ChunkSize = 0;
+		uint32 EntityOffset = 0;
+		std::vector<Column> Columns;
+		int ColumnOf[MaxComponentTypes];
+		std::vector<std::unique_ptr<Chunk>> Chunks;
+	};
+
+	struct Record
+	{
+		uint32 Archetype = 0;
+		uint32 Chunk = 0;
+		uint32 Row = 0;
+		uint32 Generation = 0;
+		bool Alive = false;
+	};
+
+	static uint32 RegisterComponent(std::size_t size, std::size_t alignment);
+
+	template<typename... Ts>
+	static uint64 MaskOf();
+
+	uint32 FindOrCreateArchetype(uint64 mask);
+
+	// Reserves a row in the archetype of mask and returns the new entity.
+	Entity Allocate(uint64 mask);
+
+	void* ComponentPointer(const Record& record, uint32 component);
+
+	std::vector<Archetype> mArchetypes;
+	std::vector<Record> mRecords;
+	std::vector<uint32> mFreeRecords;
+	uint32 mEntityCount = 0;
+};
+
+inline EntityWorld::uint32 EntityWorld::ChunkView::Count()const
+{
+	return mChunk->Count;
+}
+
+inline const EntityWorld::Entity* EntityWorld::ChunkView::Entities()const
+{
+	return reinterpret_cast<const Entity*>(mChunk->Data.get() + mArchetype->EntityOffset);
+}
+
+template<typename T>
+T* EntityWorld::ChunkView::Get()const
+{
+	int column = mArchetype->ColumnOf[ComponentId<T>()];
+	if (column < 0)
+		return nullptr;
+	return reinterpret_cast<T*>(mChunk->Data.get() + mArchetype->Columns[column].Offset);
+}
+
+template<typename T>
+EntityWorld::uint32 EntityWorld::ComponentId()
+{
+	static_assert(std::is_trivially_copyable<T>::value, "components must be plain data");
+	static const uint32 id = RegisterComponent(sizeof(T), alignof(T));
+	return id;
+}
+
+template<typename... Ts>
+EntityWorld::uint64 EntityWorld::MaskOf()
+{
+	uint64 mask = 0;
+	int expand[] = { 0, (mask |= 1ull << ComponentId<Ts>(), 0)... };
+	(void)expand;
+	return mask;
+}
+
+template<typename... Ts>
+EntityWorld::Entity EntityWorld::Spawn(const Ts&... components)
+{
+	Entity entity = Allocate(MaskOf<Ts...>());
+	const Record& record = mRecords[entity.Index];
+
+	int expand[] = { 0, (memcpy(ComponentPointer(record, ComponentId<Ts>()), &components, sizeof(Ts)), 0)... };
+	(void)expand;
+	return entity;
+}
+
+template<typename T>
+T* EntityWorld::Get(Entity entity)
+{
+	if (!IsAlive(entity))
+		return nullptr;
+	return reinterpret_cast<T*>(ComponentPointer(mRecords[entity.Index], ComponentId<T>()));
+}
+
+template<typename... Ts, typename Fn>
+void EntityWorld::ForEachChunk(const Fn& fn)
+{
+	const uint64 mask = MaskOf<Ts...>();
+	for (const Archetype& archetype : mArchetypes)
+	{
+		if ((archetype.Mask & mask) != mask)
+			continue;
+
+		for (const auto& chunk : archetype.Chunks)
+			fn(ChunkView(&archetype, chunk.get()));
+	}
+}
+
+template<typename... Ts, typename Fn>
+void EntityWorld::ParallelForEachChunk(const Fn& fn, FrameArena* scratch)
+{
+	ArenaVector<ChunkView> views{ ArenaAllocator<ChunkView>(scratch) };
+	ForEachChunk<Ts...>([&](const ChunkView& view) { views.push_back(view); });
+
+	ParallelFor((int)views.size(), [&](int i) { fn(views[i]); });
+}
+
+template<typename... Ts, typename Fn>
+void EntityWorld::ForEach(const Fn& fn)
+{
+	ForEachChunk<Ts...>([&](const ChunkView& view)
+	{
+		std::tuple<Ts*...> arrays(view.Get<Ts>()...);
+		const Entity* entities = view.Entities();
+		for (uint32 i = 0; i < view.Count(); ++i)
+			fn(entities[i], std::get<Ts*>(arrays)[i]...);
+	});
+}
@@ -0,0 +1,785 @@
+//***************************************************************************************
+// EnvironmentLighting.cpp
+//***************************************************************************************
+
+#include "EnvironmentLighting.h"
+#include "Hash.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define ENVIRONMENT_LIGHTING_SSE 1
+#include <xmmintrin.h>
+#endif
+
+using uint8 = EnvironmentLighting::uint8;
+using uint16 = EnvironmentLighting::uint16;
+using uint32 = EnvironmentLighting::uint32;
+using uint64 = EnvironmentLighting::uint64;
+using Cube = EnvironmentLighting::Cube;
+using SH9 = EnvironmentLighting::SH9;
+
+namespace
+{
+	const float Pi = 3.1415926535f;
+	const uint32 RowsPerTask = 16;
+
+	// A face's texel directions are Normal + u * U + v * V for u, v in [-1, 1], v down.
+	const float FaceAxes[6][3][3] =
+	{
+		{ {  1.0f,  0.0f,  0.0f }, {  0.0f, 0.0f, -1.0f }, { 0.0f, -1.0f,  0.0f } },
+		{ { -1.0f,  0.0f,  0.0f }, {  0.0f, 0.0f,  1.0f }, { 0.0f, -1.0f,  0.0f } },
+		{ {  0.0f,  1.0f,  0.0f }, {  1.0f, 0.0f,  0.0f }, { 0.0f,  0.0f,  1.0f } },
+		{ {  0.0f, -1.0f,  0.0f }, {  1.0f, 0.0f,  0.0f }, { 0.0f,  0.0f, -1.0f } },
+		{ {  0.0f,  0.0f,  1.0f }, {  1.0f, 0.0f,  0.0f }, { 0.0f, -1.0f,  0.0f } },
+		{ {  0.0f,  0.0f, -1.0f }, { -1.0f, 0.0f,  0.0f }, { 0.0f, -1.0f,  0.0f } },
+	};
+
+	const float SHBand0 = 0.282095f;
+	const float SHBand1 = 0.488603f;
+	const float SHBand2 = 1.092548f;
+	const float SHBand2Zonal = 0.315392f;
+	const float SHBand2Sectoral = 0.546274f;
+
+	uint32 ReadU32(const uint8* p)
+	{
+		uint32 v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	void ToFace(const float d[3], uint32& face, float& u, float& v)
+	{
+		float ax = fabsf(d[0]), ay = fabsf(d[1]), az = fabsf(d[2]);
+		if (ax >= ay && ax >= az)
+		{
+			face = d[0] > 0.0f ? 0 : 1;
+			u = (d[0] > 0.0f ? -d[2] : d[2]) / ax;
+			v = -d[1] / ax;
+		}
+		else if (ay >= az)
+		{
+			face = d[1] > 0.0f ? 2 : 3;
+			u = d[0] / ay;
+			v = (d[1] > 0.0f ? d[2] : -d[2]) / ay;
+		}
+		else
+		{
+			face = d[2] > 0.0f ? 4 : 5;
+			u = (d[2] > 0.0f ? d[0] : -d[0]) / az;
+			v = -d[1] / az;
+		}
+	}
+
+	// Bilinear fetch inside one face, clamped at its edges.
+	void SampleFace(const Cube& cube, uint32 face, float u, float v, float rgba[4])
+	{
+		int size = (int)cube.Size;
+		float fx = (u + 1.0f) * 0.5f * size - 0.5f;
+		float fy = (v + 1.0f) * 0.5f * size - 0.5f;
+		fx = std::min(std::max(fx, 0.0f), (float)(size - 1));
+		fy = std::min(std::max(fy, 0.0f), (float)(size - 1));
+
+		int x0 = (int)fx, y0 = (int)fy;
+		int x1 = std::min(x0 + 1, size - 1), y1 = std::min(y0 + 1, size - 1);
+		float tx = fx - x0, ty = fy - y0;
+
+		const float* t = cube.Faces[face].data();
+		const float* p00 = t + 4 * ((size_t)y0 * size + x0);
+		const float* p10 = t + 4 * ((size_t)y0 * size + x1);
+		const float* p01 = t + 4 * ((size_t)y1 * size + x0);
+		const float* p11 = t + 4 * ((size_t)y1 * size + x1);
+
+#if defined(ENVIRONMENT_LIGHTING_SSE)
+		__m128 a = _mm_loadu_ps(p00), b = _mm_loadu_ps(p10);
+		__m128 c = _mm_loadu_ps(p01), d = _mm_loadu_ps(p11);
+		__m128 wx = _mm_set1_ps(tx), wy = _mm_set1_ps(ty);
+		__m128 top = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), wx));
+		__m128 bottom = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), wx));
+		_mm_storeu_ps(rgba, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), wy)));
+#else
+		for (int i = 0; i < 4; ++i)
+		{
+			float top = p00[i] + (p10[i] - p00[i]) * tx;
+			float bottom = p01[i] + (p11[i] - p01[i]) * tx;
+			rgba[i] = top + (bottom - top) * ty;
+		}
+#endif
+	}
+
+	// Trilinear fetch from a pyramid of cubes.
+	void SamplePyramid(const std::vector<Cube>& pyramid, const float d[3], float lod, float rgba[4])
+	{
+		uint32 face;
+		float u, v;
+		ToFace(d, face, u, v);
+
+		float maxLod = (float)(pyramid.size() - 1);
+		lod = std::min(std::max(lod, 0.0f), maxLod);
+		uint32 l0 = (uint32)lod;
+		uint32 l1 = std::min(l0 + 1, (uint32)pyramid.size() - 1);
+		float t = lod - l0;
+
+		SampleFace(pyramid[l0], face, u, v, rgba);
+		if (t > 0.0f && l1 != l0)
+		{
+			float next[4];
+			SampleFace(pyramid[l1], face, u, v, next);
+			for (int i = 0; i < 4; ++i)
+				rgba[i] += (next[i] - rgba[i]) * t;
+		}
+	}
+
+	void Basis(const float n[3], float t[3], float b[3])
+	{
+		float sign = n[2] >= 0.0f ? 1.0f : -1.0f;
+		float a = -1.0f / (sign + n[2]);
+		float c = n[0] * n[1] * a;
+		t[0] = 1.0f + sign * n[0] * n[0] * a;
+		t[1] = sign * c;
+		t[2] = -sign * n[0];
+		b[0] = c;
+		b[1] = sign + n[1] * n[1] * a;
+		b[2] = -n[1];
+	}
+
+	float RadicalInverse(uint32 bits)
+	{
+		bits = (bits << 16) | (bits >> 16);
+		bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+		bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+		bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+		bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+		return bits * 2.3283064365386963e-10f;
+	}
+
+	void DecodeBC1Block(const uint8* block, float rgba[16][4])
+	{
+		uint32 c0 = block[0] | (block[1] << 8);
+		uint32 c1 = block[2] | (block[3] << 8);
+		uint32 bits = ReadU32(block + 4);
+
+		float palette[4][4];
+		auto expand = [](uint32 c, float out[4])
+		{
+			out[0] = ((c >> 11) & 31) / 31.0f;
+			out[1] = ((c >> 5) & 63) / 63.0f;
+			out[2] = (c & 31) / 31.0f;
+			out[3] = 1.0f;
+		};
+		expand(c0, palette[0]);
+		expand(c1, palette[1]);
+
+		for (int i = 0; i < 4; ++i)
+		{
+			if (c0 > c1)
+			{
+				palette[2][i] = (2.0f * palette[0][i] + palette[1][i]) / 3.0f;
+				palette[3][i] = (palette[0][i] + 2.0f * palette[1][i]) / 3.0f;
+			}
+			else
+			{
+				palette[2][i] = 0.5f * (palette[0][i] + palette[1][i]);
+				palette[3][i] = 0.0f;
+			}
+		}
+
+		for (int t = 0; t < 16; ++t)
+			std::memcpy(rgba[t], palette[(bits >> (2 * t)) & 3], sizeof(rgba[t]));
+	}
+}
+
+void EnvironmentLighting::TexelDirection(uint32 face, float x, float y, uint32 size, float direction[3])
+{
+	float u = 2.0f * (x + 0.5f) / size - 1.0f;
+	float v = 2.0f * (y + 0.5f) / size - 1.0f;
+
+	const float (*axes)[3] = FaceAxes[face];
+	float len = sqrtf(1.0f + u * u + v * v);
+	for (int i = 0; i < 3; ++i)
+		direction[i] = (axes[0][i] + u * axes[1][i] + v * axes[2][i]) / len;
+}
+
+bool EnvironmentLighting::DecodeDdsCube(const uint8* data, std::size_t size, Cube& cube)
+{
+	const std::size_t HeaderSize = 4 + 124;
+	if (size < HeaderSize || ReadU32(data) != 0x20534444) // 'DDS '
+		return false;
+
+	uint32 height = ReadU32(data + 12);
+	uint32 width = ReadU32(data + 16);
+	uint32 mipCount = std::max(ReadU32(data + 28), 1u);
+	uint32 fourCC = ReadU32(data + 84);
+	uint32 bitCount = ReadU32(data + 88);
+	uint32 redMask = ReadU32(data + 92);
+	uint32 caps2 = ReadU32(data + 112);
+
+	const uint32 AllFaces = 0xFE00;
+	if (width != height || width == 0 || (caps2 & AllFaces) != AllFaces)
+		return false;
+
+	std::size_t offset = HeaderSize;
+	enum class Format { BC1, RGBA, BGRA } format;
+
+	if (fourCC == 0x31545844) // 'DXT1'
+	{
+		format = Format::BC1;
+	}
+	else if (fourCC == 0x30315844) // 'DX10'
+	{
+		if (size < HeaderSize + 20)
+			return false;
+		uint32 dxgiFormat = ReadU32(data + HeaderSize);
+		offset += 20;
+
+		if (dxgiFormat == 71 || dxgiFormat == 72)          // BC1_UNORM(_SRGB)
+			format = Format::BC1;
+		else if (dxgiFormat == 28 || dxgiFormat == 29)     // R8G8B8A8_UNORM(_SRGB)
+			format = Format::RGBA;
+		else if (dxgiFormat == 87 || dxgiFormat == 91)     // B8G8R8A8_UNORM(_SRGB)
+			format = Format::BGRA;
+		else
+			return false;
+	}
+	else if (fourCC == 0 && bitCount == 32)
+	{
+		format = redMask == 0x000000FF ? Format::RGBA : Format::BGRA;
+	}
+	else
+	{
+		return false;
+	}
+
+	auto mipBytes = [&](uint32 s)
+	{
+		if (format == Format::BC1)
+			return (std::size_t)std::max((s + 3) / 4, 1u) * std::max((s + 3) / 4, 1u) * 8;
+		return (std::size_t)s * s * 4;
+	};
+
+	std::size_t faceStride = 0;
+	for (uint32 m = 0; m < mipCount; ++m)
+		faceStride += mipBytes(std::max(width >> m, 1u));
+
+	if (size < offset + 6 * faceStride)
+		return false;
+
+	cube.Size = width;
+	for (uint32 f = 0; f < 6; ++f)
+	{
+		const uint8* src = data + offset + f * faceStride;
+		std::vector<float>& dst = cube.Faces[f];
+		dst.assign((size_t)width * width * 4, 0.0f);
+
+		if (format == Format::BC1)
+		{
+			uint32 blocks = std::max((width + 3) / 4, 1u);
+			for (uint32 by = 0; by < blocks; ++by)
+			{
+				for (uint32 bx = 0; bx < blocks; ++bx)
+				{
+					float texels[16][4];
+					DecodeBC1Block(src + 8 * ((size_t)by * blocks + bx), texels);
+					for (uint32 t = 0; t < 16; ++t)
+					{
+						uint32 x = bx * 4 + (t & 3), y = by * 4 + (t >> 2);
+						if (x < width && y < width)
+							std::memcpy(&dst[4 * ((size_t)y * width + x)], texels[t], 4 * sizeof(float));
+					}
+				}
+			}
+		}
+		else
+		{
+			for (std::size_t i = 0; i < (size_t)width * width; ++i)
+			{
+				const uint8* p = src + 4 * i;
+				float r = p[0] / 255.0f, g = p[1] / 255.0f, b = p[2] / 255.0f;
+				if (format == Format::BGRA)
+					std::swap(r, b);
+				dst[4 * i + 0] = r;
+				dst[4 * i + 1] = g;
+				dst[4 * i + 2] = b;
+				dst[4 * i + 3] = p[3] / 255.0f;
+			}
+		}
+	}
+
+	return true;
+}
+
+void EnvironmentLighting::Downsample(const Cube& src, Cube& dst)
+{
+	assert(src.Size > 1);
+
+	uint32 size = src.Size / 2;
+	dst.Size = size;
+	for (uint32 f = 0; f < 6; ++f)
+	{
+		const float* s = src.Faces[f].data();
+		std::vector<float>& d = dst.Faces[f];
+		d.resize((size_t)size * size * 4);
+
+		for (uint32 y = 0; y < size; ++y)
+		{
+			for (uint32 x = 0; x < size; ++x)
+			{
+				const float* p00 = s + 4 * ((size_t)(2 * y) * src.Size + 2 * x);
+				const float* p01 = p00 + 4 * (size_t)src.Size;
+				for (int c = 0; c < 4; ++c)
+					d[4 * ((size_t)y * size + x) + c] = 0.25f * (p00[c] + p00[4 + c] + p01[c] + p01[4 + c]);
+			}
+		}
+	}
+}
+
+void EnvironmentLighting::ProjectSH(const Cube& cube, SH9& radiance)
+{
+	const uint32 size = cube.Size;
+	const uint32 blocksPerFace = (size + RowsPerTask - 1) / RowsPerTask;
+	const float texelArea = (2.0f / size) * (2.0f / size);
+
+	// Every task sums its rows into its own coefficients (plus the total weight in
+	// the padding channel of coefficient 0), then the partial sums are added up.
+	std::vector<SH9> partial(6 * blocksPerFace);
+
+	ParallelFor((int)partial.size(), [&](int task)
+	{
+		uint32 face = (uint32)task / blocksPerFace;
+		uint32 y0 = ((uint32)task % blocksPerFace) * RowsPerTask;
+		uint32 y1 = std::min(y0 + RowsPerTask, size);
+		const float (*axes)[3] = FaceAxes[face];
+		const float* texels = cube.Faces[face].data();
+		SH9& sum = partial[task];
+
+		for (uint32 y = y0; y < y1; ++y)
+		{
+			float v = 2.0f * (y + 0.5f) / size - 1.0f;
+			uint32 x = 0;
+
+#if defined(ENVIRONMENT_LIGHTING_SSE)
+			// Four texels at a time: directions, weights and colours in SoA form.
+			__m128 acc[9][3];
+			for (int i = 0; i < 9; ++i)
+				acc[i][0] = acc[i][1] = acc[i][2] = _mm_setzero_ps();
+			__m128 weightSum = _mm_setzero_ps();
+
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 vv = _mm_set1_ps(v);
+			for (; x + 4 <= size; x += 4)
+			{
+				__m128 u = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f),
+					_mm_set1_ps((float)x)), _mm_set1_ps(2.0f / size)), one);
+
+				__m128 len2 = _mm_add_ps(one, _mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(vv, vv)));
+				__m128 invLen = _mm_div_ps(one, _mm_sqrt_ps(len2));
+				__m128 w = _mm_mul_ps(_mm_mul_ps(invLen, _mm_mul_ps(invLen, invLen)), _mm_set1_ps(texelArea));
+
+				__m128 d[3];
+				for (int i = 0; i < 3; ++i)
+				{
+					d[i] = _mm_add_ps(_mm_set1_ps(axes[0][i] + v * axes[2][i]), _mm_mul_ps(u, _mm_set1_ps(axes[1][i])));
+					d[i] = _mm_mul_ps(d[i], invLen);
+				}
+
+				__m128 basis[9];
+				basis[0] = _mm_set1_ps(SHBand0);
+				basis[1] = _mm_mul_ps(_mm_set1_ps(SHBand1), d[1]);
+				basis[2] = _mm_mul_ps(_mm_set1_ps(SHBand1), d[2]);
+				basis[3] = _mm_mul_ps(_mm_set1_ps(SHBand1), d[0]);
+				basis[4] = _mm_mul_ps(_mm_set1_ps(SHBand2), _mm_mul_ps(d[0], d[1]));
+				basis[5] = _mm_mul_ps(_mm_set1_ps(SHBand2), _mm_mul_ps(d[1], d[2]));
+				basis[6] = _mm_mul_ps(_mm_set1_ps(SHBand2Zonal),
+					_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(d[2], d[2])), one));
+				basis[7] = _mm_mul_ps(_mm_set1_ps(SHBand2), _mm_mul_ps(d[0], d[2]));
+				basis[8] = _mm_mul_ps(_mm_set1_ps(SHBand2Sectoral),
+					_mm_sub_ps(_mm_mul_ps(d[0], d[0]), _mm_mul_ps(d[1], d[1])));
+
+				const float* p = texels + 4 * ((size_t)y * size + x);
+				__m128 r = _mm_loadu_ps(p), g = _mm_loadu_ps(p + 4), b = _mm_loadu_ps(p + 8), a = _mm_loadu_ps(p + 12);
+				_MM_TRANSPOSE4_PS(r, g, b, a);
+				r = _mm_mul_ps(r, w);
+				g = _mm_mul_ps(g, w);
+				b = _mm_mul_ps(b, w);
+
+				for (int i = 0; i < 9; ++i)
+				{
+					acc[i][0] = _mm_add_ps(acc[i][0], _mm_mul_ps(basis[i], r));
+					acc[i][1] = _mm_add_ps(acc[i][1], _mm_mul_ps(basis[i], g));
+					acc[i][2] = _mm_add_ps(acc[i][2], _mm_mul_ps(basis[i], b));
+				}
+				weightSum = _mm_add_ps(weightSum, w);
+			}
+
+			for (int i = 0; i < 9; ++i)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					float lanes[4];
+					_mm_storeu_ps(lanes, acc[i][c]);
+					sum.Coeffs[i][c] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+				}
+			}
+			float lanes[4];
+			_mm_storeu_ps(lanes, weightSum);
+			sum.Coeffs[0][3] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+			for (; x < size; ++x)
+			{
+				float u = 2.0f * (x + 0.5f) / size - 1.0f;
+				float len2 = 1.0f + u * u + v * v;
+				float invLen = 1.0f / sqrtf(len2);
+				float w = invLen * invLen * invLen * texelArea;
+
+				float d[3];
+				for (int i = 0; i < 3; ++i)
+					d[i] = (axes[0][i] + u * axes[1][i] + v * axes[2][i]) * invLen;
+
+				float basis[9] = {
+					SHBand0,
+					SHBand1 * d[1], SHBand1 * d[2], SHBand1 * d[0],
+					SHBand2 * d[0] * d[1], SHBand2 * d[1] * d[2], SHBand2Zonal * (3.0f * d[2] * d[2] - 1.0f),
+					SHBand2 * d[0] * d[2], SHBand2Sectoral * (d[0] * d[0] - d[1] * d[1]) };
+
+				const float* p = texels + 4 * ((size_t)y * size + x);
+				for (int i = 0; i < 9; ++i)
+				{
+					for (int c = 0; c < 3; ++c)
+						sum.Coeffs[i][c] += basis[i] * p[c] * w;
+				}
+				sum.Coeffs[0][3] += w;
+			}
+		}
+	});
+
+	radiance = SH9();
+	float weight = 0.0f;
+	for (const SH9& p : partial)
+	{
+		for (int i = 0; i < 9; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+				radiance.Coeffs[i][c] += p.Coeffs[i][c];
+		}
+		weight += p.Coeffs[0][3];
+	}
+
+	// The texel weights approximate the solid angle; rescale so they cover the sphere.
+	float norm = weight > 0.0f ? 4.0f * Pi / weight : 0.0f;
+	for (int i = 0; i < 9; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+			radiance.Coeffs[i][c] *= norm;
+	}
+}
+
+void EnvironmentLighting::ConvolveIrradiance(const SH9& radiance, SH9& irradiance)
+{
+	// Cosine lobe convolution (pi, 2pi/3, pi/4 per band), divided by pi.
+	const float band[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+
+	irradiance = SH9();
+	for (int i = 0; i < 9; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+			irradiance.Coeffs[i][c] = radiance.Coeffs[i][c] * band[i];
+	}
+}
+
+void EnvironmentLighting::EvaluateSH(const SH9& sh, const float d[3], float rgb[3])
+{
+	float basis[9] = {
+		SHBand0,
+		SHBand1 * d[1], SHBand1 * d[2], SHBand1 * d[0],
+		SHBand2 * d[0] * d[1], SHBand2 * d[1] * d[2], SHBand2Zonal * (3.0f * d[2] * d[2] - 1.0f),
+		SHBand2 * d[0] * d[2], SHBand2Sectoral * (d[0] * d[0] - d[1] * d[1]) };
+
+	for (int c = 0; c < 3; ++c)
+	{
+		rgb[c] = 0.0f;
+		for (int i = 0; i < 9; ++i)
+			rgb[c] += sh.Coeffs[i][c] * basis[i];
+	}
+}
+
+void EnvironmentLighting::PrefilterGGX(const std::vector<Cube>& pyramid, const Settings& settings, std::vector<Cube>& mips)
+{
+	assert(!pyramid.empty() && settings.SpecularMips > 0);
+
+	const uint32 workingSize = pyramid[0].Size;
+	const float texelSolidAngle = 4.0f * Pi / (6.0f * workingSize * workingSize);
+
+	// Sample directions only depend on the roughness, so each mip computes them once in
+	// tangent space: (x, y, z) of the light direction around the normal, its weight
+	// N.L and the source lod that covers the sample's solid angle.
+	struct Sample
+	{
+		float L[3];
+		float NdotL;
+		float Lod;
+	};
+	std::vector<std::vector<Sample>> samples(settings.SpecularMips);
+
+	mips.resize(settings.SpecularMips);
+	for (uint32 m = 0; m < settings.SpecularMips; ++m)
+	{
+		uint32 size = std::max(settings.SpecularSize >> m, 1u);
+		mips[m].Size = size;
+		for (uint32 f = 0; f < 6; ++f)
+			mips[m].Faces[f].resize((size_t)size * size * 4);
+
+		float roughness = settings.SpecularMips > 1 ? (float)m / (settings.SpecularMips - 1) : 0.0f;
+		if (m == 0 || roughness <= 0.0f)
+		{
+			// A mirror: one sample straight along the normal at the output resolution.
+			Sample s = { { 0.0f, 0.0f, 1.0f }, 1.0f, log2f((float)workingSize / size) };
+			samples[m].push_back(s);
+			continue;
+		}
+
+		float a = roughness * roughness;
+		float a2 = a * a;
+		for (uint32 i = 0; i < settings.SpecularSamples; ++i)
+		{
+			float xi0 = (i + 0.5f) / settings.SpecularSamples;
+			float xi1 = RadicalInverse(i);
+
+			float phi = 2.0f * Pi * xi0;
+			float cosTheta = sqrtf((1.0f - xi1) / (1.0f + (a2 - 1.0f) * xi1));
+			float sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+
+			// Reflect the view (= normal) about the sampled half vector.
+			Sample s;
+			s.L[0] = 2.0f * cosTheta * sinTheta * cosf(phi);
+			s.L[1] = 2.0f * cosTheta * sinTheta * sinf(phi);
+			s.L[2] = 2.0f * cosTheta * cosTheta - 1.0f;
+			s.NdotL = s.L[2];
+			if (s.NdotL <= 0.0f)
+				continue;
+
+			// With N = V the pdf of L is D / 4.
+			float denom = cosTheta * cosTheta * (a2 - 1.0f) + 1.0f;
+			float pdf = a2 / (Pi * denom * denom) * 0.25f;
+			float sampleSolidAngle = 1.0f / (settings.SpecularSamples * pdf);
+			s.Lod = std::max(0.5f * log2f(sampleSolidAngle / texelSolidAngle) + 1.0f, 0.0f);
+			samples[m].push_back(s);
+		}
+	}
+
+	// One task per block of rows of every face of every mip.
+	struct Task
+	{
+		uint32 Mip;
+		uint32 Face;
+		uint32 Y0;
+	};
+	std::vector<Task> tasks;
+	for (uint32 m = 0; m < settings.SpecularMips; ++m)
+	{
+		for (uint32 f = 0; f < 6; ++f)
+		{
+			for (uint32 y = 0; y < mips[m].Size; y += RowsPerTask)
+				tasks.push_back({ m, f, y });
+		}
+	}
+
+	ParallelFor((int)tasks.size(), [&](int t)
+	{
+		const Task& task = tasks[t];
+		Cube& out = mips[task.Mip];
+		uint32 y1 = std::min(task.Y0 + RowsPerTask, out.Size);
+
+		for (uint32 y = task.Y0; y < y1; ++y)
+		{
+			for (uint32 x = 0; x < out.Size; ++x)
+			{
+				float n[3], tangent[3], bitangent[3];
+				TexelDirection(task.Face, (float)x, (float)y, out.Size, n);
+				Basis(n, tangent, bitangent);
+
+				float weight = 0.0f;
+				float* dst = &out.Faces[task.Face][4 * ((size_t)y * out.Size + x)];
+
+#if defined(ENVIRONMENT_LIGHTING_SSE)
+				__m128 acc = _mm_setzero_ps();
+#else
+				float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+#endif
+				for (const Sample& s : samples[task.Mip])
+				{
+					float l[3];
+					for (int i = 0; i < 3; ++i)
+						l[i] = tangent[i] * s.L[0] + bitangent[i] * s.L[1] + n[i] * s.L[2];
+
+					float rgba[4];
+					SamplePyramid(pyramid, l, s.Lod, rgba);
+
+#if defined(ENVIRONMENT_LIGHTING_SSE)
+					acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(rgba), _mm_set1_ps(s.NdotL)));
+#else
+					for (int c = 0; c < 4; ++c)
+						acc[c] += rgba[c] * s.NdotL;
+#endif
+					weight += s.NdotL;
+				}
+
+				float inv = weight > 0.0f ? 1.0f / weight : 0.0f;
+#if defined(ENVIRONMENT_LIGHTING_SSE)
+				_mm_storeu_ps(dst, _mm_mul_ps(acc, _mm_set1_ps(inv)));
+#else
+				for (int c = 0; c < 4; ++c)
+					dst[c] = acc[c] * inv;
+#endif
+			}
+		}
+	});
+}
+
+uint16 EnvironmentLighting::FloatToHalf(float value)
+{
+	uint32 bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+
+	uint32 sign = (bits >> 16) & 0x8000;
+	uint32 abs = bits & 0x7FFFFFFF;
+
+	if (abs >= 0x7F800000)                        // inf or NaN
+		return (uint16)(sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0));
+	if (abs >= 0x477FF000)                        // rounds past the largest half
+		return (uint16)(sign | 0x7C00);
+
+	int exponent = (int)(abs >> 23) - 127 + 15;
+	uint32 mantissa = abs & 0x7FFFFF;
+
+	if (exponent <= 0)
+	{
+		// Subnormal half, or zero.
+		if (exponent < -10)
+			return (uint16)sign;
+		mantissa |= 0x800000;
+		uint32 shift = (uint32)(14 - exponent);
+		uint32 half = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1)
+			half++;
+		return (uint16)(sign | half);
+	}
+
+	// Round to nearest; a carry out of the mantissa correctly bumps the exponent.
+	uint32 half = sign | ((uint32)exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000)
+		half++;
+	return (uint16)half;
+}
+
+const uint16* EnvironmentLighting::SpecularTexels(uint32 face, uint32 mip)const
+{
+	assert(face < 6 && mip < mHeader.SpecularMips);
+	return mTexelData + mSubresourceOffsets[face * mHeader.SpecularMips + mip];
+}
+
+bool EnvironmentLighting::Build(const std::string& sourcePath, const std::string& cachePath, const Settings& settings)
+{
+	assert(settings.SpecularMips > 0 && settings.SpecularSize >= (1u << (settings.SpecularMips - 1)));
+
+	mLoadedFromCache = false;
+	mCache.Close();
+	mTexels.clear();
+	mTexelData = nullptr;
+
+	MappedFile source;
+	if (!source.Open(sourcePath) || source.Data() == nullptr)
+		return false;
+
+	uint32 version = CacheVersion;
+	uint64 sourceHash = Hash::Fnv1a(source.Data(), source.Size());
+	sourceHash = Hash::Fnv1aValue(version, sourceHash);
+	sourceHash = Hash::Fnv1aValue(settings, sourceHash);
+
+	mHeader = CacheHeader();
+	mHeader.SpecularSize = settings.SpecularSize;
+	mHeader.SpecularMips = settings.SpecularMips;
+	mHeader.SourceHash = sourceHash;
+
+	mSubresourceOffsets.clear();
+	std::size_t texelCount = 0;
+	for (uint32 f = 0; f < 6; ++f)
+	{
+		for (uint32 m = 0; m < settings.SpecularMips; ++m)
+		{
+			uint32 size = std::max(settings.SpecularSize >> m, 1u);
+			mSubresourceOffsets.push_back(texelCount);
+			texelCount += (std::size_t)size * size * 4;
+		}
+	}
+
+	// A cache from the same source and settings is used as it is.
+	if (mCache.Open(cachePath) && mCache.Size() >= sizeof(CacheHeader) + texelCount * sizeof(uint16))
+	{
+		CacheHeader header;
+		std::memcpy(&header, mCache.Data(), sizeof(header));
+		if (header.Magic == CacheMagic && header.Version == CacheVersion && header.SourceHash == sourceHash &&
+			header.SpecularSize == settings.SpecularSize && header.SpecularMips == settings.SpecularMips)
+		{
+			mHeader = header;
+			mTexelData = (const uint16*)(mCache.Data() + sizeof(CacheHeader));
+			mLoadedFromCache = true;
+			return true;
+		}
+	}
+	mCache.Close();
+
+	Cube cube;
+	if (!DecodeDdsCube(source.Data(), source.Size(), cube))
+		return false;
+	source.Close();
+
+	std::vector<Cube> pyramid;
+	pyramid.push_back(std::move(cube));
+	while (pyramid.back().Size > settings.WorkingSize)
+	{
+		Cube half;
+		Downsample(pyramid.back(), half);
+		pyramid.back() = std::move(half);
+	}
+	while (pyramid.back().Size > 1)
+	{
+		Cube half;
+		Downsample(pyramid.back(), half);
+		pyramid.push_back(std::move(half));
+	}
+
+	SH9 radiance;
+	ProjectSH(pyramid[0], radiance);
+	ConvolveIrradiance(radiance, mHeader.Irradiance);
+
+	std::vector<Cube> mips;
+	PrefilterGGX(pyramid, settings, mips);
+
+	mTexels.resize(texelCount);
+	for (uint32 f = 0; f < 6; ++f)
+	{
+		for (uint32 m = 0; m < settings.SpecularMips; ++m)
+		{
+			const std::vector<float>& src = mips[m].Faces[f];
+			uint16* dst = mTexels.data() + mSubresourceOffsets[f * settings.SpecularMips + m];
+			for (std::size_t i = 0; i < src.size(); ++i)
+				dst[i] = FloatToHalf(src[i]);
+		}
+	}
+	mTexelData = mTexels.data();
+
+	// A cache that cannot be written only costs the next startup the same work.
+	std::ofstream fout(cachePath, std::ios::binary | std::ios::trunc);
+	if (fout)
+	{
+		fout.write((const char*)&mHeader, sizeof(mHeader));
+		fout.write((const char*)mTexels.data(), mTexels.size() * sizeof(uint16));
+	}
+
+	return true;
+}
@@ -0,0 +1,125 @@
+//***************************************************************************************
+// EnvironmentLighting.h
+//
+// Image based lighting from an environment cubemap, computed on the CPU:
+//
+//   - diffuse: the cubemap projected to L2 spherical harmonics (9 RGB coefficients) and
+//     convolved with the cosine lobe, so evaluating them at a normal gives the light a
+//     white Lambertian surface with that normal reflects,
+//   - specular: a mip chain where mip m is the cubemap prefiltered with the GGX lobe of
+//     roughness m / (mips - 1), to be sampled along the reflection vector.
+//
+// Both run across all cores and use SSE where available.  The result is cached in a file
+// the caller names; later runs map the cache instead of recomputing it.
+//
+// Cache file layout:
+//   CacheHeader
+//   half RGBA texels of every face and mip, in D3D12 subresource order (face * mips + mip)
+//***************************************************************************************
+
+#pragma once
+
+#include "MappedFile.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class EnvironmentLighting
+{
+public:
+
+	using uint8 = std::uint8_t;
+	using uint16 = std::uint16_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	static const uint32 CacheMagic = 0x4C564E45; // 'ENVL'
+	static const uint32 CacheVersion = 1;
+
+	struct Settings
+	{
+		// Faces are box-filtered down to this size before any processing.
+		uint32 WorkingSize = 256;
+
+		uint32 SpecularSize = 128;
+		uint32 SpecularMips = 6;
+		uint32 SpecularSamples = 64;
+	};
+
+	// Float RGBA faces in the D3D order +X, -X, +Y, -Y, +Z, -Z, rows top to bottom.
+	struct Cube
+	{
+		uint32 Size = 0;
+		std::vector<float> Faces[6];
+	};
+
+	// L2 spherical harmonics; coefficient i of channel c is Coeffs[i][c].  The fourth
+	// channel is padding so the array can be copied into a constant buffer.
+	struct SH9
+	{
+		float Coeffs[9][4] = {};
+	};
+
+	struct CacheHeader
+	{
+		uint32 Magic = CacheMagic;
+		uint32 Version = CacheVersion;
+		uint32 SpecularSize = 0;
+		uint32 SpecularMips = 0;
+		uint64 SourceHash = 0;
+		SH9 Irradiance;
+	};
+
+public:
+	EnvironmentLighting() = default;
+	EnvironmentLighting(const EnvironmentLighting& rhs) = delete;
+	EnvironmentLighting& operator=(const EnvironmentLighting& rhs) = delete;
+
+	///<summary>
+	/// Loads cachePath if it was computed from the current sourcePath with the same
+	/// settings; otherwise decodes the source DDS cubemap, computes everything and writes
+	/// cachePath.  Returns false if the source cannot be read or decoded.
+	///</summary>
+	bool Build(const std::string& sourcePath, const std::string& cachePath, const Settings& settings);
+
+	bool LoadedFromCache()const { return mLoadedFromCache; }
+
+	// Irradiance SH, scaled by 1/pi: EvaluateSH gives the outgoing radiance of a white
+	// Lambertian surface.
+	const SH9& Irradiance()const { return mHeader.Irradiance; }
+
+	uint32 SpecularSize()const { return mHeader.SpecularSize; }
+	uint32 SpecularMips()const { return mHeader.SpecularMips; }
+
+	// Half RGBA texels of one face and mip of the specular chain.
+	const uint16* SpecularTexels(uint32 face, uint32 mip)const;
+
+	// Decodes mip 0 of a BC1 or 32-bit RGBA/BGRA DDS cubemap.
+	static bool DecodeDdsCube(const uint8* data, std::size_t size, Cube& cube);
+
+	// Halves a cube with a 2x2 box filter.
+	static void Downsample(const Cube& src, Cube& dst);
+
+	static void ProjectSH(const Cube& cube, SH9& radiance);
+	static void ConvolveIrradiance(const SH9& radiance, SH9& irradiance);
+	static void EvaluateSH(const SH9& sh, const float direction[3], float rgb[3]);
+
+	// Fills mips[0 .. settings.SpecularMips) from the source pyramid (pyramid[0] is the
+	// working size, each level half the previous one).
+	static void PrefilterGGX(const std::vector<Cube>& pyramid, const Settings& settings, std::vector<Cube>& mips);
+
+	// Unit direction through the centre of texel (x, y) of a face of the given size.
+	static void TexelDirection(uint32 face, float x, float y, uint32 size, float direction[3]);
+
+	static uint16 FloatToHalf(float value);
+
+private:
+	CacheHeader mHeader;
+	bool mLoadedFromCache = false;
+
+	// Texels come from the mapped cache, or from mTexels when freshly computed.
+	MappedFile mCache;
+	std::vector<uint16> mTexels;
+	const uint16* mTexelData = nullptr;
+	std::vector<std::size_t> mSubresourceOffsets;
+};
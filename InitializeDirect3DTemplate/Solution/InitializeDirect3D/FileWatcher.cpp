@@ -0,0 +1,358 @@
+//***************************************************************************************
+// FileWatcher.cpp
+//***************************************************************************************
+
+#include "FileWatcher.h"
+#include <algorithm>
+#include <cctype>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#if defined(_WIN32)
+	const DWORD gNotifyFilter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+
+	// Starts the next read; its completion signals the directory's event.
+	bool IssueRead(HANDLE handle, std::vector<std::uint32_t>& buffer, OVERLAPPED* overlapped)
+	{
+		ResetEvent(overlapped->hEvent);
+		return ReadDirectoryChangesW(handle, buffer.data(), (DWORD)(buffer.size() * sizeof(std::uint32_t)),
+			FALSE, gNotifyFilter, nullptr, overlapped, nullptr) != 0;
+	}
+#else
+	const std::uint32_t gWatchMask = IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO;
+#endif
+}
+
+FileWatcher::FileWatcher(float settleSeconds) :
+	mSettleSeconds(settleSeconds)
+{
+}
+
+std::string FileWatcher::NormalizePath(const std::string& path)
+{
+	std::string result;
+	result.reserve(path.size());
+	for (std::size_t i = 0; i < path.size(); ++i)
+	{
+		char c = path[i] == '\\' ? '/' : path[i];
+
+		// Drop repeated slashes and "./" segments.
+		bool segmentStart = result.empty() || result.back() == '/';
+		if (c == '/' && !result.empty() && result.back() == '/')
+			continue;
+		if (c == '.' && segmentStart && i + 1 < path.size() && (path[i + 1] == '/' || path[i + 1] == '\\'))
+		{
+			++i;
+			continue;
+		}
+
+#if defined(_WIN32)
+		c = (char)std::tolower((unsigned char)c);
+#endif
+		result.push_back(c);
+	}
+	return result;
+}
+
+void FileWatcher::Record(const Directory& directory, const std::string& name)
+{
+	std::string path = NormalizePath(directory.Path + name);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mPending[path] = Clock::now();
+	mStats.Events++;
+}
+
+void FileWatcher::TakeChanges(std::vector<std::string>& out)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Clock::time_point now = Clock::now();
+	for (auto it = mPending.begin(); it != mPending.end();)
+	{
+		if (std::chrono::duration<float>(now - it->second).count() < mSettleSeconds)
+		{
+			++it;
+			continue;
+		}
+
+		out.push_back(it->first);
+		mStats.Changes++;
+		it = mPending.erase(it);
+	}
+}
+
+FileWatcher::Stats FileWatcher::GetStats()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mStats;
+}
+
+#if defined(_WIN32)
+
+FileWatcher::~FileWatcher()
+{
+	Stop();
+
+	for (Directory& directory : mDirectories)
+	{
+		// The pending read still writes to the buffer until it is cancelled.
+		OVERLAPPED* overlapped = (OVERLAPPED*)directory.Overlapped;
+		DWORD bytes = 0;
+		CancelIoEx(directory.Handle, overlapped);
+		GetOverlappedResult(directory.Handle, overlapped, &bytes, TRUE);
+
+		CloseHandle(directory.Handle);
+		CloseHandle(directory.Event);
+		delete overlapped;
+	}
+
+	if (mStopEvent != nullptr)
+		CloseHandle(mStopEvent);
+}
+
+bool FileWatcher::Watch(const std::string& directory)
+{
+	// One wait slot is the stop event's.
+	if (mRunning || mDirectories.size() + 1 >= MAXIMUM_WAIT_OBJECTS)
+		return false;
+
+	HANDLE handle = CreateFileA(directory.c_str(), FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	Directory watched;
+	watched.Path = NormalizePath(directory + "/");
+	watched.Handle = handle;
+	watched.Event = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+	watched.Buffer.resize(16 * 1024 / sizeof(std::uint32_t));
+
+	OVERLAPPED* overlapped = new OVERLAPPED();
+	overlapped->hEvent = watched.Event;
+	watched.Overlapped = overlapped;
+
+	if (watched.Event == nullptr || !IssueRead(handle, watched.Buffer, overlapped))
+	{
+		if (watched.Event != nullptr)
+			CloseHandle(watched.Event);
+		CloseHandle(handle);
+		delete overlapped;
+		return false;
+	}
+
+	mDirectories.push_back(std::move(watched));
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mStats.Directories = (uint32)mDirectories.size();
+	return true;
+}
+
+void FileWatcher::Start()
+{
+	if (mRunning || mDirectories.empty())
+		return;
+
+	if (mStopEvent == nullptr)
+		mStopEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+	ResetEvent(mStopEvent);
+
+	mRunning = true;
+	mThread = std::thread(&FileWatcher::Run, this);
+}
+
+void FileWatcher::Stop()
+{
+	if (!mRunning)
+		return;
+
+	SetEvent(mStopEvent);
+	mThread.join();
+	mRunning = false;
+}
+
+void FileWatcher::Run()
+{
+	// The stop event comes first, so it wins over any directory that is signaled with it.
+	// slots[i] is the directory behind events[i + 1]; directories drop out of both.
+	std::vector<HANDLE> events;
+	std::vector<std::size_t> slots;
+	events.push_back(mStopEvent);
+	for (std::size_t i = 0; i < mDirectories.size(); ++i)
+	{
+		events.push_back(mDirectories[i].Event);
+		slots.push_back(i);
+	}
+
+	for (;;)
+	{
+		DWORD signaled = WaitForMultipleObjects((DWORD)events.size(), events.data(), FALSE, INFINITE);
+		if (signaled <= WAIT_OBJECT_0 || signaled >= WAIT_OBJECT_0 + events.size())
+			break;
+
+		const std::size_t slot = signaled - WAIT_OBJECT_0 - 1;
+		Directory& directory = mDirectories[slots[slot]];
+		OVERLAPPED* overlapped = (OVERLAPPED*)directory.Overlapped;
+
+		// No bytes means the buffer overflowed and the changes are lost.
+		DWORD bytes = 0;
+		if (!GetOverlappedResult(directory.Handle, overlapped, &bytes, FALSE) || bytes == 0)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStats.Overflows++;
+		}
+		else
+		{
+			const BYTE* record = (const BYTE*)directory.Buffer.data();
+			for (;;)
+			{
+				const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)record;
+				if (info->Action != FILE_ACTION_REMOVED && info->Action != FILE_ACTION_RENAMED_OLD_NAME)
+				{
+					int wideLength = (int)(info->FileNameLength / sizeof(WCHAR));
+					int length = WideCharToMultiByte(CP_ACP, 0, info->FileName, wideLength, nullptr, 0, nullptr, nullptr);
+					std::string name(length, '\0');
+					WideCharToMultiByte(CP_ACP, 0, info->FileName, wideLength, &name[0], length, nullptr, nullptr);
+					Record(directory, name);
+				}
+
+				if (info->NextEntryOffset == 0)
+					break;
+				record += info->NextEntryOffset;
+			}
+		}
+
+		// A directory that cannot be read again drops out of the wait.
+		if (!IssueRead(directory.Handle, directory.Buffer, overlapped))
+		{
+			events.erase(events.begin() + slot + 1);
+			slots.erase(slots.begin() + slot);
+		}
+	}
+}
+
+#else
+
+FileWatcher::~FileWatcher()
+{
+	Stop();
+
+	if (mInotify >= 0)
+		close(mInotify);
+}
+
+bool FileWatcher::Watch(const std::string& directory)
+{
+	if (mRunning)
+		return false;
+
+	if (mInotify < 0)
+	{
+		mInotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (mInotify < 0)
+			return false;
+	}
+
+	int watch = inotify_add_watch(mInotify, directory.c_str(), gWatchMask | IN_ONLYDIR);
+	if (watch < 0)
+		return false;
+
+	Directory watched;
+	watched.Path = NormalizePath(directory + "/");
+	watched.Watch = watch;
+	mDirectories.push_back(std::move(watched));
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mStats.Directories = (uint32)mDirectories.size();
+	return true;
+}
+
+void FileWatcher::Start()
+{
+	if (mRunning || mDirectories.empty())
+		return;
+
+	if (pipe(mStopPipe) != 0)
+		return;
+
+	mRunning = true;
+	mThread = std::thread(&FileWatcher::Run, this);
+}
+
+void FileWatcher::Stop()
+{
+	if (!mRunning)
+		return;
+
+	char wake = 0;
+	while (write(mStopPipe[1], &wake, 1) < 0 && errno == EINTR)
+		continue;
+	mThread.join();
+	mRunning = false;
+
+	close(mStopPipe[0]);
+	close(mStopPipe[1]);
+	mStopPipe[0] = mStopPipe[1] = -1;
+}
+
+void FileWatcher::Run()
+{
+	alignas(inotify_event) char buffer[16 * 1024];
+
+	pollfd fds[2] = {};
+	fds[0].fd = mInotify;
+	fds[0].events = POLLIN;
+	fds[1].fd = mStopPipe[0];
+	fds[1].events = POLLIN;
+
+	for (;;)
+	{
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[1].revents != 0)
+			break;
+		if ((fds[0].revents & POLLIN) == 0)
+			continue;
+
+		ssize_t bytes = read(mInotify, buffer, sizeof(buffer));
+		for (ssize_t offset = 0; offset < bytes;)
+		{
+			const inotify_event* event = (const inotify_event*)(buffer + offset);
+			offset += sizeof(inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mStats.Overflows++;
+				continue;
+			}
+			if (event->len == 0)
+				continue;
+
+			auto directory = std::find_if(mDirectories.begin(), mDirectories.end(),
+				[event](const Directory& d) { return d.Watch == event->wd; });
+			if (directory != mDirectories.end())
+				Record(*directory, event->name);
+		}
+	}
+}
+
+#endif
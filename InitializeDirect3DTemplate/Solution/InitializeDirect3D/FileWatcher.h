@@ -0,0 +1,100 @@
+//***************************************************************************************
+// FileWatcher.h
+//
+// Reports the files that change in a set of directories: ReadDirectoryChangesW on
+// Windows, inotify elsewhere, both waited on by one background thread.  Subdirectories
+// are not watched; watch each directory that matters.
+//
+// Editors save in several writes, or write a temporary file and rename it over the
+// original, so a file is only reported once it has gone a settle time without another
+// event, and only once however many events it had.
+//
+// Paths are reported as the watched directory joined with the file name, normalized by
+// NormalizePath so they compare equal to the paths the caller registered.
+//***************************************************************************************
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class FileWatcher
+{
+public:
+
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	struct Stats
+	{
+		uint32 Directories = 0;
+		uint64 Events = 0;          // as the OS reported them
+		uint64 Changes = 0;         // files reported once they settled
+		uint64 Overflows = 0;       // events the OS dropped; their files are not reported
+	};
+
+public:
+	explicit FileWatcher(float settleSeconds = 0.2f);
+	FileWatcher(const FileWatcher& rhs) = delete;
+	FileWatcher& operator=(const FileWatcher& rhs) = delete;
+	~FileWatcher();
+
+	// Adds a directory before Start.  Returns false if it does not exist or cannot be watched.
+	bool Watch(const std::string& directory);
+
+	void Start();
+	void Stop();
+
+	// Appends the files that changed and have settled since the last call.
+	void TakeChanges(std::vector<std::string>& out);
+
+	Stats GetStats()const;
+
+	///<summary>
+	/// Forward slashes, no "./" segments, and lower case on Windows where paths do not
+	/// tell case apart.
+	///</summary>
+	static std::string NormalizePath(const std::string& path);
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Directory
+	{
+		std::string Path;           // normalized, with a trailing slash
+#if defined(_WIN32)
+		void* Handle = nullptr;
+		void* Event = nullptr;
+		void* Overlapped = nullptr;             // an OVERLAPPED, allocated by Watch
+		std::vector<std::uint32_t> Buffer;      // FILE_NOTIFY_INFORMATION records
+#else
+		int Watch = -1;
+#endif
+	};
+
+	void Run();
+	void Record(const Directory& directory, const std::string& name);
+
+private:
+	float mSettleSeconds;
+	std::vector<Directory> mDirectories;
+
+	mutable std::mutex mMutex;
+	std::unordered_map<std::string, Clock::time_point> mPending;   // file -> its last event
+	std::thread mThread;
+	bool mRunning = false;
+
+#if defined(_WIN32)
+	void* mStopEvent = nullptr;
+#else
+	int mInotify = -1;
+	int mStopPipe[2] = { -1, -1 };
+#endif
+
+	Stats mStats;
+};
@@ -0,0 +1,333 @@
+//***************************************************************************************
+// FoliageScatter.cpp
+//***************************************************************************************
+
+#include "FoliageScatter.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using uint32 = FoliageScatter::uint32;
+
+namespace
+{
+	// xorshift32; small, fast and plenty for placement.
+	class Random
+	{
+	public:
+		explicit Random(uint32 seed) : mState(seed * 0x9E3779B9u + 0x6D2B79F5u)
+		{
+			if (mState == 0)
+				mState = 1;
+		}
+
+		uint32 Next()
+		{
+			mState ^= mState << 13;
+			mState ^= mState >> 17;
+			mState ^= mState << 5;
+			return mState;
+		}
+
+		// Uniform in [0, 1).
+		float Float()
+		{
+			return (Next() >> 8) * (1.0f / 16777216.0f);
+		}
+
+		float Range(float lo, float hi)
+		{
+			return lo + (hi - lo) * Float();
+		}
+
+	private:
+		uint32 mState;
+	};
+}
+
+FoliageScatter::DensityMask::DensityMask(const Rect& area, float cellSize, float value)
+	: mArea(area), mCellSize(cellSize)
+{
+	mWidth = (uint32)std::max(1.0f, std::ceil((area.MaxX - area.MinX) / cellSize));
+	mHeight = (uint32)std::max(1.0f, std::ceil((area.MaxZ - area.MinZ) / cellSize));
+	mCells.assign((size_t)mWidth * mHeight, value);
+}
+
+void FoliageScatter::DensityMask::FillRect(const Rect& r, float value)
+{
+	for (uint32 y = 0; y < mHeight; ++y)
+	{
+		float z = mArea.MinZ + (y + 0.5f) * mCellSize;
+		if (z < r.MinZ || z > r.MaxZ)
+			continue;
+
+		for (uint32 x = 0; x < mWidth; ++x)
+		{
+			float px = mArea.MinX + (x + 0.5f) * mCellSize;
+			if (px >= r.MinX && px <= r.MaxX)
+				mCells[(size_t)y * mWidth + x] = value;
+		}
+	}
+}
+
+void FoliageScatter::DensityMask::FillSegment(float x0, float z0, float x1, float z1, float radius, float value)
+{
+	float dx = x1 - x0, dz = z1 - z0;
+	float lengthSq = dx * dx + dz * dz;
+
+	// Only visit the cells under the segment's bounding box.
+	int minX = (int)std::floor((std::min(x0, x1) - radius - mArea.MinX) / mCellSize);
+	int maxX = (int)std::floor((std::max(x0, x1) + radius - mArea.MinX) / mCellSize);
+	int minY = (int)std::floor((std::min(z0, z1) - radius - mArea.MinZ) / mCellSize);
+	int maxY = (int)std::floor((std::max(z0, z1) + radius - mArea.MinZ) / mCellSize);
+	minX = std::max(minX, 0);
+	minY = std::max(minY, 0);
+	maxX = std::min(maxX, (int)mWidth - 1);
+	maxY = std::min(maxY, (int)mHeight - 1);
+
+	for (int y = minY; y <= maxY; ++y)
+	{
+		for (int x = minX; x <= maxX; ++x)
+		{
+			float px = mArea.MinX + (x + 0.5f) * mCellSize;
+			float pz = mArea.MinZ + (y + 0.5f) * mCellSize;
+
+			float t = lengthSq > 0.0f ? ((px - x0) * dx + (pz - z0) * dz) / lengthSq : 0.0f;
+			t = std::min(std::max(t, 0.0f), 1.0f);
+			float ex = px - (x0 + t * dx), ez = pz - (z0 + t * dz);
+			if (ex * ex + ez * ez <= radius * radius)
+				mCells[(size_t)y * mWidth + x] = value;
+		}
+	}
+}
+
+float FoliageScatter::DensityMask::Sample(float x, float z)const
+{
+	if (x < mArea.MinX || z < mArea.MinZ || x >= mArea.MaxX || z >= mArea.MaxZ)
+		return 0.0f;
+
+	uint32 cx = std::min((uint32)((x - mArea.MinX) / mCellSize), mWidth - 1);
+	uint32 cy = std::min((uint32)((z - mArea.MinZ) / mCellSize), mHeight - 1);
+	return mCells[(size_t)cy * mWidth + cx];
+}
+
+void FoliageScatter::PoissonDisk(const Rect& area, float minDistance, uint32 seed, std::vector<float>& points,
+	uint32 attempts)
+{
+	float width = area.MaxX - area.MinX;
+	float height = area.MaxZ - area.MinZ;
+	if (width <= 0.0f || height <= 0.0f || minDistance <= 0.0f)
+		return;
+
+	// A cell of r / sqrt(2) holds at most one point, so the grid can store that point
+	// in place and a candidate only has to look at the 5x5 cells around it.  Empty cells
+	// hold a point far outside the area.
+	const float cellSize = minDistance / sqrtf(2.0f);
+	const float invCellSize = 1.0f / cellSize;
+	const int gridWidth = (int)std::ceil(width * invCellSize);
+	const int gridHeight = (int)std::ceil(height * invCellSize);
+	const float minDistanceSq = minDistance * minDistance;
+
+	const float far = 1e18f;
+	std::vector<float> grid(2 * (size_t)gridWidth * gridHeight, far);
+	std::vector<uint32> active;
+
+	Random random(seed);
+	size_t base = points.size() / 2;
+
+	auto add = [&](float x, float z)
+	{
+		int cx = std::min((int)((x - area.MinX) * invCellSize), gridWidth - 1);
+		int cy = std::min((int)((z - area.MinZ) * invCellSize), gridHeight - 1);
+		size_t cell = 2 * ((size_t)cy * gridWidth + cx);
+		grid[cell] = x;
+		grid[cell + 1] = z;
+		active.push_back((uint32)(points.size() / 2 - base));
+		points.push_back(x);
+		points.push_back(z);
+	};
+
+	auto fits = [&](float x, float z)
+	{
+		int cx = (int)((x - area.MinX) * invCellSize);
+		int cy = (int)((z - area.MinZ) * invCellSize);
+		int x0 = std::max(cx - 2, 0), x1 = std::min(cx + 2, gridWidth - 1);
+		for (int y = std::max(cy - 2, 0); y <= std::min(cy + 2, gridHeight - 1); ++y)
+		{
+			const float* row = &grid[2 * (size_t)y * gridWidth];
+			for (int gx = x0; gx <= x1; ++gx)
+			{
+				float ox = row[2 * gx] - x;
+				float oz = row[2 * gx + 1] - z;
+				if (ox * ox + oz * oz < minDistanceSq)
+					return false;
+			}
+		}
+		return true;
+	};
+
+	add(random.Range(area.MinX, area.MaxX), random.Range(area.MinZ, area.MaxZ));
+
+	// Candidates go just outside the minimum distance at evenly spaced angles from a
+	// random start, stepped by a fixed rotation: no trigonometry per candidate and a
+	// denser packing than uniform samples over the whole annulus.
+	const float step = 6.28318530718f / attempts;
+	const float stepCos = cosf(step), stepSin = sinf(step);
+	const float radius = minDistance * 1.0001f;
+
+	while (!active.empty())
+	{
+		uint32 slot = random.Next() % (uint32)active.size();
+		size_t p = 2 * (base + active[slot]);
+		float px = points[p], pz = points[p + 1];
+
+		float angle = random.Float() * 6.28318530718f;
+		float dirX = cosf(angle), dirZ = sinf(angle);
+
+		bool placed = false;
+		for (uint32 k = 0; k < attempts; ++k)
+		{
+			float x = px + radius * dirX;
+			float z = pz + radius * dirZ;
+
+			float nextX = dirX * stepCos - dirZ * stepSin;
+			dirZ = dirX * stepSin + dirZ * stepCos;
+			dirX = nextX;
+
+			if (x < area.MinX || z < area.MinZ || x >= area.MaxX || z >= area.MaxZ)
+				continue;
+
+			if (fits(x, z))
+			{
+				add(x, z);
+				placed = true;
+				break;
+			}
+		}
+
+		if (!placed)
+		{
+			active[slot] = active.back();
+			active.pop_back();
+		}
+	}
+}
+
+void FoliageScatter::Scatter(const Layer& layer)
+{
+	if (layer.Mask == nullptr)
+		return;
+
+	std::vector<float> points;
+	PoissonDisk(layer.Mask->Area(), layer.MinDistance, layer.Seed, points);
+
+	// A second stream so the sizes do not depend on how many samples were tried.
+	Random random(layer.Seed ^ 0xA511E9B3u);
+
+	size_t count = points.size() / 2;
+	mStats.Candidates += (uint32)count;
+	for (size_t i = 0; i < count; ++i)
+	{
+		float x = points[2 * i], z = points[2 * i + 1];
+		float density = layer.Mask->Sample(x, z);
+		float keep = random.Float();
+		float width = random.Range(layer.MinWidth, layer.MaxWidth);
+		float height = random.Range(layer.MinHeight, layer.MaxHeight);
+		if (keep >= density)
+			continue;
+
+		Instance instance;
+		instance.Position[0] = x;
+		instance.Position[1] = layer.GroundY + 0.5f * height;
+		instance.Position[2] = z;
+		instance.Size[0] = width;
+		instance.Size[1] = height;
+		mInstances.push_back(instance);
+	}
+
+	mStats.Instances = (uint32)mInstances.size();
+	mChunks.clear();
+	mStats.Chunks = 0;
+	mStats.MaxPerChunk = 0;
+}
+
+void FoliageScatter::BuildChunks(float chunkSize)
+{
+	mChunks.clear();
+	mStats.Chunks = 0;
+	mStats.MaxPerChunk = 0;
+	if (mInstances.empty())
+		return;
+
+	float minX = FLT_MAX, minZ = FLT_MAX, maxX = -FLT_MAX, maxZ = -FLT_MAX;
+	for (const Instance& instance : mInstances)
+	{
+		minX = std::min(minX, instance.Position[0]);
+		minZ = std::min(minZ, instance.Position[2]);
+		maxX = std::max(maxX, instance.Position[0]);
+		maxZ = std::max(maxZ, instance.Position[2]);
+	}
+
+	uint32 columns = (uint32)((maxX - minX) / chunkSize) + 1;
+	uint32 rows = (uint32)((maxZ - minZ) / chunkSize) + 1;
+
+	auto chunkOf = [&](const Instance& instance)
+	{
+		uint32 cx = std::min((uint32)((instance.Position[0] - minX) / chunkSize), columns - 1);
+		uint32 cy = std::min((uint32)((instance.Position[2] - minZ) / chunkSize), rows - 1);
+		return cy * columns + cx;
+	};
+
+	// Counting sort by chunk keeps the order inside each chunk stable.
+	std::vector<uint32> starts((size_t)columns * rows + 1, 0);
+	for (const Instance& instance : mInstances)
+		starts[chunkOf(instance) + 1]++;
+	for (size_t c = 1; c < starts.size(); ++c)
+		starts[c] += starts[c - 1];
+
+	std::vector<Instance> sorted(mInstances.size());
+	std::vector<uint32> cursor(starts.begin(), starts.end() - 1);
+	for (const Instance& instance : mInstances)
+		sorted[cursor[chunkOf(instance)]++] = instance;
+	mInstances.swap(sorted);
+
+	for (size_t c = 0; c + 1 < starts.size(); ++c)
+	{
+		uint32 first = starts[c], count = starts[c + 1] - starts[c];
+		if (count == 0)
+			continue;
+
+		Chunk chunk;
+		chunk.FirstInstance = first;
+		chunk.InstanceCount = count;
+		for (int a = 0; a < 3; ++a)
+		{
+			chunk.Min[a] = FLT_MAX;
+			chunk.Max[a] = -FLT_MAX;
+		}
+
+		// Sprites face the camera, so half their width bounds them in both X and Z.
+		for (uint32 i = first; i < first + count; ++i)
+		{
+			const Instance& instance = mInstances[i];
+			float extents[3] = { 0.5f * instance.Size[0], 0.5f * instance.Size[1], 0.5f * instance.Size[0] };
+			for (int a = 0; a < 3; ++a)
+			{
+				chunk.Min[a] = std::min(chunk.Min[a], instance.Position[a] - extents[a]);
+				chunk.Max[a] = std::max(chunk.Max[a], instance.Position[a] + extents[a]);
+			}
+		}
+
+		mChunks.push_back(chunk);
+		mStats.MaxPerChunk = std::max(mStats.MaxPerChunk, count);
+	}
+
+	mStats.Chunks = (uint32)mChunks.size();
+}
+
+void FoliageScatter::Clear()
+{
+	mInstances.clear();
+	mChunks.clear();
+	mStats = Stats();
+}
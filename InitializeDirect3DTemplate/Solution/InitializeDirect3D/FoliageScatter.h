@@ -0,0 +1,130 @@
+//***************************************************************************************
+// FoliageScatter.h
+//
+// Distributes foliage sprites over the XZ plane and groups them into spatial chunks.
+//
+//   - Positions come from Bridson's Poisson-disk sampling, so no two instances of a
+//     layer are closer than its minimum distance and there are no visible clumps.
+//   - A density mask thins the samples: a sample survives with the probability stored
+//     in the mask under it, so a mask painted with 0 over walls and water keeps them
+//     clear.
+//   - Instances are sorted by chunk.  Every chunk is a contiguous range of the instance
+//     array with its own bounds, so the foliage can be culled (and later streamed) a
+//     chunk at a time.
+//
+// The result is deterministic for a given seed.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class FoliageScatter
+{
+public:
+	using uint32 = std::uint32_t;
+
+	struct Rect
+	{
+		float MinX = 0.0f;
+		float MinZ = 0.0f;
+		float MaxX = 0.0f;
+		float MaxZ = 0.0f;
+	};
+
+	// Density in [0, 1] over a rectangle, stored in square cells.  Outside it is 0.
+	class DensityMask
+	{
+	public:
+		DensityMask(const Rect& area, float cellSize, float value = 0.0f);
+
+		// Sets every cell whose centre lies inside r.
+		void FillRect(const Rect& r, float value);
+
+		// Sets every cell whose centre is within radius of the segment.
+		void FillSegment(float x0, float z0, float x1, float z1, float radius, float value);
+
+		float Sample(float x, float z)const;
+
+		const Rect& Area()const { return mArea; }
+
+	private:
+		Rect mArea;
+		float mCellSize = 1.0f;
+		uint32 mWidth = 0;
+		uint32 mHeight = 0;
+		std::vector<float> mCells;
+	};
+
+	struct Layer
+	{
+		float MinDistance = 4.0f;
+
+		float MinWidth = 4.0f;
+		float MaxWidth = 8.0f;
+		float MinHeight = 7.0f;
+		float MaxHeight = 12.0f;
+
+		// Instances stand on this height; their position is the centre of the sprite.
+		float GroundY = 0.0f;
+
+		uint32 Seed = 1;
+		const DensityMask* Mask = nullptr;
+	};
+
+	// Matches the tree sprite vertex: centre position and billboard size.
+	struct Instance
+	{
+		float Position[3];
+		float Size[2];
+	};
+
+	struct Chunk
+	{
+		float Min[3];
+		float Max[3];
+		uint32 FirstInstance = 0;
+		uint32 InstanceCount = 0;
+	};
+
+	struct Stats
+	{
+		uint32 Candidates = 0;      // Poisson-disk samples before the density test
+		uint32 Instances = 0;
+		uint32 Chunks = 0;
+		uint32 MaxPerChunk = 0;
+	};
+
+public:
+	FoliageScatter() = default;
+	FoliageScatter(const FoliageScatter& rhs) = delete;
+	FoliageScatter& operator=(const FoliageScatter& rhs) = delete;
+
+	///<summary>
+	/// Bridson's algorithm: appends to points (x, z pairs) a maximal set of points in area
+	/// with no two closer than minDistance.  Each active point tries attempts candidates
+	/// around itself before it is retired.
+	///</summary>
+	static void PoissonDisk(const Rect& area, float minDistance, uint32 seed, std::vector<float>& points,
+		uint32 attempts = 30);
+
+	// Scatters one layer over its mask's area and adds the instances.  Invalidates the
+	// chunks until BuildChunks is called again.
+	void Scatter(const Layer& layer);
+
+	// Sorts the instances into square chunks of chunkSize and computes their bounds.
+	// Empty chunks are dropped.
+	void BuildChunks(float chunkSize);
+
+	void Clear();
+
+	const std::vector<Instance>& Instances()const { return mInstances; }
+	const std::vector<Chunk>& Chunks()const { return mChunks; }
+	const Stats& GetStats()const { return mStats; }
+
+private:
+	std::vector<Instance> mInstances;
+	std::vector<Chunk> mChunks;
+	Stats mStats;
+};
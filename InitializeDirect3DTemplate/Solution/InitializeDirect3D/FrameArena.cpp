@@ -0,0 +1,254 @@
+//***************************************************************************************
+// FrameArena.cpp
+//***************************************************************************************
+
+#include "FrameArena.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+using uint32 = FrameArena::uint32;
+using uint64 = FrameArena::uint64;
+
+#if defined(FRAME_ARENA_COUNT_ALLOCATIONS)
+
+namespace
+{
+	std::atomic<uint64> gHeapAllocations(0);
+}
+
+// The array and nothrow forms call these by default.
+void* operator new(std::size_t size)
+{
+	++gHeapAllocations;
+	if (void* p = std::malloc(size > 0 ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+// Types aligned past max_align_t come through these instead.
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	++gHeapAllocations;
+	std::size_t align = (std::size_t)alignment;
+#if defined(_WIN32)
+	if (void* p = _aligned_malloc(size > 0 ? size : 1, align))
+		return p;
+#else
+	if (void* p = std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align))
+		return p;
+#endif
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+#if defined(_WIN32)
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+	operator delete(p, alignment);
+}
+
+uint64 FrameArena::HeapAllocationCount()
+{
+	return gHeapAllocations.load();
+}
+
+#else
+
+uint64 FrameArena::HeapAllocationCount()
+{
+	return 0;
+}
+
+#endif
+
+FrameArena::FrameArena(std::size_t blockSize)
+	: mBlockSize(std::max<std::size_t>(blockSize, 1024))
+{
+}
+
+void FrameArena::AddBlock(std::size_t minimumSize)
+{
+	Block block;
+	block.Size = std::max(mBlockSize, minimumSize);
+	block.Data.reset(new unsigned char[block.Size]);
+	block.Memory = TrackedMemory(MemoryTag::FrameResources, block.Size);
+	mBlocks.push_back(std::move(block));
+
+	mStats.Capacity += mBlocks.back().Size;
+	mStats.Blocks = (uint32)mBlocks.size();
+	mStats.BlockAllocations++;
+}
+
+void* FrameArena::Allocate(std::size_t bytes, std::size_t alignment)
+{
+	if (bytes == 0)
+		bytes = 1;
+
+	// Blocks left over from before the last reset are reused before new ones are added.
+	for (;;)
+	{
+		if (mCurrent < mBlocks.size())
+		{
+			Block& block = mBlocks[mCurrent];
+			std::uintptr_t base = (std::uintptr_t)block.Data.get();
+			std::uintptr_t aligned = (base + mOffset + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+			std::size_t end = (std::size_t)(aligned - base) + bytes;
+			if (end <= block.Size)
+			{
+				mStats.Used += end - mOffset;
+				mStats.Peak = std::max(mStats.Peak, mStats.Used);
+				mOffset = end;
+				return (void*)aligned;
+			}
+
+			if (mCurrent + 1 < mBlocks.size())
+			{
+				++mCurrent;
+				mOffset = 0;
+				continue;
+			}
+		}
+
+		AddBlock(bytes + alignment);
+		mCurrent = mBlocks.size() - 1;
+		mOffset = 0;
+	}
+}
+
+void FrameArena::Reset()
+{
+	// A frame that spilled into several blocks gets them as one, so the next frame like
+	// it fits without touching the heap.
+	if (mBlocks.size() > 1)
+	{
+		std::size_t total = 0;
+		for (const Block& block : mBlocks)
+			total += block.Size;
+
+		mBlocks.clear();
+		mStats.Capacity = 0;
+		AddBlock(total);
+	}
+
+	mCurrent = 0;
+	mOffset = 0;
+	mStats.Used = 0;
+}
+
+FrameArenaSet::FrameArenaSet(std::size_t blockSize)
+	: mBlockSize(blockSize)
+{
+}
+
+namespace
+{
+	// Hands a slot to each thread and takes it back when the thread exits.  Worker pools
+	// come and go (the init graph, hot reload), so slots that were never returned would
+	// run out.
+	class SlotOwner
+	{
+	public:
+		SlotOwner()
+		{
+			std::lock_guard<std::mutex> lock(Mutex());
+			auto& freeSlots = FreeSlots();
+			if (!freeSlots.empty())
+			{
+				mSlot = freeSlots.back();
+				freeSlots.pop_back();
+			}
+			else if (NextSlot() < FrameArenaSet::MaxThreads)
+			{
+				mSlot = NextSlot()++;
+			}
+		}
+
+		~SlotOwner()
+		{
+			if (mSlot >= FrameArenaSet::MaxThreads)
+				return;
+
+			std::lock_guard<std::mutex> lock(Mutex());
+			FreeSlots().push_back(mSlot);
+		}
+
+		uint32 Slot()const { return mSlot; }
+
+	private:
+		// Function statics, so they exist before the first thread_local owner is made and
+		// after the last one is destroyed.
+		static std::mutex& Mutex() { static std::mutex m; return m; }
+		static std::vector<uint32>& FreeSlots() { static std::vector<uint32> v; return v; }
+		static uint32& NextSlot() { static uint32 n = 0; return n; }
+
+		uint32 mSlot = FrameArenaSet::MaxThreads;
+	};
+}
+
+uint32 FrameArenaSet::ThreadSlot()
+{
+	// Slots are shared by every set: a thread has the same slot in each frame's set.
+	thread_local SlotOwner owner;
+	return owner.Slot();
+}
+
+FrameArena* FrameArenaSet::Local()
+{
+	uint32 slot = ThreadSlot();
+	if (slot >= MaxThreads)
+		return nullptr;
+
+	// Only the owning thread ever creates its slot's arena.
+	if (!mArenas[slot])
+		mArenas[slot] = std::make_unique<FrameArena>(mBlockSize);
+	return mArenas[slot].get();
+}
+
+void FrameArenaSet::Reset()
+{
+	for (auto& arena : mArenas)
+	{
+		if (arena)
+			arena->Reset();
+	}
+}
+
+FrameArena::Stats FrameArenaSet::GetStats()const
+{
+	FrameArena::Stats total;
+	for (const auto& arena : mArenas)
+	{
+		if (!arena)
+			continue;
+
+		const FrameArena::Stats& stats = arena->GetStats();
+		total.Used += stats.Used;
+		total.Peak += stats.Peak;
+		total.Capacity += stats.Capacity;
+		total.Blocks += stats.Blocks;
+		total.BlockAllocations += stats.BlockAllocations;
+	}
+	return total;
+}
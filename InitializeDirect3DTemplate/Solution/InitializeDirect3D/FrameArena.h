@@ -0,0 +1,165 @@
+//***************************************************************************************
+// FrameArena.h
+//
+// Linear allocation for data that lives for one frame.  An arena hands out memory by
+// bumping an offset through large blocks and frees everything at once with Reset, so
+// transient lists cost no heap traffic once the arena has grown to the frame's needs:
+// after a frame that needed several blocks, Reset merges them into one.
+//
+// ArenaAllocator lets standard containers allocate from an arena (deallocation does
+// nothing; the memory comes back on Reset).  An allocator without an arena falls back
+// to the heap, so code can take an optional arena.
+//
+// FrameArenaSet gives every thread its own arena, so workers allocate without locks.
+// Each frame resource owns a set and resets it once the GPU has finished the frame that
+// last used it, which keeps the memory valid for everything recorded that frame.  The
+// blocks are charged to MemoryTag::FrameResources.
+//
+// Defining FRAME_ARENA_COUNT_ALLOCATIONS replaces the global operator new, plain and
+// aligned, with one that counts calls (see HeapAllocationCount), to check that a frame
+// does not allocate.
+//***************************************************************************************
+
+#pragma once
+
+#include "MemoryTracker.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+class FrameArena
+{
+public:
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	static const std::size_t DefaultBlockSize = 256 * 1024;
+
+	struct Stats
+	{
+		uint64 Used = 0;                // bytes handed out since the last reset
+		uint64 Peak = 0;                // most bytes used between two resets
+		uint64 Capacity = 0;
+		uint32 Blocks = 0;
+		uint32 BlockAllocations = 0;    // blocks ever taken from the heap
+	};
+
+public:
+	explicit FrameArena(std::size_t blockSize = DefaultBlockSize);
+	FrameArena(const FrameArena& rhs) = delete;
+	FrameArena& operator=(const FrameArena& rhs) = delete;
+
+	// Never fails: a request that does not fit gets a new block.
+	void* Allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t));
+
+	template<typename T>
+	T* AllocateArray(std::size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+		return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+	}
+
+	// Frees everything allocated since the last reset.
+	void Reset();
+
+	const Stats& GetStats()const { return mStats; }
+
+	// Calls to the global operator new so far; 0 unless FRAME_ARENA_COUNT_ALLOCATIONS is
+	// defined.
+	static uint64 HeapAllocationCount();
+
+private:
+	struct Block
+	{
+		std::unique_ptr<unsigned char[]> Data;
+		std::size_t Size = 0;
+		TrackedMemory Memory;
+	};
+
+	void AddBlock(std::size_t minimumSize);
+
+	std::size_t mBlockSize;
+	std::vector<Block> mBlocks;
+	std::size_t mCurrent = 0;
+	std::size_t mOffset = 0;
+	Stats mStats;
+};
+
+template<typename T>
+class ArenaAllocator
+{
+public:
+	using value_type = T;
+
+	// Containers that move or swap take the arena along with the memory.
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+
+	ArenaAllocator() = default;
+	explicit ArenaAllocator(FrameArena* arena) : mArena(arena) {}
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& rhs) : mArena(rhs.Arena()) {}
+
+	T* allocate(std::size_t n)
+	{
+		if (mArena == nullptr)
+			return static_cast<T*>(::operator new(n * sizeof(T)));
+		return static_cast<T*>(mArena->Allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T* p, std::size_t)
+	{
+		if (mArena == nullptr)
+			::operator delete(p);
+	}
+
+	FrameArena* Arena()const { return mArena; }
+
+private:
+	FrameArena* mArena = nullptr;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.Arena() == b.Arena(); }
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.Arena() != b.Arena(); }
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+class FrameArenaSet
+{
+public:
+	using uint32 = FrameArena::uint32;
+
+	static const uint32 MaxThreads = 64;
+
+public:
+	explicit FrameArenaSet(std::size_t blockSize = FrameArena::DefaultBlockSize);
+	FrameArenaSet(const FrameArenaSet& rhs) = delete;
+	FrameArenaSet& operator=(const FrameArenaSet& rhs) = delete;
+
+	///<summary>
+	/// The calling thread's arena, created the first time the thread asks.  A thread that
+	/// exits leaves its slot to the next new thread; while more than MaxThreads threads
+	/// hold one, the rest get nullptr, which ArenaAllocator turns into heap allocations.
+	///</summary>
+	FrameArena* Local();
+
+	// Resets every thread's arena.  No thread may be allocating from the set.
+	void Reset();
+
+	// Sums over the threads' arenas.
+	FrameArena::Stats GetStats()const;
+
+private:
+	static uint32 ThreadSlot();
+
+	std::size_t mBlockSize;
+	std::unique_ptr<FrameArena> mArenas[MaxThreads];
+};
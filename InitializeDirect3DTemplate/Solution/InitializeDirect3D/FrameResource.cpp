@@ -27,4 +27,27 @@ FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCo
 FrameResource::~FrameResource()
 {
 
+}
+
+void FrameResource::TrackMemory()
+{
+    UINT64 bytes = 0;
+    auto add = [&bytes](ID3D12Resource* resource)
+    {
+        if (resource != nullptr)
+            bytes += resource->GetDesc().Width;
+    };
+
+    add(PassCB ? PassCB->Resource() : nullptr);
+    add(MaterialCB ? MaterialCB->Resource() : nullptr);
+    add(ObjectCB ? ObjectCB->Resource() : nullptr);
+    add(WavesVB ? WavesVB->Resource() : nullptr);
+    add(SceneLights ? SceneLights->Resource() : nullptr);
+    add(ClusterRanges ? ClusterRanges->Resource() : nullptr);
+    add(ClusterLightIndices ? ClusterLightIndices->Resource() : nullptr);
+    add(TreeQuadVB ? TreeQuadVB->Resource() : nullptr);
+    add(GroundPages ? GroundPages->Resource() : nullptr);
+    add(GroundPageTable ? GroundPageTable->Resource() : nullptr);
+
+    Memory = TrackedMemory(MemoryTag::FrameResources, bytes);
 }
\ No newline at end of file
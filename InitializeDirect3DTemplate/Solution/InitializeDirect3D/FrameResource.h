@@ -3,11 +3,35 @@
 #include "../../Common/d3dUtil.h"
 #include "../../Common/MathHelper.h"
 #include "../../Common/UploadBuffer.h"
+#include "BillboardExpander.h"
+#include "ClusteredLights.h"
+#include "FrameArena.h"
 
 struct ObjectConstants
 {
     DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
     DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+
+    // The (up to) four scene lights that affect this object most, as indices into the
+    // scene light buffer.
+    DirectX::XMUINT4 LightIndices = { 0, 0, 0, 0 };
+    UINT LightCount = 0;
+
+    // The baked lighting offset is set per draw (see DrawConstants), since each level of
+    // detail of an object has samples of its own.
+    DirectX::XMFLOAT3 ObjectPad = { 0.0f, 0.0f, 0.0f };
+};
+
+// Root constants of one draw (cbPerDraw in Default.hlsl).
+struct DrawConstants
+{
+    // First baked lighting sample of the drawn mesh; its vertex i uses sample offset + i.
+    // ~0u for meshes without baked lighting.
+    UINT BakedLightingOffset = ~0u;
+
+    // Dithered level of detail fade: > 0 for the level fading in, < 0 for the one fading
+    // out, 0 when not fading.
+    float LodFade = 0.0f;
 };
 
 struct PassConstants
@@ -30,6 +54,28 @@ struct PassConstants
     DirectX::XMFLOAT4 AmbientLight = { 0.0f, 0.0f, 0.0f, 1.0f };
 
     Light Lights[MaxLights];
+
+    // Clustered point and spot lights: tiles across, tiles down and depth slices, and the
+    // slice of a view depth z is log(z) * ClusterDepthScale + ClusterDepthBias.
+    DirectX::XMUINT3 ClusterDims = { 0, 0, 0 };
+    float ClusterDepthScale = 0.0f;
+    float ClusterDepthBias = 0.0f;
+
+    // Baked irradiance samples store their colour divided by this.
+    float BakedIrradianceScale = 0.0f;
+
+    // Mip of the prefiltered specular environment for roughness 1.
+    float SpecularEnvMaxMip = 0.0f;
+    float ClusterPad = 0.0f;
+
+    // L2 spherical harmonics of the environment's irradiance (rgb, w unused); see
+    // EnvironmentLighting.
+    DirectX::XMFLOAT4 AmbientSH[9] = {};
+
+    // Ground virtual texture: the plane it covers (min x, min z, 1 / size, mip count) and
+    // its pages (pages across mip 0, page size, border, page size with borders).
+    DirectX::XMFLOAT4 GroundVirtualPlane = { 0.0f, 0.0f, 0.0f, 0.0f };
+    DirectX::XMFLOAT4 GroundVirtualPages = { 0.0f, 0.0f, 0.0f, 0.0f };
 };
 
 struct Vertex
@@ -55,10 +101,36 @@ public:
     ~FrameResource();
 
     Microsoft::WRL::ComPtr<ID3D12CommandAllocator> CmdListAlloc;
+
+    // One per command stream chunk replayed in parallel; created on first use.
+    std::vector<Microsoft::WRL::ComPtr<ID3D12CommandAllocator>> WorkerCmdListAllocs;
     std::unique_ptr<UploadBuffer<PassConstants>> PassCB = nullptr;
     std::unique_ptr<UploadBuffer<MaterialConstants>> MaterialCB = nullptr;
     std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectCB = nullptr;
     std::unique_ptr<UploadBuffer<Vertex>> WavesVB = nullptr;
 
+    // Point and spot lights of the scene, the per-cluster ranges and the light index list
+    // they point into.
+    std::unique_ptr<UploadBuffer<Light>> SceneLights = nullptr;
+    std::unique_ptr<UploadBuffer<ClusteredLights::ClusterRange>> ClusterRanges = nullptr;
+    std::unique_ptr<UploadBuffer<std::uint32_t>> ClusterLightIndices = nullptr;
+
+    // Tree sprites expanded on the CPU, when that path is selected.
+    std::unique_ptr<UploadBuffer<BillboardExpander::QuadVertex>> TreeQuadVB = nullptr;
+
+    // Ground virtual texture pages read this frame, one placed copy footprint each.
+    std::unique_ptr<UploadBuffer<std::uint8_t>> GroundPages = nullptr;
+
+    // Every mip of the ground page table, when it changed this frame.
+    std::unique_ptr<UploadBuffer<std::uint8_t>> GroundPageTable = nullptr;
+
+    // Transient CPU memory of the frame, one arena per thread.  Reset once Fence has
+    // been reached, like CmdListAlloc.
+    FrameArenaSet Arenas;
+
+    // The upload buffers above, charged to MemoryTag::FrameResources by TrackMemory.
+    TrackedMemory Memory;
+    void TrackMemory();
+
     UINT64 Fence = 0;
 };
\ No newline at end of file
@@ -0,0 +1,44 @@
+//***************************************************************************************
+// Hash.h
+//
+// 64-bit FNV-1a hashing for cache keys.  Hashes can be chained by passing the previous
+// result as the seed, so a key can be built up field by field.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Hash
+{
+	const std::uint64_t Fnv1aOffset = 14695981039346656037ull;
+	const std::uint64_t Fnv1aPrime = 1099511628211ull;
+
+	inline std::uint64_t Fnv1a(const void* data, std::size_t size, std::uint64_t seed = Fnv1aOffset)
+	{
+		const std::uint8_t* bytes = (const std::uint8_t*)data;
+
+		std::uint64_t h = seed;
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			h ^= bytes[i];
+			h *= Fnv1aPrime;
+		}
+		return h;
+	}
+
+	// Strings are hashed with their length so that ("ab", "c") and ("a", "bc") differ.
+	inline std::uint64_t Fnv1a(const std::string& s, std::uint64_t seed = Fnv1aOffset)
+	{
+		std::uint64_t length = s.size();
+		return Fnv1a(s.data(), s.size(), Fnv1a(&length, sizeof(length), seed));
+	}
+
+	template<typename T>
+	inline std::uint64_t Fnv1aValue(const T& value, std::uint64_t seed = Fnv1aOffset)
+	{
+		return Fnv1a(&value, sizeof(T), seed);
+	}
+}
@@ -0,0 +1,227 @@
+//***************************************************************************************
+// InitGraph.cpp
+//***************************************************************************************
+
+#include "InitGraph.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <mutex>
+#include <set>
+#include <thread>
+
+using uint32 = InitGraph::uint32;
+using TaskId = InitGraph::TaskId;
+
+TaskId InitGraph::Add(const std::string& name, std::function<void()> fn, std::initializer_list<TaskId> dependencies,
+	uint32 exclusiveGroup)
+{
+	Task task;
+	task.Name = name;
+	task.Fn = std::move(fn);
+	task.Dependencies.assign(dependencies.begin(), dependencies.end());
+	task.Group = exclusiveGroup;
+
+	for (TaskId dependency : task.Dependencies)
+	{
+		(void)dependency;
+		assert(dependency < mTasks.size());
+	}
+
+	mTasks.push_back(std::move(task));
+	return (TaskId)mTasks.size() - 1;
+}
+
+void InitGraph::Run(uint32 threadCount)
+{
+	using Clock = std::chrono::steady_clock;
+
+	const size_t count = mTasks.size();
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	threadCount = std::max(1u, std::min(threadCount, (uint32)count));
+
+	std::vector<uint32> pending(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		pending[i] = (uint32)mTasks[i].Dependencies.size();
+		mTasks[i].Timing = TaskTiming();
+	}
+
+	std::vector<std::vector<TaskId>> dependents(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		for (TaskId dependency : mTasks[i].Dependencies)
+			dependents[dependency].push_back((TaskId)i);
+	}
+
+	// Ready tasks are started in the order they were added.
+	std::set<TaskId> ready;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (pending[i] == 0)
+			ready.insert((TaskId)i);
+	}
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::set<uint32> busyGroups;
+	size_t finished = 0;
+	uint32 running = 0;
+	std::exception_ptr error;
+
+	const Clock::time_point start = Clock::now();
+	auto seconds = [&]() { return std::chrono::duration<double>(Clock::now() - start).count(); };
+
+	auto worker = [&](uint32 thread)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;)
+		{
+			// Stop when everything ran, or when a task failed and nothing is left running.
+			if (finished == count || (error && running == 0))
+				break;
+
+			auto next = ready.end();
+			if (!error)
+			{
+				next = std::find_if(ready.begin(), ready.end(),
+					[&](TaskId id) { return mTasks[id].Group == NoGroup || busyGroups.count(mTasks[id].Group) == 0; });
+			}
+
+			if (next == ready.end())
+			{
+				wake.wait(lock);
+				continue;
+			}
+
+			TaskId id = *next;
+			ready.erase(next);
+			Task& task = mTasks[id];
+			if (task.Group != NoGroup)
+				busyGroups.insert(task.Group);
+			++running;
+
+			task.Timing.Thread = thread;
+			task.Timing.Start = seconds();
+			lock.unlock();
+
+			std::exception_ptr taskError;
+			try
+			{
+				task.Fn();
+			}
+			catch (...)
+			{
+				taskError = std::current_exception();
+			}
+
+			lock.lock();
+			task.Timing.End = seconds();
+			task.Timing.Ran = true;
+			if (task.Group != NoGroup)
+				busyGroups.erase(task.Group);
+			--running;
+			++finished;
+
+			if (taskError && !error)
+				error = taskError;
+
+			for (TaskId dependent : dependents[id])
+			{
+				if (--pending[dependent] == 0)
+					ready.insert(dependent);
+			}
+
+			wake.notify_all();
+		}
+
+		wake.notify_all();
+	};
+
+	std::vector<std::thread> threads;
+	for (uint32 t = 1; t < threadCount; ++t)
+		threads.emplace_back(worker, t);
+	worker(0);
+	for (auto& t : threads)
+		t.join();
+
+	mStats = Stats();
+	mStats.Tasks = (uint32)count;
+	mStats.Threads = threadCount;
+	mStats.WallSeconds = seconds();
+
+	// The longest chain by the measured times; dependencies always come first.
+	std::vector<double> chainEnd(count, 0.0);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const TaskTiming& timing = mTasks[i].Timing;
+		double duration = timing.Ran ? timing.End - timing.Start : 0.0;
+
+		double chainStart = 0.0;
+		for (TaskId dependency : mTasks[i].Dependencies)
+			chainStart = std::max(chainStart, chainEnd[dependency]);
+		chainEnd[i] = chainStart + duration;
+
+		mStats.SerialSeconds += duration;
+		mStats.CriticalPathSeconds = std::max(mStats.CriticalPathSeconds, chainEnd[i]);
+	}
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+std::string InitGraph::Timeline()const
+{
+	const int BarWidth = 40;
+
+	std::vector<TaskId> order;
+	size_t nameWidth = 0;
+	for (size_t i = 0; i < mTasks.size(); ++i)
+	{
+		order.push_back((TaskId)i);
+		nameWidth = std::max(nameWidth, mTasks[i].Name.size());
+	}
+	std::stable_sort(order.begin(), order.end(),
+		[&](TaskId a, TaskId b)
+	{
+		const TaskTiming& ta = mTasks[a].Timing;
+		const TaskTiming& tb = mTasks[b].Timing;
+		return ta.Ran != tb.Ran ? ta.Ran : ta.Start < tb.Start;
+	});
+
+	double total = mStats.WallSeconds > 0.0 ? mStats.WallSeconds : 1.0;
+
+	std::string out;
+	char line[256];
+	for (TaskId id : order)
+	{
+		const Task& task = mTasks[id];
+		if (!task.Timing.Ran)
+		{
+			std::snprintf(line, sizeof(line), "  %-*s  did not run\n", (int)nameWidth, task.Name.c_str());
+			out += line;
+			continue;
+		}
+
+		int first = (int)(task.Timing.Start / total * BarWidth);
+		int last = std::max(first + 1, (int)(task.Timing.End / total * BarWidth + 0.5));
+		std::string bar(BarWidth, '.');
+		for (int c = first; c < last && c < BarWidth; ++c)
+			bar[c] = '#';
+
+		std::snprintf(line, sizeof(line), "  %-*s  %s  %8.1f - %8.1f ms  thread %u\n", (int)nameWidth,
+			task.Name.c_str(), bar.c_str(), task.Timing.Start * 1000.0, task.Timing.End * 1000.0, task.Timing.Thread);
+		out += line;
+	}
+
+	std::snprintf(line, sizeof(line),
+		"  %u tasks on %u threads: %.1f ms wall, %.1f ms serial, %.1f ms longest chain\n",
+		mStats.Tasks, mStats.Threads, mStats.WallSeconds * 1000.0, mStats.SerialSeconds * 1000.0,
+		mStats.CriticalPathSeconds * 1000.0);
+	out += line;
+	return out;
+}
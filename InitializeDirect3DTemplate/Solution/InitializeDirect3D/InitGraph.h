@@ -0,0 +1,80 @@
+//***************************************************************************************
+// InitGraph.h
+//
+// Runs startup work as a graph of tasks on a few threads.  A task starts once every task
+// it depends on has finished; tasks that share an exclusive group (e.g. everything that
+// records into the one initialization command list) never run at the same time, but may
+// run in any order unless they also depend on each other.  Dependencies can only name
+// tasks added before, so the graph cannot have cycles.
+//
+// Every task is timed.  Timeline() prints when each ran and on which thread, along with
+// the serial time and the longest dependency chain, which is the floor for the wall time.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+class InitGraph
+{
+public:
+	using uint32 = std::uint32_t;
+	using TaskId = uint32;
+
+	static const uint32 NoGroup = 0xffffffffu;
+
+	struct TaskTiming
+	{
+		double Start = 0.0;     // seconds since Run began
+		double End = 0.0;
+		uint32 Thread = 0;      // 0 is the thread that called Run
+		bool Ran = false;
+	};
+
+	struct Stats
+	{
+		uint32 Tasks = 0;
+		uint32 Threads = 0;
+		double WallSeconds = 0.0;
+		double SerialSeconds = 0.0;         // sum of the task times
+		double CriticalPathSeconds = 0.0;   // longest chain of dependent task times
+	};
+
+public:
+	InitGraph() = default;
+	InitGraph(const InitGraph& rhs) = delete;
+	InitGraph& operator=(const InitGraph& rhs) = delete;
+
+	TaskId Add(const std::string& name, std::function<void()> fn, std::initializer_list<TaskId> dependencies = {},
+		uint32 exclusiveGroup = NoGroup);
+
+	///<summary>
+	/// Runs every task on up to threadCount threads (0 = one per core), the calling thread
+	/// included, and returns once all have finished.  If a task throws, no further tasks
+	/// start and the first exception is rethrown here after the running ones finish.
+	///</summary>
+	void Run(uint32 threadCount = 0);
+
+	const TaskTiming& GetTiming(TaskId task)const { return mTasks[task].Timing; }
+	const Stats& GetStats()const { return mStats; }
+
+	// One line per task in start order with a bar showing when it ran, then the totals.
+	std::string Timeline()const;
+
+private:
+	struct Task
+	{
+		std::string Name;
+		std::function<void()> Fn;
+		std::vector<TaskId> Dependencies;
+		uint32 Group = NoGroup;
+		TaskTiming Timing;
+	};
+
+	std::vector<Task> mTasks;
+	Stats mStats;
+};
@@ -0,0 +1,183 @@
+//***************************************************************************************
+// KeyedBlobFile.cpp
+//***************************************************************************************
+
+#include "KeyedBlobFile.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+namespace
+{
+	// Renames from to to, replacing to if it exists.
+	bool MoveOver(const std::string& from, const std::string& to)
+	{
+#if defined(_WIN32)
+		return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+	}
+}
+
+KeyedBlobFile::KeyedBlobFile(uint32 magic, uint32 version) :
+	mMagic(magic),
+	mVersion(version)
+{
+}
+
+bool KeyedBlobFile::Open(const std::string& path)
+{
+	Close();
+
+	if (!mFile.Open(path))
+		return false;
+
+	// Anything that does not look like a complete file of this version is ignored and
+	// will be overwritten by the next Rewrite.
+	const uint8* data = mFile.Data();
+	std::size_t size = mFile.Size();
+	if (size < sizeof(FileHeader))
+	{
+		Close();
+		return false;
+	}
+
+	FileHeader header;
+	std::memcpy(&header, data, sizeof(header));
+	if (header.Magic != mMagic || header.Version != mVersion ||
+		size < sizeof(FileHeader) + (std::size_t)header.EntryCount * sizeof(FileEntry))
+	{
+		Close();
+		return false;
+	}
+
+	const FileEntry* entries = (const FileEntry*)(data + sizeof(FileHeader));
+	for (uint32 i = 0; i < header.EntryCount; ++i)
+	{
+		if (entries[i].Offset > size || entries[i].Size > size - entries[i].Offset)
+		{
+			Close();
+			return false;
+		}
+	}
+
+	mEntries = entries;
+	mEntryCount = header.EntryCount;
+	return true;
+}
+
+void KeyedBlobFile::Close()
+{
+	mEntries = nullptr;
+	mEntryCount = 0;
+	mFile.Close();
+}
+
+bool KeyedBlobFile::Find(uint64 key, std::vector<uint8>& data)const
+{
+	const FileEntry* end = mEntries + mEntryCount;
+	const FileEntry* it = std::lower_bound(mEntries, end, key,
+		[](const FileEntry& e, uint64 k) { return e.Key < k; });
+
+	if (it == end || it->Key != key)
+		return false;
+
+	const uint8* blob = mFile.Data() + it->Offset;
+	data.assign(blob, blob + it->Size);
+	return true;
+}
+
+KeyedBlobFile::uint32 KeyedBlobFile::EntryCount()const
+{
+	return mEntryCount;
+}
+
+bool KeyedBlobFile::Rewrite(const std::string& path, std::map<uint64, std::vector<uint8>>& newEntries)
+{
+	// Merge the mapped entries with the new ones, still in key order.  Both are already
+	// sorted, and the blobs are written from where they are rather than copied.
+	std::vector<FileEntry> table;
+	std::vector<const uint8*> blobs;
+	table.reserve(mEntryCount + newEntries.size());
+	blobs.reserve(mEntryCount + newEntries.size());
+
+	uint32 mapped = 0;
+	auto added = newEntries.begin();
+	while (mapped < mEntryCount || added != newEntries.end())
+	{
+		FileEntry fe;
+		if (added == newEntries.end() || (mapped < mEntryCount && mEntries[mapped].Key < added->first))
+		{
+			fe.Key = mEntries[mapped].Key;
+			fe.Size = mEntries[mapped].Size;
+			blobs.push_back(mFile.Data() + mEntries[mapped].Offset);
+			++mapped;
+		}
+		else
+		{
+			if (mapped < mEntryCount && mEntries[mapped].Key == added->first)
+				++mapped;
+			fe.Key = added->first;
+			fe.Size = added->second.size();
+			blobs.push_back(added->second.data());
+			++added;
+		}
+		table.push_back(fe);
+	}
+
+	FileHeader header;
+	header.Magic = mMagic;
+	header.Version = mVersion;
+	header.EntryCount = (uint32)table.size();
+
+	uint64 offset = sizeof(FileHeader) + sizeof(FileEntry) * table.size();
+	for (FileEntry& fe : table)
+	{
+		fe.Offset = offset;
+		offset += fe.Size;
+	}
+
+	// The new file is written next to the old one and replaces it only once complete, so
+	// a failed write leaves both the old file and newEntries as they were.
+	const std::string tempPath = path + ".tmp";
+	{
+		std::ofstream fout(tempPath, std::ios::binary | std::ios::trunc);
+		if (!fout)
+			return false;
+
+		fout.write((const char*)&header, sizeof(header));
+		fout.write((const char*)table.data(), sizeof(FileEntry) * table.size());
+		for (std::size_t i = 0; i < table.size(); ++i)
+			fout.write((const char*)blobs[i], (std::streamsize)table[i].Size);
+
+		if (!fout.flush())
+		{
+			fout.close();
+			std::remove(tempPath.c_str());
+			return false;
+		}
+	}
+
+	// The mapping has to go before the file can be replaced on Windows.
+	Close();
+	if (!MoveOver(tempPath, path))
+	{
+		std::remove(tempPath.c_str());
+		Open(path);
+		return false;
+	}
+
+	newEntries.clear();
+
+	// Remap so later lookups are served from the new file.
+	return Open(path);
+}
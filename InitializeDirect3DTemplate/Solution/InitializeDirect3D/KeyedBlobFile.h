@@ -0,0 +1,68 @@
+//***************************************************************************************
+// KeyedBlobFile.h
+//
+// A memory-mapped file of binary blobs looked up by 64-bit key, used by the persistent
+// caches.  The layout is a header, an entry table sorted by key and then the blob data,
+// so a lookup is a binary search of the mapped table and one copy.
+//***************************************************************************************
+
+#pragma once
+
+#include "MappedFile.h"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+class KeyedBlobFile
+{
+public:
+
+	using uint8 = std::uint8_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+public:
+	// Files with a different magic or version are treated as empty.
+	KeyedBlobFile(uint32 magic, uint32 version);
+	KeyedBlobFile(const KeyedBlobFile& rhs) = delete;
+	KeyedBlobFile& operator=(const KeyedBlobFile& rhs) = delete;
+
+	// Maps path.  Returns false if it is missing, stale or truncated.
+	bool Open(const std::string& path);
+	void Close();
+
+	bool Find(uint64 key, std::vector<uint8>& data)const;
+	uint32 EntryCount()const;
+
+	///<summary>
+	/// Rewrites path with the entries currently mapped plus newEntries (which win on equal
+	/// keys), then maps the new file.  newEntries is consumed only if the write succeeds;
+	/// otherwise the old file stays mapped.
+	///</summary>
+	bool Rewrite(const std::string& path, std::map<uint64, std::vector<uint8>>& newEntries);
+
+private:
+	struct FileHeader
+	{
+		uint32 Magic = 0;
+		uint32 Version = 0;
+		uint32 EntryCount = 0;
+		uint32 Reserved = 0;
+	};
+
+	struct FileEntry
+	{
+		uint64 Key = 0;
+		uint64 Offset = 0;
+		uint64 Size = 0;
+	};
+
+private:
+	uint32 mMagic = 0;
+	uint32 mVersion = 0;
+
+	MappedFile mFile;
+	const FileEntry* mEntries = nullptr;
+	uint32 mEntryCount = 0;
+};
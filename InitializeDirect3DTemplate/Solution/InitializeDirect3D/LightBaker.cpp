@@ -0,0 +1,422 @@
+//***************************************************************************************
+// LightBaker.cpp
+//***************************************************************************************
+
+#include "LightBaker.h"
+#include "Bvh.h"
+#include "Hash.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+using uint32 = LightBaker::uint32;
+using uint64 = LightBaker::uint64;
+
+namespace
+{
+	const float Pi = 3.1415926535f;
+	const uint32 VerticesPerTask = 256;
+
+	struct Receiver
+	{
+		uint32 Mesh;
+		uint32 Vertex;
+	};
+
+	float Dot(const float a[3], const float b[3])
+	{
+		return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	}
+
+	void Normalize(float v[3])
+	{
+		float len = sqrtf(Dot(v, v));
+		if (len > 0.0f)
+		{
+			v[0] /= len;
+			v[1] /= len;
+			v[2] /= len;
+		}
+	}
+
+	// Any two unit vectors completing n to an orthonormal basis.
+	void Basis(const float n[3], float t[3], float b[3])
+	{
+		float sign = n[2] >= 0.0f ? 1.0f : -1.0f;
+		float a = -1.0f / (sign + n[2]);
+		float c = n[0] * n[1] * a;
+		t[0] = 1.0f + sign * n[0] * n[0] * a;
+		t[1] = sign * c;
+		t[2] = -sign * n[0];
+		b[0] = c;
+		b[1] = sign + n[1] * n[1] * a;
+		b[2] = -n[1];
+	}
+
+	float RadicalInverse(uint32 bits)
+	{
+		bits = (bits << 16) | (bits >> 16);
+		bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+		bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+		bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+		bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+		return bits * 2.3283064365386963e-10f;
+	}
+
+	uint32 HashVertex(uint32 x)
+	{
+		x ^= x >> 16;
+		x *= 0x7FEB352Du;
+		x ^= x >> 15;
+		x *= 0x846CA68Bu;
+		x ^= x >> 16;
+		return x;
+	}
+}
+
+void LightBaker::AddMesh(Mesh mesh)
+{
+	assert(mesh.Positions.size() == mesh.Normals.size());
+	assert(mesh.Indices.size() % 3 == 0);
+
+	mMeshes.push_back(std::move(mesh));
+}
+
+uint64 LightBaker::SceneHash(const Settings& settings)const
+{
+	uint64 h = SettingsHash(settings);
+	for (const Mesh& mesh : mMeshes)
+	{
+		h = Hash::Fnv1aValue(mesh.Key, h);
+		h = Hash::Fnv1a(mesh.Positions.data(), mesh.Positions.size() * sizeof(float), h);
+		h = Hash::Fnv1a(mesh.Normals.data(), mesh.Normals.size() * sizeof(float), h);
+		h = Hash::Fnv1a(mesh.Indices.data(), mesh.Indices.size() * sizeof(uint32), h);
+		h = Hash::Fnv1a(mesh.Albedo, sizeof(mesh.Albedo), h);
+		h = Hash::Fnv1aValue(mesh.Receiver, h);
+		h = Hash::Fnv1aValue(mesh.Occluder, h);
+	}
+	return h;
+}
+
+uint64 LightBaker::SettingsHash(const Settings& settings)
+{
+	uint32 version = FileVersion;
+	uint64 h = Hash::Fnv1aValue(version);
+	h = Hash::Fnv1aValue(settings.RayCount, h);
+	h = Hash::Fnv1aValue(settings.MaxDistance, h);
+	h = Hash::Fnv1aValue(settings.RayBias, h);
+	h = Hash::Fnv1a(settings.AmbientIrradiance, sizeof(settings.AmbientIrradiance), h);
+	for (const DirectionalLight& light : settings.Lights)
+		h = Hash::Fnv1aValue(light, h);
+	return h;
+}
+
+uint32 LightBaker::PackSample(const float irradiance[3], float occlusion, float irradianceScale)
+{
+	auto quantize = [](float v)
+	{
+		v = std::min(std::max(v, 0.0f), 1.0f);
+		return (uint32)(v * 255.0f + 0.5f);
+	};
+
+	float inv = irradianceScale > 0.0f ? 1.0f / irradianceScale : 0.0f;
+	return quantize(irradiance[0] * inv) | (quantize(irradiance[1] * inv) << 8) |
+		(quantize(irradiance[2] * inv) << 16) | (quantize(occlusion) << 24);
+}
+
+bool LightBaker::Bake(const Settings& settings, const std::string& path, uint64 sceneHash)
+{
+	assert(settings.RayCount > 0);
+
+	mStats = Stats();
+
+	// One BVH over every occluder, remembering which mesh each triangle came from.
+	std::vector<float> positions;
+	std::vector<uint32> indices;
+	std::vector<uint32> triangleMesh;
+	std::vector<Receiver> receivers;
+
+	for (uint32 m = 0; m < (uint32)mMeshes.size(); ++m)
+	{
+		const Mesh& mesh = mMeshes[m];
+		uint32 base = (uint32)(positions.size() / 3);
+		uint32 vertexCount = (uint32)(mesh.Positions.size() / 3);
+
+		if (mesh.Occluder)
+		{
+			positions.insert(positions.end(), mesh.Positions.begin(), mesh.Positions.end());
+			for (uint32 index : mesh.Indices)
+				indices.push_back(base + index);
+			triangleMesh.insert(triangleMesh.end(), mesh.Indices.size() / 3, m);
+		}
+
+		if (mesh.Receiver)
+		{
+			for (uint32 v = 0; v < vertexCount; ++v)
+				receivers.push_back({ m, v });
+		}
+	}
+
+	uint32 triangleCount = (uint32)(indices.size() / 3);
+
+	Bvh bvh;
+	bvh.Build(positions.data(), (uint32)(positions.size() / 3), indices.data(), triangleCount);
+
+	mStats.Triangles = triangleCount;
+	mStats.Vertices = (uint32)receivers.size();
+
+	// Geometric normals for shading the bounce.
+	std::vector<float> faceNormals((size_t)triangleCount * 3);
+	for (uint32 t = 0; t < triangleCount; ++t)
+	{
+		const float* p0 = &positions[3 * (size_t)indices[3 * t + 0]];
+		const float* p1 = &positions[3 * (size_t)indices[3 * t + 1]];
+		const float* p2 = &positions[3 * (size_t)indices[3 * t + 2]];
+		float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+
+		float* n = &faceNormals[3 * (size_t)t];
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+		Normalize(n);
+	}
+
+	std::vector<DirectionalLight> lights = settings.Lights;
+	for (DirectionalLight& light : lights)
+		Normalize(light.Direction);
+
+	struct Result
+	{
+		float Irradiance[3];
+		float Occlusion;
+	};
+	std::vector<Result> results(receivers.size());
+	std::atomic<uint64> rayCount(0);
+
+	int taskCount = (int)((receivers.size() + VerticesPerTask - 1) / VerticesPerTask);
+	ParallelFor(taskCount, [&](int task)
+	{
+		uint64 rays = 0;
+		uint32 begin = (uint32)task * VerticesPerTask;
+		uint32 end = std::min(begin + VerticesPerTask, (uint32)receivers.size());
+
+		for (uint32 r = begin; r < end; ++r)
+		{
+			const Mesh& mesh = mMeshes[receivers[r].Mesh];
+			const float* p = &mesh.Positions[3 * (size_t)receivers[r].Vertex];
+			float n[3] = { mesh.Normals[3 * (size_t)receivers[r].Vertex + 0],
+				mesh.Normals[3 * (size_t)receivers[r].Vertex + 1],
+				mesh.Normals[3 * (size_t)receivers[r].Vertex + 2] };
+			Normalize(n);
+
+			float t[3], b[3];
+			Basis(n, t, b);
+
+			float origin[3] = { p[0] + n[0] * settings.RayBias, p[1] + n[1] * settings.RayBias,
+				p[2] + n[2] * settings.RayBias };
+
+			// Hammersley points, rotated per vertex so neighbours do not share a pattern.
+			uint32 seed = HashVertex(r);
+			float jitterU = (seed & 0xFFFF) / 65536.0f;
+			float jitterV = (seed >> 16) / 65536.0f;
+
+			uint32 open = 0;
+			float bounce[3] = { 0.0f, 0.0f, 0.0f };
+
+			for (uint32 i = 0; i < settings.RayCount; ++i)
+			{
+				float u = (i + 0.5f) / settings.RayCount + jitterU;
+				float v = RadicalInverse(i) + jitterV;
+				u -= floorf(u);
+				v -= floorf(v);
+
+				// Cosine-weighted direction in the hemisphere around n.
+				float radius = sqrtf(u);
+				float phi = 2.0f * Pi * v;
+				float x = radius * cosf(phi), y = radius * sinf(phi), z = sqrtf(std::max(0.0f, 1.0f - u));
+				float dir[3] = {
+					t[0] * x + b[0] * y + n[0] * z,
+					t[1] * x + b[1] * y + n[1] * z,
+					t[2] * x + b[2] * y + n[2] * z };
+
+				Bvh::Hit hit;
+				rays++;
+				if (!bvh.Intersect(origin, dir, settings.MaxDistance, hit))
+				{
+					open++;
+					continue;
+				}
+
+				// Light arriving at the hit point, reflected diffusely back along the ray.
+				float hn[3] = { faceNormals[3 * (size_t)hit.Triangle + 0],
+					faceNormals[3 * (size_t)hit.Triangle + 1],
+					faceNormals[3 * (size_t)hit.Triangle + 2] };
+				if (Dot(hn, dir) > 0.0f)
+				{
+					hn[0] = -hn[0];
+					hn[1] = -hn[1];
+					hn[2] = -hn[2];
+				}
+
+				float hp[3] = {
+					origin[0] + dir[0] * hit.T + hn[0] * settings.RayBias,
+					origin[1] + dir[1] * hit.T + hn[1] * settings.RayBias,
+					origin[2] + dir[2] * hit.T + hn[2] * settings.RayBias };
+
+				float incoming[3] = { settings.AmbientIrradiance[0], settings.AmbientIrradiance[1],
+					settings.AmbientIrradiance[2] };
+				for (const DirectionalLight& light : lights)
+				{
+					float toLight[3] = { -light.Direction[0], -light.Direction[1], -light.Direction[2] };
+					float ndotl = Dot(hn, toLight);
+					if (ndotl <= 0.0f)
+						continue;
+
+					rays++;
+					if (bvh.Occluded(hp, toLight, 1e30f))
+						continue;
+
+					for (int c = 0; c < 3; ++c)
+						incoming[c] += light.Color[c] * ndotl;
+				}
+
+				const float* albedo = mMeshes[triangleMesh[hit.Triangle]].Albedo;
+				for (int c = 0; c < 3; ++c)
+					bounce[c] += albedo[c] / Pi * incoming[c];
+			}
+
+			// With cosine-weighted rays, irradiance is pi times the mean radiance.
+			Result& result = results[r];
+			for (int c = 0; c < 3; ++c)
+				result.Irradiance[c] = Pi * bounce[c] / settings.RayCount;
+			result.Occlusion = (float)open / settings.RayCount;
+		}
+
+		rayCount += rays;
+	});
+
+	mStats.Rays = rayCount;
+
+	float scale = 1e-4f;
+	for (const Result& result : results)
+	{
+		for (int c = 0; c < 3; ++c)
+			scale = std::max(scale, result.Irradiance[c]);
+	}
+
+	// Receivers were gathered mesh by mesh, so each mesh's samples are contiguous.
+	std::vector<FileEntry> entries;
+	uint32 sample = 0;
+	for (const Mesh& mesh : mMeshes)
+	{
+		if (!mesh.Receiver)
+			continue;
+
+		FileEntry entry;
+		entry.Key = mesh.Key;
+		entry.FirstSample = sample;
+		entry.SampleCount = (uint32)(mesh.Positions.size() / 3);
+		entries.push_back(entry);
+		sample += entry.SampleCount;
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const FileEntry& a, const FileEntry& b)
+	{
+		return a.Key < b.Key;
+	});
+
+	std::vector<uint32> samples(results.size());
+	for (std::size_t i = 0; i < results.size(); ++i)
+		samples[i] = PackSample(results[i].Irradiance, results[i].Occlusion, scale);
+
+	FileHeader header;
+	header.EntryCount = (uint32)entries.size();
+	header.SampleCount = (uint32)samples.size();
+	header.SceneHash = sceneHash != 0 ? sceneHash : SceneHash(settings);
+	header.IrradianceScale = scale;
+
+	std::ofstream fout(path, std::ios::binary | std::ios::trunc);
+	if (!fout)
+		return false;
+
+	fout.write((const char*)&header, sizeof(header));
+	fout.write((const char*)entries.data(), entries.size() * sizeof(FileEntry));
+	fout.write((const char*)samples.data(), samples.size() * sizeof(uint32));
+	return (bool)fout;
+}
+
+const LightBaker::Stats& LightBaker::GetStats()const
+{
+	return mStats;
+}
+
+bool BakedLightingFile::Open(const std::string& path, std::uint64_t sceneHash)
+{
+	Close();
+
+	if (!mFile.Open(path))
+		return false;
+
+	const std::uint8_t* data = mFile.Data();
+	std::size_t size = mFile.Size();
+	if (size < sizeof(LightBaker::FileHeader))
+	{
+		Close();
+		return false;
+	}
+
+	LightBaker::FileHeader header;
+	std::memcpy(&header, data, sizeof(header));
+
+	std::size_t expected = sizeof(LightBaker::FileHeader) +
+		(std::size_t)header.EntryCount * sizeof(LightBaker::FileEntry) +
+		(std::size_t)header.SampleCount * sizeof(std::uint32_t);
+	if (header.Magic != LightBaker::FileMagic || header.Version != LightBaker::FileVersion ||
+		header.SceneHash != sceneHash || size < expected)
+	{
+		Close();
+		return false;
+	}
+
+	const LightBaker::FileEntry* entries = (const LightBaker::FileEntry*)(data + sizeof(LightBaker::FileHeader));
+	for (std::uint32_t i = 0; i < header.EntryCount; ++i)
+	{
+		if (entries[i].FirstSample > header.SampleCount ||
+			entries[i].SampleCount > header.SampleCount - entries[i].FirstSample)
+		{
+			Close();
+			return false;
+		}
+	}
+
+	mHeader = header;
+	mEntries = entries;
+	mSamples = (const std::uint32_t*)(entries + header.EntryCount);
+	return true;
+}
+
+void BakedLightingFile::Close()
+{
+	mFile.Close();
+	mHeader = LightBaker::FileHeader();
+	mEntries = nullptr;
+	mSamples = nullptr;
+}
+
+bool BakedLightingFile::Find(std::uint64_t key, std::uint32_t& firstSample, std::uint32_t& sampleCount)const
+{
+	const LightBaker::FileEntry* end = mEntries + mHeader.EntryCount;
+	const LightBaker::FileEntry* it = std::lower_bound(mEntries, end, key,
+		[](const LightBaker::FileEntry& e, std::uint64_t k) { return e.Key < k; });
+	if (it == end || it->Key != key)
+		return false;
+
+	firstSample = it->FirstSample;
+	sampleCount = it->SampleCount;
+	return true;
+}
@@ -0,0 +1,153 @@
+//***************************************************************************************
+// LightBaker.h
+//
+// Offline side of the baked lighting for static geometry.  Every vertex of every
+// receiver mesh shoots cosine-distributed rays against a BVH of the whole scene:
+//
+//   - ambient occlusion is the fraction of rays that reach the sky,
+//   - indirect irradiance is one bounce of the directional and ambient light off the
+//     surfaces the other rays hit, shadowed with rays towards each light.
+//
+// Vertices are baked in parallel.  The result is written to a baked lighting file with
+// one packed 32-bit sample per vertex:
+//
+//   FileHeader
+//   FileEntry entries[EntryCount]   (sorted by key)
+//   uint32 samples[SampleCount]     (R, G, B irradiance / IrradianceScale, A occlusion; R in the low byte)
+//
+// BakedLightingFile maps such a file; the samples can be uploaded as they are.
+//***************************************************************************************
+
+#pragma once
+
+#include "MappedFile.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class LightBaker
+{
+public:
+
+	using uint8 = std::uint8_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	static const uint32 FileMagic = 0x454B4142; // 'BAKE'
+	static const uint32 FileVersion = 1;
+
+	struct FileHeader
+	{
+		uint32 Magic = FileMagic;
+		uint32 Version = FileVersion;
+		uint32 EntryCount = 0;
+		uint32 SampleCount = 0;
+		uint64 SceneHash = 0;
+		float IrradianceScale = 0.0f;
+		uint32 Reserved = 0;
+	};
+
+	struct FileEntry
+	{
+		uint64 Key = 0;
+		uint32 FirstSample = 0;
+		uint32 SampleCount = 0;
+	};
+
+	struct DirectionalLight
+	{
+		float Direction[3] = { 0.0f, -1.0f, 0.0f };   // direction the light travels
+		float Color[3] = { 0.0f, 0.0f, 0.0f };
+	};
+
+	struct Settings
+	{
+		uint32 RayCount = 64;
+
+		// Hits further away than this count as open sky.
+		float MaxDistance = 30.0f;
+
+		// Ray origins are pushed this far off the surface.
+		float RayBias = 0.01f;
+
+		// Irradiance from the sky onto unoccluded surfaces, used at the bounce.
+		float AmbientIrradiance[3] = { 0.0f, 0.0f, 0.0f };
+
+		std::vector<DirectionalLight> Lights;
+	};
+
+	// One world space mesh.  Receivers get one sample per vertex; occluders block rays.
+	// Coarser levels of detail of a mesh receive without occluding, so they get samples
+	// without shadowing the full detail mesh in the same place.
+	struct Mesh
+	{
+		uint64 Key = 0;
+		std::vector<float> Positions;       // xyz per vertex
+		std::vector<float> Normals;         // xyz per vertex
+		std::vector<uint32> Indices;
+		float Albedo[3] = { 0.5f, 0.5f, 0.5f };
+		bool Receiver = true;
+		bool Occluder = true;
+	};
+
+	struct Stats
+	{
+		uint32 Triangles = 0;
+		uint32 Vertices = 0;
+		uint64 Rays = 0;
+	};
+
+public:
+	LightBaker() = default;
+	LightBaker(const LightBaker& rhs) = delete;
+	LightBaker& operator=(const LightBaker& rhs) = delete;
+
+	void AddMesh(Mesh mesh);
+
+	// Hash of every mesh and setting that affects the result, stored in the file so a
+	// stale bake can be detected without baking.
+	uint64 SceneHash(const Settings& settings)const;
+
+	// Hash of the settings and the file version alone, for callers that identify the
+	// scene by a hash of their own and so need not add the meshes to check the file.
+	static uint64 SettingsHash(const Settings& settings);
+
+	///<summary>
+	/// Bakes every receiver and writes the baked lighting file, under sceneHash or, when it
+	/// is zero, under SceneHash(settings).  Returns false if the file cannot be written.
+	///</summary>
+	bool Bake(const Settings& settings, const std::string& path, uint64 sceneHash = 0);
+
+	static uint32 PackSample(const float irradiance[3], float occlusion, float irradianceScale);
+
+	const Stats& GetStats()const;
+
+private:
+	std::vector<Mesh> mMeshes;
+	Stats mStats;
+};
+
+// Read-only view of a baked lighting file.
+class BakedLightingFile
+{
+public:
+	BakedLightingFile() = default;
+	BakedLightingFile(const BakedLightingFile& rhs) = delete;
+	BakedLightingFile& operator=(const BakedLightingFile& rhs) = delete;
+
+	// Maps path.  Returns false if it is missing, truncated or baked from another scene.
+	bool Open(const std::string& path, std::uint64_t sceneHash);
+	void Close();
+
+	bool Find(std::uint64_t key, std::uint32_t& firstSample, std::uint32_t& sampleCount)const;
+
+	const std::uint32_t* Samples()const { return mSamples; }
+	std::uint32_t SampleCount()const { return mHeader.SampleCount; }
+	float IrradianceScale()const { return mHeader.IrradianceScale; }
+
+private:
+	MappedFile mFile;
+	LightBaker::FileHeader mHeader;
+	const LightBaker::FileEntry* mEntries = nullptr;
+	const std::uint32_t* mSamples = nullptr;
+};
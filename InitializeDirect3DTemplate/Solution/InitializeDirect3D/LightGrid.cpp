@@ -0,0 +1,180 @@
+//***************************************************************************************
+// LightGrid.cpp
+//***************************************************************************************
+
+#include "LightGrid.h"
+#include <cassert>
+#include <cmath>
+
+void LightGrid::Build(const std::vector<LightInfo>& lights, float cellSize)
+{
+	assert(cellSize > 0.0f);
+
+	mLights = lights;
+	mCellSize = cellSize;
+	mStats = Stats();
+	mStats.Lights = (uint32)lights.size();
+
+	if (lights.empty())
+	{
+		mCountX = mCountZ = 0;
+		mCellStart.assign(1, 0);
+		mCellLights.clear();
+		return;
+	}
+
+	float minX = lights[0].X, maxX = lights[0].X;
+	float minZ = lights[0].Z, maxZ = lights[0].Z;
+	for (const LightInfo& l : lights)
+	{
+		minX = fminf(minX, l.X - l.FalloffEnd);
+		maxX = fmaxf(maxX, l.X + l.FalloffEnd);
+		minZ = fminf(minZ, l.Z - l.FalloffEnd);
+		maxZ = fmaxf(maxZ, l.Z + l.FalloffEnd);
+	}
+
+	mOriginX = minX;
+	mOriginZ = minZ;
+	mCountX = (int)floorf((maxX - minX) / cellSize) + 1;
+	mCountZ = (int)floorf((maxZ - minZ) / cellSize) + 1;
+	mStats.Cells = (uint32)(mCountX * mCountZ);
+
+	// Two passes: count the lights of every cell, then fill them in.
+	std::vector<uint32> counts(mStats.Cells + 1, 0);
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		for (uint32 i = 0; i < (uint32)lights.size(); ++i)
+		{
+			const LightInfo& l = lights[i];
+			int x0 = CellX(l.X - l.FalloffEnd), x1 = CellX(l.X + l.FalloffEnd);
+			int z0 = CellZ(l.Z - l.FalloffEnd), z1 = CellZ(l.Z + l.FalloffEnd);
+
+			for (int z = z0; z <= z1; ++z)
+			{
+				for (int x = x0; x <= x1; ++x)
+				{
+					uint32 cell = (uint32)(z * mCountX + x);
+					if (pass == 0)
+						counts[cell]++;
+					else
+						mCellLights[counts[cell]++] = i;
+				}
+			}
+		}
+
+		if (pass == 0)
+		{
+			mCellStart.assign(mStats.Cells + 1, 0);
+			for (uint32 c = 0; c < mStats.Cells; ++c)
+			{
+				mCellStart[c + 1] = mCellStart[c] + counts[c];
+				if (counts[c] > mStats.MaxPerCell)
+					mStats.MaxPerCell = counts[c];
+			}
+
+			mCellLights.resize(mCellStart[mStats.Cells]);
+			for (uint32 c = 0; c < mStats.Cells; ++c)
+				counts[c] = mCellStart[c];
+		}
+	}
+
+	mStats.Entries = (uint32)mCellLights.size();
+}
+
+int LightGrid::CellX(float x)const
+{
+	int c = (int)floorf((x - mOriginX) / mCellSize);
+	return c < 0 ? 0 : (c >= mCountX ? mCountX - 1 : c);
+}
+
+int LightGrid::CellZ(float z)const
+{
+	int c = (int)floorf((z - mOriginZ) / mCellSize);
+	return c < 0 ? 0 : (c >= mCountZ ? mCountZ - 1 : c);
+}
+
+float LightGrid::Influence(const LightInfo& light, float x, float y, float z, float radius)
+{
+	float dx = light.X - x;
+	float dy = light.Y - y;
+	float dz = light.Z - z;
+	float d = sqrtf(dx * dx + dy * dy + dz * dz) - radius;
+	if (d < 0.0f)
+		d = 0.0f;
+	if (d >= light.FalloffEnd)
+		return 0.0f;
+
+	// Linear falloff, as in CalcAttenuation.
+	float range = light.FalloffEnd - light.FalloffStart;
+	float falloff = range > 0.0f ? (light.FalloffEnd - d) / range : 1.0f;
+	if (falloff > 1.0f)
+		falloff = 1.0f;
+
+	return light.Intensity * falloff;
+}
+
+LightGrid::uint32 LightGrid::Select(float x, float y, float z, float radius, uint32* outIndices, uint32 maxLights)const
+{
+	if (maxLights == 0 || mCountX == 0)
+		return 0;
+
+	// Lights only ever reach cells they were binned into, so the cells under the sphere
+	// hold every candidate.  A light spanning several of them is seen more than once;
+	// the list below ignores repeats.
+	const uint32 MaxSelected = 16;
+	assert(maxLights <= MaxSelected);
+
+	float scores[MaxSelected];
+	uint32 count = 0;
+
+	int x0 = CellX(x - radius), x1 = CellX(x + radius);
+	int z0 = CellZ(z - radius), z1 = CellZ(z + radius);
+
+	for (int cz = z0; cz <= z1; ++cz)
+	{
+		for (int cx = x0; cx <= x1; ++cx)
+		{
+			uint32 cell = (uint32)(cz * mCountX + cx);
+			for (uint32 e = mCellStart[cell]; e < mCellStart[cell + 1]; ++e)
+			{
+				uint32 li = mCellLights[e];
+
+				bool seen = false;
+				for (uint32 k = 0; k < count && !seen; ++k)
+					seen = outIndices[k] == li;
+				if (seen)
+					continue;
+
+				float score = Influence(mLights[li], x, y, z, radius);
+				if (score <= 0.0f)
+					continue;
+
+				// Insertion into the sorted top list; ties go to the lower index so the
+				// result does not depend on cell order.
+				uint32 pos = count;
+				while (pos > 0 && (scores[pos - 1] < score || (scores[pos - 1] == score && outIndices[pos - 1] > li)))
+					--pos;
+				if (pos >= maxLights)
+					continue;
+
+				uint32 last = count < maxLights ? count : maxLights - 1;
+				for (uint32 k = last; k > pos; --k)
+				{
+					scores[k] = scores[k - 1];
+					outIndices[k] = outIndices[k - 1];
+				}
+				scores[pos] = score;
+				outIndices[pos] = li;
+				if (count < maxLights)
+					count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+const LightGrid::Stats& LightGrid::GetStats()const
+{
+	return mStats;
+}
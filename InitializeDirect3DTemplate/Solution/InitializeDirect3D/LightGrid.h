@@ -0,0 +1,79 @@
+//***************************************************************************************
+// LightGrid.h
+//
+// Uniform grid over the XZ plane that lists, per cell, the lights whose range reaches
+// into it.  Used to pick, for one object, the few lights that affect it most without
+// looking at every light in the scene.
+//
+// A light's influence on an object is its intensity scaled by the same linear falloff
+// the shaders use, evaluated at the point of the object's bounding sphere closest to
+// the light.  Lights whose range does not reach the sphere have no influence.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class LightGrid
+{
+public:
+	using uint32 = std::uint32_t;
+
+	struct LightInfo
+	{
+		float X = 0.0f;
+		float Y = 0.0f;
+		float Z = 0.0f;
+		float FalloffStart = 0.0f;
+		float FalloffEnd = 0.0f;
+		float Intensity = 0.0f;
+	};
+
+	struct Stats
+	{
+		uint32 Lights = 0;
+		uint32 Cells = 0;
+		uint32 Entries = 0;         // light references over all cells
+		uint32 MaxPerCell = 0;
+	};
+
+public:
+	LightGrid() = default;
+	LightGrid(const LightGrid& rhs) = delete;
+	LightGrid& operator=(const LightGrid& rhs) = delete;
+
+	// Bins the lights into square cells of cellSize covering all their ranges.
+	void Build(const std::vector<LightInfo>& lights, float cellSize);
+
+	///<summary>
+	/// Writes the indices of the (up to) maxLights most influential lights on the sphere
+	/// to outIndices, most influential first, and returns how many were written.  Safe to
+	/// call from several threads at once.
+	///</summary>
+	uint32 Select(float x, float y, float z, float radius, uint32* outIndices, uint32 maxLights)const;
+
+	// Influence of one light on a sphere; zero when out of range.
+	static float Influence(const LightInfo& light, float x, float y, float z, float radius);
+
+	const Stats& GetStats()const;
+
+private:
+	int CellX(float x)const;
+	int CellZ(float z)const;
+
+private:
+	std::vector<LightInfo> mLights;
+
+	float mCellSize = 1.0f;
+	float mOriginX = 0.0f;
+	float mOriginZ = 0.0f;
+	int mCountX = 0;
+	int mCountZ = 0;
+
+	// Lights of cell c are mCellLights[mCellStart[c], mCellStart[c + 1]).
+	std::vector<uint32> mCellStart;
+	std::vector<uint32> mCellLights;
+
+	Stats mStats;
+};
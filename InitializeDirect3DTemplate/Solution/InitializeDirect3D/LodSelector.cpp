@@ -0,0 +1,309 @@
+//***************************************************************************************
+// LodSelector.cpp
+//***************************************************************************************
+
+#include "LodSelector.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define LOD_SELECTOR_SSE 1
+#include <xmmintrin.h>
+#endif
+
+using uint8 = LodSelector::uint8;
+using uint32 = LodSelector::uint32;
+
+namespace
+{
+	// An eye inside a bounding sphere sees it from no closer than this.
+	const float MinDistance = 1.0e-3f;
+
+	// Missing levels never fit under the threshold.
+	const float NoLevel = FLT_MAX;
+
+	struct Float3
+	{
+		float X, Y, Z;
+	};
+
+	Float3 Sub(const Float3& a, const Float3& b) { return { a.X - b.X, a.Y - b.Y, a.Z - b.Z }; }
+	float Dot(const Float3& a, const Float3& b) { return a.X * b.X + a.Y * b.Y + a.Z * b.Z; }
+
+	// Squared distance from p to the triangle abc (Ericson, Real-Time Collision Detection 5.1.5).
+	float TriangleDistanceSq(const Float3& p, const Float3& a, const Float3& b, const Float3& c)
+	{
+		Float3 ab = Sub(b, a), ac = Sub(c, a), ap = Sub(p, a);
+		float d1 = Dot(ab, ap), d2 = Dot(ac, ap);
+		Float3 closest;
+		if (d1 <= 0.0f && d2 <= 0.0f)
+		{
+			closest = a;
+		}
+		else
+		{
+			Float3 bp = Sub(p, b);
+			float d3 = Dot(ab, bp), d4 = Dot(ac, bp);
+			Float3 cp = Sub(p, c);
+			float d5 = Dot(ab, cp), d6 = Dot(ac, cp);
+			float vc = d1 * d4 - d3 * d2;
+			float vb = d5 * d2 - d1 * d6;
+			float va = d3 * d6 - d5 * d4;
+
+			if (d3 >= 0.0f && d4 <= d3)
+				closest = b;
+			else if (d6 >= 0.0f && d5 <= d6)
+				closest = c;
+			else if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+			{
+				float v = d1 / (d1 - d3);
+				closest = { a.X + v * ab.X, a.Y + v * ab.Y, a.Z + v * ab.Z };
+			}
+			else if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+			{
+				float w = d2 / (d2 - d6);
+				closest = { a.X + w * ac.X, a.Y + w * ac.Y, a.Z + w * ac.Z };
+			}
+			else if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+			{
+				float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+				closest = { b.X + w * (c.X - b.X), b.Y + w * (c.Y - b.Y), b.Z + w * (c.Z - b.Z) };
+			}
+			else
+			{
+				float denom = 1.0f / (va + vb + vc);
+				float v = vb * denom, w = vc * denom;
+				closest = { a.X + ab.X * v + ac.X * w, a.Y + ab.Y * v + ac.Y * w, a.Z + ab.Z * v + ac.Z * w };
+			}
+		}
+
+		Float3 d = Sub(p, closest);
+		return Dot(d, d);
+	}
+
+	// The positions and triangles a mesh view reads; false if an index is out of range.
+	bool Gather(const LodSelector::MeshView& mesh, std::vector<Float3>& positions, std::vector<uint32>& triangles)
+	{
+		positions.clear();
+		triangles.clear();
+
+		std::vector<uint32> remap(mesh.VertexCount, 0xffffffffu);
+		for (uint32 i = 0; i < mesh.IndexCount; ++i)
+		{
+			uint32 index;
+			const uint8* at = mesh.Indices + (size_t)(mesh.StartIndexLocation + i) * mesh.IndexSize;
+			if (mesh.IndexSize == 2)
+			{
+				std::uint16_t v;
+				std::memcpy(&v, at, 2);
+				index = v;
+			}
+			else
+			{
+				std::memcpy(&index, at, 4);
+			}
+
+			std::int64_t vertex = (std::int64_t)index + mesh.BaseVertexLocation;
+			if (vertex < 0 || vertex >= mesh.VertexCount)
+				return false;
+
+			if (remap[(size_t)vertex] == 0xffffffffu)
+			{
+				remap[(size_t)vertex] = (uint32)positions.size();
+				Float3 p;
+				std::memcpy(&p, mesh.Vertices + (size_t)vertex * mesh.VertexStride, sizeof(p));
+				positions.push_back(p);
+			}
+			triangles.push_back(remap[(size_t)vertex]);
+		}
+		triangles.resize(triangles.size() / 3 * 3);
+		return true;
+	}
+
+	// Largest distance from a point of from to the triangles of to.
+	float OneSidedError(const std::vector<Float3>& from, const std::vector<Float3>& to, const std::vector<uint32>& triangles)
+	{
+		float worst = 0.0f;
+		for (const Float3& p : from)
+		{
+			float best = FLT_MAX;
+			for (size_t t = 0; t < triangles.size() && best > worst; t += 3)
+				best = std::min(best, TriangleDistanceSq(p, to[triangles[t]], to[triangles[t + 1]], to[triangles[t + 2]]));
+			worst = std::max(worst, best);
+		}
+		return std::sqrt(worst);
+	}
+}
+
+void LodSelector::SetDesc(const Desc& desc)
+{
+	mDesc = desc;
+}
+
+void LodSelector::BeginFrame(const float eye[3], float pixelsPerUnit, float deltaTime)
+{
+	std::memcpy(mEye, eye, sizeof(mEye));
+	mPixelsPerUnit = pixelsPerUnit;
+	mDeltaTime = deltaTime;
+
+	mCenterX.clear();
+	mCenterY.clear();
+	mCenterZ.clear();
+	mRadius.clear();
+	for (uint32 k = 1; k < MaxLods; ++k)
+		mError[k].clear();
+	mCurrent.clear();
+	mStates.clear();
+	mLevels.clear();
+
+	mStats = Stats();
+}
+
+void LodSelector::Add(const float center[3], float radius, const Levels& itemLevels, State* state)
+{
+	Levels levels = itemLevels;
+	levels.Count = std::min(std::max(levels.Count, 1u), MaxLods);
+
+	mCenterX.push_back(center[0]);
+	mCenterY.push_back(center[1]);
+	mCenterZ.push_back(center[2]);
+	mRadius.push_back(radius);
+
+	// Keep the errors from decreasing, so counting the levels under the threshold finds
+	// the coarsest one that is.
+	float error = 0.0f;
+	for (uint32 k = 1; k < MaxLods; ++k)
+	{
+		error = k < levels.Count ? std::max(error, levels.Error[k]) : NoLevel;
+		mError[k].push_back(error);
+	}
+
+	mCurrent.push_back(state->Initialized ? (float)std::min(state->Lod, levels.Count - 1) : 0.0f);
+	mStates.push_back(state);
+	mLevels.push_back(levels);
+}
+
+void LodSelector::Select()
+{
+	const uint32 count = (uint32)mStates.size();
+	const uint32 padded = (count + 3) & ~3u;
+
+	// Padding items sit on the eye, where level 0 is always right.
+	mCenterX.resize(padded, mEye[0]);
+	mCenterY.resize(padded, mEye[1]);
+	mCenterZ.resize(padded, mEye[2]);
+	mRadius.resize(padded, 0.0f);
+	for (uint32 k = 1; k < MaxLods; ++k)
+		mError[k].resize(padded, NoLevel);
+	mCurrent.resize(padded, 0.0f);
+	mSelected.resize(padded);
+
+	const float threshold = mDesc.ThresholdPixels;
+	const float coarseThreshold = mDesc.ThresholdPixels * (1.0f - mDesc.Hysteresis);
+
+	// fine counts the levels that fit the threshold, coarse those that fit it with the
+	// margin.  The current level stays unless it is finer than coarse, or coarser than
+	// fine: selected = min(max(current, coarse), fine).
+	for (uint32 i = 0; i < padded; i += 4)
+	{
+#if defined(LOD_SELECTOR_SSE)
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(&mCenterX[i]), _mm_set1_ps(mEye[0]));
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(&mCenterY[i]), _mm_set1_ps(mEye[1]));
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(&mCenterZ[i]), _mm_set1_ps(mEye[2]));
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		distance = _mm_max_ps(_mm_sub_ps(distance, _mm_loadu_ps(&mRadius[i])), _mm_set1_ps(MinDistance));
+		__m128 scale = _mm_div_ps(_mm_set1_ps(mPixelsPerUnit), distance);
+
+		const __m128 one = _mm_set1_ps(1.0f);
+		__m128 fine = _mm_setzero_ps();
+		__m128 coarse = _mm_setzero_ps();
+		for (uint32 k = 1; k < MaxLods; ++k)
+		{
+			__m128 projected = _mm_mul_ps(_mm_loadu_ps(&mError[k][i]), scale);
+			fine = _mm_add_ps(fine, _mm_and_ps(_mm_cmple_ps(projected, _mm_set1_ps(threshold)), one));
+			coarse = _mm_add_ps(coarse, _mm_and_ps(_mm_cmple_ps(projected, _mm_set1_ps(coarseThreshold)), one));
+		}
+
+		__m128 selected = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(&mCurrent[i]), coarse), fine);
+		_mm_storeu_ps(&mSelected[i], selected);
+#else
+		for (uint32 j = i; j < i + 4; ++j)
+		{
+			float dx = mCenterX[j] - mEye[0];
+			float dy = mCenterY[j] - mEye[1];
+			float dz = mCenterZ[j] - mEye[2];
+			float distance = std::max(std::sqrt(dx * dx + dy * dy + dz * dz) - mRadius[j], MinDistance);
+			float scale = mPixelsPerUnit / distance;
+
+			float fine = 0.0f, coarse = 0.0f;
+			for (uint32 k = 1; k < MaxLods; ++k)
+			{
+				float projected = mError[k][j] * scale;
+				fine += projected <= threshold ? 1.0f : 0.0f;
+				coarse += projected <= coarseThreshold ? 1.0f : 0.0f;
+			}
+			mSelected[j] = std::min(std::max(mCurrent[j], coarse), fine);
+		}
+#endif
+	}
+
+	const float fadeStep = mDesc.FadeSeconds > 0.0f ? mDeltaTime / mDesc.FadeSeconds : 1.0f;
+	for (uint32 i = 0; i < count; ++i)
+	{
+		State& state = *mStates[i];
+		const Levels& levels = mLevels[i];
+		uint32 lod = std::min((uint32)mSelected[i], levels.Count - 1);
+
+		if (!state.Initialized)
+		{
+			state.Lod = state.FromLod = lod;
+			state.Fade = 1.0f;
+			state.Initialized = true;
+		}
+		else if (lod != state.Lod)
+		{
+			mStats.Transitions++;
+			if (state.Fade >= 1.0f)
+			{
+				state.FromLod = state.Lod;
+				state.Fade = 0.0f;
+			}
+			else if (lod == state.FromLod)
+			{
+				// Turning back fades out from where the fade in got to.
+				state.FromLod = state.Lod;
+				state.Fade = 1.0f - state.Fade;
+			}
+			state.Lod = lod;
+		}
+
+		state.Fade = std::min(state.Fade + fadeStep, 1.0f);
+		bool fading = state.Fade < 1.0f && state.FromLod != state.Lod;
+		if (!fading)
+			state.Fade = 1.0f;
+
+		mStats.Items++;
+		mStats.ItemsPerLod[state.Lod]++;
+		mStats.FullTriangles += levels.Triangles[0];
+		mStats.DrawnTriangles += levels.Triangles[state.Lod];
+		if (fading)
+		{
+			mStats.Fading++;
+			mStats.DrawnTriangles += levels.Triangles[state.FromLod];
+		}
+	}
+}
+
+float LodSelector::MeasureError(const MeshView& detail, const MeshView& coarse)
+{
+	std::vector<Float3> detailPositions, coarsePositions;
+	std::vector<uint32> detailTriangles, coarseTriangles;
+	if (!Gather(detail, detailPositions, detailTriangles) || !Gather(coarse, coarsePositions, coarseTriangles) ||
+		detailTriangles.empty() || coarseTriangles.empty())
+		return NoLevel;
+
+	return std::max(OneSidedError(detailPositions, coarsePositions, coarseTriangles),
+		OneSidedError(coarsePositions, detailPositions, detailTriangles));
+}
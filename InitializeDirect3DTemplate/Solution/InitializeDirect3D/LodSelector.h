@@ -0,0 +1,130 @@
+//***************************************************************************************
+// LodSelector.h
+//
+// Level of detail selection by screen-space error.  Every level of an item has the
+// geometric error it makes against the full detail surface, in world units; projected
+// from the distance of the item's bounding sphere, that error is how many pixels the
+// level can be off by.  Each frame the visible items are added to one batch and the
+// coarsest level whose projected error stays under the threshold is picked for four
+// items per SSE iteration.
+//
+// A coarser level is only taken once its error is a hysteresis margin under the
+// threshold, so an item at the boundary does not switch back and forth.  A switch fades
+// over a short time: for a while both levels are drawn, dithered against each other.
+//
+// This class only makes the decisions, the caller draws what it picked, so it has no
+// Direct3D dependency.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class LodSelector
+{
+public:
+
+	using uint8 = std::uint8_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	static const uint32 MaxLods = 4;
+
+	struct Desc
+	{
+		float ThresholdPixels = 1.0f;   // largest projected error a level may have
+		float Hysteresis = 0.25f;       // fraction of the threshold a coarser level has to be under
+		float FadeSeconds = 0.25f;      // 0 switches at once
+	};
+
+	// The levels of one item.  Errors are in world units and must not decrease from one
+	// level to the next; level 0 is the full detail and has none.
+	struct Levels
+	{
+		uint32 Count = 1;
+		float Error[MaxLods] = {};
+		uint32 Triangles[MaxLods] = {};
+	};
+
+	// What the caller keeps per item between frames.  While Fade < 1 both FromLod and Lod
+	// are drawn; Fade is how far Lod has come in.
+	struct State
+	{
+		uint32 Lod = 0;
+		uint32 FromLod = 0;
+		float Fade = 1.0f;
+		bool Initialized = false;       // a new item takes its level without a fade
+	};
+
+	// A mesh for MeasureError: float3 positions at the start of every vertex.
+	struct MeshView
+	{
+		const uint8* Vertices = nullptr;
+		uint32 VertexStride = 0;
+		uint32 VertexCount = 0;
+		const uint8* Indices = nullptr;
+		uint32 IndexSize = 2;
+		uint32 IndexCount = 0;
+		uint32 StartIndexLocation = 0;
+		std::int32_t BaseVertexLocation = 0;
+	};
+
+	struct Stats
+	{
+		uint32 Items = 0;
+		uint32 Transitions = 0;         // levels switched this frame
+		uint32 Fading = 0;
+		uint32 ItemsPerLod[MaxLods] = {};
+		uint64 FullTriangles = 0;       // had every item been drawn at level 0
+		uint64 DrawnTriangles = 0;      // both levels of a fading item count
+	};
+
+public:
+	LodSelector() = default;
+	LodSelector(const LodSelector& rhs) = delete;
+	LodSelector& operator=(const LodSelector& rhs) = delete;
+
+	void SetDesc(const Desc& desc);
+	const Desc& GetDesc()const { return mDesc; }
+
+	///<summary>
+	/// Starts a batch for a camera at eye.  pixelsPerUnit is the size in pixels of one
+	/// world unit at distance one: the viewport height over 2 tan(fovY / 2).
+	///</summary>
+	void BeginFrame(const float eye[3], float pixelsPerUnit, float deltaTime);
+
+	// Adds an item with its world bounding sphere.  state is updated by Select and has to
+	// stay where it is until then.
+	void Add(const float center[3], float radius, const Levels& levels, State* state);
+
+	// Picks the level of every item of the batch and updates their states.
+	void Select();
+
+	const Stats& GetStats()const { return mStats; }
+
+	///<summary>
+	/// Geometric error of coarse against detail: the largest distance from a vertex of
+	/// either mesh to the surface of the other.  Brute force, meant for cooking.
+	///</summary>
+	static float MeasureError(const MeshView& detail, const MeshView& coarse);
+
+private:
+	Desc mDesc;
+	float mEye[3] = {};
+	float mPixelsPerUnit = 1.0f;
+	float mDeltaTime = 0.0f;
+
+	// The batch, one entry per item; the arrays are padded to a multiple of four.
+	std::vector<float> mCenterX;
+	std::vector<float> mCenterY;
+	std::vector<float> mCenterZ;
+	std::vector<float> mRadius;
+	std::vector<float> mError[MaxLods];     // level 0 is not stored
+	std::vector<float> mCurrent;            // the level drawn now, as a float
+	std::vector<float> mSelected;
+	std::vector<State*> mStates;
+	std::vector<Levels> mLevels;
+
+	Stats mStats;
+};
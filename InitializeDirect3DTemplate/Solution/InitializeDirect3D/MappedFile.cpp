@@ -0,0 +1,159 @@
+//***************************************************************************************
+// MappedFile.cpp
+//***************************************************************************************
+
+#include "MappedFile.h"
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(MappedFile&& rhs) noexcept
+{
+	*this = std::move(rhs);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& rhs) noexcept
+{
+	if (this != &rhs)
+	{
+		Close();
+
+		mData = rhs.mData;
+		mSize = rhs.mSize;
+		mOpen = rhs.mOpen;
+#if defined(_WIN32)
+		mFileHandle = rhs.mFileHandle;
+		mMappingHandle = rhs.mMappingHandle;
+		rhs.mFileHandle = nullptr;
+		rhs.mMappingHandle = nullptr;
+#endif
+		rhs.mData = nullptr;
+		rhs.mSize = 0;
+		rhs.mOpen = false;
+	}
+	return *this;
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	mFileHandle = file;
+	mSize = (std::size_t)size.QuadPart;
+	mOpen = true;
+
+	// A zero length file cannot be mapped, but it is still a valid (empty) file.
+	if (mSize == 0)
+		return true;
+
+	mMappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMappingHandle == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	mData = (const std::uint8_t*)MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (mData == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (mData != nullptr)
+		UnmapViewOfFile(mData);
+	if (mMappingHandle != nullptr)
+		CloseHandle(mMappingHandle);
+	if (mFileHandle != nullptr)
+		CloseHandle(mFileHandle);
+
+	mData = nullptr;
+	mMappingHandle = nullptr;
+	mFileHandle = nullptr;
+	mSize = 0;
+	mOpen = false;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (::fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	mSize = (std::size_t)st.st_size;
+	mOpen = true;
+
+	if (mSize > 0)
+	{
+		void* data = ::mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			::close(fd);
+			mSize = 0;
+			mOpen = false;
+			return false;
+		}
+		mData = (const std::uint8_t*)data;
+	}
+
+	// The mapping stays valid after the descriptor is closed.
+	::close(fd);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (mData != nullptr)
+		::munmap((void*)mData, mSize);
+
+	mData = nullptr;
+	mSize = 0;
+	mOpen = false;
+}
+
+#endif
@@ -0,0 +1,42 @@
+//***************************************************************************************
+// MappedFile.h
+//
+// Read-only memory mapping of a whole file.  Uses file mapping objects on Windows and
+// mmap everywhere else, so the loaders built on top of it stay portable.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile& rhs) = delete;
+	MappedFile& operator=(const MappedFile& rhs) = delete;
+	MappedFile(MappedFile&& rhs) noexcept;
+	MappedFile& operator=(MappedFile&& rhs) noexcept;
+	~MappedFile();
+
+	// Maps the file at path.  Returns false if it does not exist or cannot be mapped.
+	// An empty file opens successfully with a null Data().
+	bool Open(const std::string& path);
+	void Close();
+
+	bool IsOpen()const { return mOpen; }
+	const std::uint8_t* Data()const { return mData; }
+	std::size_t Size()const { return mSize; }
+
+private:
+	const std::uint8_t* mData = nullptr;
+	std::size_t mSize = 0;
+	bool mOpen = false;
+
+#if defined(_WIN32)
+	void* mFileHandle = nullptr;
+	void* mMappingHandle = nullptr;
+#endif
+};
@@ -0,0 +1,135 @@
+//***************************************************************************************
+// MemoryTracker.cpp
+//***************************************************************************************
+
+#include "MemoryTracker.h"
+
+using uint32 = MemoryTracker::uint32;
+using uint64 = MemoryTracker::uint64;
+
+MemoryTracker& MemoryTracker::Global()
+{
+	static MemoryTracker tracker;
+	return tracker;
+}
+
+const char* MemoryTracker::TagName(MemoryTag tag)
+{
+	switch (tag)
+	{
+	case MemoryTag::Geometry:       return "geometry";
+	case MemoryTag::Textures:       return "textures";
+	case MemoryTag::Simulation:     return "simulation";
+	case MemoryTag::FrameResources: return "frame resources";
+	case MemoryTag::Scene:          return "scene";
+	default:                        return "unknown";
+	}
+}
+
+void MemoryTracker::Allocate(MemoryTag tag, uint64 bytes)
+{
+	TagCounters& c = mTags[(int)tag];
+	uint64 live = c.Live.fetch_add(bytes) + bytes;
+
+	uint64 peak = c.Peak.load();
+	while (live > peak && !c.Peak.compare_exchange_weak(peak, live))
+	{
+	}
+
+	c.Allocations++;
+	c.FrameAllocations++;
+	c.FrameBytes += bytes;
+}
+
+void MemoryTracker::Free(MemoryTag tag, uint64 bytes)
+{
+	mTags[(int)tag].Live -= bytes;
+}
+
+void MemoryTracker::SetBudget(MemoryTag tag, uint64 bytes)
+{
+	mTags[(int)tag].Budget = bytes;
+}
+
+void MemoryTracker::BeginFrame()
+{
+	for (TagCounters& c : mTags)
+	{
+		c.FrameAllocations = 0;
+		c.FrameBytes = 0;
+	}
+}
+
+MemoryTracker::Counters MemoryTracker::GetCounters(MemoryTag tag)const
+{
+	const TagCounters& c = mTags[(int)tag];
+
+	Counters counters;
+	counters.Live = c.Live.load();
+	counters.Peak = c.Peak.load();
+	counters.Budget = c.Budget.load();
+	counters.Allocations = c.Allocations.load();
+	counters.FrameAllocations = c.FrameAllocations.load();
+	counters.FrameBytes = c.FrameBytes.load();
+	return counters;
+}
+
+uint64 MemoryTracker::TotalLive()const
+{
+	uint64 total = 0;
+	for (const TagCounters& c : mTags)
+		total += c.Live.load();
+	return total;
+}
+
+uint32 MemoryTracker::OverBudgetMask()const
+{
+	uint32 mask = 0;
+	for (uint32 i = 0; i < (uint32)MemoryTag::Count; ++i)
+	{
+		uint64 budget = mTags[i].Budget.load();
+		if (budget > 0 && mTags[i].Live.load() > budget)
+			mask |= 1u << i;
+	}
+	return mask;
+}
+
+TrackedMemory::TrackedMemory(MemoryTag tag, uint64 bytes)
+	: mTag(tag), mBytes(bytes)
+{
+	if (mBytes > 0)
+		MemoryTracker::Global().Allocate(mTag, mBytes);
+}
+
+TrackedMemory::TrackedMemory(TrackedMemory&& rhs) noexcept
+	: mTag(rhs.mTag), mBytes(rhs.mBytes)
+{
+	rhs.mBytes = 0;
+}
+
+TrackedMemory& TrackedMemory::operator=(TrackedMemory&& rhs) noexcept
+{
+	if (this != &rhs)
+	{
+		Resize(0);
+		mTag = rhs.mTag;
+		mBytes = rhs.mBytes;
+		rhs.mBytes = 0;
+	}
+	return *this;
+}
+
+TrackedMemory::~TrackedMemory()
+{
+	Resize(0);
+}
+
+void TrackedMemory::Resize(uint64 bytes)
+{
+	MemoryTracker& tracker = MemoryTracker::Global();
+	if (bytes > mBytes)
+		tracker.Allocate(mTag, bytes - mBytes);
+	else if (bytes < mBytes)
+		tracker.Free(mTag, mBytes - bytes);
+	mBytes = bytes;
+}
@@ -0,0 +1,107 @@
+//***************************************************************************************
+// MemoryTracker.h
+//
+// Accounts memory by subsystem.  Code that creates something big (a vertex buffer, a
+// texture, a simulation grid, a frame's upload buffers) charges its size to a tag and
+// gives it back when it is released; the tracker keeps the live and peak bytes of every
+// tag, how many allocations were made overall and in the current frame, and compares the
+// live bytes against a budget per tag.
+//
+// The numbers are what the owners report, CPU and GPU memory alike, not what the heap or
+// the driver actually reserve.  All counters are atomic, so any thread can charge them.
+//***************************************************************************************
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+enum class MemoryTag : std::uint32_t
+{
+	Geometry = 0,
+	Textures,
+	Simulation,
+	FrameResources,
+	Scene,
+	Count
+};
+
+class MemoryTracker
+{
+public:
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	struct Counters
+	{
+		uint64 Live = 0;
+		uint64 Peak = 0;
+		uint64 Budget = 0;              // 0 when the tag has none
+		uint64 Allocations = 0;
+		uint32 FrameAllocations = 0;    // since BeginFrame
+		uint64 FrameBytes = 0;
+	};
+
+public:
+	MemoryTracker() = default;
+	MemoryTracker(const MemoryTracker& rhs) = delete;
+	MemoryTracker& operator=(const MemoryTracker& rhs) = delete;
+
+	// The tracker the whole program charges.
+	static MemoryTracker& Global();
+
+	static const char* TagName(MemoryTag tag);
+
+	void Allocate(MemoryTag tag, uint64 bytes);
+	void Free(MemoryTag tag, uint64 bytes);
+
+	// A budget of 0 removes it.
+	void SetBudget(MemoryTag tag, uint64 bytes);
+
+	// Starts a new frame for the per-frame allocation counts.
+	void BeginFrame();
+
+	Counters GetCounters(MemoryTag tag)const;
+	uint64 TotalLive()const;
+
+	// Bit i is set when tag i has more live bytes than its budget.
+	uint32 OverBudgetMask()const;
+
+private:
+	struct TagCounters
+	{
+		std::atomic<uint64> Live{ 0 };
+		std::atomic<uint64> Peak{ 0 };
+		std::atomic<uint64> Budget{ 0 };
+		std::atomic<uint64> Allocations{ 0 };
+		std::atomic<uint32> FrameAllocations{ 0 };
+		std::atomic<uint64> FrameBytes{ 0 };
+	};
+
+	TagCounters mTags[(int)MemoryTag::Count];
+};
+
+// Bytes charged to the global tracker for as long as the handle lives.
+class TrackedMemory
+{
+public:
+	using uint64 = MemoryTracker::uint64;
+
+	TrackedMemory() = default;
+	TrackedMemory(MemoryTag tag, uint64 bytes);
+	TrackedMemory(TrackedMemory&& rhs) noexcept;
+	TrackedMemory& operator=(TrackedMemory&& rhs) noexcept;
+	TrackedMemory(const TrackedMemory& rhs) = delete;
+	TrackedMemory& operator=(const TrackedMemory& rhs) = delete;
+	~TrackedMemory();
+
+	// Changes the charge, e.g. when the owner grows or drops part of its data.
+	void Resize(uint64 bytes);
+
+	MemoryTag Tag()const { return mTag; }
+	uint64 Bytes()const { return mBytes; }
+
+private:
+	MemoryTag mTag = MemoryTag::Scene;
+	uint64 mBytes = 0;
+};
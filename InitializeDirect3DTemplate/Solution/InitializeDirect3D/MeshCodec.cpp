@@ -0,0 +1,530 @@
+//***************************************************************************************
+// MeshCodec.cpp
+//***************************************************************************************
+
+#include "MeshCodec.h"
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define MESH_CODEC_SSE 1
+#include <emmintrin.h>
+#endif
+
+using uint8 = std::uint8_t;
+using uint32 = std::uint32_t;
+using uint64 = std::uint64_t;
+
+namespace
+{
+	const uint8 VertexVersion = 0xA1;
+	const uint8 IndexVersion = 0xE1;
+
+	// Vertex streams are coded in groups of 16 bytes, and vertices in blocks so a block of
+	// every stream fits in a small buffer.  A block stream starts with 2 bits per group
+	// giving its mode, then the groups.
+	const std::size_t GroupSize = 16;
+	const std::size_t BlockVertices = 256;
+	const std::size_t GroupBytes[4] = { 0, 4, 8, 16 };  // all zero, 2, 4 or 8 bits a value
+
+	// The edge and vertex FIFOs the index codec refers back into.
+	const uint32 FifoSize = 16;
+	const uint32 EdgeMiss = 15;       // code of a triangle without a recent edge
+	const uint32 CodeNextVertex = 4;  // the third vertex is the next unseen one
+	const uint64 VertexExplicit = 1 + FifoSize;
+
+	inline uint8 Zigzag8(uint8 delta)
+	{
+		return (uint8)((delta << 1) ^ (uint8)((std::int8_t)delta >> 7));
+	}
+
+	inline uint8 Unzigzag8(uint8 z)
+	{
+		return (uint8)((z >> 1) ^ (uint8)(0 - (z & 1)));
+	}
+
+	std::size_t ModeOf(const uint8* values)
+	{
+		uint8 largest = 0;
+		for (std::size_t i = 0; i < GroupSize; ++i)
+			largest = values[i] > largest ? values[i] : largest;
+		return largest == 0 ? 0 : largest < 4 ? 1 : largest < 16 ? 2 : 3;
+	}
+
+	void WriteGroup(std::vector<uint8>& out, const uint8* values, std::size_t mode)
+	{
+		switch (mode)
+		{
+		case 1:
+			for (std::size_t j = 0; j < 4; ++j)
+				out.push_back((uint8)(values[4 * j] | values[4 * j + 1] << 2 | values[4 * j + 2] << 4 | values[4 * j + 3] << 6));
+			break;
+		case 2:
+			for (std::size_t j = 0; j < 8; ++j)
+				out.push_back((uint8)(values[2 * j] | values[2 * j + 1] << 4));
+			break;
+		case 3:
+			out.insert(out.end(), values, values + GroupSize);
+			break;
+		}
+	}
+
+	// Unpacks one group, undoes the zigzag and adds each value to the one before it,
+	// starting from previous.
+	void DecodeGroup(const uint8* p, std::size_t mode, uint8 previous, uint8* out)
+	{
+#if defined(MESH_CODEC_SSE)
+		__m128i z;
+		switch (mode)
+		{
+		case 0:
+			z = _mm_setzero_si128();
+			break;
+		case 1:
+		{
+			uint32 packed;
+			std::memcpy(&packed, p, sizeof(packed));
+			const __m128i b = _mm_cvtsi32_si128((int)packed);
+			const __m128i mask = _mm_set1_epi8(3);
+			__m128i v0 = _mm_and_si128(b, mask);
+			__m128i v1 = _mm_and_si128(_mm_srli_epi16(b, 2), mask);
+			__m128i v2 = _mm_and_si128(_mm_srli_epi16(b, 4), mask);
+			__m128i v3 = _mm_and_si128(_mm_srli_epi16(b, 6), mask);
+			z = _mm_unpacklo_epi16(_mm_unpacklo_epi8(v0, v1), _mm_unpacklo_epi8(v2, v3));
+			break;
+		}
+		case 2:
+		{
+			const __m128i b = _mm_loadl_epi64((const __m128i*)p);
+			const __m128i mask = _mm_set1_epi8(15);
+			z = _mm_unpacklo_epi8(_mm_and_si128(b, mask), _mm_and_si128(_mm_srli_epi16(b, 4), mask));
+			break;
+		}
+		default:
+			z = _mm_loadu_si128((const __m128i*)p);
+			break;
+		}
+
+		const __m128i one = _mm_set1_epi8(1);
+		__m128i d = _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(z, 1), _mm_set1_epi8(0x7f)),
+			_mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(z, one)));
+
+		// Running sum across the 16 bytes in four steps.
+		d = _mm_add_epi8(d, _mm_slli_si128(d, 1));
+		d = _mm_add_epi8(d, _mm_slli_si128(d, 2));
+		d = _mm_add_epi8(d, _mm_slli_si128(d, 4));
+		d = _mm_add_epi8(d, _mm_slli_si128(d, 8));
+		d = _mm_add_epi8(d, _mm_set1_epi8((char)previous));
+		_mm_storeu_si128((__m128i*)out, d);
+#else
+		uint8 z[GroupSize];
+		switch (mode)
+		{
+		case 0:
+			std::memset(z, 0, sizeof(z));
+			break;
+		case 1:
+			for (std::size_t i = 0; i < GroupSize; ++i)
+				z[i] = (p[i / 4] >> (2 * (i % 4))) & 3;
+			break;
+		case 2:
+			for (std::size_t i = 0; i < GroupSize; ++i)
+				z[i] = (p[i / 2] >> (4 * (i % 2))) & 15;
+			break;
+		default:
+			std::memcpy(z, p, sizeof(z));
+			break;
+		}
+
+		for (std::size_t i = 0; i < GroupSize; ++i)
+		{
+			previous = (uint8)(previous + Unzigzag8(z[i]));
+			out[i] = previous;
+		}
+#endif
+	}
+
+	// Writes count vertices from vertexStride streams of BlockVertices bytes each.
+	void TransposeBlock(const uint8* streams, std::size_t count, std::size_t vertexStride, uint8* vertices)
+	{
+		std::size_t k = 0;
+#if defined(MESH_CODEC_SSE)
+		// Four streams at a time become one 32-bit word of 16 vertices.
+		for (; k + 4 <= vertexStride; k += 4)
+		{
+			const uint8* s = streams + k * BlockVertices;
+			for (std::size_t v = 0; v < count; v += GroupSize)
+			{
+				__m128i s0 = _mm_loadu_si128((const __m128i*)(s + v));
+				__m128i s1 = _mm_loadu_si128((const __m128i*)(s + BlockVertices + v));
+				__m128i s2 = _mm_loadu_si128((const __m128i*)(s + 2 * BlockVertices + v));
+				__m128i s3 = _mm_loadu_si128((const __m128i*)(s + 3 * BlockVertices + v));
+				__m128i lo01 = _mm_unpacklo_epi8(s0, s1), hi01 = _mm_unpackhi_epi8(s0, s1);
+				__m128i lo23 = _mm_unpacklo_epi8(s2, s3), hi23 = _mm_unpackhi_epi8(s2, s3);
+
+				alignas(16) uint32 words[GroupSize];
+				_mm_store_si128((__m128i*)words, _mm_unpacklo_epi16(lo01, lo23));
+				_mm_store_si128((__m128i*)(words + 4), _mm_unpackhi_epi16(lo01, lo23));
+				_mm_store_si128((__m128i*)(words + 8), _mm_unpacklo_epi16(hi01, hi23));
+				_mm_store_si128((__m128i*)(words + 12), _mm_unpackhi_epi16(hi01, hi23));
+
+				const std::size_t n = count - v < GroupSize ? count - v : GroupSize;
+				uint8* vertex = vertices + v * vertexStride + k;
+				for (std::size_t i = 0; i < n; ++i, vertex += vertexStride)
+					std::memcpy(vertex, &words[i], sizeof(uint32));
+			}
+		}
+#endif
+		for (; k < vertexStride; ++k)
+		{
+			const uint8* s = streams + k * BlockVertices;
+			for (std::size_t v = 0; v < count; ++v)
+				vertices[v * vertexStride + k] = s[v];
+		}
+	}
+
+	uint32 ReadIndex(const uint8* indices, std::size_t indexSize, std::size_t i)
+	{
+		if (indexSize == 2)
+		{
+			std::uint16_t v;
+			std::memcpy(&v, indices + i * 2, 2);
+			return v;
+		}
+		uint32 v;
+		std::memcpy(&v, indices + i * 4, 4);
+		return v;
+	}
+
+	void WriteVarint(std::vector<uint8>& out, uint64 value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back((uint8)(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back((uint8)value);
+	}
+
+	bool ReadVarint(const uint8*& p, const uint8* end, uint64& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (p == end)
+				return false;
+			uint8 b = *p++;
+			value |= (uint64)(b & 0x7f) << shift;
+			if ((b & 0x80) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	// What the encoder and the decoder both remember of the triangles so far.  Both start
+	// from zeroed FIFOs, so every entry can be referred to from the first triangle on.
+	struct IndexState
+	{
+		uint32 EdgeA[FifoSize] = {};
+		uint32 EdgeB[FifoSize] = {};
+		uint32 EdgeHead = 0;
+		uint32 Vertices[FifoSize] = {};
+		uint32 VertexHead = 0;
+		uint32 Next = 0;   // the vertex a new vertex most likely is
+		uint32 Last = 0;   // the last vertex coded explicitly
+
+		void PushEdge(uint32 a, uint32 b)
+		{
+			EdgeA[EdgeHead] = a;
+			EdgeB[EdgeHead] = b;
+			EdgeHead = (EdgeHead + 1) & (FifoSize - 1);
+		}
+
+		void PushVertex(uint32 v)
+		{
+			Vertices[VertexHead] = v;
+			VertexHead = (VertexHead + 1) & (FifoSize - 1);
+		}
+
+		// Entry i back from the most recent.
+		uint32 EdgeSlot(uint32 i)const { return (EdgeHead - 1 - i) & (FifoSize - 1); }
+		uint32 Vertex(uint32 i)const { return Vertices[(VertexHead - 1 - i) & (FifoSize - 1)]; }
+	};
+
+	// A vertex is 0 for the next one, 1 + i for vertex FIFO entry i, or an explicit delta.
+	void WriteVertex(std::vector<uint8>& out, IndexState& state, uint32 v)
+	{
+		if (v == state.Next)
+		{
+			WriteVarint(out, 0);
+			state.Next++;
+			state.PushVertex(v);
+			return;
+		}
+
+		for (uint32 i = 0; i < FifoSize; ++i)
+		{
+			if (state.Vertex(i) == v)
+			{
+				WriteVarint(out, 1 + i);
+				return;
+			}
+		}
+
+		std::int32_t delta = (std::int32_t)(v - state.Last);
+		WriteVarint(out, VertexExplicit + (uint32)((uint32)delta << 1 ^ (uint32)(delta >> 31)));
+		state.Last = v;
+		state.PushVertex(v);
+	}
+
+	inline bool ReadVertex(const uint8*& p, const uint8* end, IndexState& state, uint32& v)
+	{
+		uint64 code;
+		if (p != end && *p < 0x80)
+			code = *p++;
+		else if (!ReadVarint(p, end, code))
+			return false;
+
+		if (code == 0)
+		{
+			v = state.Next++;
+			state.PushVertex(v);
+		}
+		else if (code < VertexExplicit)
+		{
+			v = state.Vertex((uint32)(code - 1));
+		}
+		else
+		{
+			if (code - VertexExplicit > 0xffffffffu)
+				return false;
+			uint32 z = (uint32)(code - VertexExplicit);
+			v = state.Last + ((z >> 1) ^ (0u - (z & 1)));
+			state.Last = v;
+			state.PushVertex(v);
+		}
+		return true;
+	}
+
+	// Where the second and third vertex go for each rotation of a triangle.
+	const uint32 Rotated[3][3] = { { 0, 1, 2 }, { 1, 2, 0 }, { 2, 0, 1 } };
+
+	template<typename Index>
+	bool DecodeTriangles(Index* dst, std::size_t triangleCount, const uint8* codes, const uint8* p, const uint8* end)
+	{
+		const uint32 largest = (uint32)(Index)~0u;
+
+		IndexState state;
+		for (std::size_t t = 0; t < triangleCount; ++t, dst += 3)
+		{
+			const uint32 code = codes[t];
+			const uint32 edge = code >> 4;
+			uint32 tri[3];
+
+			if (edge == EdgeMiss)
+			{
+				if ((code & 15) != 0 || !ReadVertex(p, end, state, tri[0]) || !ReadVertex(p, end, state, tri[1]) ||
+					!ReadVertex(p, end, state, tri[2]))
+					return false;
+				state.PushEdge(tri[1], tri[0]);
+				state.PushEdge(tri[2], tri[1]);
+				state.PushEdge(tri[0], tri[2]);
+			}
+			else
+			{
+				const uint32 rotation = code & 3;
+				if (rotation > 2 || (code & 8) != 0)
+					return false;
+
+				const uint32 slot = state.EdgeSlot(edge);
+				const uint32 a = state.EdgeA[slot], b = state.EdgeB[slot];
+				uint32 c;
+				if (code & CodeNextVertex)
+				{
+					c = state.Next++;
+					state.PushVertex(c);
+				}
+				else if (!ReadVertex(p, end, state, c))
+				{
+					return false;
+				}
+
+				tri[Rotated[rotation][0]] = a;
+				tri[Rotated[rotation][1]] = b;
+				tri[Rotated[rotation][2]] = c;
+				state.PushEdge(c, b);
+				state.PushEdge(a, c);
+			}
+
+			if ((tri[0] | tri[1] | tri[2]) > largest)
+				return false;
+			dst[0] = (Index)tri[0];
+			dst[1] = (Index)tri[1];
+			dst[2] = (Index)tri[2];
+		}
+
+		return p == end;
+	}
+}
+
+void MeshCodec::EncodeVertexBuffer(const void* vertices, std::size_t vertexCount, std::size_t vertexStride,
+	std::vector<std::uint8_t>& out)
+{
+	const uint8* src = (const uint8*)vertices;
+
+	out.clear();
+	out.push_back(VertexVersion);
+
+	uint8 last[MaxVertexStride] = {};
+	uint8 stream[BlockVertices];
+	for (std::size_t start = 0; start < vertexCount; start += BlockVertices)
+	{
+		const std::size_t count = vertexCount - start < BlockVertices ? vertexCount - start : BlockVertices;
+		const std::size_t groups = (count + GroupSize - 1) / GroupSize;
+
+		for (std::size_t k = 0; k < vertexStride; ++k)
+		{
+			uint8 previous = last[k];
+			for (std::size_t v = 0; v < count; ++v)
+			{
+				uint8 b = src[(start + v) * vertexStride + k];
+				stream[v] = Zigzag8((uint8)(b - previous));
+				previous = b;
+			}
+			std::memset(stream + count, 0, groups * GroupSize - count);
+			last[k] = previous;
+
+			const std::size_t header = out.size();
+			out.resize(header + (groups + 3) / 4, 0);
+			for (std::size_t g = 0; g < groups; ++g)
+			{
+				std::size_t mode = ModeOf(stream + g * GroupSize);
+				out[header + g / 4] |= (uint8)(mode << (2 * (g % 4)));
+				WriteGroup(out, stream + g * GroupSize, mode);
+			}
+		}
+	}
+}
+
+bool MeshCodec::DecodeVertexBuffer(void* vertices, std::size_t vertexCount, std::size_t vertexStride,
+	const std::uint8_t* data, std::size_t size)
+{
+	if (vertexStride == 0 || vertexStride > MaxVertexStride || size == 0 || data[0] != VertexVersion)
+		return false;
+
+	uint8* dst = (uint8*)vertices;
+	const uint8* p = data + 1;
+	const uint8* end = data + size;
+
+	uint8 last[MaxVertexStride] = {};
+	std::vector<uint8> streams(vertexStride * BlockVertices);
+	for (std::size_t start = 0; start < vertexCount; start += BlockVertices)
+	{
+		const std::size_t count = vertexCount - start < BlockVertices ? vertexCount - start : BlockVertices;
+		const std::size_t groups = (count + GroupSize - 1) / GroupSize;
+		const std::size_t headerBytes = (groups + 3) / 4;
+
+		for (std::size_t k = 0; k < vertexStride; ++k)
+		{
+			uint8* stream = streams.data() + k * BlockVertices;
+			if ((std::size_t)(end - p) < headerBytes)
+				return false;
+			const uint8* header = p;
+			p += headerBytes;
+
+			uint8 previous = last[k];
+			for (std::size_t g = 0; g < groups; ++g)
+			{
+				std::size_t mode = (header[g / 4] >> (2 * (g % 4))) & 3;
+				if ((std::size_t)(end - p) < GroupBytes[mode])
+					return false;
+				DecodeGroup(p, mode, previous, stream + g * GroupSize);
+				p += GroupBytes[mode];
+				previous = stream[g * GroupSize + GroupSize - 1];
+			}
+			last[k] = stream[count - 1];
+		}
+
+		// Back from one stream per byte to whole vertices.
+		TransposeBlock(streams.data(), count, vertexStride, dst + start * vertexStride);
+	}
+
+	return p == end;
+}
+
+void MeshCodec::EncodeIndexBuffer(const void* indices, std::size_t indexCount, std::size_t indexSize,
+	std::vector<std::uint8_t>& out)
+{
+	const uint8* src = (const uint8*)indices;
+	const std::size_t triangleCount = indexCount / 3;
+
+	// The version, one code byte per triangle, then the vertices that need more.
+	out.assign(1 + triangleCount, 0);
+	out[0] = IndexVersion;
+
+	IndexState state;
+	for (std::size_t t = 0; t < triangleCount; ++t)
+	{
+		const uint32 tri[3] = { ReadIndex(src, indexSize, 3 * t), ReadIndex(src, indexSize, 3 * t + 1),
+			ReadIndex(src, indexSize, 3 * t + 2) };
+
+		uint32 edge = EdgeMiss;
+		uint32 rotation = 0;
+		for (uint32 i = 0; i < EdgeMiss && edge == EdgeMiss; ++i)
+		{
+			const uint32 slot = state.EdgeSlot(i);
+			for (uint32 r = 0; r < 3; ++r)
+			{
+				if (state.EdgeA[slot] == tri[r] && state.EdgeB[slot] == tri[(r + 1) % 3])
+				{
+					edge = i;
+					rotation = r;
+					break;
+				}
+			}
+		}
+
+		if (edge == EdgeMiss)
+		{
+			out[1 + t] = (uint8)(EdgeMiss << 4);
+			WriteVertex(out, state, tri[0]);
+			WriteVertex(out, state, tri[1]);
+			WriteVertex(out, state, tri[2]);
+			state.PushEdge(tri[1], tri[0]);
+			state.PushEdge(tri[2], tri[1]);
+			state.PushEdge(tri[0], tri[2]);
+			continue;
+		}
+
+		const uint32 a = tri[rotation], b = tri[(rotation + 1) % 3], c = tri[(rotation + 2) % 3];
+		uint32 code = edge << 4 | rotation;
+		if (c == state.Next)
+		{
+			code |= CodeNextVertex;
+			state.Next++;
+			state.PushVertex(c);
+		}
+		else
+		{
+			WriteVertex(out, state, c);
+		}
+		out[1 + t] = (uint8)code;
+
+		// The neighbours across the two new edges walk them the other way round.
+		state.PushEdge(c, b);
+		state.PushEdge(a, c);
+	}
+}
+
+bool MeshCodec::DecodeIndexBuffer(void* indices, std::size_t indexCount, std::size_t indexSize,
+	const std::uint8_t* data, std::size_t size)
+{
+	const std::size_t triangleCount = indexCount / 3;
+	if (indexCount % 3 != 0 || (indexSize != 2 && indexSize != 4) || size < 1 + triangleCount ||
+		data[0] != IndexVersion)
+		return false;
+
+	const uint8* codes = data + 1;
+	if (indexSize == 2)
+		return DecodeTriangles((std::uint16_t*)indices, triangleCount, codes, codes + triangleCount, data + size);
+	return DecodeTriangles((uint32*)indices, triangleCount, codes, codes + triangleCount, data + size);
+}
@@ -0,0 +1,45 @@
+//***************************************************************************************
+// MeshCodec.h
+//
+// Lossless compression made for vertex and index buffers, so cooked geometry costs less
+// disk and IO without costing load time.
+//
+// Vertex buffers: every byte is replaced by its difference from the same byte of the
+// previous vertex, and the buffer is transposed so each byte position of the vertex
+// forms its own stream.  Neighbouring vertices are alike, so most streams are small
+// numbers; they are packed 16 at a time in 0, 2, 4 or 8 bits each.  Decoding a group of
+// 16 is a handful of SSE2 instructions.
+//
+// Index buffers: triangles are coded against the edges and vertices of the triangles
+// just before them.  A triangle that shares an edge with a recent one and brings the
+// next unseen vertex costs one byte, which is the usual case once the vertices are in
+// first use order (ScenePackWriter::OptimizeVertexFetch).
+//
+// Both formats start with a version byte; decoding fails on anything malformed.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace MeshCodec
+{
+	const std::size_t MaxVertexStride = 256;
+
+	// vertexStride may be 1 to MaxVertexStride bytes.
+	void EncodeVertexBuffer(const void* vertices, std::size_t vertexCount, std::size_t vertexStride,
+		std::vector<std::uint8_t>& out);
+	bool DecodeVertexBuffer(void* vertices, std::size_t vertexCount, std::size_t vertexStride,
+		const std::uint8_t* data, std::size_t size);
+
+	///<summary>
+	/// Codes a triangle list of indexSize (2 or 4) byte indices; indexCount must be a
+	/// multiple of 3.  Decoding restores the same indices in the same order.
+	///</summary>
+	void EncodeIndexBuffer(const void* indices, std::size_t indexCount, std::size_t indexSize,
+		std::vector<std::uint8_t>& out);
+	bool DecodeIndexBuffer(void* indices, std::size_t indexCount, std::size_t indexSize,
+		const std::uint8_t* data, std::size_t size);
+}
@@ -0,0 +1,147 @@
+//***************************************************************************************
+// MeshDataCache.cpp
+//***************************************************************************************
+
+#include "MeshDataCache.h"
+#include "Hash.h"
+#include <cstring>
+
+using uint8 = MeshDataCache::uint8;
+using uint32 = MeshDataCache::uint32;
+using uint64 = MeshDataCache::uint64;
+
+MeshDataCache::MeshDataCache(const std::string& path) :
+	mPath(path),
+	mFile(FileMagic, FileVersion)
+{
+}
+
+void MeshDataCache::Open()
+{
+	mFile.Open(mPath);
+}
+
+void MeshDataCache::Pack(const void* vertices, std::size_t vertexBytes, const void* indices, std::size_t indexBytes,
+	std::vector<uint8>& packed)
+{
+	uint64 sizes[2] = { vertexBytes, indexBytes };
+	packed.resize(sizeof(sizes) + vertexBytes + indexBytes);
+	std::memcpy(packed.data(), sizes, sizeof(sizes));
+	if (vertexBytes > 0)
+		std::memcpy(packed.data() + sizeof(sizes), vertices, vertexBytes);
+	if (indexBytes > 0)
+		std::memcpy(packed.data() + sizeof(sizes) + vertexBytes, indices, indexBytes);
+}
+
+bool MeshDataCache::Unpack(const std::vector<uint8>& packed, std::vector<uint8>& vertices, std::vector<uint8>& indices)
+{
+	uint64 sizes[2];
+	if (packed.size() < sizeof(sizes))
+		return false;
+	std::memcpy(sizes, packed.data(), sizeof(sizes));
+	if (sizes[0] > packed.size() - sizeof(sizes) || sizes[1] != packed.size() - sizeof(sizes) - sizes[0])
+		return false;
+
+	const uint8* data = packed.data() + sizeof(sizes);
+	vertices.assign(data, data + sizes[0]);
+	indices.assign(data + sizes[0], data + sizes[0] + sizes[1]);
+	return true;
+}
+
+void MeshDataCache::Store(const std::string& name, Policy policy, const void* vertices, std::size_t vertexBytes,
+	const void* indices, std::size_t indexBytes)
+{
+	if (policy == Policy::Keep)
+	{
+		mEntries.erase(name);
+		return;
+	}
+
+	std::vector<uint8> packed;
+	Pack(vertices, vertexBytes, indices, indexBytes, packed);
+
+	Entry entry;
+	entry.Kind = policy;
+	entry.Key = Hash::Fnv1a(packed.data(), packed.size(), Hash::Fnv1a(name));
+	entry.RawSize = packed.size();
+
+	entry.Data = std::move(packed);
+	mStats.Dropped++;
+	mStats.RawBytes += entry.RawSize;
+	mFlushed = false;
+
+	entry.Memory = TrackedMemory(MemoryTag::Geometry, entry.Data.size());
+	mEntries[name] = std::move(entry);
+}
+
+bool MeshDataCache::Contains(const std::string& name)const
+{
+	return mEntries.count(name) > 0;
+}
+
+bool MeshDataCache::Fetch(const std::string& name, std::vector<uint8>& vertices, std::vector<uint8>& indices)
+{
+	auto it = mEntries.find(name);
+	if (it == mEntries.end())
+		return false;
+
+	const Entry& entry = it->second;
+	mStats.Fetches++;
+
+	std::vector<uint8> packed;
+	if (!entry.Data.empty())
+	{
+		packed = entry.Data;
+	}
+	else
+	{
+		mStats.FileFetches++;
+		if (!mFile.Find(entry.Key, packed))
+			return false;
+	}
+
+	return Unpack(packed, vertices, indices);
+}
+
+bool MeshDataCache::Flush()
+{
+	if (mFlushed)
+		return true;
+
+	// The file is current when it holds the dropped meshes and nothing else.
+	std::map<uint64, std::vector<uint8>> dropped;
+	bool current = true;
+	for (auto& e : mEntries)
+	{
+		if (e.second.Kind != Policy::Drop)
+			continue;
+
+		std::vector<uint8> existing;
+		if (!e.second.Data.empty() && (!mFile.Find(e.second.Key, existing) || existing != e.second.Data))
+			current = false;
+		dropped[e.second.Key] = e.second.Data;
+	}
+	current = current && mFile.EntryCount() == dropped.size();
+
+	bool ok = true;
+	mStats.FileWritten = false;
+	if (!current)
+	{
+		mFile.Close();
+		ok = mFile.Rewrite(mPath, dropped);
+		mStats.FileWritten = ok;
+	}
+
+	// The memory copies only go once the file holds them; after a failed write they stay
+	// and Fetch keeps serving them from memory.
+	for (auto& e : mEntries)
+	{
+		if (!ok || e.second.Kind != Policy::Drop)
+			continue;
+		std::vector<uint8>().swap(e.second.Data);
+		e.second.Memory.Resize(0);
+	}
+
+	mFlushed = true;
+	return ok;
+}
@@ -0,0 +1,98 @@
+//***************************************************************************************
+// MeshDataCache.h
+//
+// Holds the system memory copies of mesh data that their owners no longer keep.  A mesh
+// is stored under its name with one of two policies:
+//
+//   Keep      the owner keeps its own copy; the cache stores nothing.
+//   Drop      the data goes to a memory-mapped KeyedBlobFile on disk (written by Flush)
+//             and is copied back out on demand, so it costs no resident memory.
+//
+// The file entries are keyed by the name and the contents, so a mesh that changed is a
+// miss and Flush rewrites the file with exactly the meshes dropped this run.
+//***************************************************************************************
+
+#pragma once
+
+#include "KeyedBlobFile.h"
+#include "MemoryTracker.h"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class MeshDataCache
+{
+public:
+
+	using uint8 = std::uint8_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	static const uint32 FileMagic = 0x4853454D; // 'MESH'
+	static const uint32 FileVersion = 1;
+
+	enum class Policy
+	{
+		Keep,
+		Drop
+	};
+
+	struct Stats
+	{
+		uint32 Dropped = 0;
+		uint64 RawBytes = 0;          // of the dropped meshes
+		uint32 Fetches = 0;
+		uint32 FileFetches = 0;
+		bool FileWritten = false;     // by the last Flush
+	};
+
+public:
+	explicit MeshDataCache(const std::string& path);
+	MeshDataCache(const MeshDataCache& rhs) = delete;
+	MeshDataCache& operator=(const MeshDataCache& rhs) = delete;
+
+	// Maps the file of a previous run.  A missing or stale file is simply rewritten.
+	void Open();
+
+	///<summary>
+	/// Takes a copy of a mesh's vertex and index data under policy.  Storing a name again
+	/// replaces the earlier data.
+	///</summary>
+	void Store(const std::string& name, Policy policy, const void* vertices, std::size_t vertexBytes,
+		const void* indices, std::size_t indexBytes);
+
+	// Copies the data of a dropped mesh back out.  False for unknown names.
+	bool Fetch(const std::string& name, std::vector<uint8>& vertices, std::vector<uint8>& indices);
+
+	bool Contains(const std::string& name)const;
+
+	// Writes the dropped meshes to the file, unless it already holds exactly those, and
+	// frees their memory copies.  Returns false if the file could not be written.
+	bool Flush();
+
+	const Stats& GetStats()const { return mStats; }
+
+private:
+	struct Entry
+	{
+		Policy Kind = Policy::Keep;
+		uint64 Key = 0;
+		uint64 RawSize = 0;
+		std::vector<uint8> Data;    // the dropped data until Flush
+		TrackedMemory Memory;
+	};
+
+	static void Pack(const void* vertices, std::size_t vertexBytes, const void* indices, std::size_t indexBytes,
+		std::vector<uint8>& packed);
+	static bool Unpack(const std::vector<uint8>& packed, std::vector<uint8>& vertices, std::vector<uint8>& indices);
+
+private:
+	std::string mPath;
+	KeyedBlobFile mFile;
+
+	std::unordered_map<std::string, Entry> mEntries;
+	bool mFlushed = true;
+	Stats mStats;
+};
@@ -0,0 +1,41 @@
+//***************************************************************************************
+// ParallelFor.h
+//
+// Runs fn(i) for every i in [0, count) across the available cores: the PPL on Windows,
+// elsewhere a few std::threads pulling indices from a shared counter.  Returns once
+// every call has finished.
+//***************************************************************************************
+
+#pragma once
+
+#if defined(_WIN32)
+#include <ppl.h>
+#else
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#endif
+
+template<typename Fn>
+void ParallelFor(int count, const Fn& fn)
+{
+#if defined(_WIN32)
+	concurrency::parallel_for(0, count, fn);
+#else
+	std::atomic<int> next(0);
+	auto worker = [&]()
+	{
+		for (int i = next++; i < count; i = next++)
+			fn(i);
+	};
+
+	unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < threadCount && (int)t < count; ++t)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& t : threads)
+		t.join();
+#endif
+}
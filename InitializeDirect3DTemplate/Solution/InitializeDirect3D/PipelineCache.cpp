@@ -0,0 +1,162 @@
+//***************************************************************************************
+// PipelineCache.cpp
+//***************************************************************************************
+
+#include "PipelineCache.h"
+#include "Hash.h"
+#include <algorithm>
+#include <chrono>
+
+PipelineKey::PipelineKey() :
+	mHash(Hash::Fnv1aOffset)
+{
+}
+
+void PipelineKey::Add(const void* data, std::size_t size)
+{
+	mHash = Hash::Fnv1a(data, size, mHash);
+}
+
+void PipelineKey::AddString(const char* s)
+{
+	mHash = Hash::Fnv1a(std::string(s != nullptr ? s : ""), mHash);
+}
+
+PipelineCache::PipelineCache(const std::string& cachePath) :
+	mCachePath(cachePath),
+	mFile(FileMagic, FileVersion)
+{
+}
+
+PipelineCache::~PipelineCache()
+{
+	WaitAll();
+}
+
+bool PipelineCache::Load()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mFile.Open(mCachePath);
+}
+
+void PipelineCache::Request(uint64 key, CreateFn create)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	mStats.Requests++;
+	auto existing = mEntries.find(key);
+	if (existing != mEntries.end())
+	{
+		// Share it unless it is known to have failed.
+		const std::shared_future<bool>& done = existing->second->Done;
+		if (done.wait_for(std::chrono::seconds(0)) != std::future_status::ready || done.get())
+		{
+			mStats.Deduplicated++;
+			return;
+		}
+	}
+
+	// Copy the blob out now; the mapping may be replaced by a Flush while the worker runs.
+	std::shared_ptr<std::vector<uint8>> cachedBlob = std::make_shared<std::vector<uint8>>();
+	if (!mFile.Find(key, *cachedBlob))
+		cachedBlob.reset();
+
+	auto entry = std::make_shared<Entry>();
+	mEntries[key] = entry;
+
+	// The worker only touches its own entry until it takes the lock to publish.
+	entry->Done = std::async(std::launch::async, [this, key, entry, cachedBlob, create]()
+	{
+		CreateResult result;
+		bool ok = create(cachedBlob.get(), result) && result.Object != nullptr;
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!ok)
+		{
+			mStats.Failed++;
+			return false;
+		}
+
+		if (result.UsedCachedBlob)
+			mStats.DiskHits++;
+		else
+			mStats.Compiled++;
+
+		if (!result.UsedCachedBlob && !result.Blob.empty())
+			mNewBlobs[key] = result.Blob;
+
+		entry->Result = std::move(result);
+		return true;
+	}).share();
+}
+
+std::shared_ptr<void> PipelineCache::Get(uint64 key)
+{
+	std::shared_ptr<Entry> entry;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		auto it = mEntries.find(key);
+		if (it == mEntries.end())
+			return nullptr;
+		entry = it->second;
+	}
+
+	if (!entry->Done.get())
+		return nullptr;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	return entry->Result.Object;
+}
+
+void PipelineCache::WaitAll()
+{
+	std::vector<std::shared_future<bool>> pending;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (auto& e : mEntries)
+			pending.push_back(e.second->Done);
+	}
+
+	for (auto& f : pending)
+		f.wait();
+}
+
+PipelineCache::uint32 PipelineCache::Evict(const std::vector<uint64>& liveKeys)
+{
+	WaitAll();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	uint32 evicted = 0;
+	for (auto it = mEntries.begin(); it != mEntries.end(); )
+	{
+		if (std::find(liveKeys.begin(), liveKeys.end(), it->first) == liveKeys.end())
+		{
+			it = mEntries.erase(it);
+			++evicted;
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	mStats.Evicted += evicted;
+	return evicted;
+}
+
+bool PipelineCache::Flush()
+{
+	WaitAll();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mNewBlobs.empty())
+		return true;
+
+	return mFile.Rewrite(mCachePath, mNewBlobs);
+}
+
+PipelineCache::Stats PipelineCache::GetStats()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mStats;
+}
@@ -0,0 +1,133 @@
+//***************************************************************************************
+// PipelineCache.h
+//
+// Deduplicating, asynchronous pipeline state cache.  Pipelines are identified by a key
+// hashed from a canonical form of their description (see D3D12PipelineCache.h for the
+// Direct3D side), so two requests that differ only in fields the driver ignores share
+// one pipeline object.
+//
+// Misses are created on worker threads.  The device-specific creation is a plain
+// function that receives the blob stored on disk for the key, if any, and returns the
+// pipeline object together with the blob to persist, so the cache runs the same way
+// against a stub device.
+//***************************************************************************************
+
+#pragma once
+
+#include "KeyedBlobFile.h"
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Accumulates the canonical fields of a pipeline description into a 64-bit key.
+class PipelineKey
+{
+public:
+	PipelineKey();
+
+	void Add(const void* data, std::size_t size);
+	void AddString(const char* s);
+
+	template<typename T>
+	void AddValue(const T& value)
+	{
+		Add(&value, sizeof(T));
+	}
+
+	std::uint64_t Value()const { return mHash; }
+
+private:
+	std::uint64_t mHash;
+};
+
+class PipelineCache
+{
+public:
+
+	using uint8 = std::uint8_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	static const uint32 FileMagic = 0x4F535043; // 'CPSO'
+	static const uint32 FileVersion = 1;
+
+	struct CreateResult
+	{
+		// The device object; the deleter releases it.
+		std::shared_ptr<void> Object;
+
+		// Serialized form to store on disk for the next run.  May be empty.
+		std::vector<uint8> Blob;
+
+		// True if the object was created from the cached blob.
+		bool UsedCachedBlob = false;
+	};
+
+	// cachedBlob is null when there is nothing on disk for the key.  The function should
+	// fall back to a full compile if the blob is rejected (different driver, say).
+	using CreateFn = std::function<bool(const std::vector<uint8>* cachedBlob, CreateResult& result)>;
+
+	struct Stats
+	{
+		uint32 Requests = 0;
+		uint32 Deduplicated = 0;
+		uint32 DiskHits = 0;
+		uint32 Compiled = 0;
+		uint32 Failed = 0;
+		uint32 Evicted = 0;
+	};
+
+public:
+	explicit PipelineCache(const std::string& cachePath);
+	PipelineCache(const PipelineCache& rhs) = delete;
+	PipelineCache& operator=(const PipelineCache& rhs) = delete;
+	~PipelineCache();
+
+	// Maps the cache file.  A missing or stale file just means an empty cache.
+	bool Load();
+
+	///<summary>
+	/// Starts creating the pipeline for key on a worker thread, unless a pipeline with the
+	/// same key has already been requested, in which case the existing one is shared.  A
+	/// key whose creation failed is tried again.
+	///</summary>
+	void Request(uint64 key, CreateFn create);
+
+	// Waits for the pipeline and returns it, or null if creation failed or key was never
+	// requested.
+	std::shared_ptr<void> Get(uint64 key);
+
+	void WaitAll();
+
+	// Waits for every pending creation, then drops the entries whose key is not in
+	// liveKeys and returns how many went.  The cache's reference goes with them; whoever
+	// still draws with a dropped pipeline holds its own.  Blobs already on disk stay.
+	uint32 Evict(const std::vector<uint64>& liveKeys);
+
+	// Waits for every pending creation and writes the new blobs to the cache file.
+	bool Flush();
+
+	Stats GetStats()const;
+
+private:
+	struct Entry
+	{
+		std::shared_future<bool> Done;
+		CreateResult Result;
+	};
+
+private:
+	std::string mCachePath;
+
+	mutable std::mutex mMutex;
+	KeyedBlobFile mFile;
+	std::unordered_map<uint64, std::shared_ptr<Entry>> mEntries;
+	std::map<uint64, std::vector<uint8>> mNewBlobs;
+	Stats mStats;
+};
@@ -0,0 +1,594 @@
+//***************************************************************************************
+// RenderGraph.cpp
+//***************************************************************************************
+
+#include "RenderGraph.h"
+#include <algorithm>
+#include <cassert>
+#include <queue>
+
+using namespace RenderGraphState;
+
+void RenderGraph::Reset()
+{
+	mResources.clear();
+	mPasses.clear();
+	mOrder.clear();
+	mFinalBarriers.clear();
+	mHeapSize = 0;
+	mCompiled = false;
+	mStats = Stats();
+}
+
+RenderGraph::uint32 RenderGraph::CreateTransient(const std::string& name, const TextureDesc& desc)
+{
+	Resource r;
+	r.Name = name;
+	r.Desc = desc;
+	mResources.push_back(r);
+	return (uint32)mResources.size() - 1;
+}
+
+RenderGraph::uint32 RenderGraph::Import(const std::string& name, void* native, uint32 initialState, uint32 finalState)
+{
+	Resource r;
+	r.Name = name;
+	r.Imported = true;
+	r.Native = native;
+	r.InitialState = initialState;
+	r.FinalState = finalState;
+	mResources.push_back(r);
+	return (uint32)mResources.size() - 1;
+}
+
+RenderGraph::uint32 RenderGraph::AddPass(const std::string& name, ExecuteFn execute)
+{
+	Pass p;
+	p.Name = name;
+	p.Execute = std::move(execute);
+	mPasses.push_back(std::move(p));
+	mCompiled = false;
+	return (uint32)mPasses.size() - 1;
+}
+
+void RenderGraph::Read(uint32 pass, uint32 resource, uint32 state)
+{
+	assert((state & WriteStates) == 0);
+	mPasses[pass].Uses.push_back({ resource, state, false });
+}
+
+void RenderGraph::Write(uint32 pass, uint32 resource, uint32 state)
+{
+	mPasses[pass].Uses.push_back({ resource, state, true });
+}
+
+void RenderGraph::SetSideEffect(uint32 pass)
+{
+	mPasses[pass].SideEffect = true;
+}
+
+void RenderGraph::Compile(RenderGraphBackend& backend)
+{
+	mStats = Stats();
+	mStats.Passes = (uint32)mPasses.size();
+
+	CullPasses();
+	OrderPasses();
+	PlaceTransients(backend);
+	BuildBarriers();
+
+	mCompiled = true;
+}
+
+void RenderGraph::CullPasses()
+{
+	// Dependencies follow declaration order: a read depends on the last writer, a write on
+	// the last writer and on every read since (so it cannot overtake them).
+	std::vector<int> lastWriter(mResources.size(), -1);
+	std::vector<std::vector<uint32>> readersSinceWrite(mResources.size());
+	std::vector<std::vector<uint32>> producers(mPasses.size());
+
+	for (uint32 p = 0; p < (uint32)mPasses.size(); ++p)
+	{
+		Pass& pass = mPasses[p];
+		pass.Dependencies.clear();
+		pass.Culled = true;
+
+		for (const Use& use : pass.Uses)
+		{
+			int writer = lastWriter[use.Resource];
+			if (writer >= 0 && writer != (int)p)
+			{
+				pass.Dependencies.push_back((uint32)writer);
+				producers[p].push_back((uint32)writer);
+			}
+
+			if (use.Write)
+			{
+				for (uint32 reader : readersSinceWrite[use.Resource])
+				{
+					if (reader != p)
+						pass.Dependencies.push_back(reader);
+				}
+				readersSinceWrite[use.Resource].clear();
+				lastWriter[use.Resource] = (int)p;
+			}
+			else
+			{
+				readersSinceWrite[use.Resource].push_back(p);
+			}
+		}
+
+		std::sort(pass.Dependencies.begin(), pass.Dependencies.end());
+		pass.Dependencies.erase(std::unique(pass.Dependencies.begin(), pass.Dependencies.end()), pass.Dependencies.end());
+	}
+
+	// Everything that writes an output, or is marked as having side effects, is live, and
+	// so is everything that produces what a live pass consumes.  Write-after-read edges
+	// only order passes; they do not keep the reader alive.
+	std::vector<uint32> stack;
+	for (uint32 p = 0; p < (uint32)mPasses.size(); ++p)
+	{
+		bool root = mPasses[p].SideEffect;
+		for (const Use& use : mPasses[p].Uses)
+			root = root || (use.Write && mResources[use.Resource].Imported);
+
+		if (root)
+		{
+			mPasses[p].Culled = false;
+			stack.push_back(p);
+		}
+	}
+
+	while (!stack.empty())
+	{
+		uint32 p = stack.back();
+		stack.pop_back();
+
+		for (uint32 producer : producers[p])
+		{
+			if (mPasses[producer].Culled)
+			{
+				mPasses[producer].Culled = false;
+				stack.push_back(producer);
+			}
+		}
+	}
+
+	for (const Pass& pass : mPasses)
+	{
+		if (pass.Culled)
+			mStats.CulledPasses++;
+	}
+}
+
+void RenderGraph::OrderPasses()
+{
+	// Kahn's algorithm over the live passes; ties go to declaration order so the result is
+	// deterministic and stays close to what was written.
+	std::vector<uint32> pending(mPasses.size(), 0);
+	std::vector<std::vector<uint32>> dependents(mPasses.size());
+
+	for (uint32 p = 0; p < (uint32)mPasses.size(); ++p)
+	{
+		if (mPasses[p].Culled)
+			continue;
+
+		for (uint32 d : mPasses[p].Dependencies)
+		{
+			if (mPasses[d].Culled)
+				continue;
+			pending[p]++;
+			dependents[d].push_back(p);
+		}
+	}
+
+	std::priority_queue<uint32, std::vector<uint32>, std::greater<uint32>> ready;
+	for (uint32 p = 0; p < (uint32)mPasses.size(); ++p)
+	{
+		if (!mPasses[p].Culled && pending[p] == 0)
+			ready.push(p);
+	}
+
+	mOrder.clear();
+	while (!ready.empty())
+	{
+		uint32 p = ready.top();
+		ready.pop();
+		mOrder.push_back(p);
+
+		for (uint32 d : dependents[p])
+		{
+			if (--pending[d] == 0)
+				ready.push(d);
+		}
+	}
+}
+
+void RenderGraph::PlaceTransients(RenderGraphBackend& backend)
+{
+	for (Resource& r : mResources)
+	{
+		r.FirstUse = -1;
+		r.LastUse = -1;
+		r.UsageStates = 0;
+	}
+
+	for (int pos = 0; pos < (int)mOrder.size(); ++pos)
+	{
+		for (const Use& use : mPasses[mOrder[pos]].Uses)
+		{
+			Resource& r = mResources[use.Resource];
+			if (r.FirstUse < 0)
+				r.FirstUse = pos;
+			r.LastUse = pos;
+			r.UsageStates |= use.State;
+		}
+	}
+
+	std::vector<uint32> transients;
+	for (uint32 i = 0; i < (uint32)mResources.size(); ++i)
+	{
+		Resource& r = mResources[i];
+		if (r.Imported || r.FirstUse < 0)
+			continue;
+
+		backend.GetAllocationInfo(r.Desc, r.UsageStates, r.Size, r.Alignment);
+		r.Alignment = std::max<uint64>(r.Alignment, 1);
+		transients.push_back(i);
+
+		mStats.TransientResources++;
+		mStats.TransientBytes += r.Size;
+	}
+
+	// Largest first, each at the lowest offset that does not overlap the memory of a
+	// resource whose lifetime overlaps its own.
+	std::sort(transients.begin(), transients.end(), [this](uint32 a, uint32 b)
+		{
+			if (mResources[a].Size != mResources[b].Size)
+				return mResources[a].Size > mResources[b].Size;
+			return a < b;
+		});
+
+	mHeapSize = 0;
+	std::vector<uint32> placed;
+	for (uint32 i : transients)
+	{
+		Resource& r = mResources[i];
+
+		std::vector<std::pair<uint64, uint64>> busy;
+		for (uint32 j : placed)
+		{
+			const Resource& o = mResources[j];
+			if (o.FirstUse <= r.LastUse && r.FirstUse <= o.LastUse)
+				busy.push_back({ o.Offset, o.Offset + o.Size });
+		}
+		std::sort(busy.begin(), busy.end());
+
+		uint64 offset = 0;
+		for (const auto& range : busy)
+		{
+			if (offset + r.Size <= range.first)
+				break;
+			if (range.second > offset)
+				offset = (range.second + r.Alignment - 1) / r.Alignment * r.Alignment;
+		}
+
+		r.Offset = offset;
+		mHeapSize = std::max(mHeapSize, offset + r.Size);
+		placed.push_back(i);
+	}
+
+	mStats.HeapBytes = mHeapSize;
+}
+
+void RenderGraph::BuildBarriers()
+{
+	std::vector<uint32> state(mResources.size(), Undefined);
+	for (uint32 i = 0; i < (uint32)mResources.size(); ++i)
+	{
+		if (mResources[i].Imported)
+			state[i] = mResources[i].InitialState;
+	}
+
+	// Union of the read states of resource from position pos up to its next write, so one
+	// transition covers a whole run of reads.
+	auto readRun = [this](uint32 resource, int pos)
+	{
+		uint32 states = 0;
+		for (int p = pos; p < (int)mOrder.size(); ++p)
+		{
+			bool writes = false;
+			uint32 reads = 0;
+			for (const Use& use : mPasses[mOrder[p]].Uses)
+			{
+				if (use.Resource != resource)
+					continue;
+				if (use.Write)
+					writes = true;
+				else
+					reads |= use.State;
+			}
+
+			if (writes)
+				break;
+			states |= reads;
+		}
+		return states;
+	};
+
+	for (Pass& pass : mPasses)
+		pass.Barriers.clear();
+
+	for (int pos = 0; pos < (int)mOrder.size(); ++pos)
+	{
+		Pass& pass = mPasses[mOrder[pos]];
+
+		// Combine the uses of each resource within the pass.
+		std::vector<std::pair<uint32, uint32>> required;   // resource, state
+		std::vector<bool> writes;
+		for (const Use& use : pass.Uses)
+		{
+			auto it = std::find_if(required.begin(), required.end(),
+				[&use](const std::pair<uint32, uint32>& r) { return r.first == use.Resource; });
+			if (it == required.end())
+			{
+				required.push_back({ use.Resource, use.State });
+				writes.push_back(use.Write);
+			}
+			else
+			{
+				it->second |= use.State;
+				if (use.Write)
+					writes[it - required.begin()] = true;
+			}
+		}
+
+		for (std::size_t k = 0; k < required.size(); ++k)
+		{
+			uint32 res = required[k].first;
+			uint32 target = required[k].second;
+			Resource& r = mResources[res];
+
+			if (!writes[k])
+				target = readRun(res, pos);
+
+			if (!r.Imported && r.FirstUse == pos)
+			{
+				// Memory shared with an earlier transient needs an aliasing barrier; the
+				// resource is then created directly in the state it is first used in.
+				uint32 before = ~0u;
+				int beforeLastUse = -1;
+				bool shared = false;
+				for (uint32 o = 0; o < (uint32)mResources.size(); ++o)
+				{
+					const Resource& other = mResources[o];
+					if (o == res || other.Imported || other.FirstUse < 0)
+						continue;
+					if (other.Offset >= r.Offset + r.Size || r.Offset >= other.Offset + other.Size)
+						continue;
+
+					shared = true;
+					if (other.LastUse < pos && other.LastUse > beforeLastUse)
+					{
+						before = o;
+						beforeLastUse = other.LastUse;
+					}
+				}
+
+				if (shared)
+				{
+					Barrier b;
+					b.BarrierType = Barrier::Type::Aliasing;
+					b.Resource = res;
+					b.Before = before;
+					b.After = res;
+					pass.Barriers.push_back(b);
+					mStats.AliasingBarriers++;
+				}
+
+				r.InitialState = target;
+				state[res] = target;
+				continue;
+			}
+
+			uint32 current = state[res];
+			bool satisfied = writes[k] ? current == target :
+				(current & WriteStates) == 0 && (current & required[k].second) == required[k].second;
+			if (satisfied)
+				continue;
+
+			Barrier b;
+			b.BarrierType = Barrier::Type::Transition;
+			b.Resource = res;
+			b.Before = current;
+			b.After = target;
+			pass.Barriers.push_back(b);
+			state[res] = target;
+		}
+
+		if (!pass.Barriers.empty())
+		{
+			mStats.Barriers += (uint32)pass.Barriers.size();
+			mStats.BarrierBatches++;
+		}
+	}
+
+	mFinalBarriers.clear();
+	for (uint32 i = 0; i < (uint32)mResources.size(); ++i)
+	{
+		const Resource& r = mResources[i];
+		if (!r.Imported || state[i] == r.FinalState)
+			continue;
+
+		Barrier b;
+		b.Resource = i;
+		b.Before = state[i];
+		b.After = r.FinalState;
+		mFinalBarriers.push_back(b);
+	}
+
+	if (!mFinalBarriers.empty())
+	{
+		mStats.Barriers += (uint32)mFinalBarriers.size();
+		mStats.BarrierBatches++;
+	}
+}
+
+void RenderGraph::BuildPlacements(std::vector<RenderGraphBackend::TransientPlacement>& placements)const
+{
+	placements.clear();
+	for (uint32 i = 0; i < (uint32)mResources.size(); ++i)
+	{
+		const Resource& r = mResources[i];
+		if (r.Imported || r.FirstUse < 0)
+			continue;
+
+		RenderGraphBackend::TransientPlacement placement;
+		placement.Resource = i;
+		placement.Desc = r.Desc;
+		placement.Offset = r.Offset;
+		placement.InitialState = r.InitialState;
+		placement.UsageStates = r.UsageStates;
+		placements.push_back(placement);
+	}
+}
+
+void RenderGraph::Execute(RenderGraphBackend& backend)
+{
+	if (!mCompiled)
+		Compile(backend);
+
+	std::vector<RenderGraphBackend::TransientPlacement> placements;
+	BuildPlacements(placements);
+
+	std::vector<void*> natives;
+	backend.PrepareTransients(mHeapSize, placements, natives);
+	for (std::size_t i = 0; i < placements.size() && i < natives.size(); ++i)
+		mResources[placements[i].Resource].Native = natives[i];
+
+	for (uint32 p : mOrder)
+	{
+		const Pass& pass = mPasses[p];
+		if (!pass.Barriers.empty())
+			backend.ResourceBarriers(*this, pass.Barriers);
+		if (pass.Execute)
+			pass.Execute(*this);
+	}
+
+	if (!mFinalBarriers.empty())
+		backend.ResourceBarriers(*this, mFinalBarriers);
+}
+
+void RenderGraph::ExecuteBarriers(RenderGraphBackend& backend)const
+{
+	assert(mCompiled);
+
+	std::vector<RenderGraphBackend::TransientPlacement> placements;
+	BuildPlacements(placements);
+
+	std::vector<void*> natives;
+	backend.PrepareTransients(mHeapSize, placements, natives);
+
+	for (uint32 p : mOrder)
+	{
+		if (!mPasses[p].Barriers.empty())
+			backend.ResourceBarriers(*this, mPasses[p].Barriers);
+	}
+
+	if (!mFinalBarriers.empty())
+		backend.ResourceBarriers(*this, mFinalBarriers);
+}
+
+void* RenderGraph::Native(uint32 resource)const
+{
+	return mResources[resource].Native;
+}
+
+const std::string& RenderGraph::ResourceName(uint32 resource)const
+{
+	return mResources[resource].Name;
+}
+
+const std::vector<RenderGraph::uint32>& RenderGraph::ExecutionOrder()const
+{
+	return mOrder;
+}
+
+bool RenderGraph::IsCulled(uint32 pass)const
+{
+	return mPasses[pass].Culled;
+}
+
+const std::vector<RenderGraph::Barrier>& RenderGraph::PassBarriers(uint32 pass)const
+{
+	return mPasses[pass].Barriers;
+}
+
+const std::vector<RenderGraph::Barrier>& RenderGraph::FinalBarriers()const
+{
+	return mFinalBarriers;
+}
+
+RenderGraph::uint64 RenderGraph::HeapOffset(uint32 resource)const
+{
+	return mResources[resource].Offset;
+}
+
+const RenderGraph::Stats& RenderGraph::GetStats()const
+{
+	return mStats;
+}
+
+void NullRenderGraphBackend::GetAllocationInfo(const TextureDesc& desc, uint32, uint64& size, uint64& alignment)
+{
+	const uint64 placementAlignment = 64 * 1024;
+
+	uint64 bytes = 0;
+	for (uint32 m = 0; m < std::max(desc.MipLevels, 1u); ++m)
+	{
+		uint64 w = std::max(desc.Width >> m, 1u);
+		uint64 h = std::max(desc.Height >> m, 1u);
+		bytes += w * h * desc.BytesPerPixel;
+	}
+
+	size = (bytes + placementAlignment - 1) / placementAlignment * placementAlignment;
+	alignment = placementAlignment;
+}
+
+void NullRenderGraphBackend::PrepareTransients(uint64 heapSize, const std::vector<TransientPlacement>& placements,
+	std::vector<void*>& natives)
+{
+	HeapSize = heapSize;
+
+	// Any non-null value will do; passes never dereference them under this backend.
+	natives.clear();
+	for (std::size_t i = 0; i < placements.size(); ++i)
+		natives.push_back((void*)(i + 1));
+
+	mStates.clear();
+	for (const auto& p : placements)
+	{
+		if (mStates.size() <= p.Resource)
+			mStates.resize(p.Resource + 1, ~0u);
+		mStates[p.Resource] = p.InitialState;
+	}
+}
+
+void NullRenderGraphBackend::ResourceBarriers(const RenderGraph&, const std::vector<Barrier>& barriers)
+{
+	BatchCount++;
+	for (const Barrier& b : barriers)
+	{
+		BarrierCount++;
+		if (b.BarrierType != Barrier::Type::Transition)
+			continue;
+
+		// Imported resources are not known until their first transition.
+		if (mStates.size() <= b.Resource)
+			mStates.resize(b.Resource + 1, ~0u);
+		if (mStates[b.Resource] != ~0u && mStates[b.Resource] != b.Before)
+			StateMismatch = true;
+		mStates[b.Resource] = b.After;
+	}
+}
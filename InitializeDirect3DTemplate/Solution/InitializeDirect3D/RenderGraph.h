@@ -0,0 +1,242 @@
+//***************************************************************************************
+// RenderGraph.h
+//
+// Frame graph of render passes.  Passes declare which resources they read and write and
+// in what state; Compile then works out, on the CPU and without touching the GPU:
+//
+//   - which passes contribute to an output (the rest are culled),
+//   - an execution order that respects every read/write dependency,
+//   - the state transitions each pass needs, batched into one barrier list per pass,
+//     with consecutive reads merged into a single combined read state,
+//   - placement of transient resources in one heap, with resources whose lifetimes do
+//     not overlap sharing memory, plus the aliasing barriers that requires.
+//
+// Execute hands the compiled barriers and transient layout to a backend.  The D3D12
+// backend records real barriers; NullRenderGraphBackend only validates and counts, so
+// the compile step can be exercised without a GPU.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Resource states are bit flags so several read states can be combined.
+namespace RenderGraphState
+{
+	const std::uint32_t Undefined = 0;
+	const std::uint32_t RenderTarget = 1 << 0;
+	const std::uint32_t DepthWrite = 1 << 1;
+	const std::uint32_t DepthRead = 1 << 2;
+	const std::uint32_t ShaderResource = 1 << 3;
+	const std::uint32_t UnorderedAccess = 1 << 4;
+	const std::uint32_t CopySource = 1 << 5;
+	const std::uint32_t CopyDest = 1 << 6;
+	const std::uint32_t Present = 1 << 7;
+
+	const std::uint32_t WriteStates = RenderTarget | DepthWrite | UnorderedAccess | CopyDest;
+}
+
+class RenderGraph;
+
+class RenderGraphBackend
+{
+public:
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	struct TextureDesc
+	{
+		uint32 Width = 0;
+		uint32 Height = 0;
+		uint32 Format = 0;          // backend format enum, DXGI_FORMAT for D3D12
+		uint32 BytesPerPixel = 4;
+		uint32 MipLevels = 1;
+	};
+
+	struct Barrier
+	{
+		enum class Type
+		{
+			Transition,
+			Aliasing
+		};
+
+		Type BarrierType = Type::Transition;
+		uint32 Resource = 0;
+		uint32 Before = 0;          // Transition: state before.  Aliasing: resource before, or ~0u.
+		uint32 After = 0;
+	};
+
+	// A transient resource placed at Offset in the transient heap, created in
+	// InitialState and allowed to be used in UsageStates.
+	struct TransientPlacement
+	{
+		uint32 Resource = 0;
+		TextureDesc Desc;
+		uint64 Offset = 0;
+		uint32 InitialState = 0;
+		uint32 UsageStates = 0;
+	};
+
+public:
+	virtual ~RenderGraphBackend() = default;
+
+	virtual void GetAllocationInfo(const TextureDesc& desc, uint32 usageStates, uint64& size, uint64& alignment) = 0;
+
+	// Called once per Execute before the first pass.  Returns the native objects of the
+	// transient resources, indexed like placements.
+	virtual void PrepareTransients(uint64 heapSize, const std::vector<TransientPlacement>& placements,
+		std::vector<void*>& natives) = 0;
+
+	virtual void ResourceBarriers(const RenderGraph& graph, const std::vector<Barrier>& barriers) = 0;
+};
+
+class RenderGraph
+{
+public:
+
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+	using TextureDesc = RenderGraphBackend::TextureDesc;
+	using Barrier = RenderGraphBackend::Barrier;
+	using ExecuteFn = std::function<void(const RenderGraph& graph)>;
+
+	static const uint32 InvalidResource = 0xFFFFFFFF;
+
+	struct Stats
+	{
+		uint32 Passes = 0;
+		uint32 CulledPasses = 0;
+		uint32 Barriers = 0;
+		uint32 BarrierBatches = 0;
+		uint32 AliasingBarriers = 0;
+		uint32 TransientResources = 0;
+		uint64 TransientBytes = 0;   // what the transients would need without aliasing
+		uint64 HeapBytes = 0;        // what they need with it
+		uint64 SavedBytes()const { return TransientBytes - HeapBytes; }
+	};
+
+public:
+	RenderGraph() = default;
+	RenderGraph(const RenderGraph& rhs) = delete;
+	RenderGraph& operator=(const RenderGraph& rhs) = delete;
+
+	// Drops every pass and resource so the graph can be rebuilt for the next frame.
+	void Reset();
+
+	// A resource owned by the graph for the duration of one frame.
+	uint32 CreateTransient(const std::string& name, const TextureDesc& desc);
+
+	// A resource owned outside the graph.  It is in initialState when the graph starts
+	// and is returned to finalState after the last pass.  Imported resources are outputs.
+	uint32 Import(const std::string& name, void* native, uint32 initialState, uint32 finalState);
+
+	uint32 AddPass(const std::string& name, ExecuteFn execute);
+	void Read(uint32 pass, uint32 resource, uint32 state);
+	void Write(uint32 pass, uint32 resource, uint32 state);
+
+	// Keeps the pass even if nothing reads what it writes.
+	void SetSideEffect(uint32 pass);
+
+	///<summary>
+	/// Culls, orders, computes barriers and places transient resources.  The backend is
+	/// only asked for allocation sizes.
+	///</summary>
+	void Compile(RenderGraphBackend& backend);
+
+	void Execute(RenderGraphBackend& backend);
+
+	// Hands the compiled barriers to backend without running the passes or keeping the
+	// natives it returns.  With NullRenderGraphBackend this checks the barrier stream of
+	// a graph compiled for another backend.
+	void ExecuteBarriers(RenderGraphBackend& backend)const;
+
+	void* Native(uint32 resource)const;
+	const std::string& ResourceName(uint32 resource)const;
+
+	// Compiled results.
+	const std::vector<uint32>& ExecutionOrder()const;
+	bool IsCulled(uint32 pass)const;
+	const std::vector<Barrier>& PassBarriers(uint32 pass)const;
+	const std::vector<Barrier>& FinalBarriers()const;
+	uint64 HeapOffset(uint32 resource)const;
+	const Stats& GetStats()const;
+
+private:
+	struct Resource
+	{
+		std::string Name;
+		TextureDesc Desc;
+		bool Imported = false;
+		void* Native = nullptr;
+		uint32 InitialState = 0;
+		uint32 FinalState = 0;
+
+		// Compiled.
+		uint32 UsageStates = 0;
+		uint64 Size = 0;
+		uint64 Alignment = 0;
+		uint64 Offset = 0;
+		int FirstUse = -1;      // positions in the execution order
+		int LastUse = -1;
+	};
+
+	struct Use
+	{
+		uint32 Resource = 0;
+		uint32 State = 0;
+		bool Write = false;
+	};
+
+	struct Pass
+	{
+		std::string Name;
+		ExecuteFn Execute;
+		std::vector<Use> Uses;
+		bool SideEffect = false;
+
+		// Compiled.
+		bool Culled = false;
+		std::vector<uint32> Dependencies;
+		std::vector<Barrier> Barriers;
+	};
+
+	void CullPasses();
+	void OrderPasses();
+	void PlaceTransients(RenderGraphBackend& backend);
+	void BuildBarriers();
+	void BuildPlacements(std::vector<RenderGraphBackend::TransientPlacement>& placements)const;
+
+private:
+	std::vector<Resource> mResources;
+	std::vector<Pass> mPasses;
+	std::vector<uint32> mOrder;
+	std::vector<Barrier> mFinalBarriers;
+	uint64 mHeapSize = 0;
+	bool mCompiled = false;
+	Stats mStats;
+};
+
+// Validates the barrier stream and counts it; sizes are rows of texels rounded up to
+// 64 KB like placed resources.
+class NullRenderGraphBackend : public RenderGraphBackend
+{
+public:
+	void GetAllocationInfo(const TextureDesc& desc, uint32 usageStates, uint64& size, uint64& alignment)override;
+	void PrepareTransients(uint64 heapSize, const std::vector<TransientPlacement>& placements,
+		std::vector<void*>& natives)override;
+	void ResourceBarriers(const RenderGraph& graph, const std::vector<Barrier>& barriers)override;
+
+	uint32 BarrierCount = 0;
+	uint32 BatchCount = 0;
+	uint64 HeapSize = 0;
+
+	// Set when a transition's Before does not match the state the backend tracked.
+	bool StateMismatch = false;
+
+private:
+	std::vector<std::uint32_t> mStates;
+};
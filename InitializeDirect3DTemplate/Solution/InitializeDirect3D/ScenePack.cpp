@@ -0,0 +1,777 @@
+//***************************************************************************************
+// ScenePack.cpp
+//***************************************************************************************
+
+#include "ScenePack.h"
+#include "Hash.h"
+#include "MeshCodec.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+
+using uint8 = ScenePack::uint8;
+using uint32 = ScenePack::uint32;
+using uint64 = ScenePack::uint64;
+
+namespace
+{
+	uint64 AlignUp(uint64 value, uint64 alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	uint32 ReadIndex(const uint8* indices, uint32 indexSize, uint32 i)
+	{
+		if (indexSize == 2)
+		{
+			std::uint16_t v;
+			std::memcpy(&v, indices + (size_t)i * 2, 2);
+			return v;
+		}
+		uint32 v;
+		std::memcpy(&v, indices + (size_t)i * 4, 4);
+		return v;
+	}
+
+	void WriteIndex(uint8* indices, uint32 indexSize, uint32 i, uint32 value)
+	{
+		if (indexSize == 2)
+		{
+			std::uint16_t v = (std::uint16_t)value;
+			std::memcpy(indices + (size_t)i * 2, &v, 2);
+		}
+		else
+		{
+			std::memcpy(indices + (size_t)i * 4, &value, 4);
+		}
+	}
+}
+
+bool ScenePack::Open(const std::string& path, uint64 contentKey, uint32 srvCount)
+{
+	Close();
+
+	if (!mFile.Open(path))
+		return false;
+
+	mData = mFile.Data();
+	mSize = mFile.Size();
+	if (mData == nullptr || !Validate(contentKey, srvCount))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool ScenePack::Adopt(std::vector<uint8> bytes, uint64 contentKey, uint32 srvCount)
+{
+	Close();
+
+	mOwned = std::move(bytes);
+	mData = mOwned.data();
+	mSize = mOwned.size();
+	if (mOwned.empty() || !Validate(contentKey, srvCount))
+	{
+		Close();
+		return false;
+	}
+
+	mOwnedMemory = TrackedMemory(MemoryTag::Geometry, mOwned.size());
+	return true;
+}
+
+void ScenePack::Close()
+{
+	mFile.Close();
+	std::vector<uint8>().swap(mOwned);
+	mOwnedMemory = TrackedMemory();
+	mData = nullptr;
+	mSize = 0;
+	mHeader = Header();
+	for (SectionEntry& section : mSections)
+		section = SectionEntry();
+	mMeshByName.clear();
+}
+
+bool ScenePack::Validate(uint64 contentKey, uint32 srvCount)
+{
+	if (mSize < sizeof(Header) + sizeof(mSections))
+		return false;
+
+	std::memcpy(&mHeader, mData, sizeof(Header));
+	if (mHeader.Magic != FileMagic || mHeader.Version != FileVersion || mHeader.ContentKey != contentKey ||
+		mHeader.SectionCount != (uint32)Section::Count)
+		return false;
+
+	std::memcpy(mSections, mData + sizeof(Header), sizeof(mSections));
+	for (const SectionEntry& section : mSections)
+	{
+		if (section.Offset % SectionAlignment != 0 || section.Offset > mSize || section.Size > mSize - section.Offset)
+			return false;
+	}
+
+	auto whole = [&](Section section, size_t itemSize) { return mSections[(int)section].Size % itemSize == 0; };
+	if (!whole(Section::Meshes, sizeof(Mesh)) || !whole(Section::Submeshes, sizeof(Submesh)) ||
+		!whole(Section::Materials, sizeof(Material)) || !whole(Section::Objects, sizeof(Object)) ||
+		!whole(Section::Colliders, sizeof(Collider)) || !whole(Section::Segments, sizeof(Segment)) ||
+		!whole(Section::Cells, sizeof(Cell)))
+		return false;
+
+	const uint64 stringBytes = mSections[(int)Section::Strings].Size;
+	auto validString = [&](StringRef ref) { return (uint64)ref.Offset + ref.Length <= stringBytes; };
+
+	const uint64 vertexBytes = mSections[(int)Section::VertexData].Size;
+	const uint64 indexBytes = mSections[(int)Section::IndexData].Size;
+	const Submesh* submeshes = Submeshes();
+	for (uint32 i = 0; i < MeshCount(); ++i)
+	{
+		const Mesh& mesh = Meshes()[i];
+		if (!validString(mesh.Name) || mesh.VertexStride == 0 || (mesh.IndexSize != 2 && mesh.IndexSize != 4) ||
+			mesh.VertexOffset > vertexBytes || mesh.VertexStoredBytes > vertexBytes - mesh.VertexOffset ||
+			mesh.IndexOffset > indexBytes || mesh.IndexStoredBytes > indexBytes - mesh.IndexOffset ||
+			mesh.VertexBytes % mesh.VertexStride != 0 || mesh.IndexBytes % mesh.IndexSize != 0 ||
+			(uint64)mesh.FirstSubmesh + mesh.SubmeshCount > SubmeshCount())
+			return false;
+
+		if (mesh.Encoding == MeshEncoding::Raw)
+		{
+			if (mesh.VertexStoredBytes != mesh.VertexBytes || mesh.IndexStoredBytes != mesh.IndexBytes)
+				return false;
+		}
+		else if (mesh.Encoding != MeshEncoding::Compressed || mesh.VertexStride > MeshCodec::MaxVertexStride ||
+			(mesh.IndexBytes / mesh.IndexSize) % 3 != 0)
+		{
+			return false;
+		}
+
+		uint64 indexCount = mesh.IndexBytes / mesh.IndexSize;
+		uint64 vertexCount = mesh.VertexBytes / mesh.VertexStride;
+		for (uint32 s = mesh.FirstSubmesh; s < mesh.FirstSubmesh + mesh.SubmeshCount; ++s)
+		{
+			// Levels of detail only link forward, so a chain always ends.
+			const uint32 nextLod = submeshes[s].NextLod;
+			if (!validString(submeshes[s].Name) ||
+				(uint64)submeshes[s].StartIndexLocation + submeshes[s].IndexCount > indexCount ||
+				submeshes[s].BaseVertexLocation < 0 || (uint64)submeshes[s].BaseVertexLocation > vertexCount ||
+				(nextLod != NoLod && (nextLod <= s || nextLod >= mesh.FirstSubmesh + mesh.SubmeshCount)))
+				return false;
+		}
+
+		mMeshByName[String(mesh.Name)] = (int)i;
+	}
+
+	for (uint32 i = 0; i < MaterialCount(); ++i)
+	{
+		const Material& material = Materials()[i];
+		if (!validString(material.Name) || material.DiffuseSrvHeapIndex < 0 ||
+			(uint32)material.DiffuseSrvHeapIndex >= srvCount)
+			return false;
+	}
+
+	for (uint32 i = 0; i < ObjectCount(); ++i)
+	{
+		const Object& object = Objects()[i];
+		if (object.Mesh >= MeshCount() || object.Material >= MaterialCount())
+			return false;
+
+		const Mesh& mesh = Meshes()[object.Mesh];
+		if (object.Submesh < mesh.FirstSubmesh || object.Submesh >= mesh.FirstSubmesh + mesh.SubmeshCount)
+			return false;
+	}
+
+	for (uint32 i = 0; i < CellCount(); ++i)
+	{
+		if (!validString(Cells()[i].Path))
+			return false;
+	}
+
+	return true;
+}
+
+std::string ScenePack::String(StringRef ref)const
+{
+	const char* strings = reinterpret_cast<const char*>(mData + mSections[(int)Section::Strings].Offset);
+	return std::string(strings + ref.Offset, ref.Length);
+}
+
+const uint8* ScenePack::VertexData(const Mesh& mesh)const
+{
+	return mData + mSections[(int)Section::VertexData].Offset + mesh.VertexOffset;
+}
+
+const uint8* ScenePack::IndexData(const Mesh& mesh)const
+{
+	return mData + mSections[(int)Section::IndexData].Offset + mesh.IndexOffset;
+}
+
+bool ScenePack::ReadMesh(const Mesh& mesh, const uint8*& vertices, const uint8*& indices,
+	std::vector<uint8>& vertexStorage, std::vector<uint8>& indexStorage)const
+{
+	if (mesh.Encoding == MeshEncoding::Raw)
+	{
+		vertices = VertexData(mesh);
+		indices = IndexData(mesh);
+		return IndicesInRange(mesh, indices);
+	}
+
+	vertexStorage.resize((size_t)mesh.VertexBytes);
+	indexStorage.resize((size_t)mesh.IndexBytes);
+	if (!MeshCodec::DecodeVertexBuffer(vertexStorage.data(), (size_t)(mesh.VertexBytes / mesh.VertexStride),
+			mesh.VertexStride, VertexData(mesh), (size_t)mesh.VertexStoredBytes) ||
+		!MeshCodec::DecodeIndexBuffer(indexStorage.data(), (size_t)(mesh.IndexBytes / mesh.IndexSize),
+			mesh.IndexSize, IndexData(mesh), (size_t)mesh.IndexStoredBytes))
+		return false;
+
+	vertices = vertexStorage.data();
+	indices = indexStorage.data();
+	return IndicesInRange(mesh, indices);
+}
+
+bool ScenePack::IndicesInRange(const Mesh& mesh, const uint8* indices)const
+{
+	const uint64 vertexCount = mesh.VertexBytes / mesh.VertexStride;
+	const Submesh* submeshes = Submeshes();
+	for (uint32 s = mesh.FirstSubmesh; s < mesh.FirstSubmesh + mesh.SubmeshCount; ++s)
+	{
+		// Validate has already bounded the range and the base vertex.
+		const Submesh& submesh = submeshes[s];
+		const uint64 limit = vertexCount - (uint64)submesh.BaseVertexLocation;
+		uint32 maxIndex = 0;
+		for (uint32 i = submesh.StartIndexLocation; i < submesh.StartIndexLocation + submesh.IndexCount; ++i)
+			maxIndex = std::max(maxIndex, ReadIndex(indices, mesh.IndexSize, i));
+		if (submesh.IndexCount > 0 && maxIndex >= limit)
+			return false;
+	}
+	return true;
+}
+
+int ScenePack::FindMesh(const std::string& name)const
+{
+	auto it = mMeshByName.find(name);
+	return it != mMeshByName.end() ? it->second : -1;
+}
+
+ScenePack::StringRef ScenePackWriter::AddString(const std::string& s)
+{
+	ScenePack::StringRef ref;
+	ref.Offset = (uint32)mStrings.size();
+	ref.Length = (uint32)s.size();
+	mStrings.insert(mStrings.end(), s.begin(), s.end());
+	return ref;
+}
+
+std::string ScenePackWriter::String(ScenePack::StringRef ref)const
+{
+	return std::string(mStrings.data() + ref.Offset, ref.Length);
+}
+
+void ScenePackWriter::AppendBuffer(std::vector<uint8>& section, const void* data, uint64 bytes, uint64& offset,
+	uint64& storedBytes)
+{
+	// Every buffer starts aligned, so a raw one can be handed to an upload as it is.
+	offset = AlignUp(section.size(), ScenePack::SectionAlignment);
+	storedBytes = bytes;
+	section.resize((size_t)(offset + bytes));
+	if (bytes > 0)
+		std::memcpy(section.data() + offset, data, (size_t)bytes);
+}
+
+uint32 ScenePackWriter::AddMesh(const std::string& name, uint32 vertexStride, uint32 indexSize,
+	const void* vertices, uint64 vertexBytes, const void* indices, uint64 indexBytes)
+{
+	ScenePack::Mesh mesh;
+	mesh.Name = AddString(name);
+	mesh.VertexStride = vertexStride;
+	mesh.IndexSize = indexSize;
+	mesh.FirstSubmesh = (uint32)mSubmeshes.size();
+
+	mesh.VertexBytes = vertexBytes;
+	mesh.IndexBytes = indexBytes;
+	AppendBuffer(mVertexData, vertices, vertexBytes, mesh.VertexOffset, mesh.VertexStoredBytes);
+	AppendBuffer(mIndexData, indices, indexBytes, mesh.IndexOffset, mesh.IndexStoredBytes);
+
+	mMeshes.push_back(mesh);
+	mMeshByName[name] = (uint32)mMeshes.size() - 1;
+	return (uint32)mMeshes.size() - 1;
+}
+
+void ScenePackWriter::AddSubmesh(const std::string& name, uint32 indexCount, uint32 startIndexLocation,
+	std::int32_t baseVertexLocation, const float center[3], const float extents[3])
+{
+	ScenePack::Submesh submesh;
+	submesh.Name = AddString(name);
+	submesh.IndexCount = indexCount;
+	submesh.StartIndexLocation = startIndexLocation;
+	submesh.BaseVertexLocation = baseVertexLocation;
+	std::memcpy(submesh.BoundsCenter, center, sizeof(submesh.BoundsCenter));
+	std::memcpy(submesh.BoundsExtents, extents, sizeof(submesh.BoundsExtents));
+
+	mSubmeshes.push_back(submesh);
+	mMeshes.back().SubmeshCount++;
+}
+
+uint32 ScenePackWriter::FindSubmesh(uint32 mesh, const std::string& name)const
+{
+	const ScenePack::Mesh& m = mMeshes[mesh];
+	for (uint32 s = m.FirstSubmesh; s < m.FirstSubmesh + m.SubmeshCount; ++s)
+	{
+		const ScenePack::StringRef& ref = mSubmeshes[s].Name;
+		if (name.size() == ref.Length && std::memcmp(mStrings.data() + ref.Offset, name.data(), ref.Length) == 0)
+			return s;
+	}
+	return ScenePack::NoLod;
+}
+
+bool ScenePackWriter::LinkLod(const std::string& mesh, const std::string& submesh, const std::string& coarser, float error)
+{
+	auto meshIt = mMeshByName.find(mesh);
+	if (meshIt == mMeshByName.end())
+		return false;
+
+	uint32 last = FindSubmesh(meshIt->second, submesh);
+	uint32 next = FindSubmesh(meshIt->second, coarser);
+	if (last == ScenePack::NoLod || next == ScenePack::NoLod)
+		return false;
+
+	while (mSubmeshes[last].NextLod != ScenePack::NoLod)
+		last = mSubmeshes[last].NextLod;
+	if (next <= last)
+		return false;
+
+	mSubmeshes[last].NextLod = next;
+	mSubmeshes[next].LodError = error;
+	return true;
+}
+
+uint32 ScenePackWriter::AddMaterial(const std::string& name, const ScenePack::Material& material)
+{
+	mMaterials.push_back(material);
+	mMaterials.back().Name = AddString(name);
+	mMaterialByName[name] = (uint32)mMaterials.size() - 1;
+	return (uint32)mMaterials.size() - 1;
+}
+
+bool ScenePackWriter::AddObject(const std::string& mesh, const std::string& submesh, const std::string& material,
+	const float world[16], const float texTransform[16], uint32 layer)
+{
+	auto meshIt = mMeshByName.find(mesh);
+	auto materialIt = mMaterialByName.find(material);
+	if (meshIt == mMeshByName.end() || materialIt == mMaterialByName.end())
+		return false;
+
+	ScenePack::Object object;
+	object.Mesh = meshIt->second;
+	object.Material = materialIt->second;
+	object.Layer = layer;
+	std::memcpy(object.World, world, sizeof(object.World));
+	std::memcpy(object.TexTransform, texTransform, sizeof(object.TexTransform));
+
+	object.Submesh = FindSubmesh(object.Mesh, submesh);
+	if (object.Submesh == ScenePack::NoLod)
+		return false;
+
+	mObjects.push_back(object);
+	return true;
+}
+
+void ScenePackWriter::AddCollider(const float center[3], const float extents[3])
+{
+	ScenePack::Collider collider;
+	std::memcpy(collider.Center, center, sizeof(collider.Center));
+	std::memcpy(collider.Extents, extents, sizeof(collider.Extents));
+	mColliders.push_back(collider);
+}
+
+void ScenePackWriter::AddSegment(float x0, float z0, float x1, float z1)
+{
+	mSegments.push_back({ x0, z0, x1, z1 });
+}
+
+void ScenePackWriter::AddCell(const ScenePack::Cell& cell, const std::string& path)
+{
+	mCells.push_back(cell);
+	mCells.back().Path = AddString(path);
+}
+
+bool ScenePackWriter::CopyObjects(const std::vector<uint32>& objects, bool allMaterials, ScenePackWriter& out)const
+{
+	std::vector<bool> usedMaterials(mMaterials.size(), allMaterials);
+	std::map<uint32, std::set<uint32>> usedSubmeshes;
+	for (uint32 o : objects)
+	{
+		usedMaterials[mObjects[o].Material] = true;
+		for (uint32 s = mObjects[o].Submesh; s != ScenePack::NoLod; s = mSubmeshes[s].NextLod)
+			usedSubmeshes[mObjects[o].Mesh].insert(s);
+	}
+
+	// Materials keep their order, so a copy of all of them keeps their indices.
+	for (size_t m = 0; m < mMaterials.size(); ++m)
+	{
+		if (usedMaterials[m])
+			out.AddMaterial(String(mMaterials[m].Name), mMaterials[m]);
+	}
+
+	std::vector<uint8> vertices;
+	std::vector<uint8> indices;
+	for (const auto& used : usedSubmeshes)
+	{
+		const ScenePack::Mesh& mesh = mMeshes[used.first];
+		if (mesh.Encoding != ScenePack::MeshEncoding::Raw)
+			return false;
+
+		const uint8* sourceVertices = mVertexData.data() + mesh.VertexOffset;
+		const uint8* sourceIndices = mIndexData.data() + mesh.IndexOffset;
+		const uint64 vertexCount = mesh.VertexBytes / mesh.VertexStride;
+
+		// Every submesh gets the vertex range its indices read, with the indices made
+		// relative to the start of that range.
+		struct Placed
+		{
+			uint32 Submesh;
+			uint32 StartIndexLocation;
+			std::int32_t BaseVertexLocation;
+		};
+		std::vector<Placed> placed;
+		vertices.clear();
+		indices.clear();
+		for (uint32 s : used.second)
+		{
+			const ScenePack::Submesh& submesh = mSubmeshes[s];
+			uint32 first = 0xffffffffu, last = 0;
+			for (uint32 i = 0; i < submesh.IndexCount; ++i)
+			{
+				uint32 index = ReadIndex(sourceIndices, mesh.IndexSize, submesh.StartIndexLocation + i);
+				first = std::min(first, index);
+				last = std::max(last, index);
+			}
+			if (submesh.IndexCount == 0)
+				first = last = 0;
+
+			std::int64_t firstVertex = (std::int64_t)submesh.BaseVertexLocation + first;
+			std::int64_t lastVertex = (std::int64_t)submesh.BaseVertexLocation + last;
+			if (submesh.IndexCount > 0 && (firstVertex < 0 || lastVertex >= (std::int64_t)vertexCount))
+				return false;
+
+			Placed p = { s, (uint32)(indices.size() / mesh.IndexSize), (std::int32_t)(vertices.size() / mesh.VertexStride) };
+			placed.push_back(p);
+
+			if (submesh.IndexCount > 0)
+			{
+				const size_t stride = mesh.VertexStride;
+				const uint8* range = sourceVertices + (size_t)firstVertex * stride;
+				vertices.insert(vertices.end(), range, range + (size_t)(last - first + 1) * stride);
+			}
+
+			indices.resize(indices.size() + (size_t)submesh.IndexCount * mesh.IndexSize);
+			for (uint32 i = 0; i < submesh.IndexCount; ++i)
+			{
+				uint32 index = ReadIndex(sourceIndices, mesh.IndexSize, submesh.StartIndexLocation + i);
+				WriteIndex(indices.data(), mesh.IndexSize, p.StartIndexLocation + i, index - first);
+			}
+		}
+
+		out.AddMesh(String(mesh.Name), mesh.VertexStride, mesh.IndexSize, vertices.data(), vertices.size(),
+			indices.data(), indices.size());
+
+		// The copies keep the order of the originals, so the level of detail links still
+		// point forward.
+		std::map<uint32, uint32> copies;
+		for (const Placed& p : placed)
+		{
+			const ScenePack::Submesh& submesh = mSubmeshes[p.Submesh];
+			copies[p.Submesh] = (uint32)out.mSubmeshes.size();
+			out.AddSubmesh(String(submesh.Name), submesh.IndexCount, p.StartIndexLocation, p.BaseVertexLocation,
+				submesh.BoundsCenter, submesh.BoundsExtents);
+			out.mSubmeshes.back().LodError = submesh.LodError;
+		}
+		for (const Placed& p : placed)
+		{
+			uint32 next = mSubmeshes[p.Submesh].NextLod;
+			if (next != ScenePack::NoLod)
+				out.mSubmeshes[copies[p.Submesh]].NextLod = copies[next];
+		}
+	}
+
+	for (uint32 o : objects)
+	{
+		const ScenePack::Object& object = mObjects[o];
+		if (!out.AddObject(String(mMeshes[object.Mesh].Name), String(mSubmeshes[object.Submesh].Name),
+			String(mMaterials[object.Material].Name), object.World, object.TexTransform, object.Layer))
+			return false;
+	}
+	return true;
+}
+
+bool ScenePackWriter::SplitCells(float cellSize, ScenePackWriter& global, std::vector<CellContents>& cells)const
+{
+	cells.clear();
+
+	std::vector<uint32> globalObjects;
+	std::map<std::pair<std::int32_t, std::int32_t>, std::vector<uint32>> cellObjects;
+	std::map<std::pair<std::int32_t, std::int32_t>, CellContents> contents;
+
+	for (uint32 o = 0; o < (uint32)mObjects.size(); ++o)
+	{
+		const ScenePack::Object& object = mObjects[o];
+		const ScenePack::Submesh& submesh = mSubmeshes[object.Submesh];
+		const float* m = object.World;
+
+		// Bounds on the ground plane of the world space box around the submesh's bounds;
+		// the world matrix is row major, for row vectors.
+		float center[2], extents[2];
+		for (int axis = 0, column = 0; axis < 2; ++axis, column += 2)
+		{
+			center[axis] = m[12 + column];
+			extents[axis] = 0.0f;
+			for (int row = 0; row < 3; ++row)
+			{
+				center[axis] += submesh.BoundsCenter[row] * m[row * 4 + column];
+				extents[axis] += submesh.BoundsExtents[row] * std::fabs(m[row * 4 + column]);
+			}
+		}
+
+		if (cellSize <= 0.0f || 2.0f * extents[0] > cellSize || 2.0f * extents[1] > cellSize)
+		{
+			globalObjects.push_back(o);
+			continue;
+		}
+
+		auto key = std::make_pair((std::int32_t)std::floor(center[0] / cellSize), (std::int32_t)std::floor(center[1] / cellSize));
+		std::vector<uint32>& objects = cellObjects[key];
+		CellContents& cell = contents[key];
+		for (int axis = 0; axis < 2; ++axis)
+		{
+			float lo = center[axis] - extents[axis];
+			float hi = center[axis] + extents[axis];
+			cell.Min[axis] = objects.empty() ? lo : std::min(cell.Min[axis], lo);
+			cell.Max[axis] = objects.empty() ? hi : std::max(cell.Max[axis], hi);
+		}
+		cell.X = key.first;
+		cell.Z = key.second;
+		objects.push_back(o);
+	}
+
+	if (!CopyObjects(globalObjects, true, global))
+		return false;
+	global.mColliders = mColliders;
+	global.mSegments = mSegments;
+
+	for (auto& entry : contents)
+	{
+		CellContents& cell = entry.second;
+		cell.Writer = std::make_unique<ScenePackWriter>();
+		if (!CopyObjects(cellObjects[entry.first], false, *cell.Writer))
+			return false;
+		cells.push_back(std::move(cell));
+	}
+	return true;
+}
+
+bool ScenePackWriter::ReorderMesh(const ScenePack::Mesh& mesh)
+{
+	if (mesh.Encoding != ScenePack::MeshEncoding::Raw)
+		return false;
+
+	uint8* vertices = mVertexData.data() + mesh.VertexOffset;
+	uint8* indices = mIndexData.data() + mesh.IndexOffset;
+	const uint32 vertexCount = (uint32)(mesh.VertexBytes / mesh.VertexStride);
+
+	// The vertex range each submesh reads; they must not overlap.
+	struct Range
+	{
+		uint32 Submesh, First, Last;
+	};
+	std::vector<Range> ranges;
+	for (uint32 s = mesh.FirstSubmesh; s < mesh.FirstSubmesh + mesh.SubmeshCount; ++s)
+	{
+		const ScenePack::Submesh& submesh = mSubmeshes[s];
+		if (submesh.IndexCount == 0)
+			continue;
+
+		Range range = { s, 0xffffffffu, 0 };
+		for (uint32 i = 0; i < submesh.IndexCount; ++i)
+		{
+			std::int64_t v = (std::int64_t)ReadIndex(indices, mesh.IndexSize, submesh.StartIndexLocation + i) +
+				submesh.BaseVertexLocation;
+			if (v < 0 || v >= vertexCount)
+				return false;
+			range.First = std::min(range.First, (uint32)v);
+			range.Last = std::max(range.Last, (uint32)v);
+		}
+		ranges.push_back(range);
+	}
+
+	std::sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b) { return a.First < b.First; });
+	for (size_t i = 1; i < ranges.size(); ++i)
+	{
+		if (ranges[i].First <= ranges[i - 1].Last)
+			return false;
+	}
+
+	std::vector<uint8> reordered;
+	std::vector<uint32> remap;
+	for (const Range& range : ranges)
+	{
+		const ScenePack::Submesh& submesh = mSubmeshes[range.Submesh];
+		const uint32 count = range.Last - range.First + 1;
+
+		// New slot of every vertex in the range: first use order, then the unused ones.
+		remap.assign(count, 0xffffffffu);
+		uint32 next = 0;
+		for (uint32 i = 0; i < submesh.IndexCount; ++i)
+		{
+			uint32 v = ReadIndex(indices, mesh.IndexSize, submesh.StartIndexLocation + i) + submesh.BaseVertexLocation;
+			if (remap[v - range.First] == 0xffffffffu)
+				remap[v - range.First] = next++;
+		}
+		for (uint32& slot : remap)
+		{
+			if (slot == 0xffffffffu)
+				slot = next++;
+		}
+
+		const size_t stride = mesh.VertexStride;
+		reordered.resize(count * stride);
+		for (uint32 v = 0; v < count; ++v)
+			std::memcpy(reordered.data() + remap[v] * stride, vertices + (range.First + v) * stride, stride);
+		std::memcpy(vertices + range.First * stride, reordered.data(), reordered.size());
+
+		for (uint32 i = 0; i < submesh.IndexCount; ++i)
+		{
+			uint32 at = submesh.StartIndexLocation + i;
+			uint32 v = ReadIndex(indices, mesh.IndexSize, at) + submesh.BaseVertexLocation;
+			WriteIndex(indices, mesh.IndexSize, at, range.First + remap[v - range.First] - submesh.BaseVertexLocation);
+		}
+	}
+
+	return true;
+}
+
+uint32 ScenePackWriter::OptimizeVertexFetch()
+{
+	uint32 reordered = 0;
+	for (const ScenePack::Mesh& mesh : mMeshes)
+	{
+		if (ReorderMesh(mesh))
+			++reordered;
+	}
+	return reordered;
+}
+
+uint64 ScenePackWriter::CompressGeometry()
+{
+	std::vector<uint8> vertexData;
+	std::vector<uint8> indexData;
+	std::vector<uint8> encodedVertices;
+	std::vector<uint8> encodedIndices;
+	uint64 saved = 0;
+
+	for (ScenePack::Mesh& mesh : mMeshes)
+	{
+		const uint8* vertices = mVertexData.data() + mesh.VertexOffset;
+		const uint8* indices = mIndexData.data() + mesh.IndexOffset;
+		const uint64 indexCount = mesh.IndexBytes / mesh.IndexSize;
+
+		// Raw is kept where the codec does not apply or does not pay.
+		uint64 storedBefore = mesh.VertexStoredBytes + mesh.IndexStoredBytes;
+		bool compress = mesh.Encoding == ScenePack::MeshEncoding::Raw &&
+			mesh.VertexStride <= MeshCodec::MaxVertexStride && indexCount % 3 == 0;
+
+		if (compress)
+		{
+			MeshCodec::EncodeVertexBuffer(vertices, (size_t)(mesh.VertexBytes / mesh.VertexStride), mesh.VertexStride,
+				encodedVertices);
+			MeshCodec::EncodeIndexBuffer(indices, (size_t)indexCount, mesh.IndexSize, encodedIndices);
+			compress = encodedVertices.size() + encodedIndices.size() < storedBefore;
+		}
+
+		if (compress)
+		{
+			mesh.Encoding = ScenePack::MeshEncoding::Compressed;
+			AppendBuffer(vertexData, encodedVertices.data(), encodedVertices.size(), mesh.VertexOffset, mesh.VertexStoredBytes);
+			AppendBuffer(indexData, encodedIndices.data(), encodedIndices.size(), mesh.IndexOffset, mesh.IndexStoredBytes);
+			saved += storedBefore - mesh.VertexStoredBytes - mesh.IndexStoredBytes;
+		}
+		else
+		{
+			AppendBuffer(vertexData, vertices, mesh.VertexStoredBytes, mesh.VertexOffset, mesh.VertexStoredBytes);
+			AppendBuffer(indexData, indices, mesh.IndexStoredBytes, mesh.IndexOffset, mesh.IndexStoredBytes);
+		}
+	}
+
+	mVertexData.swap(vertexData);
+	mIndexData.swap(indexData);
+	return saved;
+}
+
+uint64 ScenePackWriter::GeometryBytes()const
+{
+	uint64 bytes = 0;
+	for (const ScenePack::Mesh& mesh : mMeshes)
+		bytes += mesh.VertexBytes + mesh.IndexBytes;
+	return bytes;
+}
+
+uint64 ScenePackWriter::Build(uint64 contentKey, double cookMilliseconds, std::vector<uint8>& bytes)const
+{
+	ScenePack::Header header;
+	header.ContentKey = contentKey;
+	header.CookMilliseconds = cookMilliseconds;
+
+	struct Source
+	{
+		const void* Data;
+		uint64 Size;
+	};
+	const Source sources[(int)ScenePack::Section::Count] =
+	{
+		{ mStrings.data(), mStrings.size() },
+		{ mMeshes.data(), mMeshes.size() * sizeof(ScenePack::Mesh) },
+		{ mSubmeshes.data(), mSubmeshes.size() * sizeof(ScenePack::Submesh) },
+		{ mMaterials.data(), mMaterials.size() * sizeof(ScenePack::Material) },
+		{ mObjects.data(), mObjects.size() * sizeof(ScenePack::Object) },
+		{ mColliders.data(), mColliders.size() * sizeof(ScenePack::Collider) },
+		{ mSegments.data(), mSegments.size() * sizeof(ScenePack::Segment) },
+		{ mCells.data(), mCells.size() * sizeof(ScenePack::Cell) },
+		{ mVertexData.data(), mVertexData.size() },
+		{ mIndexData.data(), mIndexData.size() },
+	};
+
+	ScenePack::SectionEntry sections[(int)ScenePack::Section::Count];
+	uint64 offset = sizeof(header) + sizeof(sections);
+	header.ContentHash = Hash::Fnv1aOffset;
+	for (int i = 0; i < (int)ScenePack::Section::Count; ++i)
+	{
+		header.ContentHash = Hash::Fnv1aValue(sources[i].Size, header.ContentHash);
+		header.ContentHash = Hash::Fnv1a(sources[i].Data, (size_t)sources[i].Size, header.ContentHash);
+
+		offset = AlignUp(offset, ScenePack::SectionAlignment);
+		sections[i].Offset = offset;
+		sections[i].Size = sources[i].Size;
+		offset += sources[i].Size;
+	}
+
+	bytes.assign((size_t)offset, 0);
+	std::memcpy(bytes.data(), &header, sizeof(header));
+	std::memcpy(bytes.data() + sizeof(header), sections, sizeof(sections));
+	for (int i = 0; i < (int)ScenePack::Section::Count; ++i)
+	{
+		if (sources[i].Size > 0)
+			std::memcpy(bytes.data() + sections[i].Offset, sources[i].Data, (size_t)sources[i].Size);
+	}
+	return header.ContentHash;
+}
+
+bool ScenePackWriter::WriteFile(const std::string& path, const std::vector<uint8>& bytes)
+{
+	std::ofstream fout(path, std::ios::binary | std::ios::trunc);
+	if (!fout)
+		return false;
+
+	fout.write((const char*)bytes.data(), bytes.size());
+	return (bool)fout;
+}
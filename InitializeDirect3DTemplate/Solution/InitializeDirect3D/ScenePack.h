@@ -0,0 +1,352 @@
+//***************************************************************************************
+// ScenePack.h
+//
+// A cooked scene in one relocatable file: static geometry with its submeshes and bounds,
+// the material table, the layout of the static objects, and the maze's colliders and
+// wall segments.  ScenePackWriter builds one from the output of the scene builders;
+// ScenePack maps it and hands out pointers straight into the mapping, with no parsing.
+//
+// A submesh can have coarser levels of detail, further submeshes of the same mesh linked
+// from it in a chain; objects name the full detail submesh.
+//
+// A pack can be split into world cells: the objects small enough to fit a cell move,
+// with the geometry they use, into a pack of their own per cell, which WorldStreamer
+// loads and unloads around the camera.  The main pack lists the cells.
+//
+// File layout:
+//   Header
+//   SectionEntry sections[Section::Count]
+//   section data, each section aligned to SectionAlignment
+//
+// Sections are arrays of the structs below, except Strings (bytes, referenced by offset
+// and length) and VertexData / IndexData (buffers, referenced by the meshes, either raw
+// or compressed with MeshCodec).  Every reference is an index or an offset, so the file
+// can live at any address.  Open checks every reference once; after that the accessors
+// need no checks.
+//***************************************************************************************
+
+#pragma once
+
+#include "MappedFile.h"
+#include "MemoryTracker.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ScenePack
+{
+public:
+
+	using uint8 = std::uint8_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	static const uint32 FileMagic = 0x4B415053; // 'SPAK'
+	static const uint32 FileVersion = 4;
+	static const uint32 SectionAlignment = 16;
+	static const uint32 NoLod = 0xffffffffu;
+
+	enum class Section : uint32
+	{
+		Strings = 0,
+		Meshes,
+		Submeshes,
+		Materials,
+		Objects,
+		Colliders,
+		Segments,
+		Cells,
+		VertexData,
+		IndexData,
+		Count
+	};
+
+	enum class MeshEncoding : uint32
+	{
+		Raw = 0,
+		Compressed      // MeshCodec vertex and index streams
+	};
+
+	struct StringRef
+	{
+		uint32 Offset = 0;
+		uint32 Length = 0;
+	};
+
+	struct Mesh
+	{
+		StringRef Name;
+		uint32 VertexStride = 0;
+		uint32 IndexSize = 2;           // bytes per index, 2 or 4
+		uint32 FirstSubmesh = 0;
+		uint32 SubmeshCount = 0;
+		MeshEncoding Encoding = MeshEncoding::Raw;
+		uint32 Reserved = 0;
+		uint64 VertexOffset = 0;        // into the VertexData section
+		uint64 VertexBytes = 0;         // decoded size
+		uint64 VertexStoredBytes = 0;   // size in the section
+		uint64 IndexOffset = 0;         // into the IndexData section
+		uint64 IndexBytes = 0;
+		uint64 IndexStoredBytes = 0;
+	};
+
+	struct Submesh
+	{
+		StringRef Name;
+		uint32 IndexCount = 0;
+		uint32 StartIndexLocation = 0;
+		std::int32_t BaseVertexLocation = 0;
+		float BoundsCenter[3] = {};
+		float BoundsExtents[3] = {};
+		uint32 NextLod = NoLod;         // the next coarser level, a later submesh of the same mesh
+		float LodError = 0.0f;          // distance from the full detail surface, in local units
+	};
+
+	struct Material
+	{
+		StringRef Name;
+		std::int32_t DiffuseSrvHeapIndex = -1;
+		float DiffuseAlbedo[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		float FresnelR0[3] = { 0.01f, 0.01f, 0.01f };
+		float Roughness = 0.25f;
+		float MatTransform[16] = {};
+	};
+
+	struct Object
+	{
+		uint32 Mesh = 0;
+		uint32 Submesh = 0;             // index into the whole submesh table
+		uint32 Material = 0;
+		uint32 Layer = 0;
+		float World[16] = {};
+		float TexTransform[16] = {};
+	};
+
+	struct Collider
+	{
+		float Center[3] = {};
+		float Extents[3] = {};
+	};
+
+	// A line on the ground plane, (X0, Z0) to (X1, Z1).
+	struct Segment
+	{
+		float X0 = 0.0f;
+		float Z0 = 0.0f;
+		float X1 = 0.0f;
+		float Z1 = 0.0f;
+	};
+
+	// A square of the ground plane, (X, Z) * cell size, whose objects are in the pack at
+	// Path.  Min and Max bound them on the ground plane; they may reach past the square.
+	struct Cell
+	{
+		std::int32_t X = 0;
+		std::int32_t Z = 0;
+		StringRef Path;
+		float Min[2] = {};
+		float Max[2] = {};
+		uint32 ObjectCount = 0;
+		uint32 Reserved = 0;
+		uint64 UploadBytes = 0;         // decoded vertex and index bytes
+		uint64 ContentHash = 0;         // of the cell's pack, to detect a stale file
+	};
+
+	struct Header
+	{
+		uint32 Magic = FileMagic;
+		uint32 Version = FileVersion;
+		uint64 ContentKey = 0;          // identifies the cooker that wrote the pack
+		double CookMilliseconds = 0.0;  // time the cooker took, for comparison with loads
+		uint64 ContentHash = 0;         // of the section data, the same for the same scene
+		uint32 SectionCount = (uint32)Section::Count;
+		uint32 Reserved = 0;
+	};
+
+	struct SectionEntry
+	{
+		uint64 Offset = 0;
+		uint64 Size = 0;
+	};
+
+public:
+	ScenePack() = default;
+	ScenePack(const ScenePack& rhs) = delete;
+	ScenePack& operator=(const ScenePack& rhs) = delete;
+
+	// Maps path.  Returns false if it is missing, malformed or cooked with another key, or
+	// if a material samples an SRV past the first srvCount.
+	bool Open(const std::string& path, uint64 contentKey, uint32 srvCount);
+
+	// Uses a pack built in memory, for when it could not be written to disk.
+	bool Adopt(std::vector<uint8> bytes, uint64 contentKey, uint32 srvCount);
+
+	void Close();
+	bool IsOpen()const { return mData != nullptr; }
+	bool IsMapped()const { return IsOpen() && mOwned.empty(); }
+
+	uint32 MeshCount()const { return Count<Mesh>(Section::Meshes); }
+	uint32 SubmeshCount()const { return Count<Submesh>(Section::Submeshes); }
+	uint32 MaterialCount()const { return Count<Material>(Section::Materials); }
+	uint32 ObjectCount()const { return Count<Object>(Section::Objects); }
+	uint32 ColliderCount()const { return Count<Collider>(Section::Colliders); }
+	uint32 SegmentCount()const { return Count<Segment>(Section::Segments); }
+	uint32 CellCount()const { return Count<Cell>(Section::Cells); }
+
+	const Mesh* Meshes()const { return Items<Mesh>(Section::Meshes); }
+	const Submesh* Submeshes()const { return Items<Submesh>(Section::Submeshes); }
+	const Material* Materials()const { return Items<Material>(Section::Materials); }
+	const Object* Objects()const { return Items<Object>(Section::Objects); }
+	const Collider* Colliders()const { return Items<Collider>(Section::Colliders); }
+	const Segment* Segments()const { return Items<Segment>(Section::Segments); }
+	const Cell* Cells()const { return Items<Cell>(Section::Cells); }
+
+	std::string String(StringRef ref)const;
+
+	///<summary>
+	/// Points vertices and indices at the buffers of mesh: straight into the pack when they
+	/// are stored raw, else into the storage vectors they are decoded to.  Returns false if
+	/// a compressed buffer does not decode, or if an index of a submesh falls outside the
+	/// vertices; the index data is only read here, so that is where it is checked.
+	///</summary>
+	bool ReadMesh(const Mesh& mesh, const uint8*& vertices, const uint8*& indices,
+		std::vector<uint8>& vertexStorage, std::vector<uint8>& indexStorage)const;
+
+	// Index of the mesh called name, or -1.
+	int FindMesh(const std::string& name)const;
+
+	uint64 SizeInBytes()const { return mSize; }
+	double CookMilliseconds()const { return mHeader.CookMilliseconds; }
+	uint64 ContentHash()const { return mHeader.ContentHash; }
+
+private:
+	bool Validate(uint64 contentKey, uint32 srvCount);
+	bool IndicesInRange(const Mesh& mesh, const uint8* indices)const;
+
+	const uint8* VertexData(const Mesh& mesh)const;
+	const uint8* IndexData(const Mesh& mesh)const;
+
+	template<typename T>
+	const T* Items(Section section)const
+	{
+		return reinterpret_cast<const T*>(mData + mSections[(int)section].Offset);
+	}
+
+	template<typename T>
+	uint32 Count(Section section)const
+	{
+		return (uint32)(mSections[(int)section].Size / sizeof(T));
+	}
+
+private:
+	MappedFile mFile;
+	std::vector<uint8> mOwned;
+	TrackedMemory mOwnedMemory;
+
+	const uint8* mData = nullptr;
+	uint64 mSize = 0;
+	Header mHeader;
+	SectionEntry mSections[(int)Section::Count];
+	std::unordered_map<std::string, int> mMeshByName;
+};
+
+class ScenePackWriter
+{
+public:
+
+	using uint8 = ScenePack::uint8;
+	using uint32 = ScenePack::uint32;
+	using uint64 = ScenePack::uint64;
+
+	// The objects of one cell, in a writer of their own.
+	struct CellContents
+	{
+		std::int32_t X = 0;
+		std::int32_t Z = 0;
+		float Min[2] = {};
+		float Max[2] = {};
+		std::unique_ptr<ScenePackWriter> Writer;
+	};
+
+public:
+	ScenePackWriter() = default;
+	ScenePackWriter(const ScenePackWriter& rhs) = delete;
+	ScenePackWriter& operator=(const ScenePackWriter& rhs) = delete;
+
+	// The submeshes of a mesh have to be added right after it.
+	uint32 AddMesh(const std::string& name, uint32 vertexStride, uint32 indexSize,
+		const void* vertices, uint64 vertexBytes, const void* indices, uint64 indexBytes);
+	void AddSubmesh(const std::string& name, uint32 indexCount, uint32 startIndexLocation, std::int32_t baseVertexLocation,
+		const float center[3], const float extents[3]);
+
+	///<summary>
+	/// Makes coarser the next level of detail after the last level of submesh, error away
+	/// from it.  Both are submeshes of mesh and coarser has to come after the last level.
+	/// Returns false if they are unknown or in the wrong order.
+	///</summary>
+	bool LinkLod(const std::string& mesh, const std::string& submesh, const std::string& coarser, float error);
+
+	// material.Name is ignored; the name is taken from name.
+	uint32 AddMaterial(const std::string& name, const ScenePack::Material& material);
+
+	// Returns false if the mesh, submesh or material is unknown.
+	bool AddObject(const std::string& mesh, const std::string& submesh, const std::string& material,
+		const float world[16], const float texTransform[16], uint32 layer);
+
+	void AddCollider(const float center[3], const float extents[3]);
+	void AddSegment(float x0, float z0, float x1, float z1);
+	void AddCell(const ScenePack::Cell& cell, const std::string& path);
+
+	///<summary>
+	/// Splits the objects into world cells of cellSize.  An object whose bounds fit a cell
+	/// goes to the cell its center is in; the rest, the materials, colliders and segments
+	/// go to global.  Every writer gets a copy of just the submeshes its objects use, with
+	/// their levels of detail.
+	/// global has to be empty.  Returns false if a submesh reads outside its mesh or the
+	/// geometry is already compressed.
+	///</summary>
+	bool SplitCells(float cellSize, ScenePackWriter& global, std::vector<CellContents>& cells)const;
+
+	///<summary>
+	/// Reorders the vertices of every submesh in the order its indices first use them, so
+	/// the vertex fetches of a draw walk the buffer forward.  Meshes whose submeshes share
+	/// vertices are left alone.  Returns the number of meshes reordered.
+	///</summary>
+	uint32 OptimizeVertexFetch();
+
+	// Stores the buffers of every mesh with MeshCodec, so call it after anything that
+	// rearranges them.  Returns the bytes saved.
+	uint64 CompressGeometry();
+
+	uint32 ObjectCount()const { return (uint32)mObjects.size(); }
+	uint64 GeometryBytes()const;
+
+	// Returns the content hash the pack got.
+	uint64 Build(uint64 contentKey, double cookMilliseconds, std::vector<uint8>& bytes)const;
+	static bool WriteFile(const std::string& path, const std::vector<uint8>& bytes);
+
+private:
+	ScenePack::StringRef AddString(const std::string& s);
+	void AppendBuffer(std::vector<uint8>& section, const void* data, uint64 bytes, uint64& offset, uint64& storedBytes);
+	bool ReorderMesh(const ScenePack::Mesh& mesh);
+	std::string String(ScenePack::StringRef ref)const;
+	uint32 FindSubmesh(uint32 mesh, const std::string& name)const;
+	bool CopyObjects(const std::vector<uint32>& objects, bool allMaterials, ScenePackWriter& out)const;
+
+private:
+	std::vector<char> mStrings;
+	std::vector<ScenePack::Mesh> mMeshes;
+	std::vector<ScenePack::Submesh> mSubmeshes;
+	std::vector<ScenePack::Material> mMaterials;
+	std::vector<ScenePack::Object> mObjects;
+	std::vector<ScenePack::Collider> mColliders;
+	std::vector<ScenePack::Segment> mSegments;
+	std::vector<ScenePack::Cell> mCells;
+	std::vector<uint8> mVertexData;
+	std::vector<uint8> mIndexData;
+
+	std::unordered_map<std::string, uint32> mMeshByName;
+	std::unordered_map<std::string, uint32> mMaterialByName;
+};
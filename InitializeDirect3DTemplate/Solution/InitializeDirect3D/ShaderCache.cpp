@@ -0,0 +1,250 @@
+//***************************************************************************************
+// ShaderCache.cpp
+//***************************************************************************************
+
+#include "ShaderCache.h"
+#include "Hash.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+	std::string DirectoryOf(const std::string& path)
+	{
+		std::size_t slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+	}
+}
+
+ShaderCache::ShaderCache(const std::string& cachePath, CompileFn compiler, ReadFileFn readFile) :
+	mCachePath(cachePath),
+	mCompiler(std::move(compiler)),
+	mReadFile(readFile ? std::move(readFile) : ReadFileFn(&ShaderCache::ReadFileDefault)),
+	mFile(FileMagic, FileVersion)
+{
+}
+
+ShaderCache::~ShaderCache()
+{
+}
+
+bool ShaderCache::ReadFileDefault(const std::string& path, std::string& contents)
+{
+	std::ifstream fin(path, std::ios::binary);
+	if (!fin)
+		return false;
+
+	std::ostringstream oss;
+	oss << fin.rdbuf();
+	contents = oss.str();
+	return true;
+}
+
+bool ShaderCache::Load()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	// A missing or stale file just starts an empty cache.
+	return mFile.Open(mCachePath);
+}
+
+std::vector<std::string> ShaderCache::ParseIncludes(const std::string& source)
+{
+	std::vector<std::string> includes;
+
+	std::istringstream iss(source);
+	std::string line;
+	bool inBlockComment = false;
+	while (std::getline(iss, line))
+	{
+		std::size_t i = 0;
+		if (inBlockComment)
+		{
+			std::size_t end = line.find("*/");
+			if (end == std::string::npos)
+				continue;
+			inBlockComment = false;
+			i = end + 2;
+		}
+
+		i = line.find_first_not_of(" \t", i);
+		if (i == std::string::npos)
+			continue;
+
+		if (line.compare(i, 2, "/*") == 0 && line.find("*/", i + 2) == std::string::npos)
+		{
+			inBlockComment = true;
+			continue;
+		}
+
+		if (line[i] != '#')
+			continue;
+
+		i = line.find_first_not_of(" \t", i + 1);
+		if (i == std::string::npos || line.compare(i, 7, "include") != 0)
+			continue;
+
+		std::size_t open = line.find_first_of("\"<", i + 7);
+		if (open == std::string::npos)
+			continue;
+
+		char closeChar = line[open] == '"' ? '"' : '>';
+		std::size_t close = line.find(closeChar, open + 1);
+		if (close == std::string::npos)
+			continue;
+
+		includes.push_back(line.substr(open + 1, close - open - 1));
+	}
+
+	return includes;
+}
+
+ShaderCache::uint64 ShaderCache::HashSourceTree(const std::string& path, uint64 seed, std::vector<std::string>& visited)const
+{
+	if (std::find(visited.begin(), visited.end(), path) != visited.end())
+		return seed;
+	visited.push_back(path);
+
+	std::string source;
+	if (!mReadFile(path, source))
+	{
+		// A missing include is still part of the key; the compiler will report it.
+		return Hash::Fnv1a(path, seed);
+	}
+
+	uint64 h = Hash::Fnv1a(source, Hash::Fnv1a(path, seed));
+
+	// Includes resolve relative to the including file, like D3D_COMPILE_STANDARD_FILE_INCLUDE.
+	std::string dir = DirectoryOf(path);
+	for (const std::string& include : ParseIncludes(source))
+		h = HashSourceTree(dir + include, h, visited);
+
+	return h;
+}
+
+std::vector<std::string> ShaderCache::SourceFiles(const std::string& path)const
+{
+	std::vector<std::string> visited;
+	HashSourceTree(path, 0, visited);
+	return visited;
+}
+
+ShaderCache::uint64 ShaderCache::HashSources(const std::string& path)const
+{
+	const uint32 version = FileVersion;
+	std::vector<std::string> visited;
+	return HashSourceTree(path, Hash::Fnv1aValue(version), visited);
+}
+
+ShaderCache::uint64 ShaderCache::ComputeKey(const ShaderCompileRequest& request)const
+{
+	return ComputeKey(request, HashSources(request.SourcePath));
+}
+
+ShaderCache::uint64 ShaderCache::ComputeKey(const ShaderCompileRequest& request, uint64 sourcesHash)const
+{
+	uint64 h = sourcesHash;
+	for (const ShaderDefine& d : request.Defines)
+	{
+		h = Hash::Fnv1a(d.Name, h);
+		h = Hash::Fnv1a(d.Value, h);
+	}
+
+	h = Hash::Fnv1a(request.EntryPoint, h);
+	h = Hash::Fnv1a(request.Target, h);
+	h = Hash::Fnv1aValue(request.Flags, h);
+	return h;
+}
+
+bool ShaderCache::GetOrCompile(const ShaderCompileRequest& request, std::vector<uint8>& bytecode, std::string* errors)
+{
+	return GetOrCompile(ComputeKey(request), request, bytecode, errors);
+}
+
+bool ShaderCache::GetOrCompile(uint64 key, const ShaderCompileRequest& request, std::vector<uint8>& bytecode,
+	std::string* errors)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		auto it = mNewEntries.find(key);
+		if (it != mNewEntries.end())
+		{
+			bytecode = it->second;
+			mStats.Hits++;
+			return true;
+		}
+
+		if (mFile.Find(key, bytecode))
+		{
+			mStats.Hits++;
+			return true;
+		}
+
+		mStats.Misses++;
+	}
+
+	std::string compileErrors;
+	std::vector<uint8> compiled;
+	bool ok = mCompiler(request, compiled, compileErrors);
+
+	if (errors != nullptr)
+		*errors = compileErrors;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!ok)
+	{
+		mStats.CompileFailures++;
+		return false;
+	}
+
+	bytecode = compiled;
+	mNewEntries[key] = std::move(compiled);
+	return true;
+}
+
+bool ShaderCache::Find(uint64 key, std::vector<uint8>& bytecode)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	auto it = mNewEntries.find(key);
+	if (it != mNewEntries.end())
+		bytecode = it->second;
+	else if (!mFile.Find(key, bytecode))
+		return false;
+
+	mStats.Hits++;
+	return true;
+}
+
+void ShaderCache::Insert(uint64 key, const std::vector<uint8>& bytecode)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	std::vector<uint8> existing;
+	if (mNewEntries.count(key) == 0 && !mFile.Find(key, existing))
+		mNewEntries[key] = bytecode;
+}
+
+bool ShaderCache::Flush()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if (mNewEntries.empty())
+		return true;
+
+	return mFile.Rewrite(mCachePath, mNewEntries);
+}
+
+bool ShaderCache::IsDirty()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return !mNewEntries.empty();
+}
+
+ShaderCache::Stats ShaderCache::GetStats()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mStats;
+}
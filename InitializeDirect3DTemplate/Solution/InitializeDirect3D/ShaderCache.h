@@ -0,0 +1,130 @@
+//***************************************************************************************
+// ShaderCache.h
+//
+// Persistent shader bytecode cache.  Each compiled shader is stored under a key hashed
+// from the source file, the contents of every file it #includes (transitively), the
+// defines, the entry point, the target and the compile flags, so editing any of them
+// produces a miss and a recompile.
+//
+// The cache lives in one memory-mapped KeyedBlobFile; lookups binary search the mapped
+// entry table and copy the bytecode straight out of the mapping.  New entries are kept
+// in memory until Flush rewrites the file.
+//
+// The compiler and the file reader are plain functions so the cache can be driven by
+// a stub compiler outside of Direct3D.
+//***************************************************************************************
+
+#pragma once
+
+#include "KeyedBlobFile.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ShaderDefine
+{
+	std::string Name;
+	std::string Value;
+};
+
+struct ShaderCompileRequest
+{
+	std::string SourcePath;
+	std::vector<ShaderDefine> Defines;
+	std::string EntryPoint;
+	std::string Target;
+	std::uint32_t Flags = 0;
+};
+
+class ShaderCache
+{
+public:
+
+	using uint8 = std::uint8_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	static const uint32 FileMagic = 0x43444853; // 'SHDC'
+	static const uint32 FileVersion = 1;
+
+	// Compiles request into bytecode.  On failure returns false and fills errors.
+	using CompileFn = std::function<bool(const ShaderCompileRequest& request, std::vector<uint8>& bytecode, std::string& errors)>;
+
+	// Reads a whole file.  Returns false if it does not exist.
+	using ReadFileFn = std::function<bool(const std::string& path, std::string& contents)>;
+
+	struct Stats
+	{
+		uint32 Hits = 0;
+		uint32 Misses = 0;
+		uint32 CompileFailures = 0;
+	};
+
+public:
+	ShaderCache(const std::string& cachePath, CompileFn compiler, ReadFileFn readFile = ReadFileFn());
+	ShaderCache(const ShaderCache& rhs) = delete;
+	ShaderCache& operator=(const ShaderCache& rhs) = delete;
+	~ShaderCache();
+
+	// Maps the cache file.  A missing or stale file just means an empty cache.
+	bool Load();
+
+	///<summary>
+	/// Looks the request up by key and copies the cached bytecode out, or compiles it on
+	/// a miss and remembers the result for the next Flush.  Safe to call from several
+	/// threads at once; compiles run outside the lock.
+	///</summary>
+	bool GetOrCompile(const ShaderCompileRequest& request, std::vector<uint8>& bytecode, std::string* errors = nullptr);
+
+	// The same, for a key already computed with ComputeKey.
+	bool GetOrCompile(uint64 key, const ShaderCompileRequest& request, std::vector<uint8>& bytecode,
+		std::string* errors = nullptr);
+
+	// Copies out the bytecode stored under key without compiling.  Only hits are counted.
+	bool Find(uint64 key, std::vector<uint8>& bytecode);
+
+	// Stores bytecode under key as well, for requests known to compile to the same thing.
+	void Insert(uint64 key, const std::vector<uint8>& bytecode);
+
+	// Writes every mapped and newly compiled entry back to the cache file.
+	bool Flush();
+
+	// Hash of everything that affects the compiled output of request.
+	uint64 ComputeKey(const ShaderCompileRequest& request)const;
+
+	// The same, from the HashSources of request.SourcePath, which every request on that
+	// source shares.  Reads no files.
+	uint64 ComputeKey(const ShaderCompileRequest& request, uint64 sourcesHash)const;
+
+	// Hash of path and the contents of every file it includes, transitively.
+	uint64 HashSources(const std::string& path)const;
+
+	// path and every file it includes, transitively, as the includes resolve.
+	std::vector<std::string> SourceFiles(const std::string& path)const;
+
+	// Finds the files source includes with #include "..." or #include <...>, relative
+	// to the including file.
+	static std::vector<std::string> ParseIncludes(const std::string& source);
+
+	bool IsDirty()const;
+	Stats GetStats()const;
+
+	static bool ReadFileDefault(const std::string& path, std::string& contents);
+
+private:
+	uint64 HashSourceTree(const std::string& path, uint64 seed, std::vector<std::string>& visited)const;
+
+private:
+	std::string mCachePath;
+	CompileFn mCompiler;
+	ReadFileFn mReadFile;
+
+	mutable std::mutex mMutex;
+	KeyedBlobFile mFile;
+
+	std::map<uint64, std::vector<uint8>> mNewEntries;
+	Stats mStats;
+};
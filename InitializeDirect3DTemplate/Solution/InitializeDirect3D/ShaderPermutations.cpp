@@ -0,0 +1,253 @@
+//***************************************************************************************
+// ShaderPermutations.cpp
+//***************************************************************************************
+
+#include "ShaderPermutations.h"
+#include "Hash.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <cassert>
+#include <unordered_map>
+
+namespace
+{
+	struct VariantJob
+	{
+		std::uint32_t Program = 0;
+		std::uint32_t Variant = 0;
+		std::uint32_t Mask = 0;
+		std::uint64_t CacheKey = 0;
+		std::uint64_t SourceKey = 0;
+		bool Hit = false;
+		int Unique = -1;
+	};
+}
+
+ShaderPermutations::uint32 ShaderPermutations::AddProgram(const ShaderProgramDesc& desc)
+{
+	assert(desc.Features.size() < 32);
+	assert(FindProgram(desc.Name) == InvalidProgram);
+
+	Program program;
+	program.Desc = desc;
+
+	if (program.Desc.Variants.empty())
+	{
+		uint32 combinations = 1u << (uint32)desc.Features.size();
+		for (uint32 mask = 0; mask < combinations; ++mask)
+			program.Desc.Variants.push_back(mask);
+	}
+
+	program.VariantBytecode.assign(program.Desc.Variants.size(), -1);
+	mPrograms.push_back(std::move(program));
+	return (uint32)mPrograms.size() - 1;
+}
+
+ShaderPermutations::uint32 ShaderPermutations::FindProgram(const std::string& name)const
+{
+	for (uint32 i = 0; i < (uint32)mPrograms.size(); ++i)
+	{
+		if (mPrograms[i].Desc.Name == name)
+			return i;
+	}
+	return InvalidProgram;
+}
+
+ShaderPermutations::uint32 ShaderPermutations::FeatureBit(uint32 programId, const std::string& define)const
+{
+	const auto& features = mPrograms[programId].Desc.Features;
+	for (uint32 i = 0; i < (uint32)features.size(); ++i)
+	{
+		if (features[i].Define == define)
+			return 1u << i;
+	}
+	return 0;
+}
+
+ShaderCompileRequest ShaderPermutations::MakeRequest(uint32 programId, uint32 mask)const
+{
+	const ShaderProgramDesc& desc = mPrograms[programId].Desc;
+
+	ShaderCompileRequest request;
+	request.SourcePath = desc.SourcePath;
+	request.EntryPoint = desc.EntryPoint;
+	request.Target = desc.Target;
+	request.Flags = desc.Flags;
+
+	for (uint32 i = 0; i < (uint32)desc.Features.size(); ++i)
+	{
+		const ShaderFeature& f = desc.Features[i];
+		if (mask & (1u << i))
+			request.Defines.push_back({ f.Define, f.OnValue });
+		else if (f.DefineWhenOff)
+			request.Defines.push_back({ f.Define, f.OffValue });
+	}
+
+	return request;
+}
+
+bool ShaderPermutations::CompileAll(ShaderCache& cache, const PreprocessFn& preprocess, std::string* errors)
+{
+	std::vector<uint32> programIds;
+	for (uint32 p = 0; p < (uint32)mPrograms.size(); ++p)
+		programIds.push_back(p);
+	return Compile(cache, programIds, preprocess, errors);
+}
+
+bool ShaderPermutations::Compile(ShaderCache& cache, const std::vector<uint32>& programIds,
+	const PreprocessFn& preprocess, std::string* errors)
+{
+	std::vector<VariantJob> jobs;
+	for (uint32 p : programIds)
+	{
+		const auto& variants = mPrograms[p].Desc.Variants;
+		for (uint32 v = 0; v < (uint32)variants.size(); ++v)
+		{
+			assert(variants[v] < (1u << (uint32)mPrograms[p].Desc.Features.size()));
+
+			VariantJob job;
+			job.Program = p;
+			job.Variant = v;
+			job.Mask = variants[v];
+			jobs.push_back(job);
+		}
+	}
+
+	// Every variant of a source shares its include tree, so the files are read and hashed
+	// once per source rather than once per variant.
+	std::unordered_map<std::string, std::uint64_t> sourcesHashes;
+	for (const VariantJob& job : jobs)
+		sourcesHashes.emplace(mPrograms[job.Program].Desc.SourcePath, 0);
+
+	std::vector<std::unordered_map<std::string, std::uint64_t>::iterator> sources;
+	for (auto it = sourcesHashes.begin(); it != sourcesHashes.end(); ++it)
+		sources.push_back(it);
+	ParallelFor((int)sources.size(), [&](int i) { sources[i]->second = cache.HashSources(sources[i]->first); });
+
+	ShaderCache::Stats before = cache.GetStats();
+
+	// Variants the cache already holds are done.  Only the misses are keyed by what the
+	// compiler would actually see; the preprocessor is the expensive part of that, so it
+	// runs on the pool too.
+	std::vector<std::vector<uint8>> cached(jobs.size());
+	ParallelFor((int)jobs.size(), [&](int i)
+	{
+		VariantJob& job = jobs[i];
+		ShaderCompileRequest request = MakeRequest(job.Program, job.Mask);
+		job.CacheKey = cache.ComputeKey(request, sourcesHashes.at(request.SourcePath));
+
+		job.Hit = cache.Find(job.CacheKey, cached[i]);
+		if (job.Hit)
+		{
+			job.SourceKey = Hash::Fnv1a(cached[i].data(), cached[i].size());
+			return;
+		}
+
+		std::string preprocessed;
+		if (preprocess && preprocess(request, preprocessed))
+		{
+			std::uint64_t h = Hash::Fnv1a(preprocessed);
+			h = Hash::Fnv1a(request.EntryPoint, h);
+			h = Hash::Fnv1a(request.Target, h);
+			job.SourceKey = Hash::Fnv1aValue(request.Flags, h);
+		}
+		else
+		{
+			job.SourceKey = job.CacheKey;
+		}
+	});
+
+	// Hits that came out identical share one copy of the bytecode, and misses with the
+	// same preprocessed source share one compile.
+	std::unordered_map<std::uint64_t, int> uniqueByKey[2];
+	std::vector<int> uniqueJobs;
+	for (int i = 0; i < (int)jobs.size(); ++i)
+	{
+		auto& unique = uniqueByKey[jobs[i].Hit ? 1 : 0];
+		auto it = unique.find(jobs[i].SourceKey);
+		if (it == unique.end())
+		{
+			it = unique.emplace(jobs[i].SourceKey, (int)uniqueJobs.size()).first;
+			uniqueJobs.push_back(i);
+		}
+		jobs[i].Unique = it->second;
+	}
+
+	std::vector<std::vector<uint8>> bytecode(uniqueJobs.size());
+	std::vector<std::string> compileErrors(uniqueJobs.size());
+	std::vector<char> succeeded(uniqueJobs.size(), 0);
+
+	ParallelFor((int)uniqueJobs.size(), [&](int u)
+	{
+		const VariantJob& job = jobs[uniqueJobs[u]];
+		if (job.Hit)
+		{
+			bytecode[u] = std::move(cached[uniqueJobs[u]]);
+			succeeded[u] = 1;
+			return;
+		}
+
+		ShaderCompileRequest request = MakeRequest(job.Program, job.Mask);
+		succeeded[u] = cache.GetOrCompile(job.CacheKey, request, bytecode[u], &compileErrors[u]) ? 1 : 0;
+	});
+
+	// The misses that shared a compile are stored under their own keys as well, so next
+	// time they hit without being preprocessed.
+	for (const VariantJob& job : jobs)
+	{
+		if (!job.Hit && succeeded[job.Unique] && job.CacheKey != jobs[uniqueJobs[job.Unique]].CacheKey)
+			cache.Insert(job.CacheKey, bytecode[job.Unique]);
+	}
+
+	ShaderCache::Stats after = cache.GetStats();
+
+	// Publish the results; variants that shared a source share the bytecode slot.
+	int base = (int)mBytecode.size();
+	for (auto& b : bytecode)
+		mBytecode.push_back(std::move(b));
+
+	mStats.Variants += (uint32)jobs.size();
+	mStats.UniqueSources += (uint32)uniqueJobs.size();
+	mStats.CacheHits += after.Hits - before.Hits;
+	mStats.Compiled += after.Misses - before.Misses;
+
+	bool allSucceeded = true;
+	for (const VariantJob& job : jobs)
+	{
+		if (succeeded[job.Unique])
+		{
+			mPrograms[job.Program].VariantBytecode[job.Variant] = base + job.Unique;
+			continue;
+		}
+
+		allSucceeded = false;
+		mStats.Failed++;
+		if (errors != nullptr)
+		{
+			*errors += mPrograms[job.Program].Desc.Name + " (variant " + std::to_string(job.Mask) + "):\n";
+			*errors += compileErrors[job.Unique];
+			*errors += "\n";
+		}
+	}
+
+	return allSucceeded;
+}
+
+const std::vector<ShaderPermutations::uint8>* ShaderPermutations::Find(uint32 programId, uint32 mask)const
+{
+	if (programId >= (uint32)mPrograms.size())
+		return nullptr;
+
+	const Program& program = mPrograms[programId];
+	for (std::size_t v = 0; v < program.Desc.Variants.size(); ++v)
+	{
+		if (program.Desc.Variants[v] == mask)
+			return program.VariantBytecode[v] < 0 ? nullptr : &mBytecode[program.VariantBytecode[v]];
+	}
+	return nullptr;
+}
+
+const ShaderPermutations::Stats& ShaderPermutations::GetStats()const
+{
+	return mStats;
+}
@@ -0,0 +1,119 @@
+//***************************************************************************************
+// ShaderPermutations.h
+//
+// Permutation manifest for shaders specialized through defines.  Each program (one
+// source file, entry point and target) declares its feature axes; every axis is one
+// bit of a variant mask and maps to a define value when the bit is on or off.  The
+// manifest lists the variants that are actually needed, all of them are compiled
+// concurrently through the ShaderCache, and at runtime a variant is looked up by
+// program id and mask instead of by define strings.
+//
+// Variants already in the cache are looked up by the hash of their include tree and
+// defines without running the preprocessor.  Of the rest, those whose preprocessed source
+// comes out identical (an axis the entry point never reads, say) are compiled once and
+// share their bytecode.
+//***************************************************************************************
+
+#pragma once
+
+#include "ShaderCache.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct ShaderFeature
+{
+	std::string Define;
+	std::string OnValue = "1";
+	std::string OffValue = "0";
+	bool DefineWhenOff = false;  // otherwise the define is left out when the bit is off
+};
+
+struct ShaderProgramDesc
+{
+	std::string Name;
+	std::string SourcePath;
+	std::string EntryPoint;
+	std::string Target;
+	std::uint32_t Flags = 0;
+
+	// Bit i of a variant mask switches Features[i].
+	std::vector<ShaderFeature> Features;
+
+	// Variants to build.  Empty means every combination of the features.
+	std::vector<std::uint32_t> Variants;
+};
+
+class ShaderPermutations
+{
+public:
+
+	using uint8 = std::uint8_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	static const uint32 InvalidProgram = 0xFFFFFFFF;
+
+	// Runs the preprocessor over request and returns the expanded text.  Returns false
+	// if the source does not preprocess, in which case the variant is compiled anyway so
+	// the compiler can report the error.
+	using PreprocessFn = std::function<bool(const ShaderCompileRequest& request, std::string& preprocessed)>;
+
+	struct Stats
+	{
+		uint32 Variants = 0;
+		uint32 UniqueSources = 0;
+		uint32 CacheHits = 0;
+		uint32 Compiled = 0;
+		uint32 Failed = 0;
+	};
+
+public:
+	ShaderPermutations() = default;
+	ShaderPermutations(const ShaderPermutations& rhs) = delete;
+	ShaderPermutations& operator=(const ShaderPermutations& rhs) = delete;
+
+	uint32 AddProgram(const ShaderProgramDesc& desc);
+	uint32 FindProgram(const std::string& name)const;
+
+	// Mask bit of the named feature of a program, 0 if the program has no such feature.
+	uint32 FeatureBit(uint32 programId, const std::string& define)const;
+
+	// The compile request the cache sees for one variant.
+	ShaderCompileRequest MakeRequest(uint32 programId, uint32 mask)const;
+
+	///<summary>
+	/// Looks up every variant in the manifest and preprocesses and compiles the misses on
+	/// the worker pool.  With no preprocessor only exact duplicate requests are merged.  Returns false if any
+	/// variant failed; the compiler output is collected in errors.
+	///</summary>
+	bool CompileAll(ShaderCache& cache, const PreprocessFn& preprocess, std::string* errors = nullptr);
+
+	// Compiles the variants of the given programs again, after their sources changed.  A
+	// variant that fails keeps the bytecode it had; the bytecode it replaces is not freed.
+	bool Compile(ShaderCache& cache, const std::vector<uint32>& programIds, const PreprocessFn& preprocess,
+		std::string* errors = nullptr);
+
+	uint32 ProgramCount()const { return (uint32)mPrograms.size(); }
+	const ShaderProgramDesc& GetProgram(uint32 programId)const { return mPrograms[programId].Desc; }
+
+	// Bytecode of a compiled variant, or null if it was not in the manifest or failed.
+	const std::vector<uint8>* Find(uint32 programId, uint32 mask)const;
+
+	const Stats& GetStats()const;
+
+private:
+	struct Program
+	{
+		ShaderProgramDesc Desc;
+
+		// Index into mBytecode per variant in Desc.Variants order.
+		std::vector<int> VariantBytecode;
+	};
+
+private:
+	std::vector<Program> mPrograms;
+	std::vector<std::vector<uint8>> mBytecode;
+	Stats mStats;
+};
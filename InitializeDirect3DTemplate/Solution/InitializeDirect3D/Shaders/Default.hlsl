@@ -20,6 +20,9 @@
 
 Texture2D    gDiffuseMap : register(t0);
 
+// Environment prefiltered with GGX; mip m is roughness m / gSpecularEnvMaxMip.
+TextureCube  gSpecularEnvMap : register(t5);
+
 
 SamplerState gsamPointWrap        : register(s0);
 SamplerState gsamPointClamp       : register(s1);
@@ -33,6 +36,16 @@ cbuffer cbPerObject : register(b0)
 {
     float4x4 gWorld;
 	float4x4 gTexTransform;
+    uint4 gObjectLightIndices;
+    uint gObjectLightCount;
+};
+
+// Root constants of one draw (DrawConstants), which differ between the levels of detail
+// of an object.
+cbuffer cbPerDraw : register(b3)
+{
+    uint gBakedLightingOffset;
+    float gLodFade;
 };
 
 // Constant data that varies per material.
@@ -55,6 +68,16 @@ cbuffer cbPass : register(b1)
     float4 gAmbientLight;
 
     Light gLights[MaxLights];
+
+    uint3 gClusterDims;
+    float gClusterDepthScale;
+    float gClusterDepthBias;
+    float gBakedIrradianceScale;
+    float gSpecularEnvMaxMip;
+    float cbPassPad2;
+    float4 gAmbientSH[9];
+    float4 gGroundVirtualPlane;
+    float4 gGroundVirtualPages;
 };
 
 cbuffer cbMaterial : register(b2)
@@ -65,6 +88,108 @@ cbuffer cbMaterial : register(b2)
 	float4x4 gMatTransform;
 };
 
+#if defined(CLUSTERED_LIGHTS) || defined(OBJECT_LIGHTS)
+// Point and spot lights of the scene; spot lights have a positive SpotPower.
+StructuredBuffer<Light> gSceneLights : register(t1);
+
+float3 ComputeSceneLight(Light light, Material mat, float3 posW, float3 normal, float3 toEye)
+{
+    if (light.SpotPower > 0.0f)
+        return ComputeSpotLight(light, mat, posW, normal, toEye);
+    return ComputePointLight(light, mat, posW, normal, toEye);
+}
+#endif
+
+#ifdef CLUSTERED_LIGHTS
+// Scene lights binned into view space clusters on the CPU.  Each cluster has an
+// (offset, count) range into the index list.
+StructuredBuffer<uint2> gClusterRanges       : register(t2);
+StructuredBuffer<uint>  gClusterLightIndices : register(t3);
+
+float3 ComputeClusteredLighting(Material mat, float4 posH, float3 posW, float3 normal, float3 toEye)
+{
+    float viewZ = max(mul(float4(posW, 1.0f), gView).z, gNearZ);
+    float slice = clamp(floor(log(viewZ) * gClusterDepthScale + gClusterDepthBias), 0.0f, gClusterDims.z - 1.0f);
+    uint2 tile = min((uint2)(posH.xy * gInvRenderTargetSize * gClusterDims.xy), gClusterDims.xy - 1);
+
+    uint2 range = gClusterRanges[((uint)slice * gClusterDims.y + tile.y) * gClusterDims.x + tile.x];
+
+    float3 result = 0.0f;
+    for (uint i = 0; i < range.y; ++i)
+        result += ComputeSceneLight(gSceneLights[gClusterLightIndices[range.x + i]], mat, posW, normal, toEye);
+
+    return result;
+}
+#endif
+
+#ifdef OBJECT_LIGHTS
+// The lights picked for this object on the CPU, so the cost per pixel is fixed no matter
+// how many lights the scene has.
+float3 ComputeObjectLighting(Material mat, float3 posW, float3 normal, float3 toEye)
+{
+    float3 result = 0.0f;
+    for (uint i = 0; i < gObjectLightCount; ++i)
+        result += ComputeSceneLight(gSceneLights[gObjectLightIndices[i]], mat, posW, normal, toEye);
+
+    return result;
+}
+#endif
+
+#ifdef VIRTUAL_TEXTURE
+// The ground's physical page cache and its page table, one texel per virtual page and a
+// mip per virtual mip: the cache page (x, y) and the mip mapped there, 255 if none.
+Texture2D        gPageCache : register(t6);
+Texture2D<uint4> gPageTable : register(t7);
+
+float4 SampleVirtualTexture(float3 posW, float4 fallback)
+{
+    float2 uv = (posW.xz - gGroundVirtualPlane.xy) * gGroundVirtualPlane.z;
+
+    // The mip the texel footprint asks for; the table already points every page at the
+    // closest resident ancestor.
+    float virtualSize = gGroundVirtualPages.x * gGroundVirtualPages.y;
+    float2 dx = ddx(uv) * virtualSize;
+    float2 dy = ddy(uv) * virtualSize;
+    float lod = 0.5f * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0f));
+    uint mip = min((uint)lod, (uint)gGroundVirtualPlane.w - 1);
+
+    if (any(uv < 0.0f) || any(uv >= 1.0f))
+        return fallback;
+
+    float pagesWide = (float)((uint)gGroundVirtualPages.x >> mip);
+    uint4 entry = gPageTable.Load(int3(min(uv * pagesWide, pagesWide - 1.0f), mip));
+    if (entry.z == 255)
+        return fallback;
+
+    float mappedPages = (float)((uint)gGroundVirtualPages.x >> entry.z);
+    float2 local = uv * mappedPages - min(floor(uv * mappedPages), mappedPages - 1.0f);
+    float2 texel = entry.xy * gGroundVirtualPages.w + gGroundVirtualPages.z + local * gGroundVirtualPages.y;
+
+    float2 cacheSize;
+    gPageCache.GetDimensions(cacheSize.x, cacheSize.y);
+    return gPageCache.SampleLevel(gsamLinearClamp, texel / cacheSize, 0.0f);
+}
+#endif
+
+// Baked lighting of static geometry, one packed sample per vertex: indirect irradiance
+// over gBakedIrradianceScale in rgb, ambient occlusion in a.
+StructuredBuffer<uint> gBakedLighting : register(t4);
+
+// Ambient light reflected by a white diffuse surface with normal n.
+float3 AmbientSH(float3 n)
+{
+    float3 result = gAmbientSH[0].rgb * 0.282095f;
+    result += gAmbientSH[1].rgb * (0.488603f * n.y);
+    result += gAmbientSH[2].rgb * (0.488603f * n.z);
+    result += gAmbientSH[3].rgb * (0.488603f * n.x);
+    result += gAmbientSH[4].rgb * (1.092548f * n.x * n.y);
+    result += gAmbientSH[5].rgb * (1.092548f * n.y * n.z);
+    result += gAmbientSH[6].rgb * (0.315392f * (3.0f * n.z * n.z - 1.0f));
+    result += gAmbientSH[7].rgb * (1.092548f * n.x * n.z);
+    result += gAmbientSH[8].rgb * (0.546274f * (n.x * n.x - n.y * n.y));
+    return max(result, 0.0f);
+}
+
 struct VertexIn
 {
 	float3 PosL    : POSITION;
@@ -78,9 +203,10 @@ struct VertexOut
     float3 PosW    : POSITION;
     float3 NormalW : NORMAL;
 	float2 TexC    : TEXCOORD;
+    float4 Baked   : COLOR;
 };
 
-VertexOut VS(VertexIn vin)
+VertexOut VS(VertexIn vin, uint vertexId : SV_VertexID)
 {
 	VertexOut vout = (VertexOut)0.0f;
 	
@@ -97,13 +223,36 @@ VertexOut VS(VertexIn vin)
 	// Output vertex attributes for interpolation across triangle.
 	float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), gTexTransform);
 	vout.TexC = mul(texC, gMatTransform).xy;
+
+    // No indirect light and nothing occluded unless the object was baked.
+    vout.Baked = float4(0.0f, 0.0f, 0.0f, 1.0f);
+    if (gBakedLightingOffset != 0xffffffff)
+    {
+        uint s = gBakedLighting[gBakedLightingOffset + vertexId];
+        float3 irradiance = float3(s & 0xff, (s >> 8) & 0xff, (s >> 16) & 0xff) / 255.0f;
+        vout.Baked = float4(irradiance * gBakedIrradianceScale, (s >> 24) / 255.0f);
+    }
 	
     return vout;
 }
 
 float4 PS(VertexOut pin) : SV_Target
 {
-    float4 diffuseAlbedo = gDiffuseMap.Sample(gsamAnisotropicWrap, pin.TexC) * gDiffuseAlbedo;
+#ifdef LOD_FADE
+    // Cross-fade between two levels of detail through a 4x4 ordered dither: the level
+    // fading in (gLodFade > 0) keeps the pixels whose threshold is under the fade, the one
+    // fading out (gLodFade < 0) the others, so together they cover each pixel once.
+    static const float ditherThresholds[16] = { 0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5 };
+    uint2 ditherCell = uint2(pin.PosH.xy) & 3;
+    float threshold = (ditherThresholds[ditherCell.y * 4 + ditherCell.x] + 0.5f) / 16.0f;
+    clip(gLodFade > 0.0f ? gLodFade - threshold : threshold + gLodFade);
+#endif
+
+    float4 diffuseMap = gDiffuseMap.Sample(gsamAnisotropicWrap, pin.TexC);
+#ifdef VIRTUAL_TEXTURE
+    diffuseMap = SampleVirtualTexture(pin.PosW, diffuseMap);
+#endif
+    float4 diffuseAlbedo = diffuseMap * gDiffuseAlbedo;
 	
     // Interpolating normal can unnormalize it, so renormalize it.
     pin.NormalW = normalize(pin.NormalW);
@@ -112,7 +261,7 @@ float4 PS(VertexOut pin) : SV_Target
     float3 toEyeW = normalize(gEyePosW - pin.PosW);
 
     // Light terms.
-    float4 ambient = gAmbientLight*diffuseAlbedo;
+    float4 ambient = float4(AmbientSH(pin.NormalW) * pin.Baked.a + pin.Baked.rgb, 1.0f) * diffuseAlbedo;
 
     const float shininess = 1.0f - gRoughness;
     Material mat = { diffuseAlbedo, gFresnelR0, shininess };
@@ -120,8 +269,20 @@ float4 PS(VertexOut pin) : SV_Target
     float4 directLight = ComputeLighting(gLights, mat, pin.PosW,
         pin.NormalW, toEyeW, shadowFactor);
 
+#ifdef CLUSTERED_LIGHTS
+    directLight.rgb += ComputeClusteredLighting(mat, pin.PosH, pin.PosW, pin.NormalW, toEyeW);
+#endif
+#ifdef OBJECT_LIGHTS
+    directLight.rgb += ComputeObjectLighting(mat, pin.PosW, pin.NormalW, toEyeW);
+#endif
+
     float4 litColor = ambient + directLight;
 
+    // Environment reflection, blurrier the rougher the surface.
+    float3 r = reflect(-toEyeW, pin.NormalW);
+    float3 reflection = gSpecularEnvMap.SampleLevel(gsamLinearClamp, r, gRoughness * gSpecularEnvMaxMip).rgb;
+    litColor.rgb += SchlickFresnel(gFresnelR0, pin.NormalW, r) * reflection * pin.Baked.a;
+
     // Common convention to take alpha from diffuse albedo.
     litColor.a = diffuseAlbedo.a;
 
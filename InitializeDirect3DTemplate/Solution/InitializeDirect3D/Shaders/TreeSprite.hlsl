@@ -98,6 +98,24 @@ struct GeoOut
     uint   PrimID  : SV_PrimitiveID;
 };
 
+// Quads expanded on the CPU (BillboardExpander), the alternative to the GS.
+struct QuadVertexIn
+{
+	float3 PosW     : POSITION;
+	uint   Slice    : SLICE;
+	float2 NormalXZ : NORMAL;
+	float2 TexC     : TEXCOORD;
+};
+
+struct QuadOut
+{
+	float4 PosH    : SV_POSITION;
+	float3 PosW    : POSITION;
+	float3 NormalW : NORMAL;
+	float2 TexC    : TEXCOORD;
+	nointerpolation uint Slice : SLICE;
+};
+
 VertexOut VS(VertexIn vin)
 {
 	VertexOut vout;
@@ -167,10 +185,22 @@ void GS(point VertexOut gin[1], //PrimitiveType InputVertexType InputName[NumEle
 	}
 }
 
+QuadOut QuadVS(QuadVertexIn vin)
+{
+	QuadOut vout;
+	vout.PosH    = mul(float4(vin.PosW, 1.0f), gViewProj);
+	vout.PosW    = vin.PosW;
+	vout.NormalW = float3(vin.NormalXZ.x, 0.0f, vin.NormalXZ.y);
+	vout.TexC    = vin.TexC;
+	vout.Slice   = vin.Slice;
+
+	return vout;
+}
+
 //step6
-float4 PS(GeoOut pin) : SV_Target
+float4 ShadeSprite(GeoOut pin, uint slice)
 {
-	float3 uvw = float3(pin.TexC, pin.PrimID%3);
+	float3 uvw = float3(pin.TexC, slice);
     float4 diffuseAlbedo = gTreeMapArray.Sample(gsamAnisotropicWrap, uvw) * gDiffuseAlbedo;
 
     //using dynamic indexing
@@ -214,4 +244,21 @@ float4 PS(GeoOut pin) : SV_Target
     return litColor;
 }
 
+float4 PS(GeoOut pin) : SV_Target
+{
+	return ShadeSprite(pin, pin.PrimID % 3);
+}
+
+float4 QuadPS(QuadOut pin) : SV_Target
+{
+	GeoOut sprite;
+	sprite.PosH    = pin.PosH;
+	sprite.PosW    = pin.PosW;
+	sprite.NormalW = pin.NormalW;
+	sprite.TexC    = pin.TexC;
+	sprite.PrimID  = pin.Slice;
+
+	return ShadeSprite(sprite, pin.Slice);
+}
+
 
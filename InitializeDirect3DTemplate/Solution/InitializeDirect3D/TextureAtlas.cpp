@@ -0,0 +1,515 @@
+//***************************************************************************************
+// TextureAtlas.cpp
+//***************************************************************************************
+
+#include "TextureAtlas.h"
+
+using Microsoft::WRL::ComPtr;
+using namespace DirectX;
+
+namespace
+{
+	UINT AlignUp(UINT value, UINT alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	UINT NextPowerOfTwo(UINT value)
+	{
+		UINT p = 1;
+		while (p < value)
+			p <<= 1;
+		return p;
+	}
+}
+
+TextureAtlas::TextureAtlas(UINT maxSize, UINT padding, UINT mipLevels, UINT blockSize) :
+	mMaxSize(maxSize),
+	mPadding(padding),
+	mMipLevels(mipLevels > 0 ? mipLevels : 1),
+	mBlockSize(blockSize > 0 ? blockSize : 1)
+{
+}
+
+TextureAtlas::~TextureAtlas()
+{
+}
+
+void TextureAtlas::Add(const std::string& name, UINT width, UINT height)
+{
+	assert(width > 0 && height > 0);
+	assert(!Contains(name));
+
+	Entry e;
+	e.Name = name;
+	e.Width = width;
+	e.Height = height;
+	mEntries.push_back(e);
+}
+
+UINT TextureAtlas::Alignment()const
+{
+	// A region that starts on a multiple of blockSize*2^(mips-1) still starts on a
+	// block boundary in the smallest mip, so no two regions ever share a texel or block.
+	return mBlockSize << (mMipLevels - 1);
+}
+
+UINT TextureAtlas::Gutter()const
+{
+	// Scale the gutter up so that mPadding texels remain in the smallest mip.
+	return AlignUp(mPadding << (mMipLevels - 1), Alignment());
+}
+
+bool TextureAtlas::Pack()
+{
+	const UINT align = Alignment();
+	const UINT gutter = Gutter();
+
+	UINT64 area = 0;
+	UINT maxSide = 0;
+	for (const auto& e : mEntries)
+	{
+		UINT w = AlignUp(e.Width + 2 * gutter, align);
+		UINT h = AlignUp(e.Height + 2 * gutter, align);
+		area += (UINT64)w * h;
+		maxSide = MathHelper::Max(maxSide, MathHelper::Max(w, h));
+	}
+
+	if (mEntries.empty())
+		return false;
+
+	// Start from the smallest power-of-two square that could hold everything and grow
+	// one side at a time until the set fits.
+	UINT side = NextPowerOfTwo(MathHelper::Max(maxSide, (UINT)ceilf(sqrtf((float)area))));
+	UINT width = side;
+	UINT height = side;
+
+	while (width <= mMaxSize && height <= mMaxSize)
+	{
+		if (TryPack(width, height))
+		{
+			mWidth = width;
+			mHeight = height;
+			return true;
+		}
+
+		if (width <= height)
+			width *= 2;
+		else
+			height *= 2;
+	}
+
+	return false;
+}
+
+bool TextureAtlas::TryPack(UINT width, UINT height)
+{
+	const UINT align = Alignment();
+	const UINT gutter = Gutter();
+
+	mRegions.clear();
+	mFreeRects.clear();
+
+	Rect all;
+	all.W = width;
+	all.H = height;
+	mFreeRects.push_back(all);
+
+	// Placing the largest textures first gives MaxRects much tighter results.
+	std::vector<const Entry*> order;
+	for (const auto& e : mEntries)
+		order.push_back(&e);
+
+	std::sort(order.begin(), order.end(), [](const Entry* a, const Entry* b)
+		{
+			UINT sideA = MathHelper::Max(a->Width, a->Height);
+			UINT sideB = MathHelper::Max(b->Width, b->Height);
+			if (sideA != sideB)
+				return sideA > sideB;
+			return a->Width * a->Height > b->Width * b->Height;
+		});
+
+	for (const Entry* e : order)
+	{
+		Rect placed;
+		if (!Insert(AlignUp(e->Width + 2 * gutter, align), AlignUp(e->Height + 2 * gutter, align), placed))
+			return false;
+
+		AtlasRegion region;
+		region.X = placed.X + gutter;
+		region.Y = placed.Y + gutter;
+		region.Width = e->Width;
+		region.Height = e->Height;
+		region.UVScale = XMFLOAT2((float)e->Width / width, (float)e->Height / height);
+		region.UVOffset = XMFLOAT2((float)region.X / width, (float)region.Y / height);
+
+		mRegions[e->Name] = region;
+	}
+
+	return true;
+}
+
+bool TextureAtlas::Insert(UINT w, UINT h, Rect& placed)
+{
+	// Best short side fit: choose the free rectangle that leaves the smallest leftover
+	// on its shorter side, breaking ties on the longer side.
+	UINT bestShort = UINT_MAX;
+	UINT bestLong = UINT_MAX;
+	int bestIndex = -1;
+
+	for (size_t i = 0; i < mFreeRects.size(); ++i)
+	{
+		const Rect& r = mFreeRects[i];
+		if (r.W < w || r.H < h)
+			continue;
+
+		UINT leftoverW = r.W - w;
+		UINT leftoverH = r.H - h;
+		UINT shortSide = MathHelper::Min(leftoverW, leftoverH);
+		UINT longSide = MathHelper::Max(leftoverW, leftoverH);
+
+		if (shortSide < bestShort || (shortSide == bestShort && longSide < bestLong))
+		{
+			bestShort = shortSide;
+			bestLong = longSide;
+			bestIndex = (int)i;
+		}
+	}
+
+	if (bestIndex < 0)
+		return false;
+
+	placed.X = mFreeRects[bestIndex].X;
+	placed.Y = mFreeRects[bestIndex].Y;
+	placed.W = w;
+	placed.H = h;
+
+	SplitFreeRects(placed);
+	PruneFreeRects();
+
+	return true;
+}
+
+void TextureAtlas::SplitFreeRects(const Rect& used)
+{
+	std::vector<Rect> next;
+	next.reserve(mFreeRects.size() * 2);
+
+	for (const Rect& r : mFreeRects)
+	{
+		bool overlaps =
+			used.X < r.X + r.W && used.X + used.W > r.X &&
+			used.Y < r.Y + r.H && used.Y + used.H > r.Y;
+
+		if (!overlaps)
+		{
+			next.push_back(r);
+			continue;
+		}
+
+		// Keep the (possibly overlapping) maximal rectangles on each side of the used one.
+		if (used.X > r.X)
+			next.push_back({ r.X, r.Y, used.X - r.X, r.H });
+		if (used.X + used.W < r.X + r.W)
+			next.push_back({ used.X + used.W, r.Y, r.X + r.W - (used.X + used.W), r.H });
+		if (used.Y > r.Y)
+			next.push_back({ r.X, r.Y, r.W, used.Y - r.Y });
+		if (used.Y + used.H < r.Y + r.H)
+			next.push_back({ r.X, used.Y + used.H, r.W, r.Y + r.H - (used.Y + used.H) });
+	}
+
+	mFreeRects.swap(next);
+}
+
+void TextureAtlas::PruneFreeRects()
+{
+	auto contains = [](const Rect& a, const Rect& b)
+		{
+			return b.X >= a.X && b.Y >= a.Y &&
+				b.X + b.W <= a.X + a.W &&
+				b.Y + b.H <= a.Y + a.H;
+		};
+
+	for (size_t i = 0; i < mFreeRects.size(); ++i)
+	{
+		for (size_t j = i + 1; j < mFreeRects.size(); ++j)
+		{
+			if (contains(mFreeRects[j], mFreeRects[i]))
+			{
+				mFreeRects.erase(mFreeRects.begin() + i);
+				--i;
+				break;
+			}
+			if (contains(mFreeRects[i], mFreeRects[j]))
+			{
+				mFreeRects.erase(mFreeRects.begin() + j);
+				--j;
+			}
+		}
+	}
+}
+
+UINT TextureAtlas::Width()const
+{
+	return mWidth;
+}
+
+UINT TextureAtlas::Height()const
+{
+	return mHeight;
+}
+
+UINT TextureAtlas::MipLevels()const
+{
+	return mMipLevels;
+}
+
+bool TextureAtlas::Contains(const std::string& name)const
+{
+	for (const auto& e : mEntries)
+	{
+		if (e.Name == name)
+			return true;
+	}
+	return false;
+}
+
+const AtlasRegion& TextureAtlas::Region(const std::string& name)const
+{
+	return mRegions.at(name);
+}
+
+float TextureAtlas::Occupancy()const
+{
+	if (mWidth == 0 || mHeight == 0)
+		return 0.0f;
+
+	UINT64 used = 0;
+	for (const auto& e : mEntries)
+		used += (UINT64)e.Width * e.Height;
+
+	return (float)used / ((float)mWidth * mHeight);
+}
+
+void TextureAtlas::ApplyToMaterial(Material* mat, const std::string& name)const
+{
+	const AtlasRegion& region = Region(name);
+
+	// Texture coordinates are row vectors, so the atlas remap goes after whatever
+	// transform the material already applies.
+	XMMATRIX matTransform = XMLoadFloat4x4(&mat->MatTransform);
+	XMMATRIX remap = XMMatrixScaling(region.UVScale.x, region.UVScale.y, 1.0f) *
+		XMMatrixTranslation(region.UVOffset.x, region.UVOffset.y, 0.0f);
+	XMStoreFloat4x4(&mat->MatTransform, matTransform * remap);
+
+	mat->NumFramesDirty = gNumFrameResources;
+}
+
+void TextureAtlas::AddGutterStrips(const Texture* source, const AtlasRegion& region, UINT mip,
+	std::vector<GutterStrip>& strips)const
+{
+	// Strips are measured in copyable units: blocks of blockSize texels, or texels.
+	const UINT step = mBlockSize;
+	const UINT gutter = Gutter() >> mip;
+	const UINT units = (gutter + step - 1) / step;
+	if (units == 0)
+		return;
+
+	const UINT x = region.X >> mip;
+	const UINT y = region.Y >> mip;
+	const UINT wide = (MathHelper::Max(region.Width >> mip, 1u) + step - 1) / step;
+	const UINT high = (MathHelper::Max(region.Height >> mip, 1u) + step - 1) / step;
+
+	GutterStrip strip;
+	strip.Source = source;
+	strip.Mip = mip;
+
+	// Left and right, corners included.
+	strip.Units = units;
+	strip.Rows = high + 2 * units;
+	strip.Row = -(int)units;
+	strip.DstY = y - units * step;
+	strip.DstX = x - units * step;
+	strip.Column = -(int)units;
+	strips.push_back(strip);
+	strip.DstX = x + wide * step;
+	strip.Column = (int)wide;
+	strips.push_back(strip);
+
+	// Top and bottom.
+	strip.Units = wide;
+	strip.Rows = units;
+	strip.Column = 0;
+	strip.DstX = x;
+	strip.DstY = y - units * step;
+	strip.Row = -(int)units;
+	strips.push_back(strip);
+	strip.DstY = y + high * step;
+	strip.Row = (int)high;
+	strips.push_back(strip);
+}
+
+void TextureAtlas::CopyGutters(
+	ID3D12Device* device,
+	ID3D12GraphicsCommandList* cmdList,
+	const std::vector<GutterStrip>& strips,
+	Texture* atlasTex)const
+{
+	// Copies cannot repeat texels, so every strip is laid out in one upload buffer from the
+	// source's upload heap, then copied in one go.
+	struct Layout
+	{
+		D3D12_PLACED_SUBRESOURCE_FOOTPRINT Footprint;
+		D3D12_PLACED_SUBRESOURCE_FOOTPRINT Source;
+		UINT SourceRows = 0;
+		UINT SourceUnits = 0;
+		UINT UnitBytes = 0;
+	};
+
+	const DXGI_FORMAT format = atlasTex->Resource->GetDesc().Format;
+	std::vector<Layout> layouts(strips.size());
+	UINT64 totalBytes = 0;
+	for (size_t i = 0; i < strips.size(); ++i)
+	{
+		const GutterStrip& strip = strips[i];
+		Layout& layout = layouts[i];
+
+		// Laid out from offset 0 like the loader did, so mip m sits after mips 0 to m-1.
+		auto srcDesc = strip.Source->Resource->GetDesc();
+		std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> sourceFootprints(strip.Mip + 1);
+		std::vector<UINT> sourceRows(strip.Mip + 1);
+		std::vector<UINT64> sourceRowBytes(strip.Mip + 1);
+		device->GetCopyableFootprints(&srcDesc, 0, strip.Mip + 1, 0,
+			sourceFootprints.data(), sourceRows.data(), sourceRowBytes.data(), nullptr);
+		const UINT64 rowBytes = sourceRowBytes[strip.Mip];
+
+		layout.Source = sourceFootprints[strip.Mip];
+		layout.SourceRows = sourceRows[strip.Mip];
+		layout.SourceUnits = (layout.Source.Footprint.Width + mBlockSize - 1) / mBlockSize;
+		layout.UnitBytes = (UINT)(rowBytes / layout.SourceUnits);
+		assert(rowBytes % layout.SourceUnits == 0);
+
+		totalBytes = (totalBytes + D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT - 1) /
+			D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT * D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT;
+		layout.Footprint.Offset = totalBytes;
+		layout.Footprint.Footprint.Format = format;
+		layout.Footprint.Footprint.Width = strip.Units * mBlockSize;
+		layout.Footprint.Footprint.Height = strip.Rows * mBlockSize;
+		layout.Footprint.Footprint.Depth = 1;
+		layout.Footprint.Footprint.RowPitch = AlignUp(strip.Units * layout.UnitBytes, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT);
+		totalBytes += (UINT64)layout.Footprint.Footprint.RowPitch * strip.Rows;
+	}
+
+	if (totalBytes == 0)
+		return;
+
+	auto uploadHeap = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
+	auto bufferDesc = CD3DX12_RESOURCE_DESC::Buffer(totalBytes);
+	ThrowIfFailed(device->CreateCommittedResource(
+		&uploadHeap,
+		D3D12_HEAP_FLAG_NONE,
+		&bufferDesc,
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(atlasTex->UploadHeap.ReleaseAndGetAddressOf())));
+
+	BYTE* gutterData = nullptr;
+	ThrowIfFailed(atlasTex->UploadHeap->Map(0, nullptr, reinterpret_cast<void**>(&gutterData)));
+
+	const Texture* mappedSource = nullptr;
+	const BYTE* sourceData = nullptr;
+	for (size_t i = 0; i < strips.size(); ++i)
+	{
+		const GutterStrip& strip = strips[i];
+		const Layout& layout = layouts[i];
+
+		// Strips of one source are added together, so each source is mapped once.
+		if (strip.Source != mappedSource)
+		{
+			if (mappedSource != nullptr)
+				mappedSource->UploadHeap->Unmap(0, nullptr);
+			mappedSource = strip.Source;
+			ThrowIfFailed(mappedSource->UploadHeap->Map(0, nullptr, (void**)&sourceData));
+		}
+
+		for (UINT r = 0; r < strip.Rows; ++r)
+		{
+			const int row = MathHelper::Clamp(strip.Row + (int)r, 0, (int)layout.SourceRows - 1);
+			const BYTE* srcRow = sourceData + layout.Source.Offset + (UINT64)row * layout.Source.Footprint.RowPitch;
+			BYTE* dstRow = gutterData + layout.Footprint.Offset + (UINT64)r * layout.Footprint.Footprint.RowPitch;
+			for (UINT u = 0; u < strip.Units; ++u)
+			{
+				const int column = MathHelper::Clamp(strip.Column + (int)u, 0, (int)layout.SourceUnits - 1);
+				memcpy(dstRow + (size_t)u * layout.UnitBytes, srcRow + (size_t)column * layout.UnitBytes, layout.UnitBytes);
+			}
+		}
+
+		CD3DX12_TEXTURE_COPY_LOCATION dst(atlasTex->Resource.Get(), strip.Mip);
+		CD3DX12_TEXTURE_COPY_LOCATION src(atlasTex->UploadHeap.Get(), layout.Footprint);
+		cmdList->CopyTextureRegion(&dst, strip.DstX, strip.DstY, 0, &src, nullptr);
+	}
+
+	if (mappedSource != nullptr)
+		mappedSource->UploadHeap->Unmap(0, nullptr);
+	atlasTex->UploadHeap->Unmap(0, nullptr);
+}
+
+void TextureAtlas::BuildResource(
+	ID3D12Device* device,
+	ID3D12GraphicsCommandList* cmdList,
+	const std::unordered_map<std::string, const Texture*>& sources,
+	D3D12_RESOURCE_STATES sourceState,
+	Texture* atlasTex)
+{
+	assert(mWidth > 0 && mHeight > 0);
+	assert(!sources.empty());
+
+	DXGI_FORMAT format = sources.begin()->second->Resource->GetDesc().Format;
+
+	auto defaultHeap = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+	auto texDesc = CD3DX12_RESOURCE_DESC::Tex2D(format, mWidth, mHeight, 1, (UINT16)mMipLevels);
+
+	// Every gutter is filled from its region's edge below, so filtering and lower mips
+	// clamp to the source's own border instead of fading to black.
+	ThrowIfFailed(device->CreateCommittedResource(
+		&defaultHeap,
+		D3D12_HEAP_FLAG_NONE,
+		&texDesc,
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		nullptr,
+		IID_PPV_ARGS(atlasTex->Resource.ReleaseAndGetAddressOf())));
+
+	std::vector<GutterStrip> strips;
+	for (const auto& src : sources)
+	{
+		const AtlasRegion& region = Region(src.first);
+		ID3D12Resource* resource = src.second->Resource.Get();
+
+		auto srcDesc = resource->GetDesc();
+		assert(srcDesc.Format == format);
+
+		auto toCopy = CD3DX12_RESOURCE_BARRIER::Transition(resource,
+			sourceState, D3D12_RESOURCE_STATE_COPY_SOURCE);
+		cmdList->ResourceBarrier(1, &toCopy);
+
+		// Sources with a shorter mip chain leave the remaining atlas mips of their region black.
+		UINT mips = MathHelper::Min((UINT)srcDesc.MipLevels, mMipLevels);
+		for (UINT m = 0; m < mips; ++m)
+		{
+			CD3DX12_TEXTURE_COPY_LOCATION dst(atlasTex->Resource.Get(), m);
+			CD3DX12_TEXTURE_COPY_LOCATION srcLoc(resource, m);
+			cmdList->CopyTextureRegion(&dst, region.X >> m, region.Y >> m, 0, &srcLoc, nullptr);
+			AddGutterStrips(src.second, region, m, strips);
+		}
+
+		auto toShader = CD3DX12_RESOURCE_BARRIER::Transition(resource,
+			D3D12_RESOURCE_STATE_COPY_SOURCE, sourceState);
+		cmdList->ResourceBarrier(1, &toShader);
+	}
+
+	CopyGutters(device, cmdList, strips, atlasTex);
+
+	auto atlasToShader = CD3DX12_RESOURCE_BARRIER::Transition(atlasTex->Resource.Get(),
+		D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	cmdList->ResourceBarrier(1, &atlasToShader);
+}
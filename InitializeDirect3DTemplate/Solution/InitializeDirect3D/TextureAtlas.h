@@ -0,0 +1,132 @@
+//***************************************************************************************
+// TextureAtlas.h
+//
+// Packs small textures (flags, 1x1 fills, UI and prop images) into one shared texture
+// using the MaxRects algorithm.  Every packed texture gets a padded, mip-aligned region
+// so neighbours do not bleed into each other when sampling lower mips, and a UV
+// scale/offset that is folded into the material's MatTransform.
+//***************************************************************************************
+
+#pragma once
+
+#include "../../Common/d3dUtil.h"
+
+// Region of the atlas assigned to one source texture.
+struct AtlasRegion
+{
+	// Texel rectangle of the source image inside the atlas (gutter excluded).
+	UINT X = 0;
+	UINT Y = 0;
+	UINT Width = 0;
+	UINT Height = 0;
+
+	// Maps source texture coordinates in [0,1] into the atlas: uv' = uv*UVScale + UVOffset.
+	DirectX::XMFLOAT2 UVScale = { 1.0f, 1.0f };
+	DirectX::XMFLOAT2 UVOffset = { 0.0f, 0.0f };
+};
+
+class TextureAtlas
+{
+public:
+	///<summary>
+	/// padding is the gutter in texels that must survive at the smallest mip.  blockSize is
+	/// 4 for block-compressed formats so every region stays block aligned at every mip.
+	///</summary>
+	TextureAtlas(UINT maxSize, UINT padding, UINT mipLevels, UINT blockSize = 1);
+	TextureAtlas(const TextureAtlas& rhs) = delete;
+	TextureAtlas& operator=(const TextureAtlas& rhs) = delete;
+	~TextureAtlas();
+
+	void Add(const std::string& name, UINT width, UINT height);
+
+	// Packs all added textures.  Returns false if they do not fit in maxSize x maxSize.
+	bool Pack();
+
+	UINT Width()const;
+	UINT Height()const;
+	UINT MipLevels()const;
+
+	bool Contains(const std::string& name)const;
+	const AtlasRegion& Region(const std::string& name)const;
+
+	// Fraction of the atlas area covered by source texels.
+	float Occupancy()const;
+
+	// Remaps the material into the region of the named texture and marks it dirty.
+	void ApplyToMaterial(Material* mat, const std::string& name)const;
+
+	///<summary>
+	/// Creates the atlas texture and records copies of every source mip into its region.
+	/// All sources must share one format and be in sourceState, which they are left in.
+	/// Each source's UploadHeap must still hold the data it was created from, laid out as
+	/// GetCopyableFootprints lays out its subresources (CreateDDSTextureFromFile12 leaves
+	/// it so); the gutters are built from it.  The sources must stay alive until the
+	/// command list has executed, and so must atlasTex->UploadHeap.
+	///</summary>
+	void BuildResource(
+		ID3D12Device* device,
+		ID3D12GraphicsCommandList* cmdList,
+		const std::unordered_map<std::string, const Texture*>& sources,
+		D3D12_RESOURCE_STATES sourceState,
+		Texture* atlasTex);
+
+private:
+	struct Rect
+	{
+		UINT X = 0;
+		UINT Y = 0;
+		UINT W = 0;
+		UINT H = 0;
+	};
+
+	struct Entry
+	{
+		std::string Name;
+		UINT Width = 0;
+		UINT Height = 0;
+	};
+
+	bool TryPack(UINT width, UINT height);
+	bool Insert(UINT w, UINT h, Rect& placed);
+	void SplitFreeRects(const Rect& used);
+	void PruneFreeRects();
+
+	UINT Alignment()const;
+	UINT Gutter()const;
+
+	// One side of the gutter around one mip of a region.  Unit (u, r) of the strip, a block
+	// or a texel, repeats unit (u + Column, r + Row) of the source clamped into its extent.
+	struct GutterStrip
+	{
+		const Texture* Source = nullptr;
+		UINT Mip = 0;
+		UINT DstX = 0;
+		UINT DstY = 0;
+		UINT Units = 0;
+		UINT Rows = 0;
+		int Column = 0;
+		int Row = 0;
+	};
+
+	// The left and right strips span the corners too, so four copies fill a gutter.
+	void AddGutterStrips(const Texture* source, const AtlasRegion& region, UINT mip,
+		std::vector<GutterStrip>& strips)const;
+	void CopyGutters(
+		ID3D12Device* device,
+		ID3D12GraphicsCommandList* cmdList,
+		const std::vector<GutterStrip>& strips,
+		Texture* atlasTex)const;
+
+private:
+	UINT mMaxSize = 0;
+	UINT mPadding = 0;
+	UINT mMipLevels = 1;
+	UINT mBlockSize = 1;
+
+	UINT mWidth = 0;
+	UINT mHeight = 0;
+
+	std::vector<Entry> mEntries;
+	std::vector<Rect> mFreeRects;
+	std::unordered_map<std::string, AtlasRegion> mRegions;
+};
@@ -0,0 +1,246 @@
+//***************************************************************************************
+// TextureResidency.cpp
+//***************************************************************************************
+
+#include "TextureResidency.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+TextureResidency::TextureResidency(std::uint64_t budgetBytes)
+{
+	mStats.BudgetBytes = budgetBytes;
+
+	// Frame 0 means "never needed".
+	mFrame = 1;
+}
+
+TextureResidency::~TextureResidency()
+{
+}
+
+std::uint32_t TextureResidency::Register(const std::string& name, std::uint32_t width, std::uint32_t height,
+	std::uint32_t mipLevels, std::uint32_t arraySize, std::uint32_t bitsPerPixel, bool blockCompressed)
+{
+	TextureInfo tex;
+	tex.Name = name;
+	tex.Width = width;
+	tex.Height = height;
+	tex.MipLevels = std::max(mipLevels, 1u);
+	tex.ResidentMip = 0;
+	tex.RequestedMip = tex.MipLevels;
+	tex.MipBytes.resize(tex.MipLevels);
+	tex.LastNeededFrame.assign(tex.MipLevels, 0);
+
+	for (std::uint32_t m = 0; m < tex.MipLevels; ++m)
+	{
+		std::uint64_t w = std::max(width >> m, 1u);
+		std::uint64_t h = std::max(height >> m, 1u);
+
+		std::uint64_t bytes = 0;
+		if (blockCompressed)
+		{
+			// 4x4 blocks; a partial block still costs a whole block.
+			std::uint64_t blocksWide = (w + 3) / 4;
+			std::uint64_t blocksHigh = (h + 3) / 4;
+			bytes = blocksWide * blocksHigh * (16 * bitsPerPixel / 8);
+		}
+		else
+		{
+			bytes = (w * h * bitsPerPixel + 7) / 8;
+		}
+
+		tex.MipBytes[m] = bytes * std::max(arraySize, 1u);
+		mStats.ResidentBytes += tex.MipBytes[m];
+	}
+
+	mTextures.push_back(tex);
+	return (std::uint32_t)mTextures.size() - 1;
+}
+
+void TextureResidency::SetBudget(std::uint64_t budgetBytes)
+{
+	mStats.BudgetBytes = budgetBytes;
+}
+
+void TextureResidency::SetMinResidentMips(std::uint32_t count)
+{
+	mMinResidentMips = std::max(count, 1u);
+}
+
+void TextureResidency::SetPinned(std::uint32_t id, bool pinned)
+{
+	assert(id < mTextures.size());
+	mTextures[id].Pinned = pinned;
+}
+
+std::uint32_t TextureResidency::MipForCoverage(std::uint32_t width, std::uint32_t height,
+	float screenPixels, float uvRepeat)
+{
+	std::uint32_t largest = std::max(std::max(width, height), 1u);
+	std::uint32_t maxMip = 0;
+	while ((largest >> maxMip) > 1)
+		++maxMip;
+
+	if (screenPixels < 1.0f)
+		return maxMip;
+
+	// Each mip level divides the texel count by four, so half of log2 of the texel to
+	// pixel ratio is the mip that samples roughly one texel per pixel.
+	float texels = (float)width * (float)height * std::max(uvRepeat, 1.0f);
+	float ratio = texels / screenPixels;
+	if (ratio <= 1.0f)
+		return 0;
+
+	std::uint32_t mip = (std::uint32_t)(0.5f * std::log2(ratio));
+	return std::min(mip, maxMip);
+}
+
+void TextureResidency::RequestMip(std::uint32_t id, std::uint32_t mip)
+{
+	assert(id < mTextures.size());
+	TextureInfo& tex = mTextures[id];
+
+	mip = std::min(mip, tex.MipLevels - 1);
+
+	if (mip >= tex.ResidentMip)
+		mStats.Hits++;
+	else
+		mStats.Misses++;
+
+	tex.RequestedMip = std::min(tex.RequestedMip, mip);
+
+	for (std::uint32_t m = mip; m < tex.MipLevels; ++m)
+		tex.LastNeededFrame[m] = mFrame;
+}
+
+std::uint32_t TextureResidency::LowestEvictableMip(const TextureInfo& tex)const
+{
+	if (tex.Pinned)
+		return 0;
+	return tex.MipLevels > mMinResidentMips ? tex.MipLevels - mMinResidentMips : 0;
+}
+
+void TextureResidency::EndFrame(std::vector<Request>& requests)
+{
+	// Bring back every mip the frame asked for.  These are needed right now, so they
+	// are granted first and the budget is enforced by evicting something else.
+	for (std::uint32_t id = 0; id < (std::uint32_t)mTextures.size(); ++id)
+	{
+		TextureInfo& tex = mTextures[id];
+		while (tex.RequestedMip < tex.ResidentMip)
+		{
+			tex.ResidentMip--;
+			mStats.ResidentBytes += tex.MipBytes[tex.ResidentMip];
+			mStats.StreamIns++;
+
+			Request r;
+			r.TextureId = id;
+			r.Mip = tex.ResidentMip;
+			r.StreamIn = true;
+			requests.push_back(r);
+		}
+	}
+
+	// Evict the most detailed resident mip that has gone the longest without being needed.
+	while (mStats.ResidentBytes > mStats.BudgetBytes)
+	{
+		int victim = -1;
+		std::uint64_t oldestFrame = mFrame;
+		std::uint64_t victimBytes = 0;
+
+		for (std::uint32_t id = 0; id < (std::uint32_t)mTextures.size(); ++id)
+		{
+			const TextureInfo& tex = mTextures[id];
+			if (tex.ResidentMip >= LowestEvictableMip(tex))
+				continue;
+
+			std::uint64_t lastNeeded = tex.LastNeededFrame[tex.ResidentMip];
+			std::uint64_t bytes = tex.MipBytes[tex.ResidentMip];
+
+			// Never evict what this frame is using; prefer larger mips on ties.
+			if (lastNeeded == mFrame)
+				continue;
+
+			if (victim < 0 || lastNeeded < oldestFrame || (lastNeeded == oldestFrame && bytes > victimBytes))
+			{
+				victim = (int)id;
+				oldestFrame = lastNeeded;
+				victimBytes = bytes;
+			}
+		}
+
+		if (victim < 0)
+			break;
+
+		TextureInfo& tex = mTextures[victim];
+		mStats.ResidentBytes -= tex.MipBytes[tex.ResidentMip];
+		mStats.Evictions++;
+
+		Request r;
+		r.TextureId = (std::uint32_t)victim;
+		r.Mip = tex.ResidentMip;
+		r.StreamIn = false;
+		requests.push_back(r);
+
+		tex.ResidentMip++;
+	}
+
+	for (auto& tex : mTextures)
+		tex.RequestedMip = tex.MipLevels;
+
+	mFrame++;
+}
+
+std::uint32_t TextureResidency::TextureCount()const
+{
+	return (std::uint32_t)mTextures.size();
+}
+
+const std::string& TextureResidency::Name(std::uint32_t id)const
+{
+	return mTextures[id].Name;
+}
+
+std::uint32_t TextureResidency::Width(std::uint32_t id)const
+{
+	return mTextures[id].Width;
+}
+
+std::uint32_t TextureResidency::Height(std::uint32_t id)const
+{
+	return mTextures[id].Height;
+}
+
+std::uint32_t TextureResidency::ResidentMip(std::uint32_t id)const
+{
+	return mTextures[id].ResidentMip;
+}
+
+std::uint64_t TextureResidency::MipBytes(std::uint32_t id, std::uint32_t mip)const
+{
+	return mTextures[id].MipBytes[mip];
+}
+
+std::uint64_t TextureResidency::TextureBytes(std::uint32_t id)const
+{
+	const TextureInfo& tex = mTextures[id];
+
+	std::uint64_t bytes = 0;
+	for (std::uint32_t m = tex.ResidentMip; m < tex.MipLevels; ++m)
+		bytes += tex.MipBytes[m];
+	return bytes;
+}
+
+const TextureResidency::Stats& TextureResidency::GetStats()const
+{
+	return mStats;
+}
+
+void TextureResidency::ResetStats()
+{
+	mStats.Hits = 0;
+	mStats.Misses = 0;
+	mStats.Evictions = 0;
+	mStats.StreamIns = 0;
+}
@@ -0,0 +1,121 @@
+//***************************************************************************************
+// TextureResidency.h
+//
+// Tracks how much memory each texture mip occupies and which mips the frame actually
+// needs.  When the resident set exceeds the budget, the most detailed mips that have
+// gone the longest without being needed are evicted; mips that are requested again
+// after eviction are reported back as stream-in requests.
+//
+// This class only makes the decisions, it does not touch the GPU, so it has no
+// Direct3D dependency.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class TextureResidency
+{
+public:
+	struct Request
+	{
+		std::uint32_t TextureId = 0;
+		std::uint32_t Mip = 0;
+		bool StreamIn = false; // false means the mip was evicted.
+	};
+
+	struct Stats
+	{
+		std::uint64_t Hits = 0;
+		std::uint64_t Misses = 0;
+		std::uint64_t Evictions = 0;
+		std::uint64_t StreamIns = 0;
+		std::uint64_t ResidentBytes = 0;
+		std::uint64_t BudgetBytes = 0;
+
+		float HitRate()const
+		{
+			std::uint64_t total = Hits + Misses;
+			return total > 0 ? (float)Hits / (float)total : 1.0f;
+		}
+	};
+
+public:
+	explicit TextureResidency(std::uint64_t budgetBytes);
+	TextureResidency(const TextureResidency& rhs) = delete;
+	TextureResidency& operator=(const TextureResidency& rhs) = delete;
+	~TextureResidency();
+
+	///<summary>
+	/// Registers a fully resident texture and returns its id.  For block-compressed
+	/// formats bitsPerPixel is the average rate (4 for BC1, 8 for BC2/BC3).
+	///</summary>
+	std::uint32_t Register(const std::string& name, std::uint32_t width, std::uint32_t height,
+		std::uint32_t mipLevels, std::uint32_t arraySize, std::uint32_t bitsPerPixel, bool blockCompressed);
+
+	void SetBudget(std::uint64_t budgetBytes);
+
+	// Smallest mips are never evicted so every texture can always be sampled.
+	void SetMinResidentMips(std::uint32_t count);
+
+	// A pinned texture keeps all its mips, for textures that cannot be streamed back in.
+	void SetPinned(std::uint32_t id, bool pinned);
+
+	///<summary>
+	/// Returns the most detailed mip worth keeping for a texture that covers screenPixels
+	/// on screen and is repeated uvRepeat times across the surface (texel:pixel ~ 1:1).
+	///</summary>
+	static std::uint32_t MipForCoverage(std::uint32_t width, std::uint32_t height,
+		float screenPixels, float uvRepeat);
+
+	// Records that the current frame needs texture id down to the given mip.
+	void RequestMip(std::uint32_t id, std::uint32_t mip);
+
+	///<summary>
+	/// Applies the policy for the frame: evicts least-recently-needed detailed mips while
+	/// over budget, then appends evictions and stream-in requests to the list.
+	///</summary>
+	void EndFrame(std::vector<Request>& requests);
+
+	std::uint32_t TextureCount()const;
+	const std::string& Name(std::uint32_t id)const;
+	std::uint32_t Width(std::uint32_t id)const;
+	std::uint32_t Height(std::uint32_t id)const;
+	std::uint32_t ResidentMip(std::uint32_t id)const;
+	std::uint64_t MipBytes(std::uint32_t id, std::uint32_t mip)const;
+	std::uint64_t TextureBytes(std::uint32_t id)const;
+
+	const Stats& GetStats()const;
+	void ResetStats();
+
+private:
+	struct TextureInfo
+	{
+		std::string Name;
+		std::uint32_t Width = 0;
+		std::uint32_t Height = 0;
+		std::uint32_t MipLevels = 1;
+		bool Pinned = false;
+
+		// Most detailed mip currently resident; mips [ResidentMip, MipLevels) are in memory.
+		std::uint32_t ResidentMip = 0;
+
+		// Most detailed mip requested this frame, MipLevels if untouched.
+		std::uint32_t RequestedMip = 0;
+
+		std::vector<std::uint64_t> MipBytes;
+		std::vector<std::uint64_t> LastNeededFrame;
+	};
+
+	std::uint32_t LowestEvictableMip(const TextureInfo& tex)const;
+
+private:
+	std::vector<TextureInfo> mTextures;
+
+	std::uint64_t mFrame = 0;
+	std::uint32_t mMinResidentMips = 1;
+
+	Stats mStats;
+};
@@ -0,0 +1,362 @@
+//***************************************************************************************
+// VirtualTexture.cpp
+//***************************************************************************************
+
+#include "VirtualTexture.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+VirtualTexture::VirtualTexture(const Desc& desc) :
+	mDesc(desc)
+{
+	assert(desc.PageSize > 0 && desc.VirtualSize >= desc.PageSize);
+
+	// One mip per halving of the page grid, down to a single page.
+	uint32 pages = desc.VirtualSize / desc.PageSize;
+	mMipCount = 1;
+	while (pages > 1)
+	{
+		pages >>= 1;
+		++mMipCount;
+	}
+	assert(mMipCount <= 16);
+
+	mPageTable.resize(mMipCount);
+	for (uint32 m = 0; m < mMipCount; ++m)
+		mPageTable[m].resize((size_t)PagesWide(m) * PagesWide(m));
+
+	mSlots.resize((size_t)desc.PhysicalPagesX * desc.PhysicalPagesY);
+}
+
+VirtualTexture::~VirtualTexture()
+{
+}
+
+VirtualTexture::uint32 VirtualTexture::MakePageId(uint32 mip, uint32 x, uint32 y)
+{
+	return (mip << 28) | ((y & 0x3FFF) << 14) | (x & 0x3FFF);
+}
+
+VirtualTexture::uint32 VirtualTexture::PageMip(uint32 pageId)
+{
+	return pageId >> 28;
+}
+
+VirtualTexture::uint32 VirtualTexture::PageX(uint32 pageId)
+{
+	return pageId & 0x3FFF;
+}
+
+VirtualTexture::uint32 VirtualTexture::PageY(uint32 pageId)
+{
+	return (pageId >> 14) & 0x3FFF;
+}
+
+const VirtualTexture::Desc& VirtualTexture::GetDesc()const
+{
+	return mDesc;
+}
+
+VirtualTexture::uint32 VirtualTexture::MipCount()const
+{
+	return mMipCount;
+}
+
+VirtualTexture::uint32 VirtualTexture::PagesWide(uint32 mip)const
+{
+	return std::max((mDesc.VirtualSize / mDesc.PageSize) >> mip, 1u);
+}
+
+VirtualTexture::PageTableEntry& VirtualTexture::Entry(uint32 mip, uint32 x, uint32 y)
+{
+	return mPageTable[mip][(size_t)y * PagesWide(mip) + x];
+}
+
+const VirtualTexture::PageTableEntry& VirtualTexture::Lookup(uint32 mip, uint32 x, uint32 y)const
+{
+	return mPageTable[mip][(size_t)y * PagesWide(mip) + x];
+}
+
+const std::vector<VirtualTexture::PageTableEntry>& VirtualTexture::PageTable(uint32 mip)const
+{
+	return mPageTable[mip];
+}
+
+const VirtualTexture::Stats& VirtualTexture::GetStats()const
+{
+	return mStats;
+}
+
+bool VirtualTexture::IsResident(uint32 pageId)const
+{
+	auto it = mPageToSlot.find(pageId);
+	return it != mPageToSlot.end() && mSlots[it->second].State == SlotState::Resident;
+}
+
+void VirtualTexture::Update(const std::vector<uint32>& feedback, std::vector<PageLoad>& loads, std::vector<uint32>& evictions)
+{
+	mFrame++;
+
+	// Every request and its ancestors up to the top mip, sorted so the requests of a page
+	// are next to each other and can be counted.
+	mRequested.clear();
+	for (uint32 pageId : feedback)
+	{
+		uint32 mip = PageMip(pageId);
+		uint32 x = PageX(pageId);
+		uint32 y = PageY(pageId);
+		if (mip >= mMipCount || x >= PagesWide(mip) || y >= PagesWide(mip))
+			continue;
+
+		for (; mip < mMipCount; ++mip, x >>= 1, y >>= 1)
+			mRequested.push_back(MakePageId(mip, x, y));
+	}
+	std::sort(mRequested.begin(), mRequested.end());
+
+	mStats.RequestedPages = 0;
+	mStats.Loads = 0;
+	mStats.Evictions = 0;
+	mStats.Misses = 0;
+
+	// Touch everything we already have so it is not picked for eviction.
+	std::vector<std::pair<uint32, uint32>>& missing = mMissing;
+	missing.clear();
+	for (std::size_t i = 0; i < mRequested.size();)
+	{
+		uint32 pageId = mRequested[i];
+		std::size_t end = i;
+		while (end < mRequested.size() && mRequested[end] == pageId)
+			++end;
+		uint32 count = (uint32)(end - i);
+		i = end;
+
+		mStats.RequestedPages++;
+		auto it = mPageToSlot.find(pageId);
+		if (it != mPageToSlot.end())
+			mSlots[it->second].LastUsedFrame = mFrame;
+		else
+			missing.push_back({ pageId, count });
+	}
+	mStats.Misses = (uint32)missing.size();
+
+	// Coarse pages first: they cover the most screen area and are the fallback for
+	// everything below them.  Within a mip, the most requested pages go first.
+	std::sort(missing.begin(), missing.end(), [](const std::pair<uint32, uint32>& a, const std::pair<uint32, uint32>& b)
+		{
+			uint32 mipA = PageMip(a.first);
+			uint32 mipB = PageMip(b.first);
+			if (mipA != mipB)
+				return mipA > mipB;
+			if (a.second != b.second)
+				return a.second > b.second;
+			return a.first < b.first;
+		});
+
+	for (const auto& m : missing)
+	{
+		if (mStats.Loads >= mDesc.MaxLoadsPerFrame)
+			break;
+
+		int slot = AcquireSlot(evictions);
+		if (slot < 0)
+			break;
+
+		Slot& s = mSlots[slot];
+		s.PageId = m.first;
+		s.LastUsedFrame = mFrame;
+		s.State = SlotState::Loading;
+		mPageToSlot[m.first] = (uint32)slot;
+
+		PageLoad load;
+		load.PageId = m.first;
+		load.PhysicalX = (uint16)(slot % mDesc.PhysicalPagesX);
+		load.PhysicalY = (uint16)(slot / mDesc.PhysicalPagesX);
+		loads.push_back(load);
+
+		mStats.Loads++;
+	}
+
+	mStats.ResidentPages = 0;
+	mStats.PendingLoads = 0;
+	for (const auto& s : mSlots)
+	{
+		if (s.State == SlotState::Resident)
+			mStats.ResidentPages++;
+		else if (s.State == SlotState::Loading)
+			mStats.PendingLoads++;
+	}
+}
+
+int VirtualTexture::AcquireSlot(std::vector<uint32>& evictions)
+{
+	int lru = -1;
+	for (uint32 i = 0; i < (uint32)mSlots.size(); ++i)
+	{
+		const Slot& s = mSlots[i];
+		if (s.State == SlotState::Free)
+			return (int)i;
+
+		// Pages in flight or needed this frame are not candidates.
+		if (s.State != SlotState::Resident || s.LastUsedFrame == mFrame)
+			continue;
+
+		if (lru < 0 || s.LastUsedFrame < mSlots[lru].LastUsedFrame)
+			lru = (int)i;
+	}
+
+	if (lru >= 0)
+	{
+		evictions.push_back(mSlots[lru].PageId);
+		Evict((uint32)lru);
+		mStats.Evictions++;
+	}
+
+	return lru;
+}
+
+void VirtualTexture::Evict(uint32 slotIndex)
+{
+	Slot& s = mSlots[slotIndex];
+	if (s.State == SlotState::Resident)
+		UnmapSubtree(s.PageId);
+
+	mPageToSlot.erase(s.PageId);
+	s.State = SlotState::Free;
+}
+
+void VirtualTexture::CompleteLoad(uint32 pageId)
+{
+	auto it = mPageToSlot.find(pageId);
+	if (it == mPageToSlot.end())
+		return; // Evicted before the data arrived.
+
+	Slot& s = mSlots[it->second];
+	if (s.State != SlotState::Loading)
+		return;
+
+	s.State = SlotState::Resident;
+	MapSubtree(pageId, it->second);
+}
+
+void VirtualTexture::CancelLoad(uint32 pageId)
+{
+	auto it = mPageToSlot.find(pageId);
+	if (it == mPageToSlot.end() || mSlots[it->second].State != SlotState::Loading)
+		return;
+
+	Evict(it->second);
+}
+
+void VirtualTexture::MapSubtree(uint32 pageId, uint32 slotIndex)
+{
+	uint32 mip = PageMip(pageId);
+	uint32 x = PageX(pageId);
+	uint32 y = PageY(pageId);
+
+	uint16 physX = (uint16)(slotIndex % mDesc.PhysicalPagesX);
+	uint16 physY = (uint16)(slotIndex / mDesc.PhysicalPagesX);
+
+	// Every page under this one that currently falls back to something coarser (or to
+	// nothing) should sample this page instead.
+	for (int k = (int)mip; k >= 0; --k)
+	{
+		uint32 span = 1u << (mip - k);
+		for (uint32 j = y * span; j < (y + 1) * span; ++j)
+		{
+			for (uint32 i = x * span; i < (x + 1) * span; ++i)
+			{
+				PageTableEntry& e = Entry((uint32)k, i, j);
+				if (e.MappedMip > mip)
+				{
+					e.PhysicalX = physX;
+					e.PhysicalY = physY;
+					e.MappedMip = (uint8)mip;
+				}
+			}
+		}
+	}
+}
+
+void VirtualTexture::UnmapSubtree(uint32 pageId)
+{
+	uint32 mip = PageMip(pageId);
+	uint32 x = PageX(pageId);
+	uint32 y = PageY(pageId);
+
+	// Entries that pointed at the evicted page now inherit their parent's mapping.
+	// Going from the evicted mip downwards guarantees the parent is already fixed up.
+	for (int k = (int)mip; k >= 0; --k)
+	{
+		uint32 span = 1u << (mip - k);
+		for (uint32 j = y * span; j < (y + 1) * span; ++j)
+		{
+			for (uint32 i = x * span; i < (x + 1) * span; ++i)
+			{
+				PageTableEntry& e = Entry((uint32)k, i, j);
+				if (e.MappedMip != mip)
+					continue;
+
+				if ((uint32)k + 1 < mMipCount)
+					e = Entry((uint32)k + 1, i >> 1, j >> 1);
+				else
+					e = PageTableEntry();
+			}
+		}
+	}
+}
+
+void VirtualTexture::GeneratePlaneFeedback(
+	const Desc& desc,
+	const float eye[3], const float forward[3],
+	float planeCenterX, float planeCenterZ, float planeY, float planeSize,
+	float fovY, float screenHeight, uint32 gridSamples,
+	std::vector<uint32>& feedback)
+{
+	uint32 pagesWide = desc.VirtualSize / desc.PageSize;
+	uint32 mipCount = 1;
+	for (uint32 p = pagesWide; p > 1; p >>= 1)
+		++mipCount;
+
+	const float texelsPerUnit = (float)desc.VirtualSize / planeSize;
+	const float pixelAngle = 2.0f * tanf(0.5f * fovY) / screenHeight;
+	const float cosHalfFov = cosf(0.5f * fovY * 1.5f); // generous cone around the view direction
+
+	const float minX = planeCenterX - 0.5f * planeSize;
+	const float minZ = planeCenterZ - 0.5f * planeSize;
+	const float step = planeSize / gridSamples;
+
+	for (uint32 j = 0; j < gridSamples; ++j)
+	{
+		for (uint32 i = 0; i < gridSamples; ++i)
+		{
+			float px = minX + (i + 0.5f) * step;
+			float pz = minZ + (j + 0.5f) * step;
+
+			float dx = px - eye[0];
+			float dy = planeY - eye[1];
+			float dz = pz - eye[2];
+			float dist = sqrtf(dx * dx + dy * dy + dz * dz);
+			if (dist < 1e-4f)
+				dist = 1e-4f;
+
+			// Skip samples well outside the view cone.
+			float cosAngle = (dx * forward[0] + dy * forward[1] + dz * forward[2]) / dist;
+			if (cosAngle < cosHalfFov)
+				continue;
+
+			// World size of one pixel at this distance, in virtual texels, picks the mip.
+			float texelsPerPixel = dist * pixelAngle * texelsPerUnit;
+			uint32 mip = texelsPerPixel > 1.0f ? (uint32)log2f(texelsPerPixel) : 0;
+			mip = std::min(mip, mipCount - 1);
+
+			float u = (px - minX) / planeSize;
+			float v = (pz - minZ) / planeSize;
+			uint32 mipPages = std::max(pagesWide >> mip, 1u);
+			uint32 x = std::min((uint32)(u * mipPages), mipPages - 1);
+			uint32 y = std::min((uint32)(v * mipPages), mipPages - 1);
+
+			feedback.push_back(MakePageId(mip, x, y));
+		}
+	}
+}
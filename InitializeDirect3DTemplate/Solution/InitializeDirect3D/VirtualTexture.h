@@ -0,0 +1,153 @@
+//***************************************************************************************
+// VirtualTexture.h
+//
+// CPU side of a sparse virtual texture.  A huge virtual image is split into fixed-size
+// pages; only the pages the camera needs live in a physical page cache, and a page table
+// (one entry per virtual page per mip) points every page at the resident page that
+// should be sampled in its place, falling back to the closest resident ancestor.
+//
+// Each frame the feedback analyzer turns the page requests for that frame into a
+// bounded number of loads and the least-recently-used evictions needed to make room.
+// There is no Direct3D dependency here; the renderer copies the pages into its physical
+// cache and the page table into an indirection texture, one texel per page and one mip
+// per virtual mip, that the pixel shader reads to find the cache page to sample.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class VirtualTexture
+{
+public:
+
+	using uint8 = std::uint8_t;
+	using uint16 = std::uint16_t;
+	using uint32 = std::uint32_t;
+
+	static const uint8 InvalidMip = 0xFF;
+
+	struct Desc
+	{
+		uint32 VirtualSize = 32768;    // texels along one side of mip 0
+		uint32 PageSize = 128;         // texels along one side of a page, border excluded
+		uint32 BorderSize = 4;         // filtering border stored around every page
+		uint32 PhysicalPagesX = 16;    // physical cache is PhysicalPagesX x PhysicalPagesY pages
+		uint32 PhysicalPagesY = 16;
+		uint32 MaxLoadsPerFrame = 16;
+	};
+
+	struct PageTableEntry
+	{
+		uint16 PhysicalX = 0;
+		uint16 PhysicalY = 0;
+		uint8 MappedMip = InvalidMip;  // mip of the page actually mapped here
+	};
+
+	struct PageLoad
+	{
+		uint32 PageId = 0;
+		uint16 PhysicalX = 0;
+		uint16 PhysicalY = 0;
+	};
+
+	struct Stats
+	{
+		uint32 RequestedPages = 0;
+		uint32 ResidentPages = 0;
+		uint32 PendingLoads = 0;
+		uint32 Loads = 0;
+		uint32 Evictions = 0;
+		uint32 Misses = 0;
+	};
+
+public:
+	explicit VirtualTexture(const Desc& desc);
+	VirtualTexture(const VirtualTexture& rhs) = delete;
+	VirtualTexture& operator=(const VirtualTexture& rhs) = delete;
+	~VirtualTexture();
+
+	// Page ids pack the mip in the top 4 bits and the page coordinates in 14 bits each.
+	static uint32 MakePageId(uint32 mip, uint32 x, uint32 y);
+	static uint32 PageMip(uint32 pageId);
+	static uint32 PageX(uint32 pageId);
+	static uint32 PageY(uint32 pageId);
+
+	const Desc& GetDesc()const;
+	uint32 MipCount()const;
+	uint32 PagesWide(uint32 mip)const;
+
+	///<summary>
+	/// Feedback analyzer.  Takes the raw page requests of one frame (duplicates allowed),
+	/// adds their ancestors so a coarser fallback is always on its way, and schedules up
+	/// to MaxLoadsPerFrame loads, coarsest first.  Slots are reclaimed from pages that
+	/// were not requested this frame, least recently used first.
+	///</summary>
+	void Update(const std::vector<uint32>& feedback, std::vector<PageLoad>& loads, std::vector<uint32>& evictions);
+
+	// Called when the data for a scheduled load has been written to its physical page.
+	void CompleteLoad(uint32 pageId);
+
+	// Called instead when the data could not be read.  The slot is free again and the page
+	// is requested anew by a later Update.
+	void CancelLoad(uint32 pageId);
+
+	bool IsResident(uint32 pageId)const;
+	const PageTableEntry& Lookup(uint32 mip, uint32 x, uint32 y)const;
+
+	// Page table of one mip, row-major, for uploading into the indirection texture.
+	const std::vector<PageTableEntry>& PageTable(uint32 mip)const;
+
+	const Stats& GetStats()const;
+
+	///<summary>
+	/// Estimates the pages needed to texture a square, y-up ground plane seen from eye,
+	/// looking along forward, by sampling an n x n grid over the plane.  This stands in
+	/// for a GPU feedback pass.
+	///</summary>
+	static void GeneratePlaneFeedback(
+		const Desc& desc,
+		const float eye[3], const float forward[3],
+		float planeCenterX, float planeCenterZ, float planeY, float planeSize,
+		float fovY, float screenHeight, uint32 gridSamples,
+		std::vector<uint32>& feedback);
+
+private:
+	enum class SlotState : uint8
+	{
+		Free,
+		Loading,
+		Resident
+	};
+
+	struct Slot
+	{
+		uint32 PageId = 0;
+		std::uint64_t LastUsedFrame = 0;
+		SlotState State = SlotState::Free;
+	};
+
+	PageTableEntry& Entry(uint32 mip, uint32 x, uint32 y);
+	int AcquireSlot(std::vector<uint32>& evictions);
+	void Evict(uint32 slotIndex);
+	void MapSubtree(uint32 pageId, uint32 slotIndex);
+	void UnmapSubtree(uint32 pageId);
+
+private:
+	Desc mDesc;
+	uint32 mMipCount = 0;
+	std::uint64_t mFrame = 0;
+
+	std::vector<std::vector<PageTableEntry>> mPageTable;
+	std::vector<Slot> mSlots;
+	std::unordered_map<uint32, uint32> mPageToSlot;
+
+	// Update's scratch, kept so a frame does not allocate: every requested page with its
+	// ancestors, and the missing pages with their request counts.
+	std::vector<uint32> mRequested;
+	std::vector<std::pair<uint32, uint32>> mMissing;
+
+	Stats mStats;
+};
@@ -0,0 +1,343 @@
+//***************************************************************************************
+// VirtualTextureBaker.cpp
+//***************************************************************************************
+
+#include "VirtualTextureBaker.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+using uint8 = VirtualTextureBaker::uint8;
+using uint32 = VirtualTextureBaker::uint32;
+using uint64 = VirtualTextureBaker::uint64;
+
+namespace
+{
+	struct BakeContext
+	{
+		VirtualTexture::Desc Desc;
+		const VirtualTextureBaker::SourceFn* Source = nullptr;
+		std::ofstream* File = nullptr;
+		std::vector<uint64> Offsets;
+		uint64 WriteOffset = 0;
+	};
+
+	uint32 Average4(uint32 a, uint32 b, uint32 c, uint32 d)
+	{
+		uint32 result = 0;
+		for (uint32 shift = 0; shift < 32; shift += 8)
+		{
+			uint32 sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) +
+				((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+			result |= ((sum + 2) / 4) << shift;
+		}
+		return result;
+	}
+
+	uint32 PagesWide(const VirtualTexture::Desc& desc, uint32 mip)
+	{
+		return std::max((desc.VirtualSize / desc.PageSize) >> mip, 1u);
+	}
+
+	void WritePage(BakeContext& ctx, uint32 mip, uint32 x, uint32 y, const std::vector<uint32>& interior)
+	{
+		const uint32 pageSize = ctx.Desc.PageSize;
+		const uint32 border = ctx.Desc.BorderSize;
+		const uint32 full = pageSize + 2 * border;
+
+		// Mip 0 borders come from the neighbouring source texels so bilinear and
+		// anisotropic filtering work across page edges.  Coarser mips clamp to the page
+		// edge; reading their true neighbours would mean baking them twice.
+		std::vector<uint32> texels((size_t)full * full);
+		for (uint32 j = 0; j < full; ++j)
+		{
+			for (uint32 i = 0; i < full; ++i)
+			{
+				int li = (int)i - (int)border;
+				int lj = (int)j - (int)border;
+				bool inside = li >= 0 && lj >= 0 && li < (int)pageSize && lj < (int)pageSize;
+
+				if (inside)
+				{
+					texels[(size_t)j * full + i] = interior[(size_t)lj * pageSize + li];
+				}
+				else if (mip == 0)
+				{
+					int sx = (int)(x * pageSize) + li;
+					int sy = (int)(y * pageSize) + lj;
+					sx = std::min(std::max(sx, 0), (int)ctx.Desc.VirtualSize - 1);
+					sy = std::min(std::max(sy, 0), (int)ctx.Desc.VirtualSize - 1);
+					texels[(size_t)j * full + i] = (*ctx.Source)((uint32)sx, (uint32)sy);
+				}
+				else
+				{
+					int ci = std::min(std::max(li, 0), (int)pageSize - 1);
+					int cj = std::min(std::max(lj, 0), (int)pageSize - 1);
+					texels[(size_t)j * full + i] = interior[(size_t)cj * pageSize + ci];
+				}
+			}
+		}
+
+		std::vector<uint8> blocks;
+		VirtualTextureBaker::CompressBC1(texels.data(), full, full, blocks);
+
+		uint32 index = VirtualTextureBaker::PageIndex(ctx.Desc, VirtualTexture::MakePageId(mip, x, y));
+		ctx.Offsets[index] = ctx.WriteOffset;
+		ctx.File->write((const char*)blocks.data(), blocks.size());
+		ctx.WriteOffset += blocks.size();
+	}
+
+	// Bakes the page and everything beneath it, returning the page's interior texels.
+	void BakeNode(BakeContext& ctx, uint32 mip, uint32 x, uint32 y, std::vector<uint32>& interior)
+	{
+		const uint32 pageSize = ctx.Desc.PageSize;
+		interior.resize((size_t)pageSize * pageSize);
+
+		if (mip == 0)
+		{
+			for (uint32 j = 0; j < pageSize; ++j)
+				for (uint32 i = 0; i < pageSize; ++i)
+					interior[(size_t)j * pageSize + i] = (*ctx.Source)(x * pageSize + i, y * pageSize + j);
+		}
+		else
+		{
+			const uint32 half = pageSize / 2;
+			const uint32 childPages = PagesWide(ctx.Desc, mip - 1);
+
+			std::vector<uint32> child;
+			for (uint32 q = 0; q < 4; ++q)
+			{
+				uint32 cx = 2 * x + (q & 1);
+				uint32 cy = 2 * y + (q >> 1);
+				if (cx >= childPages || cy >= childPages)
+					continue;
+
+				BakeNode(ctx, mip - 1, cx, cy, child);
+
+				// 2x2 box filter the child into its quadrant.
+				uint32 ox = (q & 1) * half;
+				uint32 oy = (q >> 1) * half;
+				for (uint32 j = 0; j < half; ++j)
+				{
+					for (uint32 i = 0; i < half; ++i)
+					{
+						const uint32* c = &child[(size_t)(2 * j) * pageSize + 2 * i];
+						interior[(size_t)(oy + j) * pageSize + ox + i] =
+							Average4(c[0], c[1], c[pageSize], c[pageSize + 1]);
+					}
+				}
+			}
+		}
+
+		WritePage(ctx, mip, x, y, interior);
+	}
+
+	uint32 Pack565(uint32 r, uint32 g, uint32 b)
+	{
+		return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+	}
+
+	void Unpack565(uint32 c, int rgb[3])
+	{
+		int r = (c >> 11) & 0x1F;
+		int g = (c >> 5) & 0x3F;
+		int b = c & 0x1F;
+		rgb[0] = (r << 3) | (r >> 2);
+		rgb[1] = (g << 2) | (g >> 4);
+		rgb[2] = (b << 3) | (b >> 2);
+	}
+}
+
+uint32 VirtualTextureBaker::PageIndex(const VirtualTexture::Desc& desc, uint32 pageId)
+{
+	uint32 mip = VirtualTexture::PageMip(pageId);
+
+	uint32 index = 0;
+	for (uint32 m = 0; m < mip; ++m)
+		index += PagesWide(desc, m) * PagesWide(desc, m);
+
+	return index + VirtualTexture::PageY(pageId) * PagesWide(desc, mip) + VirtualTexture::PageX(pageId);
+}
+
+bool VirtualTextureBaker::Bake(const VirtualTexture::Desc& desc, const SourceFn& source, const std::string& path)
+{
+	assert(desc.PageSize % 2 == 0);
+	assert((desc.PageSize + 2 * desc.BorderSize) % 4 == 0);
+
+	// Baked next to path and moved over it when complete, so an interrupted bake never
+	// leaves a page file that opens.
+	const std::string tempPath = path + ".tmp";
+	std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+
+	uint32 mipCount = 1;
+	for (uint32 p = desc.VirtualSize / desc.PageSize; p > 1; p >>= 1)
+		++mipCount;
+
+	uint32 full = desc.PageSize + 2 * desc.BorderSize;
+
+	PageFileHeader header;
+	header.VirtualSize = desc.VirtualSize;
+	header.PageSize = desc.PageSize;
+	header.BorderSize = desc.BorderSize;
+	header.MipCount = mipCount;
+	header.PageCount = 0;
+	for (uint32 m = 0; m < mipCount; ++m)
+		header.PageCount += PagesWide(desc, m) * PagesWide(desc, m);
+	header.PageBytes = (full / 4) * (full / 4) * 8;
+
+	BakeContext ctx;
+	ctx.Desc = desc;
+	ctx.Source = &source;
+	ctx.File = &file;
+	ctx.Offsets.assign(header.PageCount, 0);
+	ctx.WriteOffset = sizeof(PageFileHeader) + sizeof(uint64) * (uint64)header.PageCount;
+
+	// Reserve the header and offset table; they are filled in once every page is written.
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)ctx.Offsets.data(), sizeof(uint64) * ctx.Offsets.size());
+
+	std::vector<uint32> interior;
+	BakeNode(ctx, mipCount - 1, 0, 0, interior);
+
+	file.seekp(sizeof(PageFileHeader));
+	file.write((const char*)ctx.Offsets.data(), sizeof(uint64) * ctx.Offsets.size());
+	file.close();
+
+	std::remove(path.c_str());
+	if (!file || std::rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		std::remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+void VirtualTextureBaker::CompressBC1(const uint32* rgba, uint32 width, uint32 height, std::vector<uint8>& blocks)
+{
+	assert(width % 4 == 0 && height % 4 == 0);
+
+	blocks.resize((size_t)(width / 4) * (height / 4) * 8);
+	uint8* out = blocks.data();
+
+	for (uint32 by = 0; by < height; by += 4)
+	{
+		for (uint32 bx = 0; bx < width; bx += 4)
+		{
+			int texels[16][3];
+			int lo[3] = { 255, 255, 255 };
+			int hi[3] = { 0, 0, 0 };
+
+			for (uint32 t = 0; t < 16; ++t)
+			{
+				uint32 c = rgba[(size_t)(by + t / 4) * width + bx + t % 4];
+				for (int k = 0; k < 3; ++k)
+				{
+					texels[t][k] = (c >> (8 * k)) & 0xFF;
+					lo[k] = std::min(lo[k], texels[t][k]);
+					hi[k] = std::max(hi[k], texels[t][k]);
+				}
+			}
+
+			// Inset the bounding box by 1/16 of its size to reduce the error at the ends.
+			for (int k = 0; k < 3; ++k)
+			{
+				int inset = (hi[k] - lo[k]) / 16;
+				lo[k] += inset;
+				hi[k] -= inset;
+			}
+
+			uint32 c0 = Pack565(hi[0], hi[1], hi[2]);
+			uint32 c1 = Pack565(lo[0], lo[1], lo[2]);
+
+			uint32 indices = 0;
+			if (c0 != c1)
+			{
+				// c0 > c1 selects the four color mode.
+				if (c0 < c1)
+					std::swap(c0, c1);
+
+				int palette[4][3];
+				Unpack565(c0, palette[0]);
+				Unpack565(c1, palette[1]);
+				for (int k = 0; k < 3; ++k)
+				{
+					palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+					palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+				}
+
+				for (uint32 t = 0; t < 16; ++t)
+				{
+					int best = 0;
+					int bestError = INT32_MAX;
+					for (int p = 0; p < 4; ++p)
+					{
+						int dr = texels[t][0] - palette[p][0];
+						int dg = texels[t][1] - palette[p][1];
+						int db = texels[t][2] - palette[p][2];
+						int error = dr * dr + dg * dg + db * db;
+						if (error < bestError)
+						{
+							bestError = error;
+							best = p;
+						}
+					}
+					indices |= (uint32)best << (2 * t);
+				}
+			}
+
+			out[0] = (uint8)(c0 & 0xFF);
+			out[1] = (uint8)(c0 >> 8);
+			out[2] = (uint8)(c1 & 0xFF);
+			out[3] = (uint8)(c1 >> 8);
+			out[4] = (uint8)(indices & 0xFF);
+			out[5] = (uint8)((indices >> 8) & 0xFF);
+			out[6] = (uint8)((indices >> 16) & 0xFF);
+			out[7] = (uint8)(indices >> 24);
+			out += 8;
+		}
+	}
+}
+
+bool VirtualTexturePageFile::Open(const std::string& path)
+{
+	mFile.close();
+	mFile.clear();
+	mOffsets.clear();
+
+	mFile.open(path, std::ios::binary);
+	if (!mFile)
+		return false;
+
+	mFile.read((char*)&mHeader, sizeof(mHeader));
+	if (!mFile || mHeader.Magic != VirtualTextureBaker::PageFileMagic ||
+		mHeader.Version != VirtualTextureBaker::PageFileVersion)
+	{
+		mFile.close();
+		return false;
+	}
+
+	mOffsets.resize(mHeader.PageCount);
+	mFile.read((char*)mOffsets.data(), sizeof(std::uint64_t) * mOffsets.size());
+	return (bool)mFile;
+}
+
+bool VirtualTexturePageFile::ReadPage(std::uint32_t pageId, std::vector<std::uint8_t>& data)const
+{
+	VirtualTexture::Desc desc;
+	desc.VirtualSize = mHeader.VirtualSize;
+	desc.PageSize = mHeader.PageSize;
+	desc.BorderSize = mHeader.BorderSize;
+
+	std::uint32_t index = VirtualTextureBaker::PageIndex(desc, pageId);
+	if (index >= mOffsets.size())
+		return false;
+
+	// A failed read must not fail every read after it.
+	data.resize(mHeader.PageBytes);
+	mFile.clear();
+	mFile.seekg(mOffsets[index]);
+	mFile.read((char*)data.data(), data.size());
+	return (bool)mFile;
+}
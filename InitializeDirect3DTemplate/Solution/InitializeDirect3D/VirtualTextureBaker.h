@@ -0,0 +1,80 @@
+//***************************************************************************************
+// VirtualTextureBaker.h
+//
+// Tool side of the virtual texture: cuts a huge source image into bordered pages for
+// every mip, compresses each page to BC1 and writes them to a page file with an offset
+// table, so the runtime can read any single page with one seek.  The app bakes the
+// ground's page file when it is missing, the way it cooks the scene pack.
+//
+// Page file layout:
+//   PageFileHeader
+//   uint64 offsets[PageCount]   (page i occupies PageBytes bytes at offsets[i])
+//   page data
+// Pages are indexed mip by mip, row-major inside each mip, but stored in bake order.
+//***************************************************************************************
+
+#pragma once
+
+#include "VirtualTexture.h"
+#include <fstream>
+#include <functional>
+#include <string>
+
+class VirtualTextureBaker
+{
+public:
+
+	using uint8 = std::uint8_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	static const uint32 PageFileMagic = 0x58455456; // 'VTEX'
+	static const uint32 PageFileVersion = 1;
+
+	struct PageFileHeader
+	{
+		uint32 Magic = PageFileMagic;
+		uint32 Version = PageFileVersion;
+		uint32 VirtualSize = 0;
+		uint32 PageSize = 0;
+		uint32 BorderSize = 0;
+		uint32 MipCount = 0;
+		uint32 PageCount = 0;
+		uint32 PageBytes = 0;
+	};
+
+	// Returns the RGBA8 (R in the low byte) texel at (x, y) of mip 0.
+	using SourceFn = std::function<uint32(uint32 x, uint32 y)>;
+
+	///<summary>
+	/// Bakes every page of every mip of the virtual image described by desc.  Mip 0 pages
+	/// come straight from the source; coarser pages are box-filtered from the four pages
+	/// beneath them, so the source is only read once per texel.
+	///</summary>
+	static bool Bake(const VirtualTexture::Desc& desc, const SourceFn& source, const std::string& path);
+
+	// Compresses a width x height RGBA8 image (both multiples of 4) to BC1.
+	static void CompressBC1(const uint32* rgba, uint32 width, uint32 height, std::vector<uint8>& blocks);
+
+	// Linear index of a page in the page file.
+	static uint32 PageIndex(const VirtualTexture::Desc& desc, uint32 pageId);
+};
+
+// Reads single pages back out of a baked page file.
+class VirtualTexturePageFile
+{
+public:
+	VirtualTexturePageFile() = default;
+	VirtualTexturePageFile(const VirtualTexturePageFile& rhs) = delete;
+	VirtualTexturePageFile& operator=(const VirtualTexturePageFile& rhs) = delete;
+
+	bool Open(const std::string& path);
+	bool ReadPage(std::uint32_t pageId, std::vector<std::uint8_t>& data)const;
+
+	const VirtualTextureBaker::PageFileHeader& Header()const { return mHeader; }
+
+private:
+	mutable std::ifstream mFile;
+	VirtualTextureBaker::PageFileHeader mHeader;
+	std::vector<std::uint64_t> mOffsets;
+};
@@ -31,6 +31,7 @@ Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
     mCurrSolution.resize(m*n);
     mNormals.resize(m*n);
     mTangentX.resize(m*n);
+    mMemory = TrackedMemory(MemoryTag::Simulation, 4ull * m * n * sizeof(XMFLOAT3));
 
     // Generate grid vertices in system memory.
 
@@ -11,6 +11,7 @@
 
 #include <vector>
 #include <DirectXMath.h>
+#include "MemoryTracker.h"
 
 class Waves
 {
@@ -58,6 +59,9 @@ private:
     std::vector<DirectX::XMFLOAT3> mCurrSolution;
     std::vector<DirectX::XMFLOAT3> mNormals;
     std::vector<DirectX::XMFLOAT3> mTangentX;
+
+    // The four grids above, charged to the simulation.
+    TrackedMemory mMemory;
 };
 
 #endif // WAVES_H
\ No newline at end of file
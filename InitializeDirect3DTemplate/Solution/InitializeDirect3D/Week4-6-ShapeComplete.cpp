@@ -2,8 +2,35 @@
 #include "../../Common/MathHelper.h"
 #include "../../Common/UploadBuffer.h"
 #include "../../Common/GeometryGenerator.h"
+#include "AssetReloader.h"
+#include "BillboardExpander.h"
+#include "CascadedShadows.h"
+#include "ClusteredLights.h"
+#include "EntityWorld.h"
+#include "EnvironmentLighting.h"
+#include "FileWatcher.h"
+#include "FoliageScatter.h"
+#include "InitGraph.h"
+#include "LightBaker.h"
+#include "LightGrid.h"
+#include "LodSelector.h"
+#include "MemoryTracker.h"
+#include "MeshCodec.h"
+#include "MeshDataCache.h"
+#include "ScenePack.h"
+#include "D3D12PipelineCache.h"
+#include "D3D12RenderGraphBackend.h"
+#include "D3D12CommandBackend.h"
 #include "FrameResource.h"
+#include "Hash.h"
+#include "ShaderCache.h"
+#include "ShaderPermutations.h"
+#include "TextureAtlas.h"
+#include "TextureResidency.h"
+#include "VirtualTexture.h"
+#include "VirtualTextureBaker.h"
 #include "Waves.h"
+#include "WorldStreamer.h"
 
 using Microsoft::WRL::ComPtr;
 using namespace DirectX;
@@ -11,19 +38,167 @@ using namespace DirectX::PackedVector;
 
 const int gNumFrameResources = 3;
 
-struct RenderItem
+// Each pass's draws are recorded into at most gMaxRecordChunks command lists, with at
+// least gMinDrawsPerChunk draws per list so small passes are not spread too thin.
+const UINT gMaxRecordChunks = 8;
+const UINT gMinDrawsPerChunk = 64;
+
+// Capacity of the scene's point/spot light buffer.
+const UINT gMaxSceneLights = 4096;
+
+// Budget of every memory tag; a tag that goes over is reported as soon as it happens.
+const UINT64 gMemoryBudgets[(int)MemoryTag::Count] =
+{
+	64ull * 1024 * 1024,    // geometry
+	256ull * 1024 * 1024,   // textures
+	16ull * 1024 * 1024,    // simulation
+	64ull * 1024 * 1024,    // frame resources
+	32ull * 1024 * 1024,    // scene
+};
+
+// What happens to the system memory copy of each geometry once initialization no longer
+// needs it.  Geometry not listed keeps its copy; geometry from the scene pack has none,
+// its data is read from the mapped pack.
+const std::pair<const char*, MeshDataCache::Policy> gGeometryCpuPolicies[] =
+{
+	{ "treeGeo",   MeshDataCache::Policy::Drop },
+};
+
+// Everything written at run time (caches, the cooked scene, baked lighting) goes here
+// rather than next to the sources it was made from.
+const std::string gCacheDir = "Cache\\";
+
+// The sky cubemap and its environment lighting cache (see EnvironmentLighting).
+const char* const gSkyCubemapPath = "../../Textures/grasscube1024.dds";
+const std::string gEnvironmentCachePath = gCacheDir + "grasscube1024.env";
+
+// The maze walls the scene builders read; see the file for its format.
+const char* const gMazePath = "Data\\Maze.txt";
+
+// The flag and fill textures packed into the prop atlas.  Their sizes decide the atlas
+// layout, which the prop materials in the scene pack are cooked against.
+const std::pair<const char*, const char*> gPropAtlasSources[] =
+{
+	{ "whiteTex", "../../Textures/white1x1.dds" },
+	{ "canadaTex", "../../Textures/canada.dds" },
+	{ "usTex", "../../Textures/us.dds" },
+	{ "ukTex", "../../Textures/uk.dds" },
+};
+
+// Bump whenever the scene builders, GeometryGenerator or the pack format change, so that
+// packs cooked by an older build are cooked again.  The data the cook reads (the maze and
+// the atlas sources) is hashed into the key as well; see SceneKey.
+const std::uint32_t gSceneCookVersion = 1;
+
+// Objects that fit in a world cell are cooked into a pack of that cell and streamed in
+// while the camera is within the load radius; out of the unload radius they go again.
+// Uploads of streamed cells are spread so one frame records at most about the budget.
+const float gWorldCellSize = 16.0f;
+const float gWorldLoadRadius = 80.0f;
+const float gWorldUnloadRadius = 96.0f;
+const UINT64 gWorldUploadBytesPerFrame = 4ull * 1024 * 1024;
+
+// A texture reloaded while the app runs gets its new SRV in one of these spare heap
+// slots; the slot it had is free again once no frame in flight samples it.
+const UINT gReloadSrvSlots = 16;
+
+// The ground grid: 80x80, centered at the origin, half a unit below zero.  The ground
+// virtual texture covers exactly this square.
+const float gGroundSize = 80.0f;
+const float gGroundY = -0.5f;
+
+// The shaders the pipelines are built from, by name: a variant of a program of the
+// permutation manifest (see BuildShadersAndInputLayout).
+struct ShaderVariantName
+{
+	const char* Name;
+	const char* Program;
+	std::uint32_t Mask;
+};
+
+const ShaderVariantName gShaderVariants[] =
+{
+	{ "standardVS",             "standardVS",   0 },
+	{ "opaquePS",               "opaquePS",     0x2 },
+	{ "opaqueLodFadePS",        "opaquePS",     0xA },
+	{ "opaqueVirtualTexturePS", "opaquePS",     0x12 },
+	{ "transparentPS",          "opaquePS",     0x4 },
+	{ "treeSpriteVS",           "treeSpriteVS", 0 },
+	{ "treeSpriteGS",           "treeSpriteGS", 0 },
+	{ "treeSpritePS",           "treeSpritePS", 0x1 },
+	{ "treeQuadVS",             "treeQuadVS",   0 },
+	{ "treeQuadPS",             "treeQuadPS",   0x1 },
+};
+
+// CPU access to the vertices and indices of a geometry, whichever policy it has.  The
+// storage only fills when the data had to be fetched from the mesh cache.
+struct MeshDataView
+{
+	const BYTE* Vertices = nullptr;
+	const BYTE* Indices = nullptr;
+	std::vector<std::uint8_t> VertexStorage;
+	std::vector<std::uint8_t> IndexStorage;
+};
+
+// The maze as read from gMazePath: its walls' geometry in maze space, and their
+// colliders and segments in world space.
+struct MazeData
+{
+	std::vector<Vertex> Vertices;
+	std::vector<std::uint16_t> Indices;
+	std::vector<ScenePack::Collider> Colliders;
+	std::vector<ScenePack::Segment> Segments;
+};
+
+// Something a hot reload replaced, kept until the GPU is past the frames that may still
+// use it: a resource, or a descriptor slot of the SRV heap.
+struct RetiredObject
+{
+	ComPtr<ID3D12Pageable> Object;
+	UINT SrvSlot = ~0u;
+	UINT64 Fence = 0;
+};
+
+// The geometry and entities of a world cell while it is resident, and its geometry for a
+// few frames after, until the GPU is done with the frames that drew it.
+struct StreamedCell
+{
+	std::vector<std::unique_ptr<MeshGeometry>> Geometry;   // one per mesh of the cell's pack
+	std::vector<EntityWorld::Entity> Entities;
+	UINT64 UploadFence = 0;     // the uploaders go once the fence passes it
+	UINT64 RetireFence = 0;
+	TrackedMemory Memory;
+};
+
+enum class RenderLayer : int
 {
-	RenderItem() = default;
-	RenderItem(const RenderItem& rhs) = delete;
+	Opaque = 0,
+	Transparent,
+	AlphaTestedTreeSprites,
+	Count
+};
 
+// Components of the scene's entities (see EntityWorld).  Every drawn object has a
+// transform, bounds, a render mesh and a material; maze walls are colliders only.
+
+struct TransformComponent
+{
 	XMFLOAT4X4 World = MathHelper::Identity4x4();
 	XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
 
+	// Frames whose object constants (and the world bounds) still have to be refreshed.
 	int NumFramesDirty = gNumFrameResources;
+};
 
-	UINT ObjCBIndex = -1;
+struct BoundsComponent
+{
+	// Bounds of the submesh in local space, and transformed by the world matrix.
+	BoundingBox Local;
+	BoundingBox World;
+};
 
-	Material* Mat = nullptr;
+struct RenderMeshComponent
+{
 	MeshGeometry* Geo = nullptr;
 
 	D3D12_PRIMITIVE_TOPOLOGY PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
@@ -31,16 +206,48 @@ struct RenderItem
 	UINT IndexCount = 0;
 	UINT StartIndexLocation = 0;
 	int BaseVertexLocation = 0;
+
+	UINT ObjCBIndex = 0;
+
+	// See DrawConstants::BakedLightingOffset.
+	UINT BakedLightingOffset = ~0u;
+
+	RenderLayer Layer = RenderLayer::Opaque;
 };
 
-enum class RenderLayer : int
+struct MaterialComponent
 {
-	Opaque = 0,
-	Transparent,
-	AlphaTestedTreeSprites,
-	Count
+	Material* Mat = nullptr;
+};
+
+struct ColliderComponent
+{
+	BoundingBox Box;
+};
+
+// Coarser levels of detail of an entity's render mesh, which is level 0.  The levels'
+// errors are in world units; State is what LodSelector keeps between frames.
+struct LodComponent
+{
+	LodSelector::Levels Levels;
+	UINT IndexCount[LodSelector::MaxLods] = {};
+	UINT StartIndexLocation[LodSelector::MaxLods] = {};
+	int BaseVertexLocation[LodSelector::MaxLods] = {};
+	UINT BakedLightingOffset[LodSelector::MaxLods] = {};
+	LodSelector::State State;
 };
 
+// One draw of a layer, gathered from the visible entities every frame.
+struct DrawItem
+{
+	RenderMeshComponent Mesh;
+	const Material* Mat = nullptr;
+	float LodFade = 0.0f;       // see DrawConstants::LodFade
+};
+
+// Draw lists live in the frame's arena.
+using DrawList = ArenaVector<DrawItem>;
+
 class ShapesApp : public D3DApp
 {
 public:
@@ -52,29 +259,88 @@ public:
 	virtual bool Initialize()override;
 
 private:
+	virtual void CreateRtvAndDsvDescriptorHeaps()override;
 	virtual void OnResize()override;
 	virtual void Update(const GameTimer& gt)override;
 	virtual void Draw(const GameTimer& gt)override;
 
 	void OnKeyboardInput(const GameTimer& gt);
 	void UpdateCamera(const GameTimer& gt);
+	D3D12_CPU_DESCRIPTOR_HANDLE SceneColorView()const;
 	void UpdateObjectCBs(const GameTimer& gt);
 	void UpdateMaterialCBs(const GameTimer& gt);
 	void UpdateMainPassCB(const GameTimer& gt);
+	void UpdateDrawLists(const GameTimer& gt);
+	void UpdateTextureResidency(const GameTimer& gt);
+	void StreamTextureMips(ID3D12GraphicsCommandList* cmdList);
+	void UpdateGroundVirtualTexture(const GameTimer& gt);
+	void UploadGroundPages(ID3D12GraphicsCommandList* cmdList);
+	void UploadGroundPageTable(ID3D12GraphicsCommandList* cmdList);
+	void UpdateClusteredLights(const GameTimer& gt);
+	void UpdateShadowCascades(const GameTimer& gt);
+	void UpdateFoliageVisibility(const GameTimer& gt);
+	void UpdateWorldStreaming(const GameTimer& gt);
+	void StreamWorldCells(ID3D12GraphicsCommandList* cmdList, UINT64 uploadBudget);
+	void UpdateHotReload(const GameTimer& gt);
+	void ApplyHotReloads();
+	void ReplaceTexture(const std::string& name, ComPtr<ID3D12Resource> resource, ComPtr<ID3D12Resource> uploadHeap);
+	UINT TextureMaxSize(const std::string& name)const;
 
 	void LoadTextures();
+	void BuildEnvironmentLighting();
+	void UploadEnvironmentLighting();
 	void BuildDescriptorHeaps();
+	void CreateTextureSrv(const std::string& name, ID3D12Resource* texture, UINT slot);
+	void BuildTextureResidency();
+	void BuildGroundVirtualTexture();
+	static std::uint32_t GroundTexel(std::uint32_t x, std::uint32_t y);
 	void BuildRootSignature();
 	void BuildShadersAndInputLayout();
+	ComPtr<ID3DBlob> GetShaderVariant(const std::string& program, std::uint32_t mask);
 	void BuildShapeGeometry();
 	void BuildWaterGeometry();
 	void BuildTreeSpritesGeometry();
-	void BuildMazeGeometry();
+	void BuildMazeGeometry(ScenePackWriter& pack);
+	bool LoadMaze(const std::string& path, MazeData& maze, std::string& error);
+	void BuildSubmeshBounds();
+	void BuildSceneLights();
+	void BuildBakedLighting();
+	void AddBakedObjects(LightBaker& baker, const ScenePack& pack);
+	std::uint64_t BakedLightingKey(const ScenePack& pack, const ScenePack::Object& object, std::uint32_t submesh);
 	void BuildPSOs();
+	std::vector<std::pair<std::string, std::uint64_t>> RequestPSOs(std::unordered_map<std::string, ComPtr<ID3DBlob>>& shaders);
 	void BuildFrameResources();
+	UINT TextureSrvIndex(const std::string& name)const;
 	void BuildMaterials();
+	void BuildSceneLayout(ScenePackWriter& pack);
+	bool SceneKey(std::uint64_t& key);
+	static bool MeshCodecRoundTrips(const void* vertices, size_t vertexCount, size_t vertexStride,
+		const void* indices, size_t indexCount, size_t indexSize);
+	static void CheckMeshCodec(const MeshGeometry& geo);
+	static void CheckMeshCodecOnGenerators();
+	void CookScenePack(const std::string& path);
+	void LoadScenePack();
+	std::unique_ptr<MeshGeometry> CreatePackGeometry(ID3D12GraphicsCommandList* cmdList, const ScenePack& pack,
+		const ScenePack::Mesh& mesh, const std::uint8_t* vertices, const std::uint8_t* indices);
 	void BuildRenderItems();
-	void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
+	void ReleaseMeshCopies();
+	bool AcquireMeshData(const MeshGeometry& geo, MeshDataView& view);
+	void TrackMemory();
+	UINT64 ResourceBytes(ID3D12Resource* resource);
+	void ReportFrameMemory(const GameTimer& gt);
+	EntityWorld::Entity SpawnRenderable(const RenderMeshComponent& mesh, Material* mat, const XMMATRIX& world,
+		const XMMATRIX& texTransform, const BoundingBox& localBounds, const LodComponent* lod = nullptr);
+	EntityWorld::Entity SpawnPackObject(const ScenePack& pack, const ScenePack::Object& object, MeshGeometry* geo);
+	void TrackCellMemory(StreamedCell& cell);
+	void AddSceneObject(ScenePackWriter& pack, const std::string& geo, const std::string& submesh, const std::string& mat,
+		const XMMATRIX& world, const XMMATRIX& texTransform, RenderLayer layer = RenderLayer::Opaque);
+	void RecordDrawItems(CommandStream& stream, const DrawList& items, ID3D12PipelineState* pso,
+		ID3D12PipelineState* lodFadePso = nullptr, ID3D12PipelineState* virtualTexturePso = nullptr);
+	void BuildHotReload();
+	AssetReloader::ApplyFn ReloadShaders(const std::vector<std::string>& changedFiles);
+	AssetReloader::ApplyFn ReloadTexture(const std::string& name, const std::string& path);
+	AssetReloader::ApplyFn ReloadMaze();
+	void Retire(ComPtr<ID3D12Pageable> object, UINT srvSlot = ~0u);
 
 	std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> GetStaticSamplers();
 
@@ -92,26 +358,184 @@ private:
 	ComPtr<ID3D12DescriptorHeap> mSrvDescriptorHeap = nullptr;
 
 	std::unordered_map<std::string, std::unique_ptr<MeshGeometry>> mGeometries;
+	std::unique_ptr<MeshDataCache> mMeshCache;
+
+	// The cooked static scene: the geometry in mGeometries (except the foliage's) is
+	// uploaded straight out of it and keeps no copy of its own, and the materials, the
+	// static objects and the maze's colliders come from it too.  mSceneKey is what it
+	// and its cells are opened with.
+	ScenePack mScenePack;
+	std::uint64_t mSceneKey = 0;
+
+	// The pack's world cells around the camera, by cell index.  Unloaded cells give their
+	// object constant slots back for the next cells to use.
+	WorldStreamer mWorldStreamer;
+	std::unordered_map<std::uint32_t, StreamedCell> mStreamedCells;
+	std::vector<StreamedCell> mRetiredCells;
+	std::vector<std::unique_ptr<WorldStreamer::CellData>> mLoadedCells;
+	std::vector<std::uint32_t> mCellUnloads;
+	std::uint64_t mStreamedUploadBytes = 0;
+	float mWorldStreamingReportTime = 0.0f;
 	std::unordered_map<std::string, std::unique_ptr<Material>> mMaterials;
 	std::unordered_map<std::string, std::unique_ptr<Texture>> mTextures;
+	std::vector<std::string> mTextureSrvOrder;
+	UINT mMaterialSrvCount = 0;     // the slots of mTextureSrvOrder a cooked material may use
 	std::unordered_map<std::string, ComPtr<ID3DBlob>> mShaders;
+	std::unique_ptr<ShaderCache> mShaderCache;
+	ShaderPermutations mShaderPermutations;
+	ShaderPermutations::PreprocessFn mShaderPreprocess;
 	std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> mPSOs;
+	std::unique_ptr<D3D12PipelineCache> mPipelineCache;
+	std::vector<std::uint64_t> mPipelineKeys;   // the keys of mPSOs; reloader thread only after startup
 
-	std::vector<D3D12_INPUT_ELEMENT_DESC> mInputLayout;
-	std::vector<D3D12_INPUT_ELEMENT_DESC> mTreeSpriteInputLayout;
+	// Rebuilt every frame; the backend keeps the transient heap between frames.
+	RenderGraph mRenderGraph;
+	std::unique_ptr<D3D12RenderGraphBackend> mRenderGraphBackend;
 
-	std::vector<std::unique_ptr<RenderItem>> mAllRitems;
+	// Draws of each layer, recorded in parallel and replayed into per-chunk command lists.
+	CommandStream mDrawStreams[(int)RenderLayer::Count];
+	std::unique_ptr<D3D12CommandBackend> mCommandBackend;
 
-	std::vector<RenderItem*> mRitemLayer[(int)RenderLayer::Count];
-	RenderItem* mWaterRitem = nullptr;
+	std::vector<D3D12_INPUT_ELEMENT_DESC> mInputLayout;
+	std::vector<D3D12_INPUT_ELEMENT_DESC> mTreeSpriteInputLayout;
+	std::vector<D3D12_INPUT_ELEMENT_DESC> mTreeQuadInputLayout;
+
+	// Every object of the scene.  Drawn entities get consecutive object constant buffer
+	// slots, or one a streamed cell gave back; the visible ones are gathered into
+	// mDrawLayers every frame.  mObjectCapacity adds room for the streamed cells.
+	EntityWorld mEntities;
+	UINT mObjectCount = 0;
+	UINT mObjectCapacity = 0;
+	std::vector<UINT> mFreeObjectSlots;
+
+	DrawList mDrawLayers[(int)RenderLayer::Count];
+
+	// Picks the level of detail of the visible entities that have some.  Opaque ones fade
+	// between levels with a dithering pipeline; their fading draws go last in the layer.
+	LodSelector mLodSelector;
+	std::uint64_t mLodSwitches = 0;
+	float mLodReportTime = 0.0f;
+
+	// Heap allocations made by Update and Draw, counted in builds that define
+	// FRAME_ARENA_COUNT_ALLOCATIONS; transient data should come from the frame arenas.
+	std::uint64_t mFrameHeapAllocationStart = 0;
+	std::uint64_t mFrameHeapAllocations = 0;
+	UINT mFrameMemoryReportFrames = 0;
+	float mFrameMemoryReportTime = 0.0f;
+
+	// Memory the app charges to the tracker itself (the modules charge their own), kept
+	// per geometry and per texture so dropping one gives its bytes back.  Upload heaps
+	// count for as long as they are held.
+	std::unordered_map<std::string, TrackedMemory> mGeometryMemory;
+	std::vector<TrackedMemory> mTextureMemory;
+	TrackedMemory mSceneMemory;
+	std::uint32_t mOverBudgetMask = 0;
+
+	// Small textures that are packed into one atlas instead of getting their own SRV.
+	// The sources only live until the initialization copies have executed.
+	std::unique_ptr<TextureAtlas> mPropAtlas;
+	std::unordered_map<std::string, std::unique_ptr<Texture>> mAtlasSourceTextures;
+
+	// Texture memory accounting.  mSrvResidencyIds maps an SRV heap index to its residency id.
+	// mTextureFirstMips is the mip each texture's resource starts at, by residency id; it
+	// follows the resident mip as StreamTextureMips reads the textures again.
+	std::unique_ptr<TextureResidency> mTextureResidency;
+	std::vector<std::uint32_t> mSrvResidencyIds;
+	std::vector<std::uint32_t> mTextureFirstMips;
+	std::vector<TextureResidency::Request> mResidencyRequests;
+	UINT64 mTextureBudgetBytes = 64ull * 1024 * 1024;
+	float mResidencyReportTime = 0.0f;
+
+	// Page management for a unique, virtually textured ground.  The pages are baked into a
+	// page file by VirtualTextureBaker the first time, then read as the feedback asks for
+	// them and copied into their slots of the physical page cache.  mGroundPageUploads are
+	// the loads whose data is in this frame's GroundPages upload buffer.  The page table is
+	// copied into mGroundPageTable whenever it changes, and mGroundMaterial is drawn with
+	// the pipeline that samples the cache through it.
+	std::unique_ptr<VirtualTexture> mGroundVirtualTexture;
+	VirtualTexturePageFile mGroundPageFile;
+	ComPtr<ID3D12Resource> mGroundPageCache;
+	D3D12_PLACED_SUBRESOURCE_FOOTPRINT mGroundPageFootprint = {};
+	UINT64 mGroundPageUploadStride = 0;
+	std::vector<std::uint32_t> mGroundPageFeedback;
+	std::vector<VirtualTexture::PageLoad> mGroundPageLoads;
+	std::vector<std::uint32_t> mGroundPageEvictions;
+	std::vector<VirtualTexture::PageLoad> mGroundPageUploads;
+	std::vector<std::uint8_t> mGroundPageData;
+	ComPtr<ID3D12Resource> mGroundPageTable;
+	std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> mGroundPageTableFootprints;
+	UINT64 mGroundPageTableBytes = 0;
+	bool mGroundPageTableDirty = false;
+	UINT mGroundVirtualTextureSrvIndex = 0;
+	const Material* mGroundMaterial = nullptr;
+	float mVirtualTextureReportTime = 0.0f;
+
+	// Ambient SH and prefiltered reflections from the sky cubemap, cached in gCacheDir.
+	EnvironmentLighting mEnvironment;
+	UINT mEnvironmentSrvIndex = 0;
 
 	PassConstants mMainPassCB;
 
+	// Point and spot lights of the scene in world space, binned into view space clusters
+	// every frame.  Point lights have a SpotPower of zero.
+	std::vector<Light> mSceneLights;
+	std::vector<ClusteredLights::LightSphere> mSceneLightSpheres;
+	ClusteredLights mClusteredLights;
+
+	// The same lights binned on the ground plane, for picking the lights of each object.
+	LightGrid mLightGrid;
+	int mSceneLightsFramesDirty = gNumFrameResources;
+
+	// Per-vertex ambient occlusion and one bounce of indirect light for the opaque items,
+	// baked by LightBaker the first time the scene is seen and loaded from the file after.
+	// The file stays open so streamed cells find their samples in it.
+	BakedLightingFile mBakedLightingFile;
+	ComPtr<ID3D12Resource> mBakedLighting = nullptr;
+	ComPtr<ID3D12Resource> mBakedLightingUploader = nullptr;
+
+	// Cascades of the main directional light, fitted and filled with casters every frame.
+	// mShadowCasters[i].Id is the caster's entity index.
+	CascadedShadows mCascadedShadows;
+	std::vector<CascadedShadows::Caster> mShadowCasters;
+	float mShadowReportTime = 0.0f;
+
+	// Scattered trees and shrubs.  Every chunk is an entity of the tree layer.
+	FoliageScatter mFoliage;
+
+	// CPU billboard path: the visible chunks are expanded into the frame's TreeQuadVB and
+	// drawn by mTreeQuadEntity instead of the chunk entities.  That entity has no index
+	// count of its own, so it is only drawn when the foliage system adds it.  mTreeQuadGeo
+	// has no system memory copy, so it is kept out of mGeometries.
+	bool mCpuBillboards = false;
+	bool mBillboardKeyDown = false;
+	std::unique_ptr<MeshGeometry> mTreeQuadGeo;
+	EntityWorld::Entity mTreeQuadEntity;
+	std::uint64_t mBillboardSprites = 0;
+	double mBillboardSeconds = 0.0;
+	float mBillboardReportTime = 0.0f;
+
+	// Rebuilds what changes on disk while the app runs: the shaders and their pipelines,
+	// the textures that have a file of their own, and the maze.  The rebuilds run on the
+	// reloader's thread and are swapped in between frames; what they replace is retired
+	// until the frames in flight are done with it.  A texture's current SRV slot is in
+	// mTextureSrvSlots, and the heap has gReloadSrvSlots more for reloads to move to.
+	FileWatcher mFileWatcher;
+	AssetReloader mAssetReloader;
+	std::uint32_t mShaderArtifact = 0;
+	std::vector<std::string> mChangedFiles;
+	std::vector<RetiredObject> mRetiredObjects;
+	std::unordered_map<std::string, UINT> mTextureSrvSlots;
+	std::vector<UINT> mFreeSrvSlots;
+
+	// View space frustum of the camera.
+	BoundingFrustum mCamFrustum;
+
 	UINT mPassCbvOffset = 0;
 
 	bool mIsWireframe = false;
 
-	std::vector<DirectX::BoundingBox> mMazeWallBounds;  // Stores bounding boxes for all maze walls
+	std::vector<XMFLOAT4> mMazeWallSegments;  // World space (startX, startZ, endX, endZ) of every maze wall
+	EntityWorld::Entity mMazeEntity;
 	float mCollisionRadius = 1.0f;
 
 	// WASD controls
@@ -173,6 +597,10 @@ ShapesApp::ShapesApp(HINSTANCE hInstance)
 
 ShapesApp::~ShapesApp()
 {
+	// The rebuilds use the shader and pipeline caches, so they stop first.
+	mAssetReloader.Stop();
+	mFileWatcher.Stop();
+
 	if (md3dDevice != nullptr)
 		FlushCommandQueue();
 }
@@ -186,18 +614,64 @@ bool ShapesApp::Initialize()
 	ThrowIfFailed(mCommandList->Reset(mDirectCmdListAlloc.Get(), nullptr));
 	mCbvSrvDescriptorSize = md3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 
-	LoadTextures();
-	BuildRootSignature();
-	BuildDescriptorHeaps();
-	BuildShadersAndInputLayout();
-	BuildShapeGeometry();
-	BuildWaterGeometry();
-	BuildTreeSpritesGeometry();
-	BuildMazeGeometry();
-	BuildMaterials();
-	BuildRenderItems();
-	BuildFrameResources();
-	BuildPSOs();
+	CreateDirectoryA(gCacheDir.c_str(), nullptr);
+
+	mPipelineCache = std::make_unique<D3D12PipelineCache>(md3dDevice.Get(), gCacheDir + "PipelineCache.bin");
+	mPipelineCache->Load();
+
+	mRenderGraphBackend = std::make_unique<D3D12RenderGraphBackend>(md3dDevice.Get(), gNumFrameResources);
+	mCommandBackend = std::make_unique<D3D12CommandBackend>(md3dDevice.Get());
+
+	for (int i = 0; i < (int)MemoryTag::Count; ++i)
+		MemoryTracker::Global().SetBudget((MemoryTag)i, gMemoryBudgets[i]);
+
+	mMeshCache = std::make_unique<MeshDataCache>(gCacheDir + "MeshCache.bin");
+	mMeshCache->Open();
+
+	// Startup runs as a graph so texture loads, shader compilation, geometry generation and
+	// PSO creation overlap.  Everything that records into mCommandList is in one exclusive
+	// group, since a command list is not free threaded; the device is.
+	const InitGraph::uint32 commandList = 0;
+
+	InitGraph init;
+	auto textures = init.Add("LoadTextures", [this] { LoadTextures(); }, {}, commandList);
+	auto environment = init.Add("BuildEnvironmentLighting", [this] { BuildEnvironmentLighting(); });
+	auto environmentUpload = init.Add("UploadEnvironmentLighting", [this] { UploadEnvironmentLighting(); },
+		{ textures, environment }, commandList);
+	auto rootSignature = init.Add("BuildRootSignature", [this] { BuildRootSignature(); });
+	auto groundPages = init.Add("BuildGroundVirtualTexture", [this] { BuildGroundVirtualTexture(); });
+	init.Add("BuildDescriptorHeaps", [this] { BuildDescriptorHeaps(); }, { environmentUpload, groundPages });
+	init.Add("BuildTextureResidency", [this] { BuildTextureResidency(); }, { environmentUpload });
+	auto shaders = init.Add("BuildShadersAndInputLayout", [this] { BuildShadersAndInputLayout(); });
+	init.Add("CheckMeshCodecOnGenerators", [] { CheckMeshCodecOnGenerators(); });
+	// Cooking builds the materials, which look their textures up in mTextureSrvOrder; the
+	// environment upload is the last task to add to it.
+	auto scene = init.Add("LoadScenePack", [this] { LoadScenePack(); }, { textures, environmentUpload }, commandList);
+	auto trees = init.Add("BuildTreeSpritesGeometry", [this] { BuildTreeSpritesGeometry(); }, { scene }, commandList);
+	auto bounds = init.Add("BuildSubmeshBounds", [this] { BuildSubmeshBounds(); }, { trees });
+	// The wall lamps follow the maze segments, which come out of the scene pack.
+	auto lights = init.Add("BuildSceneLights", [this] { BuildSceneLights(); }, { scene });
+	auto baked = init.Add("BuildBakedLighting", [this] { BuildBakedLighting(); },
+		{ scene, lights, environment }, commandList);
+	auto renderItems = init.Add("BuildRenderItems", [this] { BuildRenderItems(); }, { scene, bounds, baked });
+	init.Add("ReleaseMeshCopies", [this] { ReleaseMeshCopies(); }, { bounds, baked });
+	init.Add("BuildFrameResources", [this] { BuildFrameResources(); }, { renderItems, lights, trees, groundPages });
+	init.Add("BuildPSOs", [this] { BuildPSOs(); }, { shaders, rootSignature });
+
+	init.Run();
+	OutputDebugStringA(("Startup:\n" + init.Timeline()).c_str());
+
+	// The cells around the starting point are in the first frame, so they are read now and
+	// uploaded with the rest.
+	WorldStreamer::Desc streaming;
+	streaming.LoadRadius = gWorldLoadRadius;
+	streaming.UnloadRadius = gWorldUnloadRadius;
+	streaming.ContentKey = mSceneKey;
+	streaming.SrvCount = mMaterialSrvCount;
+	mWorldStreamer.Start(mScenePack, streaming);
+	mWorldStreamer.Update(mCameraPos.x, mCameraPos.z);
+	mWorldStreamer.Flush();
+	StreamWorldCells(mCommandList.Get(), ~0ull);
 
 	// Execute the initialization commands.
 	ThrowIfFailed(mCommandList->Close());
@@ -207,9 +681,46 @@ bool ShapesApp::Initialize()
 	// Wait until initialization is complete.
 	FlushCommandQueue();
 
+	// The atlas now holds its own copy of the small textures, and the default buffers
+	// their own copy of the geometry.
+	mAtlasSourceTextures.clear();
+	for (auto& geo : mGeometries)
+		geo.second->DisposeUploaders();
+	mTreeQuadGeo->DisposeUploaders();
+	mBakedLightingUploader = nullptr;
+
+	TrackMemory();
+
+	BuildHotReload();
+
 	return true;
 }
 
+void ShapesApp::CreateRtvAndDsvDescriptorHeaps()
+{
+	// One RTV past the swap chain buffers for the scene color target, which is a transient
+	// of the render graph and is written anew every frame.
+	D3D12_DESCRIPTOR_HEAP_DESC rtvHeapDesc;
+	rtvHeapDesc.NumDescriptors = SwapChainBufferCount + 1;
+	rtvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
+	rtvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+	rtvHeapDesc.NodeMask = 0;
+	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&rtvHeapDesc, IID_PPV_ARGS(mRtvHeap.GetAddressOf())));
+
+	D3D12_DESCRIPTOR_HEAP_DESC dsvHeapDesc;
+	dsvHeapDesc.NumDescriptors = 1;
+	dsvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_DSV;
+	dsvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+	dsvHeapDesc.NodeMask = 0;
+	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&dsvHeapDesc, IID_PPV_ARGS(mDsvHeap.GetAddressOf())));
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE ShapesApp::SceneColorView()const
+{
+	return CD3DX12_CPU_DESCRIPTOR_HANDLE(mRtvHeap->GetCPUDescriptorHandleForHeapStart(),
+		SwapChainBufferCount, mRtvDescriptorSize);
+}
+
 void ShapesApp::OnResize()
 {
 	D3DApp::OnResize();
@@ -217,10 +728,15 @@ void ShapesApp::OnResize()
 	// The window resized, so update the aspect ratio and recompute the projection matrix.
 	XMMATRIX P = XMMatrixPerspectiveFovLH(0.25f * MathHelper::Pi, AspectRatio(), 1.0f, 1000.0f);
 	XMStoreFloat4x4(&mProj, P);
+
+	BoundingFrustum::CreateFromMatrix(mCamFrustum, P);
 }
 
 void ShapesApp::Update(const GameTimer& gt)
 {
+	mFrameHeapAllocationStart = FrameArena::HeapAllocationCount();
+	MemoryTracker::Global().BeginFrame();
+
 	OnKeyboardInput(gt);
 	UpdateCamera(gt);
 
@@ -238,73 +754,130 @@ void ShapesApp::Update(const GameTimer& gt)
 		CloseHandle(eventHandle);
 	}
 
+	// Nothing the GPU still reads was allocated from this frame resource's arenas.
+	mCurrFrameResource->Arenas.Reset();
+
+	UpdateHotReload(gt);
+	UpdateWorldStreaming(gt);
 	UpdateObjectCBs(gt);
 	UpdateMaterialCBs(gt);
+	UpdateClusteredLights(gt);
 	UpdateMainPassCB(gt);
+	UpdateDrawLists(gt);
+	UpdateShadowCascades(gt);
+	UpdateFoliageVisibility(gt);
+	UpdateTextureResidency(gt);
+	UpdateGroundVirtualTexture(gt);
 }
 
 void ShapesApp::Draw(const GameTimer& gt)
 {
-	auto cmdListAlloc = mCurrFrameResource->CmdListAlloc;
+	// Record the draws of every layer first.  This only writes command streams, so it
+	// touches no D3D12 object and runs across all cores.
+	RecordDrawItems(mDrawStreams[(int)RenderLayer::Opaque], mDrawLayers[(int)RenderLayer::Opaque],
+		mIsWireframe ? mPSOs["opaque_wireframe"].Get() : mPSOs["opaque"].Get(),
+		mIsWireframe ? nullptr : mPSOs["opaque_lodFade"].Get(),
+		mIsWireframe || !mGroundVirtualTexture ? nullptr : mPSOs["opaque_virtualTexture"].Get());
+	RecordDrawItems(mDrawStreams[(int)RenderLayer::AlphaTestedTreeSprites], mDrawLayers[(int)RenderLayer::AlphaTestedTreeSprites],
+		mCpuBillboards ? mPSOs["treeQuads"].Get() : mPSOs["treeSprites"].Get());
+	RecordDrawItems(mDrawStreams[(int)RenderLayer::Transparent], mDrawLayers[(int)RenderLayer::Transparent],
+		mPSOs["transparent"].Get());
 
 	// Reuse the memory associated with command recording.
 	// We can only reset when the associated command lists have finished execution on the GPU.
-	ThrowIfFailed(cmdListAlloc->Reset());
+	mCommandBackend->BeginFrame(*mCurrFrameResource, nullptr);
 
-	// A command list can be reset after it has been added to the command queue via ExecuteCommandList.
-	// Reusing the command list reuses memory.
-	if (mIsWireframe)
-	{
-		ThrowIfFailed(mCommandList->Reset(cmdListAlloc.Get(), mPSOs["opaque_wireframe"].Get()));
-	}
-	else
-	{
-		ThrowIfFailed(mCommandList->Reset(cmdListAlloc.Get(), mPSOs["opaque"].Get()));
-	}
+	// The cells that finished loading are uploaded ahead of the frame's draws; their
+	// entities are drawn from the next frame on.
+	StreamWorldCells(mCommandBackend->CurrentList(), gWorldUploadBytesPerFrame);
+	UploadGroundPages(mCommandBackend->CurrentList());
 
-	mCommandList->RSSetViewports(1, &mScreenViewport);
-	mCommandList->RSSetScissorRects(1, &mScissorRect);
+	// So are the assets that were rebuilt after a change on disk, and the textures whose
+	// resident mips changed.
+	ApplyHotReloads();
+	StreamTextureMips(mCommandBackend->CurrentList());
 
-	// Indicate a state transition on the resource usage.
-	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
-		D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET));
+	// Replaying a stream moves recording on to a new primary list, which the render graph
+	// has to record the following barriers into.
+	auto replay = [this](RenderLayer layer)
+	{
+		mCommandBackend->Replay(mDrawStreams[(int)layer]);
+		mRenderGraphBackend->SetCommandList(mCommandBackend->CurrentList());
+	};
 
-	// Clear the back buffer and depth buffer.
-	mCommandList->ClearRenderTargetView(CurrentBackBufferView(), Colors::LightSteelBlue, 0, nullptr);
-	mCommandList->ClearDepthStencilView(DepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
+	// The passes only declare what they touch; the graph places the transitions around
+	// them.  The scene is drawn into a transient color target and copied to the back
+	// buffer last, which is where post processing goes.
+	mRenderGraph.Reset();
 
-	// Specify the buffers we are going to render to.
-	mCommandList->OMSetRenderTargets(1, &CurrentBackBufferView(), true, &DepthStencilView());
+	auto backBuffer = mRenderGraph.Import("backBuffer", CurrentBackBuffer(),
+		RenderGraphState::Present, RenderGraphState::Present);
+	auto depthStencil = mRenderGraph.Import("depthStencil", mDepthStencilBuffer.Get(),
+		RenderGraphState::DepthWrite, RenderGraphState::DepthWrite);
 
-	ID3D12DescriptorHeap* descriptorHeaps[] = { mSrvDescriptorHeap.Get() };
-	mCommandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
+	RenderGraph::TextureDesc sceneColorDesc;
+	sceneColorDesc.Width = (RenderGraph::uint32)mClientWidth;
+	sceneColorDesc.Height = (RenderGraph::uint32)mClientHeight;
+	sceneColorDesc.Format = mBackBufferFormat;
+	sceneColorDesc.BytesPerPixel = 4;
+	auto sceneColor = mRenderGraph.CreateTransient("sceneColor", sceneColorDesc);
 
-	mCommandList->SetGraphicsRootSignature(mRootSignature.Get());
+	auto opaquePass = mRenderGraph.AddPass("opaque", [this, replay, sceneColor](const RenderGraph& graph)
+	{
+		// The transient may be a new resource this frame; the streams bind this view.
+		md3dDevice->CreateRenderTargetView((ID3D12Resource*)graph.Native(sceneColor), nullptr, SceneColorView());
 
-	auto passCB = mCurrFrameResource->PassCB->Resource();
-	mCommandList->SetGraphicsRootConstantBufferView(2, passCB->GetGPUVirtualAddress());
+		// Clear the scene color and depth buffer.
+		auto cmdList = mCommandBackend->CurrentList();
+		cmdList->ClearRenderTargetView(SceneColorView(), Colors::LightSteelBlue, 0, nullptr);
+		cmdList->ClearDepthStencilView(DepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
 
-	// Draw OPAQUE
-	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Opaque]);
+		replay(RenderLayer::Opaque);
+	});
+	mRenderGraph.Write(opaquePass, sceneColor, RenderGraphState::RenderTarget);
+	mRenderGraph.Write(opaquePass, depthStencil, RenderGraphState::DepthWrite);
 
-	// Draw TREES 
-	mCommandList->SetPipelineState(mPSOs["treeSprites"].Get());
-	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::AlphaTestedTreeSprites]);
+	auto treePass = mRenderGraph.AddPass("treeSprites", [replay](const RenderGraph&)
+	{
+		replay(RenderLayer::AlphaTestedTreeSprites);
+	});
+	mRenderGraph.Write(treePass, sceneColor, RenderGraphState::RenderTarget);
+	mRenderGraph.Write(treePass, depthStencil, RenderGraphState::DepthWrite);
 
-	// Draw TRANSPARENT 
-	mCommandList->SetPipelineState(mPSOs["transparent"].Get());
-	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Transparent]);
+	auto transparentPass = mRenderGraph.AddPass("transparent", [replay](const RenderGraph&)
+	{
+		replay(RenderLayer::Transparent);
+	});
+	mRenderGraph.Write(transparentPass, sceneColor, RenderGraphState::RenderTarget);
+	mRenderGraph.Write(transparentPass, depthStencil, RenderGraphState::DepthWrite);
 
-	// Indicate a state transition on the resource usage.
-	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
-		D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT));
+	auto presentPass = mRenderGraph.AddPass("present", [this, sceneColor, backBuffer](const RenderGraph& graph)
+	{
+		mCommandBackend->CurrentList()->CopyResource((ID3D12Resource*)graph.Native(backBuffer),
+			(ID3D12Resource*)graph.Native(sceneColor));
+	});
+	mRenderGraph.Read(presentPass, sceneColor, RenderGraphState::CopySource);
+	mRenderGraph.Write(presentPass, backBuffer, RenderGraphState::CopyDest);
+
+	mRenderGraphBackend->SetCommandList(mCommandBackend->CurrentList());
+	mRenderGraph.Compile(*mRenderGraphBackend);
+
+#if defined(DEBUG) || defined(_DEBUG)
+	// The barrier stream has to chain: every transition starts from the state the last
+	// one left its resource in.
+	NullRenderGraphBackend barrierCheck;
+	mRenderGraph.ExecuteBarriers(barrierCheck);
+	if (barrierCheck.StateMismatch)
+	{
+		OutputDebugStringA("Render graph: a barrier does not start from its resource's state\n");
+		ThrowIfFailed(E_FAIL);
+	}
+#endif
 
-	// Done recording commands.
-	ThrowIfFailed(mCommandList->Close());
+	mRenderGraph.Execute(*mRenderGraphBackend);
 
-	// Add the command list to the queue for execution.
-	ID3D12CommandList* cmdsLists[] = { mCommandList.Get() };
-	mCommandQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
+	// Done recording commands; submit the primary and chunk lists in recording order.
+	mCommandBackend->EndFrame(mCommandQueue.Get());
 
 	// Swap the back and front buffers
 	ThrowIfFailed(mSwapChain->Present(0, 0));
@@ -317,6 +890,64 @@ void ShapesApp::Draw(const GameTimer& gt)
 	// Because we are on the GPU timeline, the new fence point won't be 
 	// set until the GPU finishes processing all the commands prior to this Signal().
 	mCommandQueue->Signal(mFence.Get(), mCurrentFence);
+
+	ReportFrameMemory(gt);
+}
+
+void ShapesApp::ReportFrameMemory(const GameTimer& gt)
+{
+	MemoryTracker& tracker = MemoryTracker::Global();
+
+	// A tag that just went over its budget is reported right away.
+	std::uint32_t overBudget = tracker.OverBudgetMask();
+	std::uint32_t newlyOver = overBudget & ~mOverBudgetMask;
+	mOverBudgetMask = overBudget;
+	for (int i = 0; i < (int)MemoryTag::Count; ++i)
+	{
+		if ((newlyOver & (1u << i)) == 0)
+			continue;
+
+		MemoryTracker::Counters counters = tracker.GetCounters((MemoryTag)i);
+		std::ostringstream oss;
+		oss << "Memory budget exceeded: " << MemoryTracker::TagName((MemoryTag)i) << " has "
+			<< counters.Live / 1024 << " KB live, budget " << counters.Budget / 1024 << " KB\n";
+		::OutputDebugStringA(oss.str().c_str());
+	}
+
+	mFrameHeapAllocations += FrameArena::HeapAllocationCount() - mFrameHeapAllocationStart;
+	mFrameMemoryReportFrames++;
+	mFrameMemoryReportTime += gt.DeltaTime();
+	if (mFrameMemoryReportTime >= 2.0f)
+	{
+		FrameArena::Stats stats = mCurrFrameResource->Arenas.GetStats();
+
+		std::ostringstream oss;
+		oss << "Frame memory: " << stats.Used / 1024 << " KB from the arenas (peak " << stats.Peak / 1024
+			<< " KB, " << stats.BlockAllocations << " blocks allocated)";
+#if defined(FRAME_ARENA_COUNT_ALLOCATIONS)
+		oss << ", " << (double)mFrameHeapAllocations / mFrameMemoryReportFrames << " heap allocations per frame";
+#endif
+		oss << "\n";
+
+		// The counts are those of this frame; BeginFrame clears them in Update.
+		oss << "Tracked memory: " << tracker.TotalLive() / 1024 << " KB live\n";
+		for (int i = 0; i < (int)MemoryTag::Count; ++i)
+		{
+			MemoryTracker::Counters counters = tracker.GetCounters((MemoryTag)i);
+			oss << "  " << MemoryTracker::TagName((MemoryTag)i) << ": " << counters.Live / 1024
+				<< " KB (peak " << counters.Peak / 1024 << " KB, budget " << counters.Budget / 1024 << " KB), "
+				<< counters.Allocations << " allocations, " << counters.FrameAllocations << " this frame ("
+				<< counters.FrameBytes / 1024 << " KB)";
+			if (overBudget & (1u << i))
+				oss << " OVER BUDGET";
+			oss << "\n";
+		}
+		::OutputDebugStringA(oss.str().c_str());
+
+		mFrameHeapAllocations = 0;
+		mFrameMemoryReportFrames = 0;
+		mFrameMemoryReportTime = 0.0f;
+	}
 }
 
 void ShapesApp::OnKeyboardInput(const GameTimer& gt)
@@ -326,6 +957,12 @@ void ShapesApp::OnKeyboardInput(const GameTimer& gt)
 	else
 		mIsWireframe = false;
 
+	// B switches the tree sprites between GS and CPU expansion.
+	bool billboardKey = (GetAsyncKeyState('B') & 0x8000) != 0;
+	if (billboardKey && !mBillboardKeyDown)
+		mCpuBillboards = !mCpuBillboards;
+	mBillboardKeyDown = billboardKey;
+
 	mKeyW = (GetAsyncKeyState('W') & 0x8000) != 0;
 	mKeyA = (GetAsyncKeyState('A') & 0x8000) != 0;
 	mKeyS = (GetAsyncKeyState('S') & 0x8000) != 0;
@@ -343,28 +980,32 @@ bool ShapesApp::CheckCollision(const XMFLOAT3& position, float radius)
 {
 	XMVECTOR pos = XMLoadFloat3(&position);
 
-	for (const auto& box : mMazeWallBounds)
+	bool hit = false;
+	mEntities.ForEachChunk<ColliderComponent>([&](const EntityWorld::ChunkView& chunk)
 	{
-		XMVECTOR boxCenter = XMLoadFloat3(&box.Center);
-		XMVECTOR boxExtents = XMLoadFloat3(&box.Extents);
-
-		// Calculate the closest point on the box to the sphere center
-		XMVECTOR closestPoint = XMVectorClamp(pos,
-			XMVectorSubtract(boxCenter, boxExtents),
-			XMVectorAdd(boxCenter, boxExtents));
-
-		// Calculate distance from closest point to sphere center
-		XMVECTOR delta = XMVectorSubtract(closestPoint, pos);
-		float distance = XMVectorGetX(XMVector3Length(delta));
-
-		// If distance is less than radius, we have a collision
-		if (distance < radius)
+		const ColliderComponent* colliders = chunk.Get<ColliderComponent>();
+		for (UINT i = 0; i < chunk.Count() && !hit; ++i)
 		{
-			return true;
+			const BoundingBox& box = colliders[i].Box;
+			XMVECTOR boxCenter = XMLoadFloat3(&box.Center);
+			XMVECTOR boxExtents = XMLoadFloat3(&box.Extents);
+
+			// Calculate the closest point on the box to the sphere center
+			XMVECTOR closestPoint = XMVectorClamp(pos,
+				XMVectorSubtract(boxCenter, boxExtents),
+				XMVectorAdd(boxCenter, boxExtents));
+
+			// Calculate distance from closest point to sphere center
+			XMVECTOR delta = XMVectorSubtract(closestPoint, pos);
+			float distance = XMVectorGetX(XMVector3Length(delta));
+
+			// If distance is less than radius, we have a collision
+			if (distance < radius)
+				hit = true;
 		}
-	}
+	});
 
-	return false;
+	return hit;
 }
 
 void ShapesApp::UpdateCamera(const GameTimer& gt)
@@ -460,23 +1101,40 @@ void ShapesApp::UpdateCamera(const GameTimer& gt)
 
 void ShapesApp::UpdateObjectCBs(const GameTimer& gt)
 {
+	// Chunks write disjoint constant buffer slots, so they run in parallel.
 	auto currObjectCB = mCurrFrameResource->ObjectCB.get();
-	for (auto& e : mAllRitems)
+	mEntities.ParallelForEachChunk<TransformComponent, BoundsComponent, RenderMeshComponent>(
+		[&](const EntityWorld::ChunkView& chunk)
 	{
-		if (e->NumFramesDirty > 0)
+		TransformComponent* transforms = chunk.Get<TransformComponent>();
+		BoundsComponent* bounds = chunk.Get<BoundsComponent>();
+		const RenderMeshComponent* meshes = chunk.Get<RenderMeshComponent>();
+
+		for (UINT i = 0; i < chunk.Count(); ++i)
 		{
-			XMMATRIX world = XMLoadFloat4x4(&e->World);
-			XMMATRIX texTransform = XMLoadFloat4x4(&e->TexTransform);
+			TransformComponent& t = transforms[i];
+			if (t.NumFramesDirty <= 0)
+				continue;
+
+			XMMATRIX world = XMLoadFloat4x4(&t.World);
+			XMMATRIX texTransform = XMLoadFloat4x4(&t.TexTransform);
 
 			ObjectConstants objConstants;
 			XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(world));
 			XMStoreFloat4x4(&objConstants.TexTransform, XMMatrixTranspose(texTransform));
 
-			currObjectCB->CopyData(e->ObjCBIndex, objConstants);
+			// The lights that matter most over the item's world bounding sphere.
+			BoundingBox& worldBounds = bounds[i].World;
+			bounds[i].Local.Transform(worldBounds, world);
+			XMFLOAT3 c = worldBounds.Center;
+			float radius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&worldBounds.Extents)));
+			objConstants.LightCount = mLightGrid.Select(c.x, c.y, c.z, radius, &objConstants.LightIndices.x, 4);
 
-			e->NumFramesDirty--;
+			currObjectCB->CopyData(meshes[i].ObjCBIndex, objConstants);
+
+			t.NumFramesDirty--;
 		}
-	}
+	}, mCurrFrameResource->Arenas.Local());
 }
 
 void ShapesApp::UpdateMaterialCBs(const GameTimer& gt)
@@ -525,208 +1183,1595 @@ void ShapesApp::UpdateMainPassCB(const GameTimer& gt)
 	mMainPassCB.FarZ = 1000.0f;
 	mMainPassCB.TotalTime = gt.TotalTime();
 	mMainPassCB.DeltaTime = gt.DeltaTime();
-	mMainPassCB.AmbientLight = { 0.25f, 0.25f, 0.35f, 1.0f };
 
-	// Directional Lights (3 lights)
-	mMainPassCB.Lights[0].Direction = { 0.57735f, -0.57735f, 0.57735f };
-	mMainPassCB.Lights[0].Strength = { 0.8f, 0.8f, 0.8f };
-	mMainPassCB.Lights[1].Direction = { -0.57735f, -0.57735f, 0.57735f };
-	mMainPassCB.Lights[1].Strength = { 0.4f, 0.4f, 0.4f };
-	mMainPassCB.Lights[2].Direction = { 0.0f, -0.707f, -0.707f };
-	mMainPassCB.Lights[2].Strength = { 0.2f, 0.2f, 0.2f };
-
-	// Point Lights - 4 red lights at each corner tower
-	// Northwest Tower
-	mMainPassCB.Lights[3].Position = { -30.0f, 5.0f, 30.0f };
-	mMainPassCB.Lights[3].Strength = { 1.0f, 0.2f, 0.2f };
-	mMainPassCB.Lights[3].FalloffStart = 5.0f;
-	mMainPassCB.Lights[3].FalloffEnd = 25.0f;
-
-	// Northeast Tower
-	mMainPassCB.Lights[4].Position = { 30.0f, 5.0f, 30.0f };
-	mMainPassCB.Lights[4].Strength = { 1.0f, 0.2f, 0.2f };
-	mMainPassCB.Lights[4].FalloffStart = 5.0f;
-	mMainPassCB.Lights[4].FalloffEnd = 25.0f;
-
-	// Southwest Tower
-	mMainPassCB.Lights[5].Position = { -30.0f, 5.0f, -30.0f };
-	mMainPassCB.Lights[5].Strength = { 1.0f, 0.2f, 0.2f };
-	mMainPassCB.Lights[5].FalloffStart = 5.0f;
-	mMainPassCB.Lights[5].FalloffEnd = 25.0f;
-
-	// Southeast Tower
-	mMainPassCB.Lights[6].Position = { 30.0f, 5.0f, -30.0f };
-	mMainPassCB.Lights[6].Strength = { 1.0f, 0.2f, 0.2f };
-	mMainPassCB.Lights[6].FalloffStart = 5.0f;
-	mMainPassCB.Lights[6].FalloffEnd = 25.0f;
+	// The ambient and directional lights are set once (BuildEnvironmentLighting and
+	// BuildSceneLights), since the baked lighting depends on them.  Point and spot lights
+	// go through the clusters (see UpdateClusteredLights).
 
 	auto currPassCB = mCurrFrameResource->PassCB.get();
 	currPassCB->CopyData(0, mMainPassCB);
 }
 
-void ShapesApp::LoadTextures()
+void ShapesApp::UpdateDrawLists(const GameTimer& gt)
 {
-	auto stoneTex = std::make_unique<Texture>();
-	stoneTex->Name = "stoneTex";
-	stoneTex->Filename = L"../../Textures/stone.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), stoneTex->Filename.c_str(),
-		stoneTex->Resource, stoneTex->UploadHeap));
-
-	auto darkStoneTex = std::make_unique<Texture>();
-	darkStoneTex->Name = "darkStoneTex";
-	darkStoneTex->Filename = L"../../Textures/stone.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), darkStoneTex->Filename.c_str(),
-		darkStoneTex->Resource, darkStoneTex->UploadHeap));
-
-	auto brickTex = std::make_unique<Texture>();
-	brickTex->Name = "brickTex";
-	brickTex->Filename = L"../../Textures/bricks.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), brickTex->Filename.c_str(),
-		brickTex->Resource, brickTex->UploadHeap));
+	XMMATRIX view = XMLoadFloat4x4(&mView);
+	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
 
-	auto roofTex = std::make_unique<Texture>();
-	roofTex->Name = "roofTex";
-	roofTex->Filename = L"../../Textures/tile.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), roofTex->Filename.c_str(),
-		roofTex->Resource, roofTex->UploadHeap));
+	BoundingFrustum worldFrustum;
+	mCamFrustum.Transform(worldFrustum, invView);
 
-	auto goldTex = std::make_unique<Texture>();
-	goldTex->Name = "goldTex";
-	goldTex->Filename = L"../../Textures/bricks.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), goldTex->Filename.c_str(),
-		goldTex->Resource, goldTex->UploadHeap));
+	// Last frame's lists belong to another frame resource's arena; start new ones.
+	FrameArena* arena = mCurrFrameResource->Arenas.Local();
+	for (int i = 0; i < (int)RenderLayer::Count; ++i)
+		mDrawLayers[i] = DrawList(ArenaAllocator<DrawItem>(arena));
 
-	auto waterTex = std::make_unique<Texture>();
-	waterTex->Name = "waterTex";
-	waterTex->Filename = L"../../Textures/water1.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), waterTex->Filename.c_str(),
-		waterTex->Resource, waterTex->UploadHeap));
+	// Entities with levels of detail are added to the selector's batch and drawn once
+	// their levels are picked.  Their projected error is in pixels of the render target.
+	struct LodDraw
+	{
+		DrawItem Item;
+		const LodComponent* Lod;
+	};
+	ArenaVector<LodDraw> lodDraws{ ArenaAllocator<LodDraw>(arena) };
+	float pixelsPerUnit = (float)mClientHeight / (2.0f * tanf(0.125f * MathHelper::Pi));
+	mLodSelector.BeginFrame(&mCameraPos.x, pixelsPerUnit, gt.DeltaTime());
 
-	auto treeArrayTex = std::make_unique<Texture>();
-	treeArrayTex->Name = "treeArrayTex";
-	treeArrayTex->Filename = L"../../Textures/treeArray2.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), treeArrayTex->Filename.c_str(),
-		treeArrayTex->Resource, treeArrayTex->UploadHeap));
+	// The world bounds are current: UpdateObjectCBs refreshes them with the constants.
+	mEntities.ForEachChunk<BoundsComponent, RenderMeshComponent, MaterialComponent>(
+		[&](const EntityWorld::ChunkView& chunk)
+	{
+		const BoundsComponent* bounds = chunk.Get<BoundsComponent>();
+		const RenderMeshComponent* meshes = chunk.Get<RenderMeshComponent>();
+		const MaterialComponent* materials = chunk.Get<MaterialComponent>();
+		LodComponent* lods = chunk.Get<LodComponent>();
 
+		for (UINT i = 0; i < chunk.Count(); ++i)
+		{
+			if (meshes[i].IndexCount == 0 || worldFrustum.Contains(bounds[i].World) == DISJOINT)
+				continue;
 
-	mTextures[stoneTex->Name] = std::move(stoneTex);
-	mTextures[darkStoneTex->Name] = std::move(darkStoneTex);
-	mTextures[brickTex->Name] = std::move(brickTex);
-	mTextures[roofTex->Name] = std::move(roofTex);
-	mTextures[goldTex->Name] = std::move(goldTex);
-	mTextures[treeArrayTex->Name] = std::move(treeArrayTex);
-	mTextures["waterTex"] = std::move(waterTex);
-}
+			DrawItem item;
+			item.Mesh = meshes[i];
+			item.Mat = materials[i].Mat;
 
+			if (lods != nullptr)
+			{
+				const BoundingBox& box = bounds[i].World;
+				float radius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&box.Extents)));
+				mLodSelector.Add(&box.Center.x, radius, lods[i].Levels, &lods[i].State);
+				lodDraws.push_back({ item, &lods[i] });
+				continue;
+			}
 
-void ShapesApp::BuildDescriptorHeaps()
-{
-	// Create the SRV heap.
-	D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
-	srvHeapDesc.NumDescriptors = (UINT)mTextures.size();
-	srvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-	srvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&srvHeapDesc, IID_PPV_ARGS(&mSrvDescriptorHeap)));
+			mDrawLayers[(int)meshes[i].Layer].push_back(item);
+		}
+	});
 
-	// Fill out the heap with actual descriptors.
-	CD3DX12_CPU_DESCRIPTOR_HANDLE hDescriptor(mSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart());
+	mLodSelector.Select();
 
-	for (auto& texPair : mTextures)
+	auto levelItem = [](const LodDraw& draw, UINT level, float fade)
 	{
-		auto texture = texPair.second->Resource;
-		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-
-		auto desc = texture->GetDesc();
+		DrawItem item = draw.Item;
+		item.Mesh.IndexCount = draw.Lod->IndexCount[level];
+		item.Mesh.StartIndexLocation = draw.Lod->StartIndexLocation[level];
+		item.Mesh.BaseVertexLocation = draw.Lod->BaseVertexLocation[level];
+		item.Mesh.BakedLightingOffset = draw.Lod->BakedLightingOffset[level];
+		item.LodFade = fade;
+		return item;
+	};
 
-		// Check if this is the tree texture array
-		if (texPair.first == "treeArrayTex")
-		{
-			srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
-			srvDesc.Format = desc.Format;
-			srvDesc.Texture2DArray.MostDetailedMip = 0;
-			srvDesc.Texture2DArray.MipLevels = -1;
-			srvDesc.Texture2DArray.FirstArraySlice = 0;
-			srvDesc.Texture2DArray.ArraySize = desc.DepthOrArraySize;
-		}
-		else
+	// Only the opaque layer has a pipeline that dithers, so elsewhere the new level shows
+	// at once.  The fading draws go after the others so the pipeline switches once.
+	for (const LodDraw& draw : lodDraws)
+	{
+		const LodSelector::State& state = draw.Lod->State;
+		if (state.Fade >= 1.0f || draw.Item.Mesh.Layer != RenderLayer::Opaque)
+			mDrawLayers[(int)draw.Item.Mesh.Layer].push_back(levelItem(draw, state.Lod, 0.0f));
+	}
+	for (const LodDraw& draw : lodDraws)
+	{
+		const LodSelector::State& state = draw.Lod->State;
+		if (state.Fade < 1.0f && draw.Item.Mesh.Layer == RenderLayer::Opaque)
 		{
-			srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-			srvDesc.Format = desc.Format;
-			srvDesc.Texture2D.MostDetailedMip = 0;
-			srvDesc.Texture2D.MipLevels = desc.MipLevels;
-			srvDesc.Texture2D.ResourceMinLODClamp = 0.0f;
+			mDrawLayers[(int)RenderLayer::Opaque].push_back(levelItem(draw, state.Lod, state.Fade));
+			mDrawLayers[(int)RenderLayer::Opaque].push_back(levelItem(draw, state.FromLod, -state.Fade));
 		}
+	}
 
-		md3dDevice->CreateShaderResourceView(texture.Get(), &srvDesc, hDescriptor);
-		hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+	const LodSelector::Stats& stats = mLodSelector.GetStats();
+	mLodSwitches += stats.Transitions;
+	mLodReportTime += gt.DeltaTime();
+	if (mLodReportTime >= 2.0f)
+	{
+		std::ostringstream oss;
+		oss << "LOD: " << stats.Items << " visible items at levels";
+		for (std::uint32_t k = 0; k < LodSelector::MaxLods; ++k)
+			oss << " " << stats.ItemsPerLod[k];
+		oss << ", " << stats.Fading << " fading, " << mLodSwitches << " switches in " << mLodReportTime << " s; "
+			<< stats.DrawnTriangles << " of " << stats.FullTriangles << " full detail triangles drawn";
+		if (stats.FullTriangles > 0)
+			oss << " (" << 100.0 * (1.0 - (double)stats.DrawnTriangles / stats.FullTriangles) << "% saved)";
+		oss << "\n";
+		::OutputDebugStringA(oss.str().c_str());
+
+		mLodSwitches = 0;
+		mLodReportTime = 0.0f;
 	}
 }
 
-void ShapesApp::BuildRootSignature()
+void ShapesApp::UpdateClusteredLights(const GameTimer& gt)
 {
-	CD3DX12_DESCRIPTOR_RANGE texTable;
-	texTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0); // register t0
-
-	// Root parameter can be a table, root descriptor or root constants.
-	CD3DX12_ROOT_PARAMETER slotRootParameter[4];
-
-	// Perfomance TIP: Order from most frequent to least frequent.
-	slotRootParameter[0].InitAsDescriptorTable(1, &texTable, D3D12_SHADER_VISIBILITY_PIXEL);
-	slotRootParameter[1].InitAsConstantBufferView(0); // register b0 (ObjectCB)
-	slotRootParameter[2].InitAsConstantBufferView(1); // register b1 (PassCB)
-	slotRootParameter[3].InitAsConstantBufferView(2); // register b2 (MaterialCB)
-
-	auto staticSamplers = GetStaticSamplers();
+	ClusteredLights::Config config;
+	config.NearZ = 1.0f;
+	config.FarZ = 1000.0f;
+	config.TanHalfFovY = tanf(0.125f * MathHelper::Pi);
+	config.AspectRatio = AspectRatio();
+	mClusteredLights.Configure(config);
+
+	// Bin the lights' view space bounding spheres.  Spot lights use the sphere of their
+	// full range, which is conservative.
+	XMMATRIX view = XMLoadFloat4x4(&mView);
+	UINT lightCount = (UINT)mSceneLights.size();
 
-	// A root signature is an array of root parameters.
-	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(4, slotRootParameter,
-		(UINT)staticSamplers.size(), staticSamplers.data(),
-		D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+	mSceneLightSpheres.resize(lightCount);
+	for (UINT i = 0; i < lightCount; ++i)
+	{
+		XMFLOAT3 posV;
+		XMStoreFloat3(&posV, XMVector3TransformCoord(XMLoadFloat3(&mSceneLights[i].Position), view));
+
+		ClusteredLights::LightSphere& sphere = mSceneLightSpheres[i];
+		sphere.X = posV.x;
+		sphere.Y = posV.y;
+		sphere.Z = posV.z;
+		sphere.Radius = mSceneLights[i].FalloffEnd;
+	}
 
-	// create a root signature with a single slot which points to a descriptor range consisting of a single constant buffer
-	ComPtr<ID3DBlob> serializedRootSig = nullptr;
-	ComPtr<ID3DBlob> errorBlob = nullptr;
-	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
-		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+	mClusteredLights.Assign(mSceneLightSpheres.data(), lightCount);
 
-	if (errorBlob != nullptr)
+	// The lights themselves are static, so each frame resource only needs them once.
+	auto currFrame = mCurrFrameResource;
+	if (mSceneLightsFramesDirty > 0)
 	{
-		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+		for (UINT i = 0; i < lightCount; ++i)
+			currFrame->SceneLights->CopyData(i, mSceneLights[i]);
+		mSceneLightsFramesDirty--;
 	}
-	ThrowIfFailed(hr);
 
-	ThrowIfFailed(md3dDevice->CreateRootSignature(
-		0,
-		serializedRootSig->GetBufferPointer(),
-		serializedRootSig->GetBufferSize(),
-		IID_PPV_ARGS(mRootSignature.GetAddressOf())));
+	const auto& ranges = mClusteredLights.Ranges();
+	for (UINT i = 0; i < (UINT)ranges.size(); ++i)
+		currFrame->ClusterRanges->CopyData(i, ranges[i]);
+
+	const auto& indices = mClusteredLights.Indices();
+	for (UINT i = 0; i < (UINT)indices.size(); ++i)
+		currFrame->ClusterLightIndices->CopyData(i, indices[i]);
+
+	mMainPassCB.ClusterDims = XMUINT3(config.TilesX, config.TilesY, config.Slices);
+	mMainPassCB.ClusterDepthScale = mClusteredLights.DepthScale();
+	mMainPassCB.ClusterDepthBias = mClusteredLights.DepthBias();
 }
 
-void ShapesApp::BuildShadersAndInputLayout()
+void ShapesApp::UpdateShadowCascades(const GameTimer& gt)
 {
-	mShaders["standardVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "VS", "vs_5_0");
-	mShaders["opaquePS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "PS", "ps_5_0");
-
-	const D3D_SHADER_MACRO alphaTestDefines[] =
+	// Only opaque entities cast shadows; water and the tree sprites do not.  Casters
+	// outside the view still cast into it, so this is not limited to the draw lists.
+	mShadowCasters.clear();
+	mEntities.ForEachChunk<BoundsComponent, RenderMeshComponent>([&](const EntityWorld::ChunkView& chunk)
 	{
-		"ALPHA_TEST",
-		NULL, NULL
-	};
+		const BoundsComponent* bounds = chunk.Get<BoundsComponent>();
+		const RenderMeshComponent* meshes = chunk.Get<RenderMeshComponent>();
+		const EntityWorld::Entity* entities = chunk.Entities();
 
-	mShaders["treeSpriteVS"] = d3dUtil::CompileShader(L"Shaders\\TreeSprite.hlsl", nullptr, "VS", "vs_5_0");
-	mShaders["treeSpriteGS"] = d3dUtil::CompileShader(L"Shaders\\TreeSprite.hlsl", nullptr, "GS", "gs_5_0");
-	mShaders["treeSpritePS"] = d3dUtil::CompileShader(L"Shaders\\TreeSprite.hlsl", alphaTestDefines, "PS", "ps_5_0");
+		for (UINT i = 0; i < chunk.Count(); ++i)
+		{
+			if (meshes[i].Layer != RenderLayer::Opaque)
+				continue;
 
-	mInputLayout =
-	{
+			const BoundingBox& worldBounds = bounds[i].World;
+
+			CascadedShadows::Caster caster;
+			caster.Center = { worldBounds.Center.x, worldBounds.Center.y, worldBounds.Center.z };
+			caster.Radius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&worldBounds.Extents)));
+			caster.Id = entities[i].Index;
+			mShadowCasters.push_back(caster);
+		}
+	});
+
+	CascadedShadows::Camera camera;
+	camera.Position = { mCameraPos.x, mCameraPos.y, mCameraPos.z };
+	camera.Forward = {
+		cosf(mCameraYaw) * cosf(mCameraPitch),
+		sinf(mCameraPitch),
+		sinf(mCameraYaw) * cosf(mCameraPitch) };
+	camera.TanHalfFovY = tanf(0.125f * MathHelper::Pi);
+	camera.AspectRatio = AspectRatio();
+
+	const XMFLOAT3& dir = mMainPassCB.Lights[0].Direction;
+	CascadedShadows::Float3 lightDirection = { dir.x, dir.y, dir.z };
+
+	mCascadedShadows.Update(camera, lightDirection, mShadowCasters.data(), (UINT)mShadowCasters.size());
+
+	// There is no shadow map pass yet; the cascades and their caster lists are what it
+	// will consume.
+	mShadowReportTime += gt.DeltaTime();
+	if (mShadowReportTime >= 2.0f)
+	{
+		std::ostringstream oss;
+		oss << "Shadows: " << mShadowCasters.size() << " casters;";
+		for (UINT i = 0; i < mCascadedShadows.CascadeCount(); ++i)
+		{
+			const auto& cascade = mCascadedShadows.GetCascade(i);
+			oss << " [" << cascade.SplitNear << ", " << cascade.SplitFar << "] "
+				<< cascade.Casters.size() << " casters, " << cascade.TexelSize << " texel;";
+		}
+		oss << "\n";
+		::OutputDebugStringA(oss.str().c_str());
+
+		mShadowReportTime = 0.0f;
+	}
+}
+
+void ShapesApp::UpdateFoliageVisibility(const GameTimer& gt)
+{
+	if (!mCpuBillboards)
+		return;
+
+	// UpdateDrawLists put the visible foliage chunks in the tree layer.
+	FrameArena* arena = mCurrFrameResource->Arenas.Local();
+	auto& treeLayer = mDrawLayers[(int)RenderLayer::AlphaTestedTreeSprites];
+	ArenaVector<BillboardExpander::Range> visibleRanges{ ArenaAllocator<BillboardExpander::Range>(arena) };
+	visibleRanges.reserve(treeLayer.size());
+	for (const DrawItem& item : treeLayer)
+		visibleRanges.push_back({ item.Mesh.StartIndexLocation, item.Mesh.IndexCount });
+
+	// Expand the visible sprites around the eye into this frame's vertex buffer and
+	// draw them with one item.
+	static_assert(sizeof(BillboardExpander::Sprite) == sizeof(FoliageScatter::Instance), "sprite layouts differ");
+	const auto* sprites = reinterpret_cast<const BillboardExpander::Sprite*>(mFoliage.Instances().data());
+	const float eye[3] = { mCameraPos.x, mCameraPos.y, mCameraPos.z };
+
+	LARGE_INTEGER start, end, frequency;
+	QueryPerformanceCounter(&start);
+
+	// Three slices, like the GS path's PrimID % 3.
+	auto treeQuadVB = mCurrFrameResource->TreeQuadVB.get();
+	UINT spriteCount = BillboardExpander::ExpandRanges(sprites, visibleRanges.data(),
+		(UINT)visibleRanges.size(), 3, eye, treeQuadVB->MappedData(), arena);
+
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+
+	mTreeQuadGeo->VertexBufferGPU = treeQuadVB->Resource();
+
+	treeLayer.clear();
+	if (spriteCount > 0)
+	{
+		DrawItem item;
+		item.Mesh = *mEntities.Get<RenderMeshComponent>(mTreeQuadEntity);
+		item.Mesh.IndexCount = spriteCount * BillboardExpander::IndicesPerSprite;
+		item.Mat = mEntities.Get<MaterialComponent>(mTreeQuadEntity)->Mat;
+		treeLayer.push_back(item);
+	}
+
+	mBillboardSprites += spriteCount;
+	mBillboardSeconds += (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+	mBillboardReportTime += gt.DeltaTime();
+	if (mBillboardReportTime >= 2.0f && mBillboardSeconds > 0.0)
+	{
+		std::ostringstream oss;
+		oss << "Billboards: " << spriteCount << " sprites this frame, "
+			<< (mBillboardSprites / mBillboardSeconds) * 1e-6 << " M sprites/s expanded on the CPU\n";
+		::OutputDebugStringA(oss.str().c_str());
+
+		mBillboardSprites = 0;
+		mBillboardSeconds = 0.0;
+		mBillboardReportTime = 0.0f;
+	}
+}
+
+void ShapesApp::UpdateTextureResidency(const GameTimer& gt)
+{
+	const float tanHalfFovY = tanf(0.125f * MathHelper::Pi);
+	const float halfHeight = 0.5f * mClientHeight;
+	const float screenArea = (float)mClientWidth * (float)mClientHeight;
+
+	XMVECTOR eye = XMLoadFloat3(&mCameraPos);
+
+	// Estimate how many pixels each item covers from its bounding sphere and request the
+	// mip that gives roughly one texel per pixel.  The residency requests are not thread
+	// safe, so this system runs serially.
+	mEntities.ForEach<TransformComponent, BoundsComponent, MaterialComponent>(
+		[&](EntityWorld::Entity, const TransformComponent& transform, const BoundsComponent& bounds,
+			const MaterialComponent& material)
+	{
+		const Material* mat = material.Mat;
+		int srvIndex = mat->DiffuseSrvHeapIndex;
+		if (srvIndex < 0 || srvIndex >= (int)mSrvResidencyIds.size())
+			return;
+
+		const BoundingBox& worldBounds = bounds.World;
+
+		float radius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&worldBounds.Extents)));
+		float dist = XMVectorGetX(XMVector3Length(XMLoadFloat3(&worldBounds.Center) - eye));
+
+		float coverage = screenArea;
+		if (dist > radius)
+		{
+			float pixelRadius = radius / (dist * tanHalfFovY) * halfHeight;
+			coverage = MathHelper::Min(MathHelper::Pi * pixelRadius * pixelRadius, screenArea);
+		}
+
+		float uvRepeat = fabsf(transform.TexTransform._11 * transform.TexTransform._22) *
+			fabsf(mat->MatTransform._11 * mat->MatTransform._22);
+
+		std::uint32_t id = mSrvResidencyIds[srvIndex];
+		std::uint32_t mip = TextureResidency::MipForCoverage(
+			mTextureResidency->Width(id), mTextureResidency->Height(id), coverage, uvRepeat);
+		mTextureResidency->RequestMip(id, mip);
+	});
+
+	// StreamTextureMips acts on what this decides, once the frame's command list is open.
+	mResidencyRequests.clear();
+	mTextureResidency->EndFrame(mResidencyRequests);
+
+	mResidencyReportTime += gt.DeltaTime();
+	if (mResidencyReportTime >= 2.0f)
+	{
+		const auto& stats = mTextureResidency->GetStats();
+
+		std::ostringstream oss;
+		oss << "Textures: " << stats.ResidentBytes / 1024 << " KB resident / "
+			<< stats.BudgetBytes / 1024 << " KB budget, hit rate " << stats.HitRate() * 100.0f
+			<< "%, " << stats.Evictions << " evictions, " << stats.StreamIns << " stream-ins\n";
+		::OutputDebugStringA(oss.str().c_str());
+
+		mTextureResidency->ResetStats();
+		mResidencyReportTime = 0.0f;
+	}
+}
+
+void ShapesApp::StreamTextureMips(ID3D12GraphicsCommandList* cmdList)
+{
+	// A committed texture cannot drop or add single mips, so a texture whose resident mips
+	// changed is read from its file again, from the new most detailed mip down, and swaps
+	// in like a reloaded one.  One texture a frame bounds the reads; the others follow.
+	for (std::uint32_t id = 0; id < mTextureResidency->TextureCount(); ++id)
+	{
+		const std::uint32_t mip = mTextureResidency->ResidentMip(id);
+		if (mip == mTextureFirstMips[id])
+			continue;
+		if (mFreeSrvSlots.empty())
+			return;
+
+		const std::string& name = mTextureResidency->Name(id);
+		ComPtr<ID3D12Resource> resource;
+		ComPtr<ID3D12Resource> uploadHeap;
+		if (FAILED(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(), cmdList, mTextures.at(name)->Filename.c_str(),
+			resource, uploadHeap, TextureMaxSize(name))))
+		{
+			// Keeps what it has and is not evicted again; the budget is only a target.
+			OutputDebugStringA(("Textures: cannot read " + name + " again, it keeps its current mips\n").c_str());
+			mTextureResidency->SetPinned(id, true);
+			mTextureFirstMips[id] = mip;
+			continue;
+		}
+
+		ReplaceTexture(name, resource, uploadHeap);
+		mTextureFirstMips[id] = mip;
+		TrackMemory();
+		return;
+	}
+}
+
+void ShapesApp::UpdateGroundVirtualTexture(const GameTimer& gt)
+{
+	// Without a page file there is nothing to page in.
+	if (!mGroundVirtualTexture)
+		return;
+
+	const float eye[3] = { mCameraPos.x, mCameraPos.y, mCameraPos.z };
+	const float forward[3] = {
+		cosf(mCameraYaw) * cosf(mCameraPitch),
+		sinf(mCameraPitch),
+		sinf(mCameraYaw) * cosf(mCameraPitch) };
+
+	mGroundPageFeedback.clear();
+	VirtualTexture::GeneratePlaneFeedback(mGroundVirtualTexture->GetDesc(), eye, forward,
+		0.0f, 0.0f, gGroundY, gGroundSize, 0.25f * MathHelper::Pi, (float)mClientHeight, 64, mGroundPageFeedback);
+
+	mGroundPageLoads.clear();
+	mGroundPageEvictions.clear();
+	mGroundVirtualTexture->Update(mGroundPageFeedback, mGroundPageLoads, mGroundPageEvictions);
+
+	// At most MaxLoadsPerFrame small pages, so they are read right here.  Each goes into
+	// its own placed footprint of the upload buffer, a row of blocks at a time.
+	const auto& header = mGroundPageFile.Header();
+	const UINT rowBytes = (header.PageSize + 2 * header.BorderSize) / 4 * 8;
+	std::uint8_t* upload = mCurrFrameResource->GroundPages->MappedData();
+
+	mGroundPageUploads.clear();
+	for (const auto& load : mGroundPageLoads)
+	{
+		if (!mGroundPageFile.ReadPage(load.PageId, mGroundPageData))
+		{
+			mGroundVirtualTexture->CancelLoad(load.PageId);
+			continue;
+		}
+
+		std::uint8_t* page = upload + mGroundPageUploadStride * mGroundPageUploads.size();
+		for (UINT row = 0; row < mGroundPageFootprint.Footprint.Height / 4; ++row)
+			memcpy(page + (size_t)row * mGroundPageFootprint.Footprint.RowPitch, &mGroundPageData[(size_t)row * rowBytes], rowBytes);
+		mGroundPageUploads.push_back(load);
+	}
+
+	mVirtualTextureReportTime += gt.DeltaTime();
+	if (mVirtualTextureReportTime >= 2.0f)
+	{
+		const auto& stats = mGroundVirtualTexture->GetStats();
+
+		std::ostringstream oss;
+		oss << "Ground VT: " << stats.RequestedPages << " pages requested, " << stats.ResidentPages
+			<< " resident, " << stats.Misses << " misses, " << stats.Loads << " loads, "
+			<< stats.Evictions << " evictions\n";
+		::OutputDebugStringA(oss.str().c_str());
+
+		mVirtualTextureReportTime = 0.0f;
+	}
+}
+
+void ShapesApp::UploadGroundPages(ID3D12GraphicsCommandList* cmdList)
+{
+	if (!mGroundVirtualTexture)
+		return;
+
+	// Evicted pages were unmapped by this frame's Update.
+	if (!mGroundPageEvictions.empty())
+		mGroundPageTableDirty = true;
+
+	if (mGroundPageUploads.empty())
+	{
+		UploadGroundPageTable(cmdList);
+		return;
+	}
+
+	const UINT pageTexels = mGroundPageFootprint.Footprint.Width;
+
+	auto toCopy = CD3DX12_RESOURCE_BARRIER::Transition(mGroundPageCache.Get(),
+		D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
+	cmdList->ResourceBarrier(1, &toCopy);
+
+	CD3DX12_TEXTURE_COPY_LOCATION dst(mGroundPageCache.Get(), 0);
+	for (size_t i = 0; i < mGroundPageUploads.size(); ++i)
+	{
+		D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = mGroundPageFootprint;
+		footprint.Offset = mGroundPageUploadStride * i;
+		CD3DX12_TEXTURE_COPY_LOCATION src(mCurrFrameResource->GroundPages->Resource(), footprint);
+
+		const auto& load = mGroundPageUploads[i];
+		cmdList->CopyTextureRegion(&dst, load.PhysicalX * pageTexels, load.PhysicalY * pageTexels, 0, &src, nullptr);
+	}
+
+	auto toShader = CD3DX12_RESOURCE_BARRIER::Transition(mGroundPageCache.Get(),
+		D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	cmdList->ResourceBarrier(1, &toShader);
+
+	// The copies run ahead of every draw of this frame, so the page table may point at
+	// the pages from here on.
+	for (const auto& load : mGroundPageUploads)
+		mGroundVirtualTexture->CompleteLoad(load.PageId);
+	mGroundPageUploads.clear();
+
+	mGroundPageTableDirty = true;
+	UploadGroundPageTable(cmdList);
+}
+
+void ShapesApp::UploadGroundPageTable(ID3D12GraphicsCommandList* cmdList)
+{
+	if (!mGroundPageTableDirty)
+		return;
+
+	// Every mip of the table goes up at once; it is a few kilobytes.  Frames in flight
+	// read the same texture, but their draws finish before this frame's copies start.
+	std::uint8_t* upload = mCurrFrameResource->GroundPageTable->MappedData();
+	for (UINT mip = 0; mip < (UINT)mGroundPageTableFootprints.size(); ++mip)
+	{
+		const auto& footprint = mGroundPageTableFootprints[mip];
+		const auto& table = mGroundVirtualTexture->PageTable(mip);
+		const UINT width = footprint.Footprint.Width;
+
+		for (UINT y = 0; y < footprint.Footprint.Height; ++y)
+		{
+			std::uint8_t* row = upload + footprint.Offset + (UINT64)y * footprint.Footprint.RowPitch;
+			for (UINT x = 0; x < width; ++x)
+			{
+				const auto& entry = table[(size_t)y * width + x];
+				row[4 * x + 0] = (std::uint8_t)entry.PhysicalX;
+				row[4 * x + 1] = (std::uint8_t)entry.PhysicalY;
+				row[4 * x + 2] = entry.MappedMip;
+				row[4 * x + 3] = 0;
+			}
+		}
+	}
+
+	auto toCopy = CD3DX12_RESOURCE_BARRIER::Transition(mGroundPageTable.Get(),
+		D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
+	cmdList->ResourceBarrier(1, &toCopy);
+
+	for (UINT mip = 0; mip < (UINT)mGroundPageTableFootprints.size(); ++mip)
+	{
+		CD3DX12_TEXTURE_COPY_LOCATION dst(mGroundPageTable.Get(), mip);
+		CD3DX12_TEXTURE_COPY_LOCATION src(mCurrFrameResource->GroundPageTable->Resource(), mGroundPageTableFootprints[mip]);
+		cmdList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+	}
+
+	auto toShader = CD3DX12_RESOURCE_BARRIER::Transition(mGroundPageTable.Get(),
+		D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	cmdList->ResourceBarrier(1, &toShader);
+
+	mGroundPageTableDirty = false;
+}
+
+void ShapesApp::UpdateWorldStreaming(const GameTimer& gt)
+{
+	const UINT64 completedFence = mFence->GetCompletedValue();
+
+	// Upload heaps go once their copies executed, unloaded cells once no frame in flight
+	// draws them.
+	for (auto& entry : mStreamedCells)
+	{
+		StreamedCell& cell = entry.second;
+		if (cell.UploadFence != 0 && completedFence >= cell.UploadFence)
+		{
+			for (auto& geo : cell.Geometry)
+				geo->DisposeUploaders();
+			cell.UploadFence = 0;
+			TrackCellMemory(cell);
+		}
+	}
+	mRetiredCells.erase(std::remove_if(mRetiredCells.begin(), mRetiredCells.end(),
+		[completedFence](const StreamedCell& cell) { return completedFence >= cell.RetireFence; }), mRetiredCells.end());
+
+	mWorldStreamer.Update(mCameraPos.x, mCameraPos.z);
+
+	mCellUnloads.clear();
+	mWorldStreamer.TakeUnloads(mCellUnloads);
+	for (std::uint32_t index : mCellUnloads)
+	{
+		auto it = mStreamedCells.find(index);
+		if (it == mStreamedCells.end())
+			continue;
+
+		StreamedCell& cell = it->second;
+		for (EntityWorld::Entity entity : cell.Entities)
+		{
+			mFreeObjectSlots.push_back(mEntities.Get<RenderMeshComponent>(entity)->ObjCBIndex);
+			mEntities.Destroy(entity);
+		}
+		cell.Entities.clear();
+
+		// The last frame submitted may still draw the cell.
+		cell.RetireFence = mCurrentFence;
+		mRetiredCells.push_back(std::move(cell));
+		mStreamedCells.erase(it);
+	}
+
+	mWorldStreamingReportTime += gt.DeltaTime();
+	if (mWorldStreamingReportTime >= 2.0f)
+	{
+		auto stats = mWorldStreamer.GetStats();
+
+		std::ostringstream oss;
+		oss << "World streaming: " << stats.Resident << " of " << stats.Cells << " cells resident ("
+			<< stats.ResidentBytes / 1024 << " KB), " << stats.Pending << " pending, " << stats.Loads << " loads, "
+			<< stats.Cancelled << " cancelled, " << stats.Failed << " failed, " << stats.Unloads << " unloads, "
+			<< stats.LoadSeconds * 1000.0 << " ms reading, " << mStreamedUploadBytes / 1024 << " KB uploaded, "
+			<< mFreeObjectSlots.size() + (mObjectCapacity - mObjectCount) << " object slots free\n";
+		::OutputDebugStringA(oss.str().c_str());
+
+		mWorldStreamingReportTime = 0.0f;
+	}
+}
+
+void ShapesApp::StreamWorldCells(ID3D12GraphicsCommandList* cmdList, UINT64 uploadBudget)
+{
+	mLoadedCells.clear();
+	mWorldStreamer.TakeLoaded(uploadBudget, mLoadedCells);
+
+	for (auto& data : mLoadedCells)
+	{
+		const ScenePack& pack = data->Pack;
+		if (pack.ObjectCount() > mFreeObjectSlots.size() + (mObjectCapacity - mObjectCount))
+		{
+			OutputDebugStringA("World streaming: out of object constant slots, a cell is left out\n");
+			continue;
+		}
+
+		StreamedCell cell;
+		for (const WorldStreamer::LoadedMesh& mesh : data->Meshes)
+			cell.Geometry.push_back(CreatePackGeometry(cmdList, pack, *mesh.Mesh, mesh.Vertices, mesh.Indices));
+
+		for (std::uint32_t i = 0; i < pack.ObjectCount(); ++i)
+		{
+			const ScenePack::Object& object = pack.Objects()[i];
+			cell.Entities.push_back(SpawnPackObject(pack, object, cell.Geometry[object.Mesh].get()));
+		}
+
+		// The copies execute with the frame being recorded, which signals the next fence.
+		cell.UploadFence = mCurrentFence + 1;
+		TrackCellMemory(cell);
+
+		mStreamedUploadBytes += data->UploadBytes;
+		mStreamedCells[data->Cell] = std::move(cell);
+	}
+
+	// The decoded buffers are in the upload heaps now.
+	mLoadedCells.clear();
+}
+
+void ShapesApp::TrackCellMemory(StreamedCell& cell)
+{
+	UINT64 bytes = 0;
+	for (const auto& geo : cell.Geometry)
+	{
+		bytes += ResourceBytes(geo->VertexBufferGPU.Get()) + ResourceBytes(geo->IndexBufferGPU.Get());
+		bytes += ResourceBytes(geo->VertexBufferUploader.Get()) + ResourceBytes(geo->IndexBufferUploader.Get());
+	}
+	cell.Memory = TrackedMemory(MemoryTag::Geometry, bytes);
+}
+
+void ShapesApp::UpdateHotReload(const GameTimer& gt)
+{
+	// What a reload replaced goes once no frame in flight uses it; its SRV slot is free
+	// for the next reload then.
+	const UINT64 completedFence = mFence->GetCompletedValue();
+	for (const RetiredObject& retired : mRetiredObjects)
+	{
+		if (completedFence >= retired.Fence && retired.SrvSlot != ~0u)
+			mFreeSrvSlots.push_back(retired.SrvSlot);
+	}
+	mRetiredObjects.erase(std::remove_if(mRetiredObjects.begin(), mRetiredObjects.end(),
+		[completedFence](const RetiredObject& retired) { return completedFence >= retired.Fence; }), mRetiredObjects.end());
+
+	mChangedFiles.clear();
+	mFileWatcher.TakeChanges(mChangedFiles);
+	if (!mChangedFiles.empty())
+		mAssetReloader.Invalidate(mChangedFiles);
+}
+
+void ShapesApp::ApplyHotReloads()
+{
+	// The frame's draws are recorded already and still use what the rebuilds replace,
+	// which is why that is retired rather than released.
+	if (mAssetReloader.Apply() == 0)
+		return;
+
+	TrackMemory();
+
+	auto stats = mAssetReloader.GetStats();
+	std::ostringstream oss;
+	oss << "Hot reload: " << stats.Applied << " rebuilds applied, " << stats.Failed << " failed, "
+		<< stats.BuildSeconds * 1000.0 << " ms rebuilding, " << mRetiredObjects.size() << " objects retired\n";
+	OutputDebugStringA(oss.str().c_str());
+}
+
+void ShapesApp::BuildHotReload()
+{
+	// The shaders are one artifact: a change to a file some program reads compiles just
+	// the programs that read it, then rebuilds every pipeline from the shaders, which
+	// the pipeline cache mostly has already.
+	std::vector<std::string> shaderSources;
+	for (std::uint32_t id = 0; id < mShaderPermutations.ProgramCount(); ++id)
+	{
+		auto files = mShaderCache->SourceFiles(mShaderPermutations.GetProgram(id).SourcePath);
+		shaderSources.insert(shaderSources.end(), files.begin(), files.end());
+	}
+	mShaderArtifact = mAssetReloader.Add("shaders", shaderSources,
+		[this](const std::vector<std::string>& changed) { return ReloadShaders(changed); });
+
+	// Textures loaded from a file of their own; the atlas and the environment cube are
+	// built at startup and are not reloaded.
+	for (const auto& tex : mTextures)
+	{
+		const std::wstring& filename = tex.second->Filename;
+		if (mTextureSrvSlots.count(tex.first) == 0 || filename.size() < 4 ||
+			filename.compare(filename.size() - 4, 4, L".dds") != 0)
+			continue;
+
+		int length = WideCharToMultiByte(CP_ACP, 0, filename.c_str(), (int)filename.size(), nullptr, 0, nullptr, nullptr);
+		std::string path(length, '\0');
+		WideCharToMultiByte(CP_ACP, 0, filename.c_str(), (int)filename.size(), &path[0], length, nullptr, nullptr);
+
+		std::string name = tex.first;
+		mAssetReloader.Add(name, { path },
+			[this, name, path](const std::vector<std::string>&) { return ReloadTexture(name, path); });
+	}
+
+	mAssetReloader.Add("maze", { gMazePath },
+		[this](const std::vector<std::string>&) { return ReloadMaze(); });
+
+	for (const std::string& directory : mAssetReloader.Directories())
+	{
+		if (!mFileWatcher.Watch(directory))
+			OutputDebugStringA(("Hot reload: cannot watch " + directory + "\n").c_str());
+	}
+
+	mFileWatcher.Start();
+	mAssetReloader.Start();
+}
+
+AssetReloader::ApplyFn ShapesApp::ReloadShaders(const std::vector<std::string>& changedFiles)
+{
+	// Runs on the reloader's thread, which is the only one to use the shader and pipeline
+	// caches once initialization is done.
+	std::vector<std::uint32_t> programs;
+	std::vector<std::string> sources;
+	for (std::uint32_t id = 0; id < mShaderPermutations.ProgramCount(); ++id)
+	{
+		bool changed = false;
+		for (const std::string& file : mShaderCache->SourceFiles(mShaderPermutations.GetProgram(id).SourcePath))
+		{
+			std::string normalized = FileWatcher::NormalizePath(file);
+			if (std::find(changedFiles.begin(), changedFiles.end(), normalized) != changedFiles.end())
+				changed = true;
+			sources.push_back(normalized);
+		}
+		if (changed)
+			programs.push_back(id);
+	}
+
+	// An edited include may have dropped or added files; the artifact's list follows.
+	if (programs.empty())
+		return [this, sources] { mAssetReloader.SetFiles(mShaderArtifact, sources); };
+
+	std::string errors;
+	if (!mShaderPermutations.Compile(*mShaderCache, programs, mShaderPreprocess, &errors))
+	{
+		OutputDebugStringA(("Hot reload: shaders failed to compile, the previous ones stay\n" + errors).c_str());
+		return nullptr;
+	}
+
+	if (mShaderCache->IsDirty())
+		mShaderCache->Flush();
+
+	std::unordered_map<std::string, ComPtr<ID3DBlob>> shaders;
+	for (const ShaderVariantName& variant : gShaderVariants)
+		shaders[variant.Name] = GetShaderVariant(variant.Program, variant.Mask);
+
+	std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> psos;
+	std::vector<std::uint64_t> keys;
+	bool failed = false;
+	for (const auto& p : RequestPSOs(shaders))
+	{
+		psos[p.first] = mPipelineCache->Find(p.second);
+		keys.push_back(p.second);
+		failed = failed || psos[p.first] == nullptr;
+	}
+
+	mPipelineCache->Flush();
+
+	// The cache keeps only the pipelines in use, so a reload does not leave a full set
+	// behind, and the failed ones are created again by the next reload.
+	if (failed)
+	{
+		mPipelineCache->Evict(mPipelineKeys);
+		OutputDebugStringA("Hot reload: pipelines failed to build, the previous ones stay\n");
+		return nullptr;
+	}
+	mPipelineCache->Evict(keys);
+	mPipelineKeys = keys;
+
+	std::size_t programCount = programs.size();
+	return [this, shaders, psos, sources, programCount]
+	{
+		// The pipelines replaced here stay alive for the frames in flight.
+		for (const auto& p : psos)
+		{
+			auto it = mPSOs.find(p.first);
+			if (it != mPSOs.end() && it->second != p.second)
+				Retire(it->second);
+			mPSOs[p.first] = p.second;
+		}
+		mShaders = shaders;
+		mAssetReloader.SetFiles(mShaderArtifact, sources);
+
+		std::ostringstream oss;
+		oss << "Hot reload: " << programCount << " shader programs compiled, " << psos.size() << " pipelines rebuilt\n";
+		OutputDebugStringA(oss.str().c_str());
+	};
+}
+
+AssetReloader::ApplyFn ShapesApp::ReloadTexture(const std::string& name, const std::string& path)
+{
+	// The file is read here; the texture is created and its upload recorded at the frame
+	// boundary, into the frame's command list.
+	std::ifstream fin(path, std::ios::binary);
+	if (!fin)
+	{
+		OutputDebugStringA(("Hot reload: cannot open " + path + "\n").c_str());
+		return nullptr;
+	}
+
+	auto data = std::make_shared<std::vector<std::uint8_t>>(
+		(std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+	if (data->size() < 4 || memcmp(data->data(), "DDS ", 4) != 0)
+	{
+		OutputDebugStringA(("Hot reload: " + path + " is not a DDS file\n").c_str());
+		return nullptr;
+	}
+
+	return [this, name, path, data]
+	{
+		if (mFreeSrvSlots.empty())
+		{
+			OutputDebugStringA(("Hot reload: no free SRV slot, " + name + " keeps its old texture\n").c_str());
+			return;
+		}
+
+		// Only the mips the texture has resident now are created.
+		ComPtr<ID3D12Resource> resource;
+		ComPtr<ID3D12Resource> uploadHeap;
+		if (FAILED(DirectX::CreateDDSTextureFromMemory12(md3dDevice.Get(), mCommandBackend->CurrentList(),
+			data->data(), data->size(), resource, uploadHeap, TextureMaxSize(name))))
+		{
+			OutputDebugStringA(("Hot reload: cannot create a texture from " + path + ", the old one stays\n").c_str());
+			return;
+		}
+
+		ReplaceTexture(name, resource, uploadHeap);
+		OutputDebugStringA(("Hot reload: " + name + " from " + path + "\n").c_str());
+	};
+}
+
+void ShapesApp::ReplaceTexture(const std::string& name, ComPtr<ID3D12Resource> resource, ComPtr<ID3D12Resource> uploadHeap)
+{
+	// The new texture gets a slot of its own, so the frames in flight keep sampling the old
+	// one through the old slot.  The caller makes sure a slot is free.
+	UINT oldSlot = mTextureSrvSlots.at(name);
+	UINT newSlot = mFreeSrvSlots.back();
+	mFreeSrvSlots.pop_back();
+	CreateTextureSrv(name, resource.Get(), newSlot);
+
+	for (auto& mat : mMaterials)
+	{
+		if (mat.second->DiffuseSrvHeapIndex == (int)oldSlot)
+			mat.second->DiffuseSrvHeapIndex = (int)newSlot;
+	}
+
+	if (newSlot >= mSrvResidencyIds.size())
+		mSrvResidencyIds.resize(newSlot + 1);
+	mSrvResidencyIds[newSlot] = mSrvResidencyIds[oldSlot];
+	mTextureSrvSlots[name] = newSlot;
+
+	Texture& texture = *mTextures.at(name);
+	Retire(texture.Resource, oldSlot);
+	Retire(uploadHeap);
+	texture.Resource = resource;
+	texture.UploadHeap = nullptr;
+}
+
+UINT ShapesApp::TextureMaxSize(const std::string& name)const
+{
+	// The loader skips the mips larger than this, so the texture starts at its resident mip.
+	const std::uint32_t id = mSrvResidencyIds[mTextureSrvSlots.at(name)];
+	const std::uint32_t mip = mTextureResidency->ResidentMip(id);
+	return MathHelper::Max(MathHelper::Max(mTextureResidency->Width(id) >> mip, mTextureResidency->Height(id) >> mip), 1u);
+}
+
+AssetReloader::ApplyFn ShapesApp::ReloadMaze()
+{
+	auto maze = std::make_shared<MazeData>();
+	std::string error;
+	if (!LoadMaze(gMazePath, *maze, error))
+	{
+		OutputDebugStringA(("Hot reload: " + error + ", the maze stays as it was\n").c_str());
+		return nullptr;
+	}
+
+	// The walls' geometry, colliders and segments change; the baked lighting, the shrubs
+	// kept out of the corridors and the wall lamps stay as they were cooked.
+	return [this, maze]
+	{
+		const UINT vbByteSize = (UINT)maze->Vertices.size() * sizeof(Vertex);
+		const UINT ibByteSize = (UINT)maze->Indices.size() * sizeof(std::uint16_t);
+
+		auto geo = std::make_unique<MeshGeometry>();
+		geo->Name = "mazeGeo";
+
+		ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
+		CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), maze->Vertices.data(), vbByteSize);
+
+		ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+		CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), maze->Indices.data(), ibByteSize);
+
+		geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(), mCommandBackend->CurrentList(),
+			maze->Vertices.data(), vbByteSize, geo->VertexBufferUploader);
+		geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(), mCommandBackend->CurrentList(),
+			maze->Indices.data(), ibByteSize, geo->IndexBufferUploader);
+
+		geo->VertexByteStride = sizeof(Vertex);
+		geo->VertexBufferByteSize = vbByteSize;
+		geo->IndexFormat = DXGI_FORMAT_R16_UINT;
+		geo->IndexBufferByteSize = ibByteSize;
+
+		XMVECTOR vMin = XMVectorReplicate(+MathHelper::Infinity);
+		XMVECTOR vMax = XMVectorReplicate(-MathHelper::Infinity);
+		for (const Vertex& v : maze->Vertices)
+		{
+			XMVECTOR p = XMLoadFloat3(&v.Pos);
+			vMin = XMVectorMin(vMin, p);
+			vMax = XMVectorMax(vMax, p);
+		}
+
+		SubmeshGeometry submesh;
+		submesh.IndexCount = (UINT)maze->Indices.size();
+		submesh.StartIndexLocation = 0;
+		submesh.BaseVertexLocation = 0;
+		BoundingBox::CreateFromPoints(submesh.Bounds, vMin, vMax);
+		geo->DrawArgs["walls"] = submesh;
+
+		Retire(geo->VertexBufferUploader);
+		Retire(geo->IndexBufferUploader);
+		geo->DisposeUploaders();
+
+		std::unique_ptr<MeshGeometry>& current = mGeometries["mazeGeo"];
+		if (current != nullptr)
+		{
+			Retire(current->VertexBufferGPU);
+			Retire(current->IndexBufferGPU);
+		}
+
+		if (RenderMeshComponent* mesh = mEntities.Get<RenderMeshComponent>(mMazeEntity))
+		{
+			mesh->Geo = geo.get();
+			mesh->IndexCount = submesh.IndexCount;
+			mesh->StartIndexLocation = 0;
+			mesh->BaseVertexLocation = 0;
+			mesh->BakedLightingOffset = ~0u;
+			mEntities.Get<BoundsComponent>(mMazeEntity)->Local = submesh.Bounds;
+			mEntities.Get<TransformComponent>(mMazeEntity)->NumFramesDirty = gNumFrameResources;
+		}
+		current = std::move(geo);
+
+		// Colliders are spawned and destroyed outside the query.
+		std::vector<EntityWorld::Entity> colliders;
+		mEntities.ForEach<ColliderComponent>([&](EntityWorld::Entity entity, ColliderComponent&)
+		{
+			colliders.push_back(entity);
+		});
+		for (EntityWorld::Entity entity : colliders)
+			mEntities.Destroy(entity);
+
+		for (const auto& packed : maze->Colliders)
+		{
+			ColliderComponent collider;
+			collider.Box = BoundingBox(XMFLOAT3(packed.Center), XMFLOAT3(packed.Extents));
+			mEntities.Spawn(collider);
+		}
+
+		mMazeWallSegments.clear();
+		for (const auto& segment : maze->Segments)
+			mMazeWallSegments.push_back(XMFLOAT4(segment.X0, segment.Z0, segment.X1, segment.Z1));
+
+		std::ostringstream oss;
+		oss << "Hot reload: maze with " << maze->Segments.size() << " walls\n";
+		OutputDebugStringA(oss.str().c_str());
+	};
+}
+
+void ShapesApp::Retire(ComPtr<ID3D12Pageable> object, UINT srvSlot)
+{
+	// The frame being recorded signals the next fence.
+	RetiredObject retired;
+	retired.Object = object;
+	retired.SrvSlot = srvSlot;
+	retired.Fence = mCurrentFence + 1;
+	mRetiredObjects.push_back(retired);
+}
+
+void ShapesApp::LoadTextures()
+{
+	auto stoneTex = std::make_unique<Texture>();
+	stoneTex->Name = "stoneTex";
+	stoneTex->Filename = L"../../Textures/stone.dds";
+	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+		mCommandList.Get(), stoneTex->Filename.c_str(),
+		stoneTex->Resource, stoneTex->UploadHeap));
+
+	auto darkStoneTex = std::make_unique<Texture>();
+	darkStoneTex->Name = "darkStoneTex";
+	darkStoneTex->Filename = L"../../Textures/stone.dds";
+	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+		mCommandList.Get(), darkStoneTex->Filename.c_str(),
+		darkStoneTex->Resource, darkStoneTex->UploadHeap));
+
+	auto brickTex = std::make_unique<Texture>();
+	brickTex->Name = "brickTex";
+	brickTex->Filename = L"../../Textures/bricks.dds";
+	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+		mCommandList.Get(), brickTex->Filename.c_str(),
+		brickTex->Resource, brickTex->UploadHeap));
+
+	auto roofTex = std::make_unique<Texture>();
+	roofTex->Name = "roofTex";
+	roofTex->Filename = L"../../Textures/tile.dds";
+	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+		mCommandList.Get(), roofTex->Filename.c_str(),
+		roofTex->Resource, roofTex->UploadHeap));
+
+	auto goldTex = std::make_unique<Texture>();
+	goldTex->Name = "goldTex";
+	goldTex->Filename = L"../../Textures/bricks.dds";
+	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+		mCommandList.Get(), goldTex->Filename.c_str(),
+		goldTex->Resource, goldTex->UploadHeap));
+
+	auto waterTex = std::make_unique<Texture>();
+	waterTex->Name = "waterTex";
+	waterTex->Filename = L"../../Textures/water1.dds";
+	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+		mCommandList.Get(), waterTex->Filename.c_str(),
+		waterTex->Resource, waterTex->UploadHeap));
+
+	auto treeArrayTex = std::make_unique<Texture>();
+	treeArrayTex->Name = "treeArrayTex";
+	treeArrayTex->Filename = L"../../Textures/treeArray2.dds";
+	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+		mCommandList.Get(), treeArrayTex->Filename.c_str(),
+		treeArrayTex->Resource, treeArrayTex->UploadHeap));
+
+
+	mTextures[stoneTex->Name] = std::move(stoneTex);
+	mTextures[darkStoneTex->Name] = std::move(darkStoneTex);
+	mTextures[brickTex->Name] = std::move(brickTex);
+	mTextures[roofTex->Name] = std::move(roofTex);
+	mTextures[goldTex->Name] = std::move(goldTex);
+	mTextures[treeArrayTex->Name] = std::move(treeArrayTex);
+	mTextures["waterTex"] = std::move(waterTex);
+
+	// Flags and the white fill texture are tiny; pack them into one atlas so they
+	// share a single resource and descriptor.
+	mPropAtlas = std::make_unique<TextureAtlas>(2048, 2, 1);
+
+	std::unordered_map<std::string, const Texture*> atlasResources;
+	for (const auto& src : gPropAtlasSources)
+	{
+		auto tex = std::make_unique<Texture>();
+		tex->Name = src.first;
+		tex->Filename = AnsiToWString(src.second);
+		ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+			mCommandList.Get(), tex->Filename.c_str(),
+			tex->Resource, tex->UploadHeap));
+
+		auto desc = tex->Resource->GetDesc();
+		mPropAtlas->Add(tex->Name, (UINT)desc.Width, desc.Height);
+
+		atlasResources[tex->Name] = tex.get();
+		mAtlasSourceTextures[tex->Name] = std::move(tex);
+	}
+
+	if (!mPropAtlas->Pack())
+	{
+		::OutputDebugStringA("Prop textures do not fit in the atlas.\n");
+		ThrowIfFailed(E_FAIL);
+	}
+
+	auto propAtlasTex = std::make_unique<Texture>();
+	propAtlasTex->Name = "propAtlasTex";
+	propAtlasTex->Filename = L"";
+	mPropAtlas->BuildResource(md3dDevice.Get(), mCommandList.Get(), atlasResources,
+		D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, propAtlasTex.get());
+	mTextures[propAtlasTex->Name] = std::move(propAtlasTex);
+
+	// SRV heap order.  Material::DiffuseSrvHeapIndex indexes into this list, or into the
+	// spare slots after it once a texture was reloaded.
+	mTextureSrvOrder =
+	{
+		"stoneTex",
+		"darkStoneTex",
+		"brickTex",
+		"roofTex",
+		"goldTex",
+		"treeArrayTex",
+		"waterTex",
+		"propAtlasTex"
+	};
+	mMaterialSrvCount = (UINT)mTextureSrvOrder.size();
+}
+
+
+void ShapesApp::BuildEnvironmentLighting()
+{
+	EnvironmentLighting::Settings settings;
+	if (!mEnvironment.Build(gSkyCubemapPath, gEnvironmentCachePath, settings))
+		ThrowIfFailed(HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND));
+
+	std::ostringstream oss;
+	oss << "Environment lighting: ";
+	if (mEnvironment.LoadedFromCache())
+		oss << "loaded from cache\n";
+	else
+		oss << "computed from " << gSkyCubemapPath << "\n";
+	OutputDebugStringA(oss.str().c_str());
+
+	// Diffuse ambient: the SH, and their average for anything that wants a flat term.
+	const auto& sh = mEnvironment.Irradiance();
+	for (int i = 0; i < 9; ++i)
+		mMainPassCB.AmbientSH[i] = XMFLOAT4(sh.Coeffs[i][0], sh.Coeffs[i][1], sh.Coeffs[i][2], 0.0f);
+
+	const float band0 = 0.282095f;
+	mMainPassCB.AmbientLight = XMFLOAT4(sh.Coeffs[0][0] * band0, sh.Coeffs[0][1] * band0, sh.Coeffs[0][2] * band0, 1.0f);
+}
+
+void ShapesApp::UploadEnvironmentLighting()
+{
+	// Specular: a half float cube with the prefiltered mips.
+	UINT size = mEnvironment.SpecularSize();
+	UINT mips = mEnvironment.SpecularMips();
+
+	auto envTex = std::make_unique<Texture>();
+	envTex->Name = "skyEnvTex";
+	envTex->Filename = AnsiToWString(gEnvironmentCachePath);
+
+	auto defaultHeap = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+	auto texDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R16G16B16A16_FLOAT, size, size, 6, (UINT16)mips);
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&defaultHeap,
+		D3D12_HEAP_FLAG_NONE,
+		&texDesc,
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		nullptr,
+		IID_PPV_ARGS(envTex->Resource.GetAddressOf())));
+
+	std::vector<D3D12_SUBRESOURCE_DATA> subresources(6 * mips);
+	for (UINT face = 0; face < 6; ++face)
+	{
+		for (UINT mip = 0; mip < mips; ++mip)
+		{
+			UINT mipSize = MathHelper::Max(size >> mip, 1u);
+			D3D12_SUBRESOURCE_DATA& data = subresources[face * mips + mip];
+			data.pData = mEnvironment.SpecularTexels(face, mip);
+			data.RowPitch = (LONG_PTR)mipSize * 4 * sizeof(std::uint16_t);
+			data.SlicePitch = data.RowPitch * mipSize;
+		}
+	}
+
+	UINT64 uploadSize = GetRequiredIntermediateSize(envTex->Resource.Get(), 0, (UINT)subresources.size());
+	auto uploadHeap = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
+	auto uploadDesc = CD3DX12_RESOURCE_DESC::Buffer(uploadSize);
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&uploadHeap,
+		D3D12_HEAP_FLAG_NONE,
+		&uploadDesc,
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(envTex->UploadHeap.GetAddressOf())));
+
+	UpdateSubresources(mCommandList.Get(), envTex->Resource.Get(), envTex->UploadHeap.Get(),
+		0, 0, (UINT)subresources.size(), subresources.data());
+
+	auto toShader = CD3DX12_RESOURCE_BARRIER::Transition(envTex->Resource.Get(),
+		D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	mCommandList->ResourceBarrier(1, &toShader);
+
+	mMainPassCB.SpecularEnvMaxMip = (float)(mips - 1);
+
+	mEnvironmentSrvIndex = (UINT)mTextureSrvOrder.size();
+	mTextureSrvOrder.push_back(envTex->Name);
+	mTextures[envTex->Name] = std::move(envTex);
+}
+
+void ShapesApp::BuildDescriptorHeaps()
+{
+	// Create the SRV heap, with spare slots for textures that are reloaded and, last, the
+	// ground virtual texture's page cache and page table.
+	D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
+	srvHeapDesc.NumDescriptors = (UINT)mTextures.size() + gReloadSrvSlots + 2;
+	srvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+	srvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&srvHeapDesc, IID_PPV_ARGS(&mSrvDescriptorHeap)));
+
+	// Fill out the heap with actual descriptors.
+	for (UINT slot = 0; slot < (UINT)mTextureSrvOrder.size(); ++slot)
+	{
+		const std::string& texName = mTextureSrvOrder[slot];
+		CreateTextureSrv(texName, mTextures.at(texName)->Resource.Get(), slot);
+		mTextureSrvSlots[texName] = slot;
+	}
+
+	mGroundVirtualTextureSrvIndex = srvHeapDesc.NumDescriptors - 2;
+	for (UINT slot = (UINT)mTextureSrvOrder.size(); slot < mGroundVirtualTextureSrvIndex; ++slot)
+		mFreeSrvSlots.push_back(slot);
+
+	// Null views when the ground is not paged, so the table is always valid to bind.
+	CD3DX12_CPU_DESCRIPTOR_HANDLE hDescriptor(mSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart());
+	hDescriptor.Offset(mGroundVirtualTextureSrvIndex, mCbvSrvDescriptorSize);
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Format = DXGI_FORMAT_BC1_UNORM;
+	srvDesc.Texture2D.MipLevels = 1;
+	md3dDevice->CreateShaderResourceView(mGroundPageCache.Get(), &srvDesc, hDescriptor);
+
+	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+	srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UINT;
+	srvDesc.Texture2D.MipLevels = mGroundVirtualTexture ? mGroundVirtualTexture->MipCount() : 1;
+	md3dDevice->CreateShaderResourceView(mGroundPageTable.Get(), &srvDesc, hDescriptor);
+}
+
+void ShapesApp::CreateTextureSrv(const std::string& name, ID3D12Resource* texture, UINT slot)
+{
+	CD3DX12_CPU_DESCRIPTOR_HANDLE hDescriptor(mSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart());
+	hDescriptor.Offset(slot, mCbvSrvDescriptorSize);
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+
+	auto desc = texture->GetDesc();
+
+	// Check if this is the tree texture array
+	if (name == "treeArrayTex")
+	{
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+		srvDesc.Format = desc.Format;
+		srvDesc.Texture2DArray.MostDetailedMip = 0;
+		srvDesc.Texture2DArray.MipLevels = -1;
+		srvDesc.Texture2DArray.FirstArraySlice = 0;
+		srvDesc.Texture2DArray.ArraySize = desc.DepthOrArraySize;
+	}
+	else if (name == "skyEnvTex")
+	{
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURECUBE;
+		srvDesc.Format = desc.Format;
+		srvDesc.TextureCube.MostDetailedMip = 0;
+		srvDesc.TextureCube.MipLevels = desc.MipLevels;
+		srvDesc.TextureCube.ResourceMinLODClamp = 0.0f;
+	}
+	else
+	{
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Format = desc.Format;
+		srvDesc.Texture2D.MostDetailedMip = 0;
+		srvDesc.Texture2D.MipLevels = desc.MipLevels;
+		srvDesc.Texture2D.ResourceMinLODClamp = 0.0f;
+	}
+
+	md3dDevice->CreateShaderResourceView(texture, &srvDesc, hDescriptor);
+}
+
+void ShapesApp::BuildTextureResidency()
+{
+	mTextureResidency = std::make_unique<TextureResidency>(mTextureBudgetBytes);
+	mSrvResidencyIds.clear();
+	mTextureFirstMips.clear();
+
+	for (const auto& texName : mTextureSrvOrder)
+	{
+		auto desc = mTextures.at(texName)->Resource->GetDesc();
+
+		bool blockCompressed = false;
+		UINT bitsPerPixel = 32;
+		switch (desc.Format)
+		{
+		case DXGI_FORMAT_BC1_UNORM:
+		case DXGI_FORMAT_BC1_UNORM_SRGB:
+		case DXGI_FORMAT_BC4_UNORM:
+			blockCompressed = true;
+			bitsPerPixel = 4;
+			break;
+		case DXGI_FORMAT_BC2_UNORM:
+		case DXGI_FORMAT_BC2_UNORM_SRGB:
+		case DXGI_FORMAT_BC3_UNORM:
+		case DXGI_FORMAT_BC3_UNORM_SRGB:
+		case DXGI_FORMAT_BC5_UNORM:
+		case DXGI_FORMAT_BC7_UNORM:
+		case DXGI_FORMAT_BC7_UNORM_SRGB:
+			blockCompressed = true;
+			bitsPerPixel = 8;
+			break;
+		case DXGI_FORMAT_R16G16B16A16_FLOAT:
+			bitsPerPixel = 64;
+			break;
+		default:
+			break;
+		}
+
+		std::uint32_t id = mTextureResidency->Register(texName,
+			(std::uint32_t)desc.Width, desc.Height, desc.MipLevels, desc.DepthOrArraySize,
+			bitsPerPixel, blockCompressed);
+		mSrvResidencyIds.push_back(id);
+		mTextureFirstMips.push_back(0);
+
+		// Only a DDS file of its own can be read back from a lower mip; the atlas and the
+		// prefiltered environment keep all their mips.
+		const std::wstring& file = mTextures.at(texName)->Filename;
+		if (file.size() < 4 || file.compare(file.size() - 4, 4, L".dds") != 0)
+			mTextureResidency->SetPinned(id, true);
+	}
+}
+
+std::uint32_t ShapesApp::GroundTexel(std::uint32_t x, std::uint32_t y)
+{
+	// Grass with patches of dirt: value noise at a few octaves, plus per-texel grain.
+	auto lattice = [](std::uint32_t i, std::uint32_t j)
+	{
+		std::uint32_t h = i * 73856093u ^ j * 19349663u;
+		h ^= h >> 13;
+		h *= 0x5bd1e995u;
+		h ^= h >> 15;
+		return (float)(h & 0xFFFF) / 65535.0f;
+	};
+	auto noise = [&lattice](float u, float v)
+	{
+		std::uint32_t i = (std::uint32_t)u, j = (std::uint32_t)v;
+		float fu = u - (float)i, fv = v - (float)j;
+		float top = MathHelper::Lerp(lattice(i, j), lattice(i + 1, j), fu);
+		float bottom = MathHelper::Lerp(lattice(i, j + 1), lattice(i + 1, j + 1), fu);
+		return MathHelper::Lerp(top, bottom, fv);
+	};
+
+	float patches = 0.0f, amplitude = 0.5f, scale = 1.0f / 512.0f;
+	for (int octave = 0; octave < 4; ++octave, amplitude *= 0.5f, scale *= 2.0f)
+		patches += amplitude * noise((float)x * scale, (float)y * scale);
+	float dirt = MathHelper::Clamp((patches - 0.45f) * 6.0f, 0.0f, 1.0f);
+	float grain = 0.85f + 0.3f * lattice(x, y);
+
+	const float grass[3] = { 70.0f, 120.0f, 40.0f };
+	const float soil[3] = { 115.0f, 85.0f, 55.0f };
+	std::uint32_t rgba = 0xFF000000u;
+	for (int c = 0; c < 3; ++c)
+	{
+		float value = MathHelper::Lerp(grass[c], soil[c], dirt) * grain;
+		rgba |= (std::uint32_t)MathHelper::Clamp(value, 0.0f, 255.0f) << (8 * c);
+	}
+	return rgba;
+}
+
+void ShapesApp::BuildGroundVirtualTexture()
+{
+	// 8K x 8K virtual texels over the 80x80 ground, cached in a 2K x 2K physical texture.
+	VirtualTexture::Desc desc;
+	desc.VirtualSize = 8192;
+	desc.PageSize = 128;
+	desc.BorderSize = 4;
+	desc.PhysicalPagesX = 16;
+	desc.PhysicalPagesY = 16;
+	desc.MaxLoadsPerFrame = 16;
+
+	// The page file is baked once, like the scene pack is cooked; this runs beside the rest
+	// of startup.  Delete it to bake again after changing GroundTexel.
+	const std::string path = gCacheDir + "GroundPages.vt";
+	auto matches = [&desc](const VirtualTextureBaker::PageFileHeader& header)
+	{
+		return header.VirtualSize == desc.VirtualSize && header.PageSize == desc.PageSize &&
+			header.BorderSize == desc.BorderSize;
+	};
+	if (!mGroundPageFile.Open(path) || !matches(mGroundPageFile.Header()))
+	{
+		LARGE_INTEGER start, end, frequency;
+		QueryPerformanceCounter(&start);
+		bool baked = VirtualTextureBaker::Bake(desc, &GroundTexel, path) && mGroundPageFile.Open(path);
+		QueryPerformanceCounter(&end);
+		QueryPerformanceFrequency(&frequency);
+
+		std::ostringstream oss;
+		if (baked)
+			oss << "Ground VT: baked " << mGroundPageFile.Header().PageCount << " pages in "
+				<< 1000.0 * (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart << " ms\n";
+		else
+			oss << "Ground VT: could not bake " << path << ", the ground is not paged\n";
+		OutputDebugStringA(oss.str().c_str());
+		if (!baked)
+			return;
+	}
+
+	// BC1 pages with their borders, side by side.
+	const UINT pageTexels = desc.PageSize + 2 * desc.BorderSize;
+	auto defaultHeap = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+	auto cacheDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_BC1_UNORM,
+		desc.PhysicalPagesX * pageTexels, desc.PhysicalPagesY * pageTexels, 1, 1);
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(&defaultHeap, D3D12_HEAP_FLAG_NONE, &cacheDesc,
+		D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, nullptr, IID_PPV_ARGS(&mGroundPageCache)));
+
+	mGroundPageFootprint.Footprint.Format = DXGI_FORMAT_BC1_UNORM;
+	mGroundPageFootprint.Footprint.Width = pageTexels;
+	mGroundPageFootprint.Footprint.Height = pageTexels;
+	mGroundPageFootprint.Footprint.Depth = 1;
+	mGroundPageFootprint.Footprint.RowPitch = (pageTexels / 4 * 8 + D3D12_TEXTURE_DATA_PITCH_ALIGNMENT - 1) /
+		D3D12_TEXTURE_DATA_PITCH_ALIGNMENT * D3D12_TEXTURE_DATA_PITCH_ALIGNMENT;
+	mGroundPageUploadStride = ((UINT64)mGroundPageFootprint.Footprint.RowPitch * (pageTexels / 4) +
+		D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT - 1) / D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT * D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT;
+
+	mGroundVirtualTexture = std::make_unique<VirtualTexture>(desc);
+
+	// The page table as a texture the pixel shader looks pages up in: one texel per page
+	// and one mip per virtual mip.  Its contents go up with the first frame.
+	const UINT pagesWide = mGroundVirtualTexture->PagesWide(0);
+	const UINT mipCount = mGroundVirtualTexture->MipCount();
+	auto tableDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UINT, pagesWide, pagesWide, 1, (UINT16)mipCount);
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(&defaultHeap, D3D12_HEAP_FLAG_NONE, &tableDesc,
+		D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, nullptr, IID_PPV_ARGS(&mGroundPageTable)));
+
+	mGroundPageTableFootprints.resize(mipCount);
+	md3dDevice->GetCopyableFootprints(&tableDesc, 0, mipCount, 0, mGroundPageTableFootprints.data(),
+		nullptr, nullptr, &mGroundPageTableBytes);
+	mGroundPageTableDirty = true;
+
+	mMainPassCB.GroundVirtualPlane = XMFLOAT4(-0.5f * gGroundSize, -0.5f * gGroundSize, 1.0f / gGroundSize, (float)mipCount);
+	mMainPassCB.GroundVirtualPages = XMFLOAT4((float)pagesWide, (float)desc.PageSize, (float)desc.BorderSize, (float)pageTexels);
+}
+
+void ShapesApp::BuildRootSignature()
+{
+	CD3DX12_DESCRIPTOR_RANGE texTable;
+	texTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0); // register t0
+
+	// Root parameter can be a table, root descriptor or root constants.
+	CD3DX12_DESCRIPTOR_RANGE envTable;
+	envTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 5); // register t5
+
+	CD3DX12_DESCRIPTOR_RANGE virtualTextureTable;
+	virtualTextureTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 2, 6); // registers t6, t7
+
+	CD3DX12_ROOT_PARAMETER slotRootParameter[11];
+
+	// Perfomance TIP: Order from most frequent to least frequent.
+	slotRootParameter[0].InitAsDescriptorTable(1, &texTable, D3D12_SHADER_VISIBILITY_PIXEL);
+	slotRootParameter[1].InitAsConstantBufferView(0); // register b0 (ObjectCB)
+	slotRootParameter[2].InitAsConstantBufferView(1); // register b1 (PassCB)
+	slotRootParameter[3].InitAsConstantBufferView(2); // register b2 (MaterialCB)
+	slotRootParameter[4].InitAsShaderResourceView(1, 0, D3D12_SHADER_VISIBILITY_PIXEL); // register t1 (scene lights)
+	slotRootParameter[5].InitAsShaderResourceView(2, 0, D3D12_SHADER_VISIBILITY_PIXEL); // register t2 (cluster ranges)
+	slotRootParameter[6].InitAsShaderResourceView(3, 0, D3D12_SHADER_VISIBILITY_PIXEL); // register t3 (cluster light indices)
+	slotRootParameter[7].InitAsShaderResourceView(4, 0, D3D12_SHADER_VISIBILITY_VERTEX); // register t4 (baked lighting)
+	slotRootParameter[8].InitAsDescriptorTable(1, &envTable, D3D12_SHADER_VISIBILITY_PIXEL); // register t5 (specular environment)
+	slotRootParameter[9].InitAsConstants(2, 3); // register b3 (DrawConstants)
+	slotRootParameter[10].InitAsDescriptorTable(1, &virtualTextureTable, D3D12_SHADER_VISIBILITY_PIXEL); // ground page cache and table
+
+	auto staticSamplers = GetStaticSamplers();
+
+	// A root signature is an array of root parameters.
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(11, slotRootParameter,
+		(UINT)staticSamplers.size(), staticSamplers.data(),
+		D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+
+	// create a root signature with a single slot which points to a descriptor range consisting of a single constant buffer
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if (errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
+
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mRootSignature.GetAddressOf())));
+
+	mPipelineCache->RegisterRootSignature(mRootSignature.Get(), serializedRootSig.Get());
+}
+
+ComPtr<ID3DBlob> ShapesApp::GetShaderVariant(const std::string& program, std::uint32_t mask)
+{
+	const std::vector<std::uint8_t>* bytecode =
+		mShaderPermutations.Find(mShaderPermutations.FindProgram(program), mask);
+	if (bytecode == nullptr)
+		ThrowIfFailed(E_INVALIDARG);
+
+	ComPtr<ID3DBlob> blob;
+	ThrowIfFailed(D3DCreateBlob(bytecode->size(), blob.GetAddressOf()));
+	CopyMemory(blob->GetBufferPointer(), bytecode->data(), bytecode->size());
+	return blob;
+}
+
+void ShapesApp::BuildShadersAndInputLayout()
+{
+	// Only shaders whose source, includes or compile options changed since the last run
+	// are compiled; the rest come out of the bytecode cache.
+	auto compiler = [](const ShaderCompileRequest& request, std::vector<std::uint8_t>& bytecode, std::string& errors)
+	{
+		std::vector<D3D_SHADER_MACRO> macros;
+		for (const auto& d : request.Defines)
+			macros.push_back({ d.Name.c_str(), d.Value.c_str() });
+		macros.push_back({ NULL, NULL });
+
+		ComPtr<ID3DBlob> byteCode = nullptr;
+		ComPtr<ID3DBlob> errorBlob;
+		HRESULT hr = D3DCompileFromFile(AnsiToWString(request.SourcePath).c_str(), macros.data(),
+			D3D_COMPILE_STANDARD_FILE_INCLUDE, request.EntryPoint.c_str(), request.Target.c_str(),
+			request.Flags, 0, &byteCode, &errorBlob);
+
+		if (errorBlob != nullptr)
+			errors.assign((const char*)errorBlob->GetBufferPointer(), errorBlob->GetBufferSize());
+
+		if (FAILED(hr))
+			return false;
+
+		const std::uint8_t* data = (const std::uint8_t*)byteCode->GetBufferPointer();
+		bytecode.assign(data, data + byteCode->GetBufferSize());
+		return true;
+	};
+
+	// Variants are told apart by what the preprocessor makes of them, so defines that a
+	// program never reads do not cost an extra compile.  Hot reloads compile with it too.
+	mShaderPreprocess = [](const ShaderCompileRequest& request, std::string& preprocessed)
+	{
+		std::string source;
+		if (!ShaderCache::ReadFileDefault(request.SourcePath, source))
+			return false;
+
+		std::vector<D3D_SHADER_MACRO> macros;
+		for (const auto& d : request.Defines)
+			macros.push_back({ d.Name.c_str(), d.Value.c_str() });
+		macros.push_back({ NULL, NULL });
+
+		ComPtr<ID3DBlob> text;
+		ComPtr<ID3DBlob> errorBlob;
+		HRESULT hr = D3DPreprocess(source.data(), source.size(), request.SourcePath.c_str(), macros.data(),
+			D3D_COMPILE_STANDARD_FILE_INCLUDE, &text, &errorBlob);
+		if (FAILED(hr))
+			return false;
+
+		preprocessed.assign((const char*)text->GetBufferPointer(), text->GetBufferSize());
+		return true;
+	};
+
+	mShaderCache = std::make_unique<ShaderCache>(gCacheDir + "ShaderCache.bin", compiler);
+	mShaderCache->Load();
+
+	UINT compileFlags = 0;
+#if defined(DEBUG) || defined(_DEBUG)  
+	compileFlags = D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#endif
+
+	// Permutation manifest.  Each feature is one bit of the variant mask; only the
+	// variants listed are built.
+	const ShaderFeature pointLights = { "NUM_POINT_LIGHTS", "4", "0", true };
+	const ShaderFeature alphaTest = { "ALPHA_TEST" };
+	const ShaderFeature fog = { "FOG" };
+	const ShaderFeature clusteredLights = { "CLUSTERED_LIGHTS" };
+	const ShaderFeature objectLights = { "OBJECT_LIGHTS" };
+	const ShaderFeature lodFade = { "LOD_FADE" };
+	const ShaderFeature virtualTexture = { "VIRTUAL_TEXTURE" };
+
+	mShaderPermutations.AddProgram({ "standardVS", "Shaders\\Default.hlsl", "VS", "vs_5_0", compileFlags, {}, {} });
+	mShaderPermutations.AddProgram({ "opaquePS", "Shaders\\Default.hlsl", "PS", "ps_5_0", compileFlags,
+		{ pointLights, clusteredLights, objectLights, lodFade, virtualTexture }, { 0x2, 0x4, 0xA, 0x12 } });
+	mShaderPermutations.AddProgram({ "treeSpriteVS", "Shaders\\TreeSprite.hlsl", "VS", "vs_5_0", compileFlags, {}, {} });
+	mShaderPermutations.AddProgram({ "treeSpriteGS", "Shaders\\TreeSprite.hlsl", "GS", "gs_5_0", compileFlags, {}, {} });
+	// The pass constants do not carry the fog parameters yet, so only the alpha tested
+	// variant is built.
+	mShaderPermutations.AddProgram({ "treeSpritePS", "Shaders\\TreeSprite.hlsl", "PS", "ps_5_0", compileFlags,
+		{ alphaTest, fog }, { 0x1 } });
+	mShaderPermutations.AddProgram({ "treeQuadVS", "Shaders\\TreeSprite.hlsl", "QuadVS", "vs_5_0", compileFlags, {}, {} });
+	mShaderPermutations.AddProgram({ "treeQuadPS", "Shaders\\TreeSprite.hlsl", "QuadPS", "ps_5_0", compileFlags,
+		{ alphaTest, fog }, { 0x1 } });
+
+	std::string errors;
+	if (!mShaderPermutations.CompileAll(*mShaderCache, mShaderPreprocess, &errors))
+	{
+		OutputDebugStringA(errors.c_str());
+		ThrowIfFailed(E_FAIL);
+	}
+
+	if (mShaderCache->IsDirty())
+		mShaderCache->Flush();
+
+	const auto& stats = mShaderPermutations.GetStats();
+	std::ostringstream oss;
+	oss << "Shaders: " << stats.Variants << " variants, " << stats.UniqueSources << " unique, "
+		<< stats.CacheHits << " cached, " << stats.Compiled << " compiled\n";
+	OutputDebugStringA(oss.str().c_str());
+
+	for (const ShaderVariantName& variant : gShaderVariants)
+		mShaders[variant.Name] = GetShaderVariant(variant.Program, variant.Mask);
+
+	mInputLayout =
+	{
 		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
@@ -737,6 +2782,14 @@ void ShapesApp::BuildShadersAndInputLayout()
 		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 		{ "SIZE", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 	};
+
+	mTreeQuadInputLayout =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "SLICE", 0, DXGI_FORMAT_R32_UINT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 16, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
 }
 
 
@@ -745,7 +2798,7 @@ void ShapesApp::BuildShapeGeometry()
 	GeometryGenerator geoGen;
 
 	// CASTLE FOUNDATION AND BASE
-	GeometryGenerator::MeshData ground = geoGen.CreateGrid(80.0f, 80.0f, 60, 40);
+	GeometryGenerator::MeshData ground = geoGen.CreateGrid(gGroundSize, gGroundSize, 60, 40);
 	GeometryGenerator::MeshData keepFoundation = geoGen.CreateBox(20.0f, 2.0f, 15.0f, 0);
 	GeometryGenerator::MeshData keepBody = geoGen.CreateBox(10.0f, 30.0f, 12.0f, 0);
 
@@ -1038,6 +3091,33 @@ void ShapesApp::BuildShapeGeometry()
 	indices.insert(indices.end(), std::begin(gateColumn.GetIndices16()), std::end(gateColumn.GetIndices16()));
 	indices.insert(indices.end(), std::begin(gatehouse.GetIndices16()), std::end(gatehouse.GetIndices16()));
 
+	// Coarser levels of detail of the curved shapes, with fewer slices and stacks.  They
+	// are called <shape>_lod1, _lod2; the cook links them to the shape (see CookScenePack).
+	const std::pair<std::string, GeometryGenerator::MeshData> lods[] =
+	{
+		{ "torusRoof_lod1", geoGen.CreateTorus(3.2f, 2.5f, 12, 12) },
+		{ "torusRoof_lod2", geoGen.CreateTorus(3.2f, 2.5f, 6, 6) },
+		{ "keepConeRoof_lod1", geoGen.CreateCone(2.5f, 6.0f, 10, 3) },
+		{ "keepConeRoof_lod2", geoGen.CreateCone(2.5f, 6.0f, 6, 1) },
+		{ "gateColumn_lod1", geoGen.CreateCylinder(1.0f, 1.0f, 8.0f, 8, 1) },
+		{ "gateColumn_lod2", geoGen.CreateCylinder(1.0f, 1.0f, 8.0f, 5, 1) },
+	};
+
+	std::vector<std::pair<std::string, SubmeshGeometry>> lodSubmeshes;
+	for (const auto& lod : lods)
+	{
+		SubmeshGeometry submesh;
+		submesh.IndexCount = (UINT)lod.second.Indices32.size();
+		submesh.StartIndexLocation = (UINT)indices.size();
+		submesh.BaseVertexLocation = (INT)vertices.size();
+		lodSubmeshes.push_back({ lod.first, submesh });
+
+		for (const GeometryGenerator::Vertex& v : lod.second.Vertices)
+			vertices.push_back({ v.Position, v.Normal, v.TexC });
+		for (std::uint32_t index : lod.second.Indices32)
+			indices.push_back((std::uint16_t)index);
+	}
+
 	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
 	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
 
@@ -1050,12 +3130,6 @@ void ShapesApp::BuildShapeGeometry()
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
 	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
 	geo->VertexByteStride = sizeof(Vertex);
 	geo->VertexBufferByteSize = vbByteSize;
 	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
@@ -1076,6 +3150,8 @@ void ShapesApp::BuildShapeGeometry()
 	geo->DrawArgs["gableWedge"] = gableWedgeSubmesh;
 	geo->DrawArgs["gateColumn"] = gateColumnSubmesh;
 	geo->DrawArgs["gatehouse"] = gatehouseSubmesh;
+	for (const auto& lod : lodSubmeshes)
+		geo->DrawArgs[lod.first] = lod.second;
 
 	mGeometries[geo->Name] = std::move(geo);
 
@@ -1110,12 +3186,6 @@ void ShapesApp::BuildWaterGeometry()
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
 	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
 	geo->VertexByteStride = sizeof(Vertex);
 	geo->VertexBufferByteSize = vbByteSize;
 	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
@@ -1133,131 +3203,164 @@ void ShapesApp::BuildWaterGeometry()
 
 void ShapesApp::BuildTreeSpritesGeometry()
 {
-	struct TreeVertex
-	{
-		XMFLOAT3 Pos;
-		XMFLOAT2 Size;
-	};
-
-	// Create 30 trees randomly
-	/*const int treeCount = 30;
-	std::vector<TreeVertex> vertices(treeCount);*/
-
-	const int treesPerSide = 12;  // 12 trees on each side of the maze
-	const int treeCount = treesPerSide * 4;  // 48 trees total
+	// Scatter over the land (the ground grid and the strip around the maze), then keep
+	// the courtyard, both sets of walls and the paths between the gates clear.  Outside
+	// the mask is water.
+	FoliageScatter::DensityMask treeMask({ -40.0f, -40.0f, 40.0f, 96.0f }, 1.0f, 1.0f);
+	treeMask.FillRect({ -32.0f, -32.0f, 32.0f, 32.0f }, 0.0f);
+	treeMask.FillRect({ -37.0f, 38.0f, 37.0f, 92.0f }, 0.0f);
+	treeMask.FillRect({ -6.0f, 30.0f, 6.0f, 40.0f }, 0.0f);
+	treeMask.FillRect({ -6.0f, 90.0f, 6.0f, 96.0f }, 0.0f);
+
+	// Shrubs also grow, more sparsely, in the maze corridors.
+	FoliageScatter::DensityMask shrubMask({ -40.0f, -40.0f, 40.0f, 96.0f }, 0.5f, 1.0f);
+	shrubMask.FillRect({ -32.0f, -32.0f, 32.0f, 32.0f }, 0.0f);
+	shrubMask.FillRect({ -36.0f, 39.0f, 36.0f, 91.0f }, 0.35f);
+	shrubMask.FillRect({ -6.0f, 30.0f, 6.0f, 40.0f }, 0.0f);
+	for (const auto& wall : mMazeWallSegments)
+		shrubMask.FillSegment(wall.x, wall.y, wall.z, wall.w, 1.5f, 0.0f);
+
+	const float groundY = -0.5f;
+
+	FoliageScatter::Layer trees;
+	trees.MinDistance = 5.0f;
+	trees.GroundY = groundY;
+	trees.Seed = 1;
+	trees.Mask = &treeMask;
+
+	FoliageScatter::Layer shrubs;
+	shrubs.MinDistance = 1.5f;
+	shrubs.MinWidth = 1.5f;
+	shrubs.MaxWidth = 3.0f;
+	shrubs.MinHeight = 1.5f;
+	shrubs.MaxHeight = 3.0f;
+	shrubs.GroundY = groundY;
+	shrubs.Seed = 2;
+	shrubs.Mask = &shrubMask;
+
+	mFoliage.Clear();
+	mFoliage.Scatter(trees);
+	mFoliage.Scatter(shrubs);
+	mFoliage.BuildChunks(16.0f);
+
+	const auto& stats = mFoliage.GetStats();
+	std::ostringstream oss;
+	oss << "Foliage: " << stats.Instances << " of " << stats.Candidates << " samples in " << stats.Chunks
+		<< " chunks (at most " << stats.MaxPerChunk << " per chunk)\n";
+	OutputDebugStringA(oss.str().c_str());
+
+	// The instances are the point list itself; every chunk draws its own range of it.
+	typedef FoliageScatter::Instance TreeVertex;
+	const std::vector<TreeVertex>& vertices = mFoliage.Instances();
+
+	std::vector<std::uint32_t> indices(vertices.size());
+	for (std::uint32_t i = 0; i < (std::uint32_t)indices.size(); ++i)
+		indices[i] = i;
 
-	std::vector<TreeVertex> vertices(treeCount);
-
-	float groundY = -0.5f;
-	float treeY = groundY + 5.0f;
+	const UINT vbByteSize = (UINT)vertices.size() * sizeof(TreeVertex);
+	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint32_t);
 
-	int treeIndex = 0;
+	auto geo = std::make_unique<MeshGeometry>();
+	geo->Name = "treeGeo";
 
-	// TREES LEFT SIDE 
-	float leftX = -38.0f;
-	for (int i = 0; i < treesPerSide; ++i)
-	{
-		float t = (float)i / (float)(treesPerSide - 1);
-		float z = 38.0f + t * 54.0f;
+	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
+	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
 
-		vertices[treeIndex].Pos = XMFLOAT3(leftX, treeY, z);
+	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
-		float width = MathHelper::RandF(4.0f, 8.0f);
-		float height = MathHelper::RandF(7.0f, 12.0f);
-		vertices[treeIndex].Size = XMFLOAT2(width, height);
-		treeIndex++;
-	}
+	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
 
-	// TREES RIGHT SIDE
-	float rightX = 38.0f;
-	for (int i = 0; i < treesPerSide; ++i)
-	{
-		float t = (float)i / (float)(treesPerSide - 1);
-		float z = 38.0f + t * 54.0f;
+	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
 
-		vertices[treeIndex].Pos = XMFLOAT3(rightX, treeY, z);
+	geo->VertexByteStride = sizeof(TreeVertex);
+	geo->VertexBufferByteSize = vbByteSize;
+	geo->IndexFormat = DXGI_FORMAT_R32_UINT;
+	geo->IndexBufferByteSize = ibByteSize;
 
-		float width = MathHelper::RandF(4.0f, 8.0f);
-		float height = MathHelper::RandF(7.0f, 12.0f);
-		vertices[treeIndex].Size = XMFLOAT2(width, height);
-		treeIndex++;
-	}
+	SubmeshGeometry submesh;
+	submesh.IndexCount = (UINT)indices.size();
+	submesh.StartIndexLocation = 0;
+	submesh.BaseVertexLocation = 0;
 
-	// TREES BACK SIDE 
-	float backZ = 36.0f;
-	for (int i = 0; i < treesPerSide; ++i)
-	{
-		float t = (float)i / (float)(treesPerSide - 1);
-		float x = -35.0f + t * 70.0f;
+	geo->DrawArgs["points"] = submesh;
 
-		vertices[treeIndex].Pos = XMFLOAT3(x, treeY, backZ);
+	mGeometries["treeGeo"] = std::move(geo);
 
-		float width = MathHelper::RandF(4.0f, 8.0f);
-		float height = MathHelper::RandF(7.0f, 12.0f);
-		vertices[treeIndex].Size = XMFLOAT2(width, height);
-		treeIndex++;
-	}
+	// The CPU billboard path: a static index buffer for every sprite at once; the vertex
+	// buffer is the current frame's TreeQuadVB.
+	std::vector<std::uint32_t> quadIndices;
+	BillboardExpander::BuildIndices(MathHelper::Max((UINT)vertices.size(), 1u), quadIndices);
+	const UINT quadIbByteSize = (UINT)quadIndices.size() * sizeof(std::uint32_t);
+
+	mTreeQuadGeo = std::make_unique<MeshGeometry>();
+	mTreeQuadGeo->Name = "treeQuadGeo";
+	mTreeQuadGeo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), quadIndices.data(), quadIbByteSize, mTreeQuadGeo->IndexBufferUploader);
+
+	mTreeQuadGeo->VertexByteStride = sizeof(BillboardExpander::QuadVertex);
+	mTreeQuadGeo->VertexBufferByteSize = (UINT)(quadIndices.size() / BillboardExpander::IndicesPerSprite) *
+		BillboardExpander::VerticesPerSprite * sizeof(BillboardExpander::QuadVertex);
+	mTreeQuadGeo->IndexFormat = DXGI_FORMAT_R32_UINT;
+	mTreeQuadGeo->IndexBufferByteSize = quadIbByteSize;
+}
 
-	// TREES FRONT SIDE
-	float frontZ = 94.0f;
-	for (int i = 0; i < treesPerSide; ++i)
+void ShapesApp::BuildMazeGeometry(ScenePackWriter& pack)
+{
+	MazeData maze;
+	std::string error;
+	if (!LoadMaze(gMazePath, maze, error))
 	{
-		float t = (float)i / (float)(treesPerSide - 1);
-		float x = -35.0f + t * 70.0f;
-
-		vertices[treeIndex].Pos = XMFLOAT3(x, treeY, frontZ);
-
-		float width = MathHelper::RandF(4.0f, 8.0f);
-		float height = MathHelper::RandF(7.0f, 12.0f);
-		vertices[treeIndex].Size = XMFLOAT2(width, height);
-		treeIndex++;
+		OutputDebugStringA(("Maze: " + error + "\n").c_str());
+		ThrowIfFailed(E_FAIL);
 	}
 
-	std::vector<std::uint16_t> indices;
-	for (int i = 0; i < treeCount; ++i)
-		indices.push_back(i);
+	for (const auto& collider : maze.Colliders)
+		pack.AddCollider(collider.Center, collider.Extents);
+	for (const auto& segment : maze.Segments)
+		pack.AddSegment(segment.X0, segment.Z0, segment.X1, segment.Z1);
 
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(TreeVertex);
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+	// Create the mesh geometry
+	const UINT vbByteSize = (UINT)maze.Vertices.size() * sizeof(Vertex);
+	const UINT ibByteSize = (UINT)maze.Indices.size() * sizeof(std::uint16_t);
 
 	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "treeGeo";
+	geo->Name = "mazeGeo";
 
 	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), maze.Vertices.data(), vbByteSize);
 
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
-
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), maze.Indices.data(), ibByteSize);
 
-	geo->VertexByteStride = sizeof(TreeVertex);
+	geo->VertexByteStride = sizeof(Vertex);
 	geo->VertexBufferByteSize = vbByteSize;
 	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
 	geo->IndexBufferByteSize = ibByteSize;
 
 	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
+	submesh.IndexCount = (UINT)maze.Indices.size();
 	submesh.StartIndexLocation = 0;
 	submesh.BaseVertexLocation = 0;
 
-	geo->DrawArgs["points"] = submesh;
+	geo->DrawArgs["walls"] = submesh;
 
-	mGeometries["treeGeo"] = std::move(geo);
+	mGeometries["mazeGeo"] = std::move(geo);
 }
 
-void ShapesApp::BuildMazeGeometry()
+bool ShapesApp::LoadMaze(const std::string& path, MazeData& maze, std::string& error)
 {
-	GeometryGenerator geoGen;
-
-	mMazeWallBounds.clear();
+	// Runs on the reloader's thread too, so it only touches maze.
+	std::ifstream fin(path);
+	if (!fin)
+	{
+		error = path + ": cannot open";
+		return false;
+	}
 
-	std::vector<Vertex> allVertices;
-	std::vector<std::uint16_t> allIndices;
+	GeometryGenerator geoGen;
 	UINT vertexOffset = 0;
 
 	auto addWallSegment = [&](float startX, float startZ, float endX, float endZ, float height)
@@ -1270,10 +3373,21 @@ void ShapesApp::BuildMazeGeometry()
 			float centerZ = (startZ + endZ) / 2.0f;
 			float angle = atan2f(endZ - startZ, endX - startX);
 
-			BoundingBox box;
-			box.Center = XMFLOAT3(centerX, groundY + height / 2.0f, centerZ + 110.0f);
-			box.Extents = XMFLOAT3(length / 2.5f + 0.1f, height / 2.0f, width / 2.5f + 0.1f);
-			mMazeWallBounds.push_back(box);
+			ScenePack::Collider collider;
+			collider.Center[0] = centerX;
+			collider.Center[1] = groundY + height / 2.0f;
+			collider.Center[2] = centerZ + 110.0f;
+			collider.Extents[0] = length / 2.5f + 0.1f;
+			collider.Extents[1] = height / 2.0f;
+			collider.Extents[2] = width / 2.5f + 0.1f;
+			maze.Colliders.push_back(collider);
+
+			ScenePack::Segment segment;
+			segment.X0 = startX;
+			segment.Z0 = startZ + 110.0f;
+			segment.X1 = endX;
+			segment.Z1 = endZ + 110.0f;
+			maze.Segments.push_back(segment);
 
 			GeometryGenerator::MeshData wall = geoGen.CreateBox(length, height, width, 3);
 
@@ -1287,112 +3401,358 @@ void ShapesApp::BuildMazeGeometry()
 				vert.Pos.y = groundY + height / 2.0f + v.Position.y;
 				vert.Normal = v.Normal;
 				vert.TexC = v.TexC;
-				allVertices.push_back(vert);
+				maze.Vertices.push_back(vert);
+			}
+
+			for (const auto& idx : wall.Indices32)
+			{
+				maze.Indices.push_back((std::uint16_t)(vertexOffset + idx));
+			}
+
+			vertexOffset += (UINT)wall.Vertices.size();
+		};
+
+	std::string line;
+	for (int lineNumber = 1; std::getline(fin, line); ++lineNumber)
+	{
+		std::size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#')
+			continue;
+
+		std::istringstream iss(line);
+		float startX, startZ, endX, endZ, height;
+		std::string rest;
+		if (!(iss >> startX >> startZ >> endX >> endZ >> height) || (iss >> rest) || height <= 0.0f)
+		{
+			error = path + "(" + std::to_string(lineNumber) + "): expected startX startZ endX endZ height";
+			return false;
+		}
+
+		addWallSegment(startX, startZ, endX, endZ, height);
+
+		// The indices are 16-bit.
+		if (vertexOffset > 0xffff)
+		{
+			error = path + "(" + std::to_string(lineNumber) + "): too many walls";
+			return false;
+		}
+	}
+
+	if (maze.Segments.empty())
+	{
+		error = path + ": no walls";
+		return false;
+	}
+	return true;
+}
+
+void ShapesApp::BuildSubmeshBounds()
+{
+	// Compute the local bounds of every submesh from the system memory copies.  All our
+	// vertex formats start with the position.
+	for (auto& geoPair : mGeometries)
+	{
+		MeshGeometry* geo = geoPair.second.get();
+
+		// The scene pack carries the bounds of what it holds.
+		if (mScenePack.FindMesh(geo->Name) >= 0)
+			continue;
+
+		MeshDataView data;
+		if (!AcquireMeshData(*geo, data))
+			continue;
+
+		const BYTE* vertexData = data.Vertices;
+		const BYTE* indexData = data.Indices;
+		bool index16 = geo->IndexFormat == DXGI_FORMAT_R16_UINT;
+
+		for (auto& arg : geo->DrawArgs)
+		{
+			SubmeshGeometry& submesh = arg.second;
+
+			XMVECTOR vMin = XMVectorReplicate(+MathHelper::Infinity);
+			XMVECTOR vMax = XMVectorReplicate(-MathHelper::Infinity);
+
+			for (UINT i = 0; i < submesh.IndexCount; ++i)
+			{
+				UINT index = submesh.StartIndexLocation + i;
+				UINT v = index16 ? ((const std::uint16_t*)indexData)[index] : ((const std::uint32_t*)indexData)[index];
+				v += submesh.BaseVertexLocation;
+
+				XMVECTOR p = XMLoadFloat3((const XMFLOAT3*)(vertexData + (size_t)v * geo->VertexByteStride));
+				vMin = XMVectorMin(vMin, p);
+				vMax = XMVectorMax(vMax, p);
 			}
 
-			for (const auto& idx : wall.Indices32)
-			{
-				allIndices.push_back(vertexOffset + idx);
-			}
+			XMStoreFloat3(&submesh.Bounds.Center, 0.5f * (vMin + vMax));
+			XMStoreFloat3(&submesh.Bounds.Extents, 0.5f * (vMax - vMin));
+		}
+	}
+}
+
+void ShapesApp::BuildSceneLights()
+{
+	// Directional Lights (3 lights).  The ambient light comes from the environment.
+	mMainPassCB.Lights[0].Direction = { 0.57735f, -0.57735f, 0.57735f };
+	mMainPassCB.Lights[0].Strength = { 0.8f, 0.8f, 0.8f };
+	mMainPassCB.Lights[1].Direction = { -0.57735f, -0.57735f, 0.57735f };
+	mMainPassCB.Lights[1].Strength = { 0.4f, 0.4f, 0.4f };
+	mMainPassCB.Lights[2].Direction = { 0.0f, -0.707f, -0.707f };
+	mMainPassCB.Lights[2].Strength = { 0.2f, 0.2f, 0.2f };
+
+	mSceneLights.clear();
+
+	auto addPointLight = [&](XMFLOAT3 position, XMFLOAT3 strength, float falloffStart, float falloffEnd)
+		{
+			Light light;
+			light.Position = position;
+			light.Strength = strength;
+			light.FalloffStart = falloffStart;
+			light.FalloffEnd = falloffEnd;
+			light.SpotPower = 0.0f;
+			mSceneLights.push_back(light);
+		};
+
+	// Red lights at the four corner towers.
+	for (float x : { -30.0f, 30.0f })
+	{
+		for (float z : { -30.0f, 30.0f })
+			addPointLight({ x, 5.0f, z }, { 1.0f, 0.2f, 0.2f }, 5.0f, 25.0f);
+	}
+
+	// Torches on both faces of the outer walls (centred on +-30, two units thick).
+	const XMFLOAT3 torchStrength = { 0.9f, 0.5f, 0.15f };
+	for (float t = -24.0f; t <= 24.0f; t += 6.0f)
+	{
+		for (float face : { -31.5f, -28.5f, 28.5f, 31.5f })
+		{
+			addPointLight({ t, 4.5f, face }, torchStrength, 1.0f, 7.0f);
+			addPointLight({ face, 4.5f, t }, torchStrength, 1.0f, 7.0f);
+		}
+	}
 
-			vertexOffset += (UINT)wall.Vertices.size();
-		};
+	// Lamps along both sides of every maze wall (one unit thick), aimed down and away from
+	// the wall so they light the path in front of it.
+	for (const auto& wall : mMazeWallSegments)
+	{
+		float dx = wall.z - wall.x;
+		float dz = wall.w - wall.y;
+		float length = sqrtf(dx * dx + dz * dz);
+		if (length < 1.0f)
+			continue;
 
-	// OUTER WALLS
-	addWallSegment(-35.0f, -70.0f, -5.0f, -70.0f, 4.0f);
-	addWallSegment(5.0f, -70.0f, 35.0f, -70.0f, 4.0f);
-	addWallSegment(-35.0f, -20.0f, -5.0f, -20.0f, 4.0f);
-	addWallSegment(5.0f, -20.0f, 35.0f, -20.0f, 4.0f);
-	addWallSegment(-35.0f, -70.0f, -35.0f, -20.0f, 4.0f);
-	addWallSegment(35.0f, -70.0f, 35.0f, -20.0f, 4.0f);
+		float nx = -dz / length;
+		float nz = dx / length;
 
-	// Horizontals
-	addWallSegment(-35.0f, -62.0f, -20.0f, -62.0f, 4.0f);
-	addWallSegment(20.0f, -62.0f, 35.0f, -62.0f, 4.0f);
+		for (float t = 1.0f; t <= length - 1.0f; t += 6.0f)
+		{
+			float px = wall.x + dx * t / length;
+			float pz = wall.y + dz * t / length;
 
-	addWallSegment(-35.0f, -54.0f, -10.0f, -54.0f, 4.0f);
-	addWallSegment(-7.0f, -54.0f, 35.0f, -54.0f, 4.0f);
+			for (float s : { -1.0f, 1.0f })
+			{
+				Light light;
+				light.Position = XMFLOAT3(px + s * 1.1f * nx, 3.0f, pz + s * 1.1f * nz);
 
-	addWallSegment(-35.0f, -46.0f, -25.0f, -46.0f, 4.0f);
-	addWallSegment(5.0f, -46.0f, 35.0f, -46.0f, 4.0f);
+				XMVECTOR dir = XMVector3Normalize(XMVectorSet(0.6f * s * nx, -1.0f, 0.6f * s * nz, 0.0f));
+				XMStoreFloat3(&light.Direction, dir);
 
-	addWallSegment(-35.0f, -38.0f, -20.0f, -38.0f, 4.0f);
-	addWallSegment(-15.0f, -38.0f, 10.0f, -38.0f, 4.0f);
-	addWallSegment(20.0f, -38.0f, 35.0f, -38.0f, 4.0f);
+				light.Strength = { 1.0f, 0.75f, 0.4f };
+				light.FalloffStart = 1.0f;
+				light.FalloffEnd = 8.0f;
+				light.SpotPower = 4.0f;
+				mSceneLights.push_back(light);
+			}
+		}
+	}
 
-	addWallSegment(-35.0f, -30.0f, -15.0f, -30.0f, 4.0f);
-	addWallSegment(15.0f, -30.0f, 35.0f, -30.0f, 4.0f);
+	if (mSceneLights.size() > gMaxSceneLights)
+		mSceneLights.resize(gMaxSceneLights);
 
-	// Verticals
+	std::ostringstream oss;
+	oss << "Scene lights: " << mSceneLights.size() << " point and spot lights\n";
+	OutputDebugStringA(oss.str().c_str());
 
-	addWallSegment(-30.0f, -70.0f, -30.0f, -62.0f, 4.0f);
-	addWallSegment(-30.0f, -54.0f, -30.0f, -46.0f, 4.0f);
-	addWallSegment(-30.0f, -38.0f, -30.0f, -30.0f, 4.0f);
+	std::vector<LightGrid::LightInfo> gridLights(mSceneLights.size());
+	for (size_t i = 0; i < mSceneLights.size(); ++i)
+	{
+		const Light& light = mSceneLights[i];
+		LightGrid::LightInfo& info = gridLights[i];
+		info.X = light.Position.x;
+		info.Y = light.Position.y;
+		info.Z = light.Position.z;
+		info.FalloffStart = light.FalloffStart;
+		info.FalloffEnd = light.FalloffEnd;
+		info.Intensity = 0.2126f * light.Strength.x + 0.7152f * light.Strength.y + 0.0722f * light.Strength.z;
+	}
+	mLightGrid.Build(gridLights, 16.0f);
 
-	addWallSegment(-22.0f, -62.0f, -22.0f, -54.0f, 4.0f);
-	addWallSegment(-22.0f, -46.0f, -22.0f, -38.0f, 4.0f);
-	addWallSegment(-22.0f, -30.0f, -22.0f, -20.0f, 4.0f);
+	// Sizes the cluster grid so the frame resources can allocate its buffers.
+	ClusteredLights::Config config;
+	config.TanHalfFovY = tanf(0.125f * MathHelper::Pi);
+	config.AspectRatio = AspectRatio();
+	mClusteredLights.Configure(config);
+}
 
-	addWallSegment(-14.0f, -70.0f, -14.0f, -62.0f, 4.0f);
-	addWallSegment(-14.0f, -54.0f, -14.0f, -46.0f, 4.0f);
-	addWallSegment(-14.0f, -38.0f, -14.0f, -30.0f, 4.0f);
+void ShapesApp::BuildBakedLighting()
+{
+	LightBaker::Settings settings;
+	settings.AmbientIrradiance[0] = mMainPassCB.AmbientLight.x;
+	settings.AmbientIrradiance[1] = mMainPassCB.AmbientLight.y;
+	settings.AmbientIrradiance[2] = mMainPassCB.AmbientLight.z;
+	for (int i = 0; i < 3; ++i)
+	{
+		LightBaker::DirectionalLight light;
+		memcpy(light.Direction, &mMainPassCB.Lights[i].Direction, sizeof(light.Direction));
+		memcpy(light.Color, &mMainPassCB.Lights[i].Strength, sizeof(light.Color));
+		settings.Lights.push_back(light);
+	}
 
-	addWallSegment(-6.0f, -62.0f, -6.0f, -54.0f, 4.0f);
-	addWallSegment(-6.0f, -46.0f, -6.0f, -38.0f, 4.0f);
+	// Only bake when the scene or the lights changed since the file was written.  The
+	// scene pack's content hash covers the cells too, so checking reads no geometry.
+	const std::string path = gCacheDir + "BakedLighting.bin";
+	const std::uint64_t sceneHash = Hash::Fnv1aValue(mScenePack.ContentHash(), LightBaker::SettingsHash(settings));
 
-	addWallSegment(6.0f, -70.0f, 6.0f, -62.0f, 4.0f);
-	addWallSegment(6.0f, -54.0f, 6.0f, -46.0f, 4.0f);
-	addWallSegment(6.0f, -38.0f, 6.0f, -30.0f, 4.0f);
+	if (!mBakedLightingFile.Open(path, sceneHash))
+	{
+		// Every cell is baked, resident or not, so they light and shade each other.
+		LightBaker baker;
+		AddBakedObjects(baker, mScenePack);
+		for (std::uint32_t i = 0; i < mScenePack.CellCount(); ++i)
+		{
+			const ScenePack::Cell& cell = mScenePack.Cells()[i];
+			ScenePack cellPack;
+			if (cellPack.Open(mScenePack.String(cell.Path), mSceneKey, mMaterialSrvCount) && cellPack.ContentHash() == cell.ContentHash)
+				AddBakedObjects(baker, cellPack);
+		}
 
-	addWallSegment(14.0f, -62.0f, 14.0f, -54.0f, 4.0f);
-	addWallSegment(14.0f, -46.0f, 14.0f, -38.0f, 4.0f);
-	addWallSegment(14.0f, -30.0f, 14.0f, -20.0f, 4.0f);
+		bool written = baker.Bake(settings, path, sceneHash);
+		const auto& stats = baker.GetStats();
 
-	addWallSegment(22.0f, -70.0f, 22.0f, -62.0f, 4.0f);
-	addWallSegment(22.0f, -54.0f, 22.0f, -46.0f, 4.0f);
-	addWallSegment(22.0f, -38.0f, 22.0f, -30.0f, 4.0f);
+		std::ostringstream oss;
+		oss << "Baked lighting: " << stats.Vertices << " vertices, " << stats.Triangles << " triangles, "
+			<< stats.Rays << " rays\n";
+		if (!written)
+			oss << "Baked lighting: could not write " << path << "\n";
+		OutputDebugStringA(oss.str().c_str());
 
-	addWallSegment(30.0f, -62.0f, 30.0f, -54.0f, 4.0f);
-	addWallSegment(30.0f, -46.0f, 30.0f, -38.0f, 4.0f);
-	addWallSegment(30.0f, -30.0f, 30.0f, -20.0f, 4.0f);
+		mBakedLightingFile.Open(path, sceneHash);
+	}
 
+	// Without a file every item keeps the flat ambient term.  The buffer is never empty so
+	// the root SRV always points at something.
+	const std::uint32_t noSamples = 0;
+	UINT sampleCount = mBakedLightingFile.SampleCount();
+	const void* samples = sampleCount > 0 ? (const void*)mBakedLightingFile.Samples() : &noSamples;
+	UINT64 byteSize = (UINT64)(sampleCount > 0 ? sampleCount : 1) * sizeof(std::uint32_t);
 
-	// Create the mesh geometry
-	const UINT vbByteSize = (UINT)allVertices.size() * sizeof(Vertex);
-	const UINT ibByteSize = (UINT)allIndices.size() * sizeof(std::uint16_t);
+	mBakedLighting = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(), mCommandList.Get(),
+		samples, byteSize, mBakedLightingUploader);
 
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "mazeGeo";
+	mMainPassCB.BakedIrradianceScale = mBakedLightingFile.IrradianceScale();
+}
 
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), allVertices.data(), vbByteSize);
+void ShapesApp::AddBakedObjects(LightBaker& baker, const ScenePack& pack)
+{
+	// The opaque objects never move, so they receive baked lighting and occlude each other.
+	// SV_VertexID is the raw index buffer value (without BaseVertexLocation), so an object
+	// bakes every vertex from its base vertex up to its largest index.  Every level of
+	// detail of an object is baked, but only the full detail occludes.
+	std::vector<MeshDataView> meshData(pack.MeshCount());
+	std::vector<bool> meshRead(pack.MeshCount(), false);
+
+	for (std::uint32_t o = 0; o < pack.ObjectCount(); ++o)
+	{
+		const ScenePack::Object& object = pack.Objects()[o];
+		const ScenePack::Mesh& packMesh = pack.Meshes()[object.Mesh];
+		if ((RenderLayer)object.Layer != RenderLayer::Opaque || packMesh.VertexStride != sizeof(Vertex))
+			continue;
+
+		// Every submesh of a mesh shares one view.
+		MeshDataView& data = meshData[object.Mesh];
+		if (!meshRead[object.Mesh])
+		{
+			meshRead[object.Mesh] = true;
+			if (!pack.ReadMesh(packMesh, data.Vertices, data.Indices, data.VertexStorage, data.IndexStorage))
+			{
+				data.Vertices = nullptr;
+				OutputDebugStringA(("Scene pack: could not decode " + pack.String(packMesh.Name) + "\n").c_str());
+			}
+		}
+		if (data.Vertices == nullptr)
+			continue;
 
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), allIndices.data(), ibByteSize);
+		const Vertex* vertices = (const Vertex*)data.Vertices;
+		bool index16 = packMesh.IndexSize == 2;
+		XMMATRIX world = XMLoadFloat4x4((const XMFLOAT4X4*)object.World);
 
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), allVertices.data(), vbByteSize, geo->VertexBufferUploader);
+		for (std::uint32_t s = object.Submesh; s != ScenePack::NoLod; s = pack.Submeshes()[s].NextLod)
+		{
+			const ScenePack::Submesh& submesh = pack.Submeshes()[s];
 
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), allIndices.data(), ibByteSize, geo->IndexBufferUploader);
+			LightBaker::Mesh mesh;
+			mesh.Indices.resize(submesh.IndexCount);
+			mesh.Occluder = s == object.Submesh;
 
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
+			UINT vertexCount = 0;
+			for (UINT i = 0; i < submesh.IndexCount; ++i)
+			{
+				UINT index = submesh.StartIndexLocation + i;
+				UINT v = index16 ? ((const std::uint16_t*)data.Indices)[index] : ((const std::uint32_t*)data.Indices)[index];
+				mesh.Indices[i] = v;
+				if (v + 1 > vertexCount)
+					vertexCount = v + 1;
+			}
 
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)allIndices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
+			mesh.Positions.resize((size_t)vertexCount * 3);
+			mesh.Normals.resize((size_t)vertexCount * 3);
+			for (UINT v = 0; v < vertexCount; ++v)
+			{
+				const Vertex& vertex = vertices[submesh.BaseVertexLocation + v];
+				XMStoreFloat3((XMFLOAT3*)&mesh.Positions[3 * (size_t)v],
+					XMVector3TransformCoord(XMLoadFloat3(&vertex.Pos), world));
+				XMStoreFloat3((XMFLOAT3*)&mesh.Normals[3 * (size_t)v],
+					XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&vertex.Normal), world)));
+			}
 
-	geo->DrawArgs["walls"] = submesh;
+			memcpy(mesh.Albedo, pack.Materials()[object.Material].DiffuseAlbedo, sizeof(mesh.Albedo));
+			mesh.Key = BakedLightingKey(pack, object, s);
+			baker.AddMesh(std::move(mesh));
+		}
+	}
+}
 
-	mGeometries["mazeGeo"] = std::move(geo);
+std::uint64_t ShapesApp::BakedLightingKey(const ScenePack& pack, const ScenePack::Object& object, std::uint32_t submesh)
+{
+	// By name and placement, which stay the same whichever pack the object is cooked into.
+	// submesh is the object's or one of its levels of detail.
+	std::uint64_t key = Hash::Fnv1a(pack.String(pack.Meshes()[object.Mesh].Name));
+	key = Hash::Fnv1a(pack.String(pack.Submeshes()[submesh].Name), key);
+	return Hash::Fnv1a(object.World, sizeof(object.World), key);
 }
 
 void ShapesApp::BuildPSOs()
 {
+	mPipelineKeys.clear();
+	for (const auto& p : RequestPSOs(mShaders))
+	{
+		mPSOs[p.first] = mPipelineCache->Get(p.second);
+		mPipelineKeys.push_back(p.second);
+	}
+
+	mPipelineCache->Flush();
+
+	const auto& stats = mPipelineCache->GetStats();
+	std::ostringstream oss;
+	oss << "Pipelines: " << stats.Requests << " requested, " << stats.Deduplicated << " shared, "
+		<< stats.DiskHits << " from disk, " << stats.Compiled << " compiled\n";
+	OutputDebugStringA(oss.str().c_str());
+}
+
+std::vector<std::pair<std::string, std::uint64_t>> ShapesApp::RequestPSOs(
+	std::unordered_map<std::string, ComPtr<ID3DBlob>>& shaders)
+{
+	// The descriptions point into shaders, so it must outlive the Get of every key.
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC opaquePsoDesc;
 
 	ZeroMemory(&opaquePsoDesc, sizeof(D3D12_GRAPHICS_PIPELINE_STATE_DESC));
@@ -1401,14 +3761,14 @@ void ShapesApp::BuildPSOs()
 
 	opaquePsoDesc.VS =
 	{
-		reinterpret_cast<BYTE*>(mShaders["standardVS"]->GetBufferPointer()),
-		mShaders["standardVS"]->GetBufferSize()
+		reinterpret_cast<BYTE*>(shaders["standardVS"]->GetBufferPointer()),
+		shaders["standardVS"]->GetBufferSize()
 	};
 
 	opaquePsoDesc.PS =
 	{
-		reinterpret_cast<BYTE*>(mShaders["opaquePS"]->GetBufferPointer()),
-		mShaders["opaquePS"]->GetBufferSize()
+		reinterpret_cast<BYTE*>(shaders["opaquePS"]->GetBufferPointer()),
+		shaders["opaquePS"]->GetBufferSize()
 	};
 
 	opaquePsoDesc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
@@ -1423,13 +3783,39 @@ void ShapesApp::BuildPSOs()
 	opaquePsoDesc.SampleDesc.Quality = m4xMsaaState ? (m4xMsaaQuality - 1) : 0;
 	opaquePsoDesc.DSVFormat = mDepthStencilFormat;
 
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&opaquePsoDesc, IID_PPV_ARGS(&mPSOs["opaque"])));
+	// Every pipeline is requested up front so they compile in parallel; identical
+	// descriptions share one pipeline and compiled ones come back from disk.
+	std::vector<std::pair<std::string, std::uint64_t>> psoKeys;
+	psoKeys.push_back({ "opaque", mPipelineCache->Request(opaquePsoDesc) });
+
+	// Opaque items fading between levels of detail, which discard a dither pattern.
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC opaqueLodFadePsoDesc = opaquePsoDesc;
+	opaqueLodFadePsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(shaders["opaqueLodFadePS"]->GetBufferPointer()),
+		shaders["opaqueLodFadePS"]->GetBufferSize()
+	};
+	psoKeys.push_back({ "opaque_lodFade", mPipelineCache->Request(opaqueLodFadePsoDesc) });
+
+	// The ground, sampling its virtual texture through the page table.
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC opaqueVirtualTexturePsoDesc = opaquePsoDesc;
+	opaqueVirtualTexturePsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(shaders["opaqueVirtualTexturePS"]->GetBufferPointer()),
+		shaders["opaqueVirtualTexturePS"]->GetBufferSize()
+	};
+	psoKeys.push_back({ "opaque_virtualTexture", mPipelineCache->Request(opaqueVirtualTexturePsoDesc) });
 
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC opaqueWireframePsoDesc = opaquePsoDesc;
 	opaqueWireframePsoDesc.RasterizerState.FillMode = D3D12_FILL_MODE_WIREFRAME;
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&opaqueWireframePsoDesc, IID_PPV_ARGS(&mPSOs["opaque_wireframe"])));
+	psoKeys.push_back({ "opaque_wireframe", mPipelineCache->Request(opaqueWireframePsoDesc) });
 
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC transparentPsoDesc = opaquePsoDesc;
+	transparentPsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(shaders["transparentPS"]->GetBufferPointer()),
+		shaders["transparentPS"]->GetBufferSize()
+	};
 
 	D3D12_RENDER_TARGET_BLEND_DESC transparencyBlendDesc;
 	transparencyBlendDesc.BlendEnable = true;
@@ -1444,42 +3830,211 @@ void ShapesApp::BuildPSOs()
 	transparencyBlendDesc.RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
 
 	transparentPsoDesc.BlendState.RenderTarget[0] = transparencyBlendDesc;
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&transparentPsoDesc, IID_PPV_ARGS(&mPSOs["transparent"])));
+	psoKeys.push_back({ "transparent", mPipelineCache->Request(transparentPsoDesc) });
 
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC treePsoDesc = opaquePsoDesc;
 
 	treePsoDesc.VS =
 	{
-		reinterpret_cast<BYTE*>(mShaders["treeSpriteVS"]->GetBufferPointer()),
-		mShaders["treeSpriteVS"]->GetBufferSize()
+		reinterpret_cast<BYTE*>(shaders["treeSpriteVS"]->GetBufferPointer()),
+		shaders["treeSpriteVS"]->GetBufferSize()
 	};
 
 	treePsoDesc.GS =
 	{
-		reinterpret_cast<BYTE*>(mShaders["treeSpriteGS"]->GetBufferPointer()),
-		mShaders["treeSpriteGS"]->GetBufferSize()
+		reinterpret_cast<BYTE*>(shaders["treeSpriteGS"]->GetBufferPointer()),
+		shaders["treeSpriteGS"]->GetBufferSize()
 	};
 
 	treePsoDesc.PS =
 	{
-		reinterpret_cast<BYTE*>(mShaders["treeSpritePS"]->GetBufferPointer()),
-		mShaders["treeSpritePS"]->GetBufferSize()
+		reinterpret_cast<BYTE*>(shaders["treeSpritePS"]->GetBufferPointer()),
+		shaders["treeSpritePS"]->GetBufferSize()
 	};
 
 	treePsoDesc.InputLayout = { mTreeSpriteInputLayout.data(), (UINT)mTreeSpriteInputLayout.size() };
 
 	treePsoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_POINT;
 
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&treePsoDesc, IID_PPV_ARGS(&mPSOs["treeSprites"])));
+	psoKeys.push_back({ "treeSprites", mPipelineCache->Request(treePsoDesc) });
+
+	// Same sprites expanded on the CPU: no GS, triangles in.
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC treeQuadPsoDesc = treePsoDesc;
+	treeQuadPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(shaders["treeQuadVS"]->GetBufferPointer()),
+		shaders["treeQuadVS"]->GetBufferSize()
+	};
+	treeQuadPsoDesc.GS = { nullptr, 0 };
+	treeQuadPsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(shaders["treeQuadPS"]->GetBufferPointer()),
+		shaders["treeQuadPS"]->GetBufferSize()
+	};
+	treeQuadPsoDesc.InputLayout = { mTreeQuadInputLayout.data(), (UINT)mTreeQuadInputLayout.size() };
+	treeQuadPsoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+
+	psoKeys.push_back({ "treeQuads", mPipelineCache->Request(treeQuadPsoDesc) });
+
+	return psoKeys;
+}
+
+void ShapesApp::ReleaseMeshCopies()
+{
+	// Runs once the last consumer of the copies during initialization is done; anything
+	// that needs them later goes through AcquireMeshData.
+	for (const auto& policy : gGeometryCpuPolicies)
+	{
+		auto it = mGeometries.find(policy.first);
+		if (it == mGeometries.end() || policy.second == MeshDataCache::Policy::Keep)
+			continue;
+
+		MeshGeometry* geo = it->second.get();
+		if (geo->VertexBufferCPU == nullptr || geo->IndexBufferCPU == nullptr)
+			continue;
+
+		mMeshCache->Store(geo->Name, policy.second,
+			geo->VertexBufferCPU->GetBufferPointer(), geo->VertexBufferCPU->GetBufferSize(),
+			geo->IndexBufferCPU->GetBufferPointer(), geo->IndexBufferCPU->GetBufferSize());
+		geo->VertexBufferCPU = nullptr;
+		geo->IndexBufferCPU = nullptr;
+	}
+
+	bool written = mMeshCache->Flush();
+	const auto& stats = mMeshCache->GetStats();
+
+	std::ostringstream oss;
+	oss << "Mesh copies: " << stats.Dropped << " dropped, " << stats.RawBytes / 1024 << " KB released";
+	if (stats.FileWritten)
+		oss << ", MeshCache.bin rewritten";
+	oss << "\n";
+	if (!written)
+		oss << "Mesh copies: could not write MeshCache.bin; dropped meshes cannot be fetched\n";
+	OutputDebugStringA(oss.str().c_str());
+}
+
+bool ShapesApp::AcquireMeshData(const MeshGeometry& geo, MeshDataView& view)
+{
+	if (geo.VertexBufferCPU != nullptr && geo.IndexBufferCPU != nullptr)
+	{
+		view.Vertices = (const BYTE*)geo.VertexBufferCPU->GetBufferPointer();
+		view.Indices = (const BYTE*)geo.IndexBufferCPU->GetBufferPointer();
+		return true;
+	}
+
+	int packMesh = mScenePack.FindMesh(geo.Name);
+	if (packMesh >= 0)
+	{
+		if (mScenePack.ReadMesh(mScenePack.Meshes()[packMesh], view.Vertices, view.Indices,
+			view.VertexStorage, view.IndexStorage))
+			return true;
+
+		OutputDebugStringA(("Scene pack: could not decode " + geo.Name + "\n").c_str());
+		return false;
+	}
+
+	if (!mMeshCache->Fetch(geo.Name, view.VertexStorage, view.IndexStorage) ||
+		view.VertexStorage.size() < geo.VertexBufferByteSize || view.IndexStorage.size() < geo.IndexBufferByteSize)
+	{
+		OutputDebugStringA(("Mesh copies: no system memory data for " + geo.Name + "\n").c_str());
+		return false;
+	}
+
+	view.Vertices = view.VertexStorage.data();
+	view.Indices = view.IndexStorage.data();
+	return true;
+}
+
+UINT64 ShapesApp::ResourceBytes(ID3D12Resource* resource)
+{
+	if (resource == nullptr)
+		return 0;
+
+	// What the device reserves for the resource, including alignment and mip padding.
+	D3D12_RESOURCE_DESC desc = resource->GetDesc();
+	return md3dDevice->GetResourceAllocationInfo(0, 1, &desc).SizeInBytes;
+}
+
+void ShapesApp::TrackMemory()
+{
+	// Geometry: the system memory copies, the default buffers and their upload heaps.
+	auto trackGeometry = [this](const MeshGeometry& geo)
+	{
+		UINT64 bytes = 0;
+		if (geo.VertexBufferCPU)
+			bytes += geo.VertexBufferCPU->GetBufferSize();
+		if (geo.IndexBufferCPU)
+			bytes += geo.IndexBufferCPU->GetBufferSize();
+		bytes += ResourceBytes(geo.VertexBufferGPU.Get()) + ResourceBytes(geo.IndexBufferGPU.Get());
+		bytes += ResourceBytes(geo.VertexBufferUploader.Get()) + ResourceBytes(geo.IndexBufferUploader.Get());
+		mGeometryMemory[geo.Name] = TrackedMemory(MemoryTag::Geometry, bytes);
+	};
+	for (const auto& geo : mGeometries)
+		trackGeometry(*geo.second);
+	trackGeometry(*mTreeQuadGeo);
+
+	mTextureMemory.clear();
+	for (const auto& tex : mTextures)
+	{
+		UINT64 bytes = ResourceBytes(tex.second->Resource.Get()) + ResourceBytes(tex.second->UploadHeap.Get());
+		mTextureMemory.push_back(TrackedMemory(MemoryTag::Textures, bytes));
+	}
+	mTextureMemory.push_back(TrackedMemory(MemoryTag::Textures, ResourceBytes(mGroundPageCache.Get())));
+
+	// Scene data outside the entity world, which charges its own chunks.
+	UINT64 sceneBytes = mSceneLights.capacity() * sizeof(Light) +
+		mSceneLightSpheres.capacity() * sizeof(ClusteredLights::LightSphere) +
+		mFoliage.Instances().capacity() * sizeof(FoliageScatter::Instance) +
+		ResourceBytes(mBakedLighting.Get()) + ResourceBytes(mBakedLightingUploader.Get());
+	mSceneMemory = TrackedMemory(MemoryTag::Scene, sceneBytes);
 }
 
 void ShapesApp::BuildFrameResources()
 {
+	// Room for the objects of as many cells as can be resident at once: the ones within
+	// the unload radius of the camera, whose bounds reach at most half a cell past it.
+	UINT cellsAcross = (UINT)ceilf(2.0f * gWorldUnloadRadius / gWorldCellSize) + 2;
+	UINT cellObjects = 0, maxCellObjects = 0;
+	for (std::uint32_t i = 0; i < mScenePack.CellCount(); ++i)
+	{
+		cellObjects += mScenePack.Cells()[i].ObjectCount;
+		maxCellObjects = MathHelper::Max(maxCellObjects, mScenePack.Cells()[i].ObjectCount);
+	}
+	mObjectCapacity = mObjectCount + MathHelper::Min(cellObjects, cellsAcross * cellsAcross * maxCellObjects);
+
 	for (int i = 0; i < gNumFrameResources; ++i)
 	{
 		mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
-			1, (UINT)mAllRitems.size(), (UINT)mMaterials.size()));
+			1, mObjectCapacity, (UINT)mMaterials.size()));
+
+		auto& frame = mFrameResources.back();
+		frame->SceneLights = std::make_unique<UploadBuffer<Light>>(md3dDevice.Get(), gMaxSceneLights, false);
+		frame->ClusterRanges = std::make_unique<UploadBuffer<ClusteredLights::ClusterRange>>(md3dDevice.Get(),
+			mClusteredLights.ClusterCount(), false);
+		frame->ClusterLightIndices = std::make_unique<UploadBuffer<std::uint32_t>>(md3dDevice.Get(),
+			mClusteredLights.MaxIndexCount(), false);
+		frame->TreeQuadVB = std::make_unique<UploadBuffer<BillboardExpander::QuadVertex>>(md3dDevice.Get(),
+			mTreeQuadGeo->VertexBufferByteSize / mTreeQuadGeo->VertexByteStride, false);
+		if (mGroundVirtualTexture)
+		{
+			frame->GroundPages = std::make_unique<UploadBuffer<std::uint8_t>>(md3dDevice.Get(),
+				(UINT)(mGroundPageUploadStride * mGroundVirtualTexture->GetDesc().MaxLoadsPerFrame), false);
+			frame->GroundPageTable = std::make_unique<UploadBuffer<std::uint8_t>>(md3dDevice.Get(),
+				(UINT)mGroundPageTableBytes, false);
+		}
+		frame->TrackMemory();
+	}
+}
+
+UINT ShapesApp::TextureSrvIndex(const std::string& name)const
+{
+	auto it = std::find(mTextureSrvOrder.begin(), mTextureSrvOrder.end(), name);
+	if (it == mTextureSrvOrder.end())
+	{
+		OutputDebugStringA(("No SRV for texture " + name + "\n").c_str());
+		ThrowIfFailed(E_FAIL);
 	}
+	return (UINT)(it - mTextureSrvOrder.begin());
 }
 
 void ShapesApp::BuildMaterials()
@@ -1490,7 +4045,7 @@ void ShapesApp::BuildMaterials()
 	auto groundMat = std::make_unique<Material>();
 	groundMat->Name = "groundMat";
 	groundMat->MatCBIndex = heapIndex++;
-	groundMat->DiffuseSrvHeapIndex = 3; // tileTex
+	groundMat->DiffuseSrvHeapIndex = TextureSrvIndex("roofTex");
 	groundMat->DiffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
 	groundMat->FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05f);
 	groundMat->Roughness = 0.5f;
@@ -1499,7 +4054,7 @@ void ShapesApp::BuildMaterials()
 	auto stoneMat = std::make_unique<Material>();
 	stoneMat->Name = "stoneMat";
 	stoneMat->MatCBIndex = heapIndex++;
-	stoneMat->DiffuseSrvHeapIndex = 0; // stoneTex
+	stoneMat->DiffuseSrvHeapIndex = TextureSrvIndex("stoneTex");
 	stoneMat->DiffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
 	stoneMat->FresnelR0 = XMFLOAT3(0.02f, 0.02f, 0.02f);
 	stoneMat->Roughness = 0.3f;
@@ -1508,7 +4063,7 @@ void ShapesApp::BuildMaterials()
 	auto darkStoneMat = std::make_unique<Material>();
 	darkStoneMat->Name = "darkStoneMat";
 	darkStoneMat->MatCBIndex = heapIndex++;
-	darkStoneMat->DiffuseSrvHeapIndex = 0; // stoneTex
+	darkStoneMat->DiffuseSrvHeapIndex = TextureSrvIndex("stoneTex");
 	darkStoneMat->DiffuseAlbedo = XMFLOAT4(0.5f, 0.5f, 0.5f, 1.0f);
 	darkStoneMat->FresnelR0 = XMFLOAT3(0.02f, 0.02f, 0.02f);
 	darkStoneMat->Roughness = 0.4f;
@@ -1517,7 +4072,7 @@ void ShapesApp::BuildMaterials()
 	auto brickMat = std::make_unique<Material>();
 	brickMat->Name = "brickMat";
 	brickMat->MatCBIndex = heapIndex++;
-	brickMat->DiffuseSrvHeapIndex = 2; // brickTex
+	brickMat->DiffuseSrvHeapIndex = TextureSrvIndex("brickTex");
 	brickMat->DiffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
 	brickMat->FresnelR0 = XMFLOAT3(0.03f, 0.03f, 0.03f);
 	brickMat->Roughness = 0.2f;
@@ -1526,7 +4081,7 @@ void ShapesApp::BuildMaterials()
 	auto roofMat = std::make_unique<Material>();
 	roofMat->Name = "roofMat";
 	roofMat->MatCBIndex = heapIndex++;
-	roofMat->DiffuseSrvHeapIndex = 3; // roofTex
+	roofMat->DiffuseSrvHeapIndex = TextureSrvIndex("roofTex");
 	roofMat->DiffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
 	roofMat->FresnelR0 = XMFLOAT3(0.01f, 0.01f, 0.01f);
 	roofMat->Roughness = 0.6f;
@@ -1535,7 +4090,7 @@ void ShapesApp::BuildMaterials()
 	auto goldMat = std::make_unique<Material>();
 	goldMat->Name = "goldMat";
 	goldMat->MatCBIndex = heapIndex++;
-	goldMat->DiffuseSrvHeapIndex = 4; // goldTex
+	goldMat->DiffuseSrvHeapIndex = TextureSrvIndex("goldTex");
 	goldMat->DiffuseAlbedo = XMFLOAT4(1.0f, 0.85f, 0.0f, 1.0f);
 	goldMat->FresnelR0 = XMFLOAT3(0.8f, 0.7f, 0.2f);
 	goldMat->Roughness = 0.1f;
@@ -1544,7 +4099,7 @@ void ShapesApp::BuildMaterials()
 	auto treeMat = std::make_unique<Material>();
 	treeMat->Name = "treeMat";
 	treeMat->MatCBIndex = heapIndex++;
-	treeMat->DiffuseSrvHeapIndex = 5; 
+	treeMat->DiffuseSrvHeapIndex = TextureSrvIndex("treeArrayTex");
 	treeMat->DiffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
 	treeMat->FresnelR0 = XMFLOAT3(0.01f, 0.01f, 0.01f);
 	treeMat->Roughness = 0.2f;
@@ -1553,12 +4108,13 @@ void ShapesApp::BuildMaterials()
 	auto waterMat = std::make_unique<Material>();
 	waterMat->Name = "waterMat";
 	waterMat->MatCBIndex = heapIndex++; 
-	waterMat->DiffuseSrvHeapIndex = 6;  
+	waterMat->DiffuseSrvHeapIndex = TextureSrvIndex("waterTex");
 	waterMat->DiffuseAlbedo = XMFLOAT4(0.2f, 0.4f, 0.8f, 0.6f); 
 	waterMat->FresnelR0 = XMFLOAT3(0.1f, 0.1f, 0.1f);
 	waterMat->Roughness = 0.1f;
 
 
+	mGroundMaterial = groundMat.get();
 	mMaterials["groundMat"] = std::move(groundMat);
 	mMaterials["stoneMat"] = std::move(stoneMat);
 	mMaterials["darkStoneMat"] = std::move(darkStoneMat);
@@ -1567,600 +4123,763 @@ void ShapesApp::BuildMaterials()
 	mMaterials["goldMat"] = std::move(goldMat);
 	mMaterials["treeMat"] = std::move(treeMat);
 	mMaterials["waterMat"] = std::move(waterMat);
-	
+
+	// Prop materials all share the atlas SRV and select their flag through MatTransform.
+	const std::pair<const char*, const char*> propMats[] =
+	{
+		{ "whiteMat", "whiteTex" },
+		{ "canadaFlagMat", "canadaTex" },
+		{ "usFlagMat", "usTex" },
+		{ "ukFlagMat", "ukTex" },
+	};
+
+	for (const auto& p : propMats)
+	{
+		auto mat = std::make_unique<Material>();
+		mat->Name = p.first;
+		mat->MatCBIndex = heapIndex++;
+		mat->DiffuseSrvHeapIndex = TextureSrvIndex("propAtlasTex");
+		mat->DiffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
+		mat->FresnelR0 = XMFLOAT3(0.01f, 0.01f, 0.01f);
+		mat->Roughness = 0.8f;
+		mPropAtlas->ApplyToMaterial(mat.get(), p.second);
+
+		mMaterials[mat->Name] = std::move(mat);
+	}
 }
 
-void ShapesApp::BuildRenderItems()
+EntityWorld::Entity ShapesApp::SpawnRenderable(const RenderMeshComponent& mesh, Material* mat, const XMMATRIX& world,
+	const XMMATRIX& texTransform, const BoundingBox& localBounds, const LodComponent* lod)
 {
-	// Clear existing render items
-	mAllRitems.clear();
-	for (int i = 0; i < (int)RenderLayer::Count; ++i)
-		mRitemLayer[i].clear();
+	TransformComponent transform;
+	XMStoreFloat4x4(&transform.World, world);
+	XMStoreFloat4x4(&transform.TexTransform, texTransform);
+
+	BoundsComponent bounds;
+	bounds.Local = localBounds;
+	localBounds.Transform(bounds.World, world);
+
+	RenderMeshComponent renderMesh = mesh;
+	if (!mFreeObjectSlots.empty())
+	{
+		renderMesh.ObjCBIndex = mFreeObjectSlots.back();
+		mFreeObjectSlots.pop_back();
+	}
+	else
+	{
+		renderMesh.ObjCBIndex = mObjectCount++;
+	}
+
+	MaterialComponent material;
+	material.Mat = mat;
+
+	if (lod != nullptr)
+		return mEntities.Spawn(transform, bounds, renderMesh, material, *lod);
+	return mEntities.Spawn(transform, bounds, renderMesh, material);
+}
+
+EntityWorld::Entity ShapesApp::SpawnPackObject(const ScenePack& pack, const ScenePack::Object& object, MeshGeometry* geo)
+{
+	const ScenePack::Submesh& submesh = pack.Submeshes()[object.Submesh];
+
+	RenderMeshComponent mesh;
+	mesh.Geo = geo;
+	mesh.IndexCount = submesh.IndexCount;
+	mesh.StartIndexLocation = submesh.StartIndexLocation;
+	mesh.BaseVertexLocation = submesh.BaseVertexLocation;
+	mesh.Layer = (RenderLayer)object.Layer;
+
+	std::uint32_t firstSample = 0, sampleCount = 0;
+	if (mBakedLightingFile.Find(BakedLightingKey(pack, object, object.Submesh), firstSample, sampleCount))
+		mesh.BakedLightingOffset = firstSample;
+
+	// Materials are looked up by name, since a cell's pack only has the ones it uses.
+	BoundingBox bounds(XMFLOAT3(submesh.BoundsCenter), XMFLOAT3(submesh.BoundsExtents));
+	Material* mat = mMaterials[pack.String(pack.Materials()[object.Material].Name)].get();
+	XMMATRIX world = XMLoadFloat4x4((const XMFLOAT4X4*)object.World);
+	XMMATRIX texTransform = XMLoadFloat4x4((const XMFLOAT4X4*)object.TexTransform);
+	if (submesh.NextLod == ScenePack::NoLod)
+		return SpawnRenderable(mesh, mat, world, texTransform, bounds);
+
+	// The errors are cooked in local units; the largest axis scale makes them world units.
+	float scale = MathHelper::Max(XMVectorGetX(XMVector3Length(world.r[0])),
+		MathHelper::Max(XMVectorGetX(XMVector3Length(world.r[1])), XMVectorGetX(XMVector3Length(world.r[2]))));
+
+	LodComponent lod;
+	lod.Levels.Count = 0;
+	for (std::uint32_t s = object.Submesh; s != ScenePack::NoLod && lod.Levels.Count < LodSelector::MaxLods;
+		s = pack.Submeshes()[s].NextLod)
+	{
+		const ScenePack::Submesh& level = pack.Submeshes()[s];
+		std::uint32_t k = lod.Levels.Count++;
+		lod.Levels.Error[k] = level.LodError * scale;
+		lod.Levels.Triangles[k] = level.IndexCount / 3;
+		lod.IndexCount[k] = level.IndexCount;
+		lod.StartIndexLocation[k] = level.StartIndexLocation;
+		lod.BaseVertexLocation[k] = level.BaseVertexLocation;
+		lod.BakedLightingOffset[k] = ~0u;
+		if (mBakedLightingFile.Find(BakedLightingKey(pack, object, s), firstSample, sampleCount))
+			lod.BakedLightingOffset[k] = firstSample;
+	}
+	return SpawnRenderable(mesh, mat, world, texTransform, bounds, &lod);
+}
+
+void ShapesApp::AddSceneObject(ScenePackWriter& pack, const std::string& geo, const std::string& submesh,
+	const std::string& mat, const XMMATRIX& world, const XMMATRIX& texTransform, RenderLayer layer)
+{
+	XMFLOAT4X4 w, t;
+	XMStoreFloat4x4(&w, world);
+	XMStoreFloat4x4(&t, texTransform);
+
+	if (!pack.AddObject(geo, submesh, mat, &w._11, &t._11, (std::uint32_t)layer))
+		OutputDebugStringA(("Scene pack: unknown geometry, submesh or material for " + geo + "/" + submesh + "\n").c_str());
+}
+
+bool ShapesApp::SceneKey(std::uint64_t& key)
+{
+	// Returns false if a data input cannot be read; the key is then no proof that a pack
+	// on disk is current.
+	std::vector<const char*> inputs = { gMazePath };
+	for (const auto& src : gPropAtlasSources)
+		inputs.push_back(src.second);
+
+	key = Hash::Fnv1aValue(mMaterialSrvCount, Hash::Fnv1aValue(gSceneCookVersion));
+	for (const char* input : inputs)
+	{
+		std::ifstream fin(input, std::ios::binary);
+		if (!fin)
+		{
+			OutputDebugStringA(("Scene pack: cannot read " + std::string(input) + "\n").c_str());
+			return false;
+		}
+		std::ostringstream oss;
+		oss << fin.rdbuf();
+		key = Hash::Fnv1a(oss.str(), Hash::Fnv1a(input, key));
+	}
+	return true;
+}
+
+bool ShapesApp::MeshCodecRoundTrips(const void* vertices, size_t vertexCount, size_t vertexStride,
+	const void* indices, size_t indexCount, size_t indexSize)
+{
+	// The codec is lossless, so every byte has to come back: the indices exactly, and the
+	// positions and normals with no error at all.  An encoding missing its last byte has
+	// to be refused rather than decoded into something.
+	std::vector<std::uint8_t> encoded;
+	std::vector<std::uint8_t> decodedVertices(vertexCount * vertexStride);
+	MeshCodec::EncodeVertexBuffer(vertices, vertexCount, vertexStride, encoded);
+	bool same = MeshCodec::DecodeVertexBuffer(decodedVertices.data(), vertexCount, vertexStride, encoded.data(), encoded.size()) &&
+		memcmp(decodedVertices.data(), vertices, decodedVertices.size()) == 0 &&
+		!MeshCodec::DecodeVertexBuffer(decodedVertices.data(), vertexCount, vertexStride, encoded.data(), encoded.size() - 1);
+
+	encoded.clear();
+	std::vector<std::uint8_t> decodedIndices(indexCount * indexSize);
+	MeshCodec::EncodeIndexBuffer(indices, indexCount, indexSize, encoded);
+	return same && MeshCodec::DecodeIndexBuffer(decodedIndices.data(), indexCount, indexSize, encoded.data(), encoded.size()) &&
+		memcmp(decodedIndices.data(), indices, decodedIndices.size()) == 0 &&
+		!MeshCodec::DecodeIndexBuffer(decodedIndices.data(), indexCount, indexSize, encoded.data(), encoded.size() - 1);
+}
+
+void ShapesApp::CheckMeshCodec(const MeshGeometry& geo)
+{
+	// Encodes and decodes the geometry as it comes from the generators, before the cook
+	// reorders it, and stops if any byte comes back different.
+	const size_t vertexCount = geo.VertexBufferCPU->GetBufferSize() / geo.VertexByteStride;
+	const size_t indexSize = geo.IndexFormat == DXGI_FORMAT_R16_UINT ? 2 : 4;
+	const size_t indexCount = geo.IndexBufferCPU->GetBufferSize() / indexSize;
+	if (geo.VertexByteStride > MeshCodec::MaxVertexStride || indexCount % 3 != 0)
+		return;
+
+	if (!MeshCodecRoundTrips(geo.VertexBufferCPU->GetBufferPointer(), vertexCount, geo.VertexByteStride,
+		geo.IndexBufferCPU->GetBufferPointer(), indexCount, indexSize))
+	{
+		OutputDebugStringA(("Mesh codec: " + geo.Name + " does not decode to what was encoded\n").c_str());
+		ThrowIfFailed(E_FAIL);
+	}
+}
+
+void ShapesApp::CheckMeshCodecOnGenerators()
+{
+	// Runs on every start, release builds included: every shape GeometryGenerator makes is
+	// round-tripped with 32 and 16 bit indices, so a codec that breaks any of them stops
+	// the app before a pack is cooked with it.
+	GeometryGenerator geoGen;
+	std::pair<const char*, GeometryGenerator::MeshData> meshes[] =
+	{
+		{ "box", geoGen.CreateBox(1.0f, 1.0f, 1.0f, 3) },
+		{ "grid", geoGen.CreateGrid(20.0f, 30.0f, 60, 40) },
+		{ "sphere", geoGen.CreateSphere(0.5f, 20, 20) },
+		{ "geosphere", geoGen.CreateGeosphere(0.5f, 3) },
+		{ "cylinder", geoGen.CreateCylinder(0.5f, 0.3f, 3.0f, 20, 20) },
+		{ "quad", geoGen.CreateQuad(0.0f, 0.0f, 1.0f, 1.0f, 0.0f) },
+		{ "cone", geoGen.CreateCone(1.0f, 2.0f, 20, 20) },
+		{ "wedge", geoGen.CreateWedge(1.0f, 1.0f, 1.0f) },
+		{ "torus", geoGen.CreateTorus(1.0f, 0.3f, 20, 20) },
+		{ "pyramid", geoGen.CreatePyramid(1.0f, 1.0f, 1.0f) },
+		{ "diamond", geoGen.CreateDiamond(1.0f, 1.0f) },
+		{ "triangularPrism", geoGen.CreateTriangularPrism(1.0f, 1.0f, 1.0f) },
+		{ "hexagonalPrism", geoGen.CreateHexagonalPrism(1.0f, 1.0f) },
+	};
+
+	for (auto& mesh : meshes)
+	{
+		GeometryGenerator::MeshData& data = mesh.second;
+		const size_t vertexStride = sizeof(GeometryGenerator::Vertex);
+		bool same = MeshCodecRoundTrips(data.Vertices.data(), data.Vertices.size(), vertexStride,
+			data.Indices32.data(), data.Indices32.size(), 4);
+		if (data.Vertices.size() <= 0x10000)
+			same = same && MeshCodecRoundTrips(data.Vertices.data(), data.Vertices.size(), vertexStride,
+				data.GetIndices16().data(), data.Indices32.size(), 2);
+
+		if (!same)
+		{
+			OutputDebugStringA((std::string("Mesh codec: the generator's ") + mesh.first + " does not decode to what was encoded\n").c_str());
+			ThrowIfFailed(E_FAIL);
+		}
+	}
+}
+
+void ShapesApp::CookScenePack(const std::string& path)
+{
+	// Runs the scene builders on the CPU and writes what they made to the pack.  Nothing
+	// is uploaded here; LoadScenePack uploads from the pack however it came to be.
+	LARGE_INTEGER start, end, frequency;
+	QueryPerformanceCounter(&start);
+
+	ScenePackWriter pack;
+	BuildShapeGeometry();
+	BuildWaterGeometry();
+	BuildMazeGeometry(pack);
+	BuildSubmeshBounds();
+	BuildMaterials();
+
+	// In name order, so the same scene always cooks into the same bytes.
+	std::map<std::string, const MeshGeometry*> geometries;
+	for (const auto& geo : mGeometries)
+		geometries[geo.first] = geo.second.get();
+
+	for (const auto& entry : geometries)
+	{
+		const MeshGeometry* geo = entry.second;
+#if defined(DEBUG) || defined(_DEBUG)
+		CheckMeshCodec(*geo);
+#endif
+		pack.AddMesh(geo->Name, geo->VertexByteStride, geo->IndexFormat == DXGI_FORMAT_R16_UINT ? 2 : 4,
+			geo->VertexBufferCPU->GetBufferPointer(), geo->VertexBufferCPU->GetBufferSize(),
+			geo->IndexBufferCPU->GetBufferPointer(), geo->IndexBufferCPU->GetBufferSize());
+
+		std::map<std::string, SubmeshGeometry> submeshes(geo->DrawArgs.begin(), geo->DrawArgs.end());
+		for (const auto& args : submeshes)
+		{
+			const SubmeshGeometry& submesh = args.second;
+			pack.AddSubmesh(args.first, submesh.IndexCount, submesh.StartIndexLocation, submesh.BaseVertexLocation,
+				&submesh.Bounds.Center.x, &submesh.Bounds.Extents.x);
+		}
+
+		// <name>_lod1, _lod2 ... are coarser levels of detail of <name>, each linked with how
+		// far it is from the full detail.
+		auto view = [geo](const SubmeshGeometry& submesh)
+		{
+			LodSelector::MeshView mesh;
+			mesh.Vertices = (const std::uint8_t*)geo->VertexBufferCPU->GetBufferPointer();
+			mesh.VertexStride = geo->VertexByteStride;
+			mesh.VertexCount = (UINT)(geo->VertexBufferCPU->GetBufferSize() / geo->VertexByteStride);
+			mesh.Indices = (const std::uint8_t*)geo->IndexBufferCPU->GetBufferPointer();
+			mesh.IndexSize = geo->IndexFormat == DXGI_FORMAT_R16_UINT ? 2 : 4;
+			mesh.IndexCount = submesh.IndexCount;
+			mesh.StartIndexLocation = submesh.StartIndexLocation;
+			mesh.BaseVertexLocation = submesh.BaseVertexLocation;
+			return mesh;
+		};
+		for (const auto& args : submeshes)
+		{
+			for (UINT k = 1; k < LodSelector::MaxLods; ++k)
+			{
+				auto coarser = submeshes.find(args.first + "_lod" + std::to_string(k));
+				if (coarser == submeshes.end())
+					break;
+
+				float error = LodSelector::MeasureError(view(args.second), view(coarser->second));
+				pack.LinkLod(geo->Name, args.first, coarser->first, error);
+			}
+		}
+	}
+
+	// In constant buffer order, which the pack keeps.
+	std::vector<const Material*> materials(mMaterials.size());
+	for (const auto& mat : mMaterials)
+		materials[mat.second->MatCBIndex] = mat.second.get();
+
+	for (const Material* mat : materials)
+	{
+		ScenePack::Material packed;
+		packed.DiffuseSrvHeapIndex = mat->DiffuseSrvHeapIndex;
+		memcpy(packed.DiffuseAlbedo, &mat->DiffuseAlbedo, sizeof(packed.DiffuseAlbedo));
+		memcpy(packed.FresnelR0, &mat->FresnelR0, sizeof(packed.FresnelR0));
+		packed.Roughness = mat->Roughness;
+		memcpy(packed.MatTransform, &mat->MatTransform, sizeof(packed.MatTransform));
+		pack.AddMaterial(mat->Name, packed);
+	}
+
+	BuildSceneLayout(pack);
+
+	// The objects that fit a world cell move to a pack of that cell.  If a cell cannot be
+	// written, nothing is split and every object stays in the main pack.
+	ScenePackWriter global;
+	std::vector<ScenePackWriter::CellContents> cells;
+	bool split = pack.SplitCells(gWorldCellSize, global, cells);
+	std::uint32_t reordered = 0;
+	std::uint64_t saved = 0;
+
+	const std::string stem = path.substr(0, path.find_last_of('.'));
+	for (size_t i = 0; i < cells.size() && split; ++i)
+	{
+		ScenePackWriter& cellPack = *cells[i].Writer;
+		reordered += cellPack.OptimizeVertexFetch();
+		saved += cellPack.CompressGeometry();
+
+		ScenePack::Cell cell;
+		cell.X = cells[i].X;
+		cell.Z = cells[i].Z;
+		memcpy(cell.Min, cells[i].Min, sizeof(cell.Min));
+		memcpy(cell.Max, cells[i].Max, sizeof(cell.Max));
+		cell.ObjectCount = cellPack.ObjectCount();
+		cell.UploadBytes = cellPack.GeometryBytes();
+
+		std::vector<std::uint8_t> cellBytes;
+		cell.ContentHash = cellPack.Build(mSceneKey, 0.0, cellBytes);
+
+		std::ostringstream cellPath;
+		cellPath << stem << ".cell." << cell.X << "." << cell.Z << ".bin";
+		split = ScenePackWriter::WriteFile(cellPath.str(), cellBytes);
+		global.AddCell(cell, cellPath.str());
+	}
+	if (!split)
+	{
+		reordered = 0;
+		saved = 0;
+		cells.clear();
+	}
+
+	ScenePackWriter& main = split ? global : pack;
+	reordered += main.OptimizeVertexFetch();
+	saved += main.CompressGeometry();
+
+	mGeometries.clear();
+	mMaterials.clear();
+
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+	double milliseconds = 1000.0 * (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+	std::vector<std::uint8_t> bytes;
+	main.Build(mSceneKey, milliseconds, bytes);
+
+	// Without a file this run still uses the pack, from memory.
+	bool written = ScenePackWriter::WriteFile(path, bytes) && mScenePack.Open(path, mSceneKey, mMaterialSrvCount);
+	if (!written && !mScenePack.Adopt(std::move(bytes), mSceneKey, mMaterialSrvCount))
+		ThrowIfFailed(E_FAIL);
+
+	std::ostringstream oss;
+	oss << "Scene pack: cooked in " << milliseconds << " ms, " << cells.size() << " world cells, " << reordered
+		<< " meshes reordered for vertex fetch, " << saved / 1024 << " KB saved by geometry compression";
+	if (!split)
+		oss << ", could not write the world cells";
+	if (!written)
+		oss << ", could not write " << path;
+	oss << "\n";
+	OutputDebugStringA(oss.str().c_str());
+}
+
+void ShapesApp::LoadScenePack()
+{
+	const std::string path = gCacheDir + "ScenePack.bin";
+	// With an input missing the pack on disk cannot be trusted; the cook then stops on the
+	// maze itself if that is what is missing.
+	if (!SceneKey(mSceneKey) || !mScenePack.Open(path, mSceneKey, mMaterialSrvCount))
+		CookScenePack(path);
+
+	LARGE_INTEGER start, end, decodeStart, decodeEnd, frequency;
+	QueryPerformanceCounter(&start);
+	LONGLONG decodeTicks = 0;
+
+	// Raw buffers are uploaded straight out of the pack; compressed ones are decoded first.
+	std::vector<std::uint8_t> vertexStorage;
+	std::vector<std::uint8_t> indexStorage;
+	for (std::uint32_t i = 0; i < mScenePack.MeshCount(); ++i)
+	{
+		const ScenePack::Mesh& mesh = mScenePack.Meshes()[i];
+
+		const std::uint8_t* vertices = nullptr;
+		const std::uint8_t* indices = nullptr;
+		QueryPerformanceCounter(&decodeStart);
+		if (!mScenePack.ReadMesh(mesh, vertices, indices, vertexStorage, indexStorage))
+			ThrowIfFailed(E_FAIL);
+		QueryPerformanceCounter(&decodeEnd);
+		decodeTicks += decodeEnd.QuadPart - decodeStart.QuadPart;
+
+		auto geo = CreatePackGeometry(mCommandList.Get(), mScenePack, mesh, vertices, indices);
+		mGeometries[geo->Name] = std::move(geo);
+	}
+
+	for (std::uint32_t i = 0; i < mScenePack.MaterialCount(); ++i)
+	{
+		const ScenePack::Material& packed = mScenePack.Materials()[i];
+
+		auto mat = std::make_unique<Material>();
+		mat->Name = mScenePack.String(packed.Name);
+		mat->MatCBIndex = (int)i;
+		mat->DiffuseSrvHeapIndex = packed.DiffuseSrvHeapIndex;
+		memcpy(&mat->DiffuseAlbedo, packed.DiffuseAlbedo, sizeof(packed.DiffuseAlbedo));
+		memcpy(&mat->FresnelR0, packed.FresnelR0, sizeof(packed.FresnelR0));
+		mat->Roughness = packed.Roughness;
+		memcpy(&mat->MatTransform, packed.MatTransform, sizeof(packed.MatTransform));
+		mMaterials[mat->Name] = std::move(mat);
+	}
+
+	const ScenePack::Collider* colliders = mScenePack.Colliders();
+	for (std::uint32_t i = 0; i < mScenePack.ColliderCount(); ++i)
+	{
+		ColliderComponent collider;
+		collider.Box = BoundingBox(XMFLOAT3(colliders[i].Center), XMFLOAT3(colliders[i].Extents));
+		mEntities.Spawn(collider);
+	}
+
+	const ScenePack::Segment* segments = mScenePack.Segments();
+	mMazeWallSegments.clear();
+	for (std::uint32_t i = 0; i < mScenePack.SegmentCount(); ++i)
+		mMazeWallSegments.push_back(XMFLOAT4(segments[i].X0, segments[i].Z0, segments[i].X1, segments[i].Z1));
+
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+	double milliseconds = 1000.0 * (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+	std::ostringstream oss;
+	oss << "Scene pack: " << mScenePack.MeshCount() << " meshes, " << mScenePack.MaterialCount() << " materials, "
+		<< mScenePack.ObjectCount() << " objects, " << mScenePack.SizeInBytes() / 1024 << " KB "
+		<< (mScenePack.IsMapped() ? "mapped" : "in memory") << ", loaded in " << milliseconds << " ms ("
+		<< 1000.0 * (double)decodeTicks / (double)frequency.QuadPart << " ms decoding geometry) against "
+		<< mScenePack.CookMilliseconds() << " ms to build the scene from code\n";
+	OutputDebugStringA(oss.str().c_str());
+}
 
-	UINT objCBIndex = 0;
+std::unique_ptr<MeshGeometry> ShapesApp::CreatePackGeometry(ID3D12GraphicsCommandList* cmdList, const ScenePack& pack,
+	const ScenePack::Mesh& mesh, const std::uint8_t* vertices, const std::uint8_t* indices)
+{
+	auto geo = std::make_unique<MeshGeometry>();
+	geo->Name = pack.String(mesh.Name);
+	geo->VertexByteStride = mesh.VertexStride;
+	geo->VertexBufferByteSize = (UINT)mesh.VertexBytes;
+	geo->IndexFormat = mesh.IndexSize == 2 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+	geo->IndexBufferByteSize = (UINT)mesh.IndexBytes;
+
+	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(), cmdList,
+		vertices, mesh.VertexBytes, geo->VertexBufferUploader);
+	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(), cmdList,
+		indices, mesh.IndexBytes, geo->IndexBufferUploader);
+
+	const ScenePack::Submesh* submeshes = pack.Submeshes();
+	for (std::uint32_t s = mesh.FirstSubmesh; s < mesh.FirstSubmesh + mesh.SubmeshCount; ++s)
+	{
+		SubmeshGeometry submesh;
+		submesh.IndexCount = submeshes[s].IndexCount;
+		submesh.StartIndexLocation = submeshes[s].StartIndexLocation;
+		submesh.BaseVertexLocation = submeshes[s].BaseVertexLocation;
+		submesh.Bounds = BoundingBox(XMFLOAT3(submeshes[s].BoundsCenter), XMFLOAT3(submeshes[s].BoundsExtents));
+		geo->DrawArgs[pack.String(submeshes[s].Name)] = submesh;
+	}
+	return geo;
+}
 
-	
+void ShapesApp::BuildSceneLayout(ScenePackWriter& pack)
+{
+	// The static objects of the scene, cooked into the pack by name.
 
 	// WATER
-	auto waterRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&waterRitem->World, XMMatrixTranslation(0.0f, -0.7f, 0.0f));
-	XMStoreFloat4x4(&waterRitem->TexTransform, XMMatrixScaling(8.0f, 8.0f, 1.0f));
-	waterRitem->ObjCBIndex = objCBIndex++;
-	waterRitem->Mat = mMaterials["waterMat"].get();
-	waterRitem->Geo = mGeometries["waterGeo"].get();
-	waterRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	waterRitem->IndexCount = waterRitem->Geo->DrawArgs["water"].IndexCount;
-	waterRitem->StartIndexLocation = waterRitem->Geo->DrawArgs["water"].StartIndexLocation;
-	waterRitem->BaseVertexLocation = waterRitem->Geo->DrawArgs["water"].BaseVertexLocation;
-
-	mWaterRitem = waterRitem.get();
-	mRitemLayer[(int)RenderLayer::Transparent].push_back(waterRitem.get());
-	mAllRitems.push_back(std::move(waterRitem));
-
-	// TREEE
-	auto treeRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&treeRitem->World, XMMatrixTranslation(0.0f, 0.0f, 0.0f));
-	XMStoreFloat4x4(&treeRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	treeRitem->ObjCBIndex = objCBIndex++;
-	treeRitem->Mat = mMaterials["treeMat"].get();
-	treeRitem->Geo = mGeometries["treeGeo"].get();
-	treeRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_POINTLIST;
-	treeRitem->IndexCount = treeRitem->Geo->DrawArgs["points"].IndexCount;
-	treeRitem->StartIndexLocation = treeRitem->Geo->DrawArgs["points"].StartIndexLocation;
-	treeRitem->BaseVertexLocation = treeRitem->Geo->DrawArgs["points"].BaseVertexLocation;
-
-	mRitemLayer[(int)RenderLayer::AlphaTestedTreeSprites].push_back(treeRitem.get());
-	mAllRitems.push_back(std::move(treeRitem));
+	AddSceneObject(pack, "waterGeo", "water", "waterMat",
+		XMMatrixTranslation(0.0f, -0.7f, 0.0f), XMMatrixScaling(8.0f, 8.0f, 1.0f), RenderLayer::Transparent);
 
 	// MAZE
-	auto mazeRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&mazeRitem->World, XMMatrixTranslation(0.0f, 0.0f, 110.0f));
-	XMStoreFloat4x4(&mazeRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	mazeRitem->ObjCBIndex = objCBIndex++;
-	mazeRitem->Mat = mMaterials["stoneMat"].get();
-	mazeRitem->Geo = mGeometries["mazeGeo"].get();
-	mazeRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	mazeRitem->IndexCount = mazeRitem->Geo->DrawArgs["walls"].IndexCount;
-	mazeRitem->StartIndexLocation = mazeRitem->Geo->DrawArgs["walls"].StartIndexLocation;
-	mazeRitem->BaseVertexLocation = mazeRitem->Geo->DrawArgs["walls"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(mazeRitem.get());
-	mAllRitems.push_back(std::move(mazeRitem));
+	AddSceneObject(pack, "mazeGeo", "walls", "stoneMat",
+		XMMatrixTranslation(0.0f, 0.0f, 110.0f), XMMatrixScaling(1.0f, 1.0f, 1.0f));
 
 	// GROUND 
-	auto groundRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&groundRitem->World, XMMatrixTranslation(0.0f, -0.5f, 0.0f));
-	XMStoreFloat4x4(&groundRitem->TexTransform, XMMatrixScaling(8.0f, 8.0f, 1.0f));
-	groundRitem->ObjCBIndex = objCBIndex++;
-	groundRitem->Mat = mMaterials["groundMat"].get();
-	groundRitem->Geo = mGeometries["castleGeo"].get();
-	groundRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	groundRitem->IndexCount = groundRitem->Geo->DrawArgs["ground"].IndexCount;
-	groundRitem->StartIndexLocation = groundRitem->Geo->DrawArgs["ground"].StartIndexLocation;
-	groundRitem->BaseVertexLocation = groundRitem->Geo->DrawArgs["ground"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(groundRitem.get());
-	mAllRitems.push_back(std::move(groundRitem));
+	AddSceneObject(pack, "castleGeo", "ground", "groundMat",
+		XMMatrixTranslation(0.0f, gGroundY, 0.0f), XMMatrixScaling(8.0f, 8.0f, 1.0f));
 
 	// FOUNDATION
-	auto keepFoundationRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&keepFoundationRitem->World, XMMatrixTranslation(0.0f, 1.0f, 0.0f));
-	XMStoreFloat4x4(&keepFoundationRitem->TexTransform, XMMatrixScaling(2.0f, 1.0f, 1.5f));
-	keepFoundationRitem->ObjCBIndex = objCBIndex++;
-	keepFoundationRitem->Mat = mMaterials["darkStoneMat"].get();
-	keepFoundationRitem->Geo = mGeometries["castleGeo"].get();
-	keepFoundationRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	keepFoundationRitem->IndexCount = keepFoundationRitem->Geo->DrawArgs["keepFoundation"].IndexCount;
-	keepFoundationRitem->StartIndexLocation = keepFoundationRitem->Geo->DrawArgs["keepFoundation"].StartIndexLocation;
-	keepFoundationRitem->BaseVertexLocation = keepFoundationRitem->Geo->DrawArgs["keepFoundation"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(keepFoundationRitem.get());
-	mAllRitems.push_back(std::move(keepFoundationRitem));
+	AddSceneObject(pack, "castleGeo", "keepFoundation", "darkStoneMat",
+		XMMatrixTranslation(0.0f, 1.0f, 0.0f), XMMatrixScaling(2.0f, 1.0f, 1.5f));
 
 	// BODY
-	auto keepBodyRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&keepBodyRitem->World, XMMatrixTranslation(0.0f, 6.0f, 0.0f));
-	XMStoreFloat4x4(&keepBodyRitem->TexTransform, XMMatrixScaling(2.0f, 3.0f, 2.0f));
-	keepBodyRitem->ObjCBIndex = objCBIndex++;
-	keepBodyRitem->Mat = mMaterials["brickMat"].get();
-	keepBodyRitem->Geo = mGeometries["castleGeo"].get();
-	keepBodyRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	keepBodyRitem->IndexCount = keepBodyRitem->Geo->DrawArgs["keepBody"].IndexCount;
-	keepBodyRitem->StartIndexLocation = keepBodyRitem->Geo->DrawArgs["keepBody"].StartIndexLocation;
-	keepBodyRitem->BaseVertexLocation = keepBodyRitem->Geo->DrawArgs["keepBody"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(keepBodyRitem.get());
-	mAllRitems.push_back(std::move(keepBodyRitem));
+	AddSceneObject(pack, "castleGeo", "keepBody", "brickMat",
+		XMMatrixTranslation(0.0f, 6.0f, 0.0f), XMMatrixScaling(2.0f, 3.0f, 2.0f));
 
 	// OUTER WALLS
 	// North Wall (facing +Z)
-	auto northWallRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&northWallRitem->World, XMMatrixTranslation(0.0f, 3.0f, 30.0f));
-	XMStoreFloat4x4(&northWallRitem->TexTransform, XMMatrixScaling(6.0f, 1.0f, 1.0f));
-	northWallRitem->ObjCBIndex = objCBIndex++;
-	northWallRitem->Mat = mMaterials["stoneMat"].get();
-	northWallRitem->Geo = mGeometries["castleGeo"].get();
-	northWallRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	northWallRitem->IndexCount = northWallRitem->Geo->DrawArgs["outerWallLong"].IndexCount;
-	northWallRitem->StartIndexLocation = northWallRitem->Geo->DrawArgs["outerWallLong"].StartIndexLocation;
-	northWallRitem->BaseVertexLocation = northWallRitem->Geo->DrawArgs["outerWallLong"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(northWallRitem.get());
-	mAllRitems.push_back(std::move(northWallRitem));
+	AddSceneObject(pack, "castleGeo", "outerWallLong", "stoneMat",
+		XMMatrixTranslation(0.0f, 3.0f, 30.0f), XMMatrixScaling(6.0f, 1.0f, 1.0f));
 
 	// South Wall (facing -Z)
-	auto southWallRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&southWallRitem->World, XMMatrixTranslation(0.0f, 3.0f, -30.0f));
-	XMStoreFloat4x4(&southWallRitem->TexTransform, XMMatrixScaling(6.0f, 1.0f, 1.0f));
-	southWallRitem->ObjCBIndex = objCBIndex++;
-	southWallRitem->Mat = mMaterials["stoneMat"].get();
-	southWallRitem->Geo = mGeometries["castleGeo"].get();
-	southWallRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	southWallRitem->IndexCount = southWallRitem->Geo->DrawArgs["outerWallLong"].IndexCount;
-	southWallRitem->StartIndexLocation = southWallRitem->Geo->DrawArgs["outerWallLong"].StartIndexLocation;
-	southWallRitem->BaseVertexLocation = southWallRitem->Geo->DrawArgs["outerWallLong"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(southWallRitem.get());
-	mAllRitems.push_back(std::move(southWallRitem));
+	AddSceneObject(pack, "castleGeo", "outerWallLong", "stoneMat",
+		XMMatrixTranslation(0.0f, 3.0f, -30.0f), XMMatrixScaling(6.0f, 1.0f, 1.0f));
 
 	// East Wall (facing +X)
-	auto eastWallRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&eastWallRitem->World, XMMatrixTranslation(30.0f, 3.0f, 0.0f));
-	XMStoreFloat4x4(&eastWallRitem->TexTransform, XMMatrixScaling(6.0f, 1.0f, 1.0f));
-	eastWallRitem->ObjCBIndex = objCBIndex++;
-	eastWallRitem->Mat = mMaterials["stoneMat"].get();
-	eastWallRitem->Geo = mGeometries["castleGeo"].get();
-	eastWallRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	eastWallRitem->IndexCount = eastWallRitem->Geo->DrawArgs["outerWallShort"].IndexCount;
-	eastWallRitem->StartIndexLocation = eastWallRitem->Geo->DrawArgs["outerWallShort"].StartIndexLocation;
-	eastWallRitem->BaseVertexLocation = eastWallRitem->Geo->DrawArgs["outerWallShort"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(eastWallRitem.get());
-	mAllRitems.push_back(std::move(eastWallRitem));
+	AddSceneObject(pack, "castleGeo", "outerWallShort", "stoneMat",
+		XMMatrixTranslation(30.0f, 3.0f, 0.0f), XMMatrixScaling(6.0f, 1.0f, 1.0f));
 
 	// West Wall (facing -X)
-	auto westWallRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&westWallRitem->World, XMMatrixTranslation(-30.0f, 3.0f, 0.0f));
-	XMStoreFloat4x4(&westWallRitem->TexTransform, XMMatrixScaling(6.0f, 1.0f, 1.0f));
-	westWallRitem->ObjCBIndex = objCBIndex++;
-	westWallRitem->Mat = mMaterials["stoneMat"].get();
-	westWallRitem->Geo = mGeometries["castleGeo"].get();
-	westWallRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	westWallRitem->IndexCount = westWallRitem->Geo->DrawArgs["outerWallShort"].IndexCount;
-	westWallRitem->StartIndexLocation = westWallRitem->Geo->DrawArgs["outerWallShort"].StartIndexLocation;
-	westWallRitem->BaseVertexLocation = westWallRitem->Geo->DrawArgs["outerWallShort"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(westWallRitem.get());
-	mAllRitems.push_back(std::move(westWallRitem));
+	AddSceneObject(pack, "castleGeo", "outerWallShort", "stoneMat",
+		XMMatrixTranslation(-30.0f, 3.0f, 0.0f), XMMatrixScaling(6.0f, 1.0f, 1.0f));
 
 	// HEXAGONAL CORNER TOWERS
 	// Northwest Tower (-X, +Z)
-	auto nwTowerRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&nwTowerRitem->World, XMMatrixTranslation(-30.0f, 1.0f, 30.0f));
-	XMStoreFloat4x4(&nwTowerRitem->TexTransform, XMMatrixScaling(1.0f, 2.0f, 1.0f));
-	nwTowerRitem->ObjCBIndex = objCBIndex++;
-	nwTowerRitem->Mat = mMaterials["brickMat"].get();
-	nwTowerRitem->Geo = mGeometries["castleGeo"].get();
-	nwTowerRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	nwTowerRitem->IndexCount = nwTowerRitem->Geo->DrawArgs["hexTower"].IndexCount;
-	nwTowerRitem->StartIndexLocation = nwTowerRitem->Geo->DrawArgs["hexTower"].StartIndexLocation;
-	nwTowerRitem->BaseVertexLocation = nwTowerRitem->Geo->DrawArgs["hexTower"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(nwTowerRitem.get());
-	mAllRitems.push_back(std::move(nwTowerRitem));
+	AddSceneObject(pack, "castleGeo", "hexTower", "brickMat",
+		XMMatrixTranslation(-30.0f, 1.0f, 30.0f), XMMatrixScaling(1.0f, 2.0f, 1.0f));
 
 	// Northeast Tower (+X, +Z)
-	auto neTowerRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&neTowerRitem->World, XMMatrixTranslation(30.0f, 1.0f, 30.0f));
-	XMStoreFloat4x4(&neTowerRitem->TexTransform, XMMatrixScaling(1.0f, 2.0f, 1.0f));
-	neTowerRitem->ObjCBIndex = objCBIndex++;
-	neTowerRitem->Mat = mMaterials["brickMat"].get();
-	neTowerRitem->Geo = mGeometries["castleGeo"].get();
-	neTowerRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	neTowerRitem->IndexCount = neTowerRitem->Geo->DrawArgs["hexTower"].IndexCount;
-	neTowerRitem->StartIndexLocation = neTowerRitem->Geo->DrawArgs["hexTower"].StartIndexLocation;
-	neTowerRitem->BaseVertexLocation = neTowerRitem->Geo->DrawArgs["hexTower"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(neTowerRitem.get());
-	mAllRitems.push_back(std::move(neTowerRitem));
+	AddSceneObject(pack, "castleGeo", "hexTower", "brickMat",
+		XMMatrixTranslation(30.0f, 1.0f, 30.0f), XMMatrixScaling(1.0f, 2.0f, 1.0f));
 
 	// Southwest Tower (-X, -Z)
-	auto swTowerRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&swTowerRitem->World, XMMatrixTranslation(-30.0f, 1.0f, -30.0f));
-	XMStoreFloat4x4(&swTowerRitem->TexTransform, XMMatrixScaling(1.0f, 2.0f, 1.0f));
-	swTowerRitem->ObjCBIndex = objCBIndex++;
-	swTowerRitem->Mat = mMaterials["brickMat"].get();
-	swTowerRitem->Geo = mGeometries["castleGeo"].get();
-	swTowerRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	swTowerRitem->IndexCount = swTowerRitem->Geo->DrawArgs["hexTower"].IndexCount;
-	swTowerRitem->StartIndexLocation = swTowerRitem->Geo->DrawArgs["hexTower"].StartIndexLocation;
-	swTowerRitem->BaseVertexLocation = swTowerRitem->Geo->DrawArgs["hexTower"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(swTowerRitem.get());
-	mAllRitems.push_back(std::move(swTowerRitem));
+	AddSceneObject(pack, "castleGeo", "hexTower", "brickMat",
+		XMMatrixTranslation(-30.0f, 1.0f, -30.0f), XMMatrixScaling(1.0f, 2.0f, 1.0f));
 
 	// Southeast Tower (+X, -Z)
-	auto seTowerRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&seTowerRitem->World, XMMatrixTranslation(30.0f, 1.0f, -30.0f));
-	XMStoreFloat4x4(&seTowerRitem->TexTransform, XMMatrixScaling(1.0f, 2.0f, 1.0f));
-	seTowerRitem->ObjCBIndex = objCBIndex++;
-	seTowerRitem->Mat = mMaterials["brickMat"].get();
-	seTowerRitem->Geo = mGeometries["castleGeo"].get();
-	seTowerRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	seTowerRitem->IndexCount = seTowerRitem->Geo->DrawArgs["hexTower"].IndexCount;
-	seTowerRitem->StartIndexLocation = seTowerRitem->Geo->DrawArgs["hexTower"].StartIndexLocation;
-	seTowerRitem->BaseVertexLocation = seTowerRitem->Geo->DrawArgs["hexTower"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(seTowerRitem.get());
-	mAllRitems.push_back(std::move(seTowerRitem));
+	AddSceneObject(pack, "castleGeo", "hexTower", "brickMat",
+		XMMatrixTranslation(30.0f, 1.0f, -30.0f), XMMatrixScaling(1.0f, 2.0f, 1.0f));
 
 	// TORUS ROOFS ON TOWERS
 	// Northwest Tower Roof
-	auto nwTowerRoofRitem = std::make_unique<RenderItem>();
 	XMMATRIX nwRoofTransform = XMMatrixScaling(0.8f, 0.4f, 1.0f) * XMMatrixTranslation(-30.0f, 11.0f, 30.0f);
-	XMStoreFloat4x4(&nwTowerRoofRitem->World, nwRoofTransform);
-	XMStoreFloat4x4(&nwTowerRoofRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	nwTowerRoofRitem->ObjCBIndex = objCBIndex++;
-	nwTowerRoofRitem->Mat = mMaterials["roofMat"].get();
-	nwTowerRoofRitem->Geo = mGeometries["castleGeo"].get();
-	nwTowerRoofRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	nwTowerRoofRitem->IndexCount = nwTowerRoofRitem->Geo->DrawArgs["torusRoof"].IndexCount;
-	nwTowerRoofRitem->StartIndexLocation = nwTowerRoofRitem->Geo->DrawArgs["torusRoof"].StartIndexLocation;
-	nwTowerRoofRitem->BaseVertexLocation = nwTowerRoofRitem->Geo->DrawArgs["torusRoof"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(nwTowerRoofRitem.get());
-	mAllRitems.push_back(std::move(nwTowerRoofRitem));
+	AddSceneObject(pack, "castleGeo", "torusRoof", "roofMat", nwRoofTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
 
 	// Northeast Tower Roof
-	auto neTowerRoofRitem = std::make_unique<RenderItem>();
 	XMMATRIX neRoofTransform = XMMatrixScaling(0.8f, 0.4f, 1.0f) * XMMatrixTranslation(30.0f, 11.0f, 30.0f);
-	XMStoreFloat4x4(&neTowerRoofRitem->World, neRoofTransform);
-	XMStoreFloat4x4(&neTowerRoofRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	neTowerRoofRitem->ObjCBIndex = objCBIndex++;
-	neTowerRoofRitem->Mat = mMaterials["roofMat"].get();
-	neTowerRoofRitem->Geo = mGeometries["castleGeo"].get();
-	neTowerRoofRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	neTowerRoofRitem->IndexCount = neTowerRoofRitem->Geo->DrawArgs["torusRoof"].IndexCount;
-	neTowerRoofRitem->StartIndexLocation = neTowerRoofRitem->Geo->DrawArgs["torusRoof"].StartIndexLocation;
-	neTowerRoofRitem->BaseVertexLocation = neTowerRoofRitem->Geo->DrawArgs["torusRoof"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(neTowerRoofRitem.get());
-	mAllRitems.push_back(std::move(neTowerRoofRitem));
+	AddSceneObject(pack, "castleGeo", "torusRoof", "roofMat", neRoofTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
 
 	// Southwest Tower Roof
-	auto swTowerRoofRitem = std::make_unique<RenderItem>();
 	XMMATRIX swRoofTransform = XMMatrixScaling(0.8f, 0.4f, 1.0f) * XMMatrixTranslation(-30.0f, 11.0f, -30.0f);
-	XMStoreFloat4x4(&swTowerRoofRitem->World, swRoofTransform);
-	XMStoreFloat4x4(&swTowerRoofRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	swTowerRoofRitem->ObjCBIndex = objCBIndex++;
-	swTowerRoofRitem->Mat = mMaterials["roofMat"].get();
-	swTowerRoofRitem->Geo = mGeometries["castleGeo"].get();
-	swTowerRoofRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	swTowerRoofRitem->IndexCount = swTowerRoofRitem->Geo->DrawArgs["torusRoof"].IndexCount;
-	swTowerRoofRitem->StartIndexLocation = swTowerRoofRitem->Geo->DrawArgs["torusRoof"].StartIndexLocation;
-	swTowerRoofRitem->BaseVertexLocation = swTowerRoofRitem->Geo->DrawArgs["torusRoof"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(swTowerRoofRitem.get());
-	mAllRitems.push_back(std::move(swTowerRoofRitem));
+	AddSceneObject(pack, "castleGeo", "torusRoof", "roofMat", swRoofTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
 
 	// Southeast Tower Roof
-	auto seTowerRoofRitem = std::make_unique<RenderItem>();
 	XMMATRIX seRoofTransform = XMMatrixScaling(0.8f, 0.3f, 1.0f) * XMMatrixTranslation(30.0f, 11.0f, -30.0f);
-	XMStoreFloat4x4(&seTowerRoofRitem->World, seRoofTransform);
-	XMStoreFloat4x4(&seTowerRoofRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	seTowerRoofRitem->ObjCBIndex = objCBIndex++;
-	seTowerRoofRitem->Mat = mMaterials["roofMat"].get();
-	seTowerRoofRitem->Geo = mGeometries["castleGeo"].get();
-	seTowerRoofRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	seTowerRoofRitem->IndexCount = seTowerRoofRitem->Geo->DrawArgs["torusRoof"].IndexCount;
-	seTowerRoofRitem->StartIndexLocation = seTowerRoofRitem->Geo->DrawArgs["torusRoof"].StartIndexLocation;
-	seTowerRoofRitem->BaseVertexLocation = seTowerRoofRitem->Geo->DrawArgs["torusRoof"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(seTowerRoofRitem.get());
-	mAllRitems.push_back(std::move(seTowerRoofRitem));
+	AddSceneObject(pack, "castleGeo", "torusRoof", "roofMat", seRoofTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
 
 	// KEEP PYRAMID ROOF
-	auto keepPyramidRoofRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&keepPyramidRoofRitem->World, XMMatrixTranslation(0.0f, 25.0f, 0.0f));
-	XMStoreFloat4x4(&keepPyramidRoofRitem->TexTransform, XMMatrixScaling(2.0f, 2.0f, 1.5f));
-	keepPyramidRoofRitem->ObjCBIndex = objCBIndex++;
-	keepPyramidRoofRitem->Mat = mMaterials["roofMat"].get();
-	keepPyramidRoofRitem->Geo = mGeometries["castleGeo"].get();
-	keepPyramidRoofRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	keepPyramidRoofRitem->IndexCount = keepPyramidRoofRitem->Geo->DrawArgs["keepPyramidRoof"].IndexCount;
-	keepPyramidRoofRitem->StartIndexLocation = keepPyramidRoofRitem->Geo->DrawArgs["keepPyramidRoof"].StartIndexLocation;
-	keepPyramidRoofRitem->BaseVertexLocation = keepPyramidRoofRitem->Geo->DrawArgs["keepPyramidRoof"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(keepPyramidRoofRitem.get());
-	mAllRitems.push_back(std::move(keepPyramidRoofRitem));
+	AddSceneObject(pack, "castleGeo", "keepPyramidRoof", "roofMat",
+		XMMatrixTranslation(0.0f, 25.0f, 0.0f), XMMatrixScaling(2.0f, 2.0f, 1.5f));
 
 	// KEEP SIDE TOWERS
 	// SW
-	auto keepFrontLeftTowerRitem = std::make_unique<RenderItem>();
 	XMMATRIX frontLeftTowerScale = XMMatrixScaling(0.7f, 1.0f, 0.7f) * XMMatrixTranslation(-6.5f, 2.0f, -5.0f);
-	XMStoreFloat4x4(&keepFrontLeftTowerRitem->World, frontLeftTowerScale);
-	XMStoreFloat4x4(&keepFrontLeftTowerRitem->TexTransform, XMMatrixScaling(1.0f, 2.0f, 1.0f));
-	keepFrontLeftTowerRitem->ObjCBIndex = objCBIndex++;
-	keepFrontLeftTowerRitem->Mat = mMaterials["brickMat"].get();
-	keepFrontLeftTowerRitem->Geo = mGeometries["castleGeo"].get();
-	keepFrontLeftTowerRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	keepFrontLeftTowerRitem->IndexCount = keepFrontLeftTowerRitem->Geo->DrawArgs["hexTower"].IndexCount;
-	keepFrontLeftTowerRitem->StartIndexLocation = keepFrontLeftTowerRitem->Geo->DrawArgs["hexTower"].StartIndexLocation;
-	keepFrontLeftTowerRitem->BaseVertexLocation = keepFrontLeftTowerRitem->Geo->DrawArgs["hexTower"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(keepFrontLeftTowerRitem.get());
-	mAllRitems.push_back(std::move(keepFrontLeftTowerRitem));
+	AddSceneObject(pack, "castleGeo", "hexTower", "brickMat", frontLeftTowerScale, XMMatrixScaling(1.0f, 2.0f, 1.0f));
 
 	// SE
-	auto keepFrontRightTowerRitem = std::make_unique<RenderItem>();
 	XMMATRIX frontRightTowerScale = XMMatrixScaling(0.7f, 1.0f, 0.7f) * XMMatrixTranslation(6.5f, 2.0f, -5.0f);
-	XMStoreFloat4x4(&keepFrontRightTowerRitem->World, frontRightTowerScale);
-	XMStoreFloat4x4(&keepFrontRightTowerRitem->TexTransform, XMMatrixScaling(1.0f, 2.0f, 1.0f));
-	keepFrontRightTowerRitem->ObjCBIndex = objCBIndex++;
-	keepFrontRightTowerRitem->Mat = mMaterials["brickMat"].get();
-	keepFrontRightTowerRitem->Geo = mGeometries["castleGeo"].get();
-	keepFrontRightTowerRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	keepFrontRightTowerRitem->IndexCount = keepFrontRightTowerRitem->Geo->DrawArgs["hexTower"].IndexCount;
-	keepFrontRightTowerRitem->StartIndexLocation = keepFrontRightTowerRitem->Geo->DrawArgs["hexTower"].StartIndexLocation;
-	keepFrontRightTowerRitem->BaseVertexLocation = keepFrontRightTowerRitem->Geo->DrawArgs["hexTower"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(keepFrontRightTowerRitem.get());
-	mAllRitems.push_back(std::move(keepFrontRightTowerRitem));
+	AddSceneObject(pack, "castleGeo", "hexTower", "brickMat", frontRightTowerScale, XMMatrixScaling(1.0f, 2.0f, 1.0f));
 
 	// NW
-	auto keepBackLeftTowerRitem = std::make_unique<RenderItem>();
 	XMMATRIX backLeftTowerScale = XMMatrixScaling(0.7f, 1.0f, 0.7f) * XMMatrixTranslation(-6.5f, 2.0f, 5.0f);
-	XMStoreFloat4x4(&keepBackLeftTowerRitem->World, backLeftTowerScale);
-	XMStoreFloat4x4(&keepBackLeftTowerRitem->TexTransform, XMMatrixScaling(1.0f, 2.0f, 1.0f));
-	keepBackLeftTowerRitem->ObjCBIndex = objCBIndex++;
-	keepBackLeftTowerRitem->Mat = mMaterials["brickMat"].get();
-	keepBackLeftTowerRitem->Geo = mGeometries["castleGeo"].get();
-	keepBackLeftTowerRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	keepBackLeftTowerRitem->IndexCount = keepBackLeftTowerRitem->Geo->DrawArgs["hexTower"].IndexCount;
-	keepBackLeftTowerRitem->StartIndexLocation = keepBackLeftTowerRitem->Geo->DrawArgs["hexTower"].StartIndexLocation;
-	keepBackLeftTowerRitem->BaseVertexLocation = keepBackLeftTowerRitem->Geo->DrawArgs["hexTower"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(keepBackLeftTowerRitem.get());
-	mAllRitems.push_back(std::move(keepBackLeftTowerRitem));
+	AddSceneObject(pack, "castleGeo", "hexTower", "brickMat", backLeftTowerScale, XMMatrixScaling(1.0f, 2.0f, 1.0f));
 
 	// NE
-	auto keepBackRightTowerRitem = std::make_unique<RenderItem>();
 	XMMATRIX backRightTowerScale = XMMatrixScaling(0.7f, 1.0f, 0.7f) * XMMatrixTranslation(6.5f, 2.0f, 5.0f);
-	XMStoreFloat4x4(&keepBackRightTowerRitem->World, backRightTowerScale);
-	XMStoreFloat4x4(&keepBackRightTowerRitem->TexTransform, XMMatrixScaling(1.0f, 2.0f, 1.0f));
-	keepBackRightTowerRitem->ObjCBIndex = objCBIndex++;
-	keepBackRightTowerRitem->Mat = mMaterials["brickMat"].get();
-	keepBackRightTowerRitem->Geo = mGeometries["castleGeo"].get();
-	keepBackRightTowerRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	keepBackRightTowerRitem->IndexCount = keepBackRightTowerRitem->Geo->DrawArgs["hexTower"].IndexCount;
-	keepBackRightTowerRitem->StartIndexLocation = keepBackRightTowerRitem->Geo->DrawArgs["hexTower"].StartIndexLocation;
-	keepBackRightTowerRitem->BaseVertexLocation = keepBackRightTowerRitem->Geo->DrawArgs["hexTower"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(keepBackRightTowerRitem.get());
-	mAllRitems.push_back(std::move(keepBackRightTowerRitem));
+	AddSceneObject(pack, "castleGeo", "hexTower", "brickMat", backRightTowerScale, XMMatrixScaling(1.0f, 2.0f, 1.0f));
 
 	// KEEP SIDE TOWER CONE ROOFS
 	// SW
-	auto keepFrontLeftConeRoofRitem = std::make_unique<RenderItem>();
 	XMMATRIX frontLeftConeTransform = XMMatrixScaling(0.8f, 1.7f, 0.7f) * XMMatrixTranslation(-6.5f, 16.0f, -5.0f);
-	XMStoreFloat4x4(&keepFrontLeftConeRoofRitem->World, frontLeftConeTransform);
-	XMStoreFloat4x4(&keepFrontLeftConeRoofRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	keepFrontLeftConeRoofRitem->ObjCBIndex = objCBIndex++;
-	keepFrontLeftConeRoofRitem->Mat = mMaterials["roofMat"].get();
-	keepFrontLeftConeRoofRitem->Geo = mGeometries["castleGeo"].get();
-	keepFrontLeftConeRoofRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	keepFrontLeftConeRoofRitem->IndexCount = keepFrontLeftConeRoofRitem->Geo->DrawArgs["keepConeRoof"].IndexCount;
-	keepFrontLeftConeRoofRitem->StartIndexLocation = keepFrontLeftConeRoofRitem->Geo->DrawArgs["keepConeRoof"].StartIndexLocation;
-	keepFrontLeftConeRoofRitem->BaseVertexLocation = keepFrontLeftConeRoofRitem->Geo->DrawArgs["keepConeRoof"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(keepFrontLeftConeRoofRitem.get());
-	mAllRitems.push_back(std::move(keepFrontLeftConeRoofRitem));
+	AddSceneObject(pack, "castleGeo", "keepConeRoof", "roofMat", frontLeftConeTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
 
 	// SE
-	auto keepFrontRightConeRoofRitem = std::make_unique<RenderItem>();
 	XMMATRIX frontRightConeTransform = XMMatrixScaling(0.8f, 1.7f, 0.7f) * XMMatrixTranslation(6.5f, 16.0f, -5.0f);
-	XMStoreFloat4x4(&keepFrontRightConeRoofRitem->World, frontRightConeTransform);
-	XMStoreFloat4x4(&keepFrontRightConeRoofRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	keepFrontRightConeRoofRitem->ObjCBIndex = objCBIndex++;
-	keepFrontRightConeRoofRitem->Mat = mMaterials["roofMat"].get();
-	keepFrontRightConeRoofRitem->Geo = mGeometries["castleGeo"].get();
-	keepFrontRightConeRoofRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	keepFrontRightConeRoofRitem->IndexCount = keepFrontRightConeRoofRitem->Geo->DrawArgs["keepConeRoof"].IndexCount;
-	keepFrontRightConeRoofRitem->StartIndexLocation = keepFrontRightConeRoofRitem->Geo->DrawArgs["keepConeRoof"].StartIndexLocation;
-	keepFrontRightConeRoofRitem->BaseVertexLocation = keepFrontRightConeRoofRitem->Geo->DrawArgs["keepConeRoof"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(keepFrontRightConeRoofRitem.get());
-	mAllRitems.push_back(std::move(keepFrontRightConeRoofRitem));
+	AddSceneObject(pack, "castleGeo", "keepConeRoof", "roofMat",
+		frontRightConeTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
 
 	// NW
-	auto keepBackLeftConeRoofRitem = std::make_unique<RenderItem>();
 	XMMATRIX backLeftConeTransform = XMMatrixScaling(0.8f, 1.7f, 0.7f) * XMMatrixTranslation(-6.5f, 16.0f, 5.0f);
-	XMStoreFloat4x4(&keepBackLeftConeRoofRitem->World, backLeftConeTransform);
-	XMStoreFloat4x4(&keepBackLeftConeRoofRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	keepBackLeftConeRoofRitem->ObjCBIndex = objCBIndex++;
-	keepBackLeftConeRoofRitem->Mat = mMaterials["roofMat"].get();
-	keepBackLeftConeRoofRitem->Geo = mGeometries["castleGeo"].get();
-	keepBackLeftConeRoofRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	keepBackLeftConeRoofRitem->IndexCount = keepBackLeftConeRoofRitem->Geo->DrawArgs["keepConeRoof"].IndexCount;
-	keepBackLeftConeRoofRitem->StartIndexLocation = keepBackLeftConeRoofRitem->Geo->DrawArgs["keepConeRoof"].StartIndexLocation;
-	keepBackLeftConeRoofRitem->BaseVertexLocation = keepBackLeftConeRoofRitem->Geo->DrawArgs["keepConeRoof"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(keepBackLeftConeRoofRitem.get());
-	mAllRitems.push_back(std::move(keepBackLeftConeRoofRitem));
+	AddSceneObject(pack, "castleGeo", "keepConeRoof", "roofMat", backLeftConeTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
 
 	// NE
-	auto keepBackRightConeRoofRitem = std::make_unique<RenderItem>();
 	XMMATRIX backRightConeTransform = XMMatrixScaling(0.8f, 1.7f, 0.7f) * XMMatrixTranslation(6.5f, 16.0f, 5.0f);
-	XMStoreFloat4x4(&keepBackRightConeRoofRitem->World, backRightConeTransform);
-	XMStoreFloat4x4(&keepBackRightConeRoofRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	keepBackRightConeRoofRitem->ObjCBIndex = objCBIndex++;
-	keepBackRightConeRoofRitem->Mat = mMaterials["roofMat"].get();
-	keepBackRightConeRoofRitem->Geo = mGeometries["castleGeo"].get();
-	keepBackRightConeRoofRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	keepBackRightConeRoofRitem->IndexCount = keepBackRightConeRoofRitem->Geo->DrawArgs["keepConeRoof"].IndexCount;
-	keepBackRightConeRoofRitem->StartIndexLocation = keepBackRightConeRoofRitem->Geo->DrawArgs["keepConeRoof"].StartIndexLocation;
-	keepBackRightConeRoofRitem->BaseVertexLocation = keepBackRightConeRoofRitem->Geo->DrawArgs["keepConeRoof"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(keepBackRightConeRoofRitem.get());
-	mAllRitems.push_back(std::move(keepBackRightConeRoofRitem));
+	AddSceneObject(pack, "castleGeo", "keepConeRoof", "roofMat", backRightConeTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
 
 	// DIAMOND SPIRE
-	auto diamondSpireRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&diamondSpireRitem->World, XMMatrixTranslation(0.0f, 31.0f, 0.0f));
-	XMStoreFloat4x4(&diamondSpireRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	diamondSpireRitem->ObjCBIndex = objCBIndex++;
-	diamondSpireRitem->Mat = mMaterials["goldMat"].get();
-	diamondSpireRitem->Geo = mGeometries["castleGeo"].get();
-	diamondSpireRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	diamondSpireRitem->IndexCount = diamondSpireRitem->Geo->DrawArgs["diamondSpire"].IndexCount;
-	diamondSpireRitem->StartIndexLocation = diamondSpireRitem->Geo->DrawArgs["diamondSpire"].StartIndexLocation;
-	diamondSpireRitem->BaseVertexLocation = diamondSpireRitem->Geo->DrawArgs["diamondSpire"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(diamondSpireRitem.get());
-	mAllRitems.push_back(std::move(diamondSpireRitem));
+	AddSceneObject(pack, "castleGeo", "diamondSpire", "goldMat",
+		XMMatrixTranslation(0.0f, 31.0f, 0.0f), XMMatrixScaling(1.0f, 1.0f, 1.0f));
 
 	// GATEHOUSE BASE 
-	auto gatehouseRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&gatehouseRitem->World, XMMatrixTranslation(0.0f, 4.0f, 31.0f));
-	XMStoreFloat4x4(&gatehouseRitem->TexTransform, XMMatrixScaling(2.0f, 1.5f, 1.0f));
-	gatehouseRitem->ObjCBIndex = objCBIndex++;
-	gatehouseRitem->Mat = mMaterials["stoneMat"].get();
-	gatehouseRitem->Geo = mGeometries["castleGeo"].get();
-	gatehouseRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	gatehouseRitem->IndexCount = gatehouseRitem->Geo->DrawArgs["gatehouse"].IndexCount;
-	gatehouseRitem->StartIndexLocation = gatehouseRitem->Geo->DrawArgs["gatehouse"].StartIndexLocation;
-	gatehouseRitem->BaseVertexLocation = gatehouseRitem->Geo->DrawArgs["gatehouse"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(gatehouseRitem.get());
-	mAllRitems.push_back(std::move(gatehouseRitem));
+	AddSceneObject(pack, "castleGeo", "gatehouse", "stoneMat",
+		XMMatrixTranslation(0.0f, 4.0f, 31.0f), XMMatrixScaling(2.0f, 1.5f, 1.0f));
 
 	// GATE TOWERS 
 	// Left gate tower
-	auto leftGateTowerRitem = std::make_unique<RenderItem>();
 	XMMATRIX leftGateTowerScale = XMMatrixScaling(0.6f, 1.0f, 0.6f) * XMMatrixTranslation(-8.0f, 1.0f, 31.0f);
-	XMStoreFloat4x4(&leftGateTowerRitem->World, leftGateTowerScale);
-	XMStoreFloat4x4(&leftGateTowerRitem->TexTransform, XMMatrixScaling(1.0f, 2.0f, 1.0f));
-	leftGateTowerRitem->ObjCBIndex = objCBIndex++;
-	leftGateTowerRitem->Mat = mMaterials["brickMat"].get();
-	leftGateTowerRitem->Geo = mGeometries["castleGeo"].get();
-	leftGateTowerRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	leftGateTowerRitem->IndexCount = leftGateTowerRitem->Geo->DrawArgs["hexTower"].IndexCount;
-	leftGateTowerRitem->StartIndexLocation = leftGateTowerRitem->Geo->DrawArgs["hexTower"].StartIndexLocation;
-	leftGateTowerRitem->BaseVertexLocation = leftGateTowerRitem->Geo->DrawArgs["hexTower"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(leftGateTowerRitem.get());
-	mAllRitems.push_back(std::move(leftGateTowerRitem));
+	AddSceneObject(pack, "castleGeo", "hexTower", "brickMat", leftGateTowerScale, XMMatrixScaling(1.0f, 2.0f, 1.0f));
 
 	// Right gate tower
-	auto rightGateTowerRitem = std::make_unique<RenderItem>();
 	XMMATRIX rightGateTowerScale = XMMatrixScaling(0.6f, 1.0f, 0.6f) * XMMatrixTranslation(8.0f, 1.0f, 31.0f);
-	XMStoreFloat4x4(&rightGateTowerRitem->World, rightGateTowerScale);
-	XMStoreFloat4x4(&rightGateTowerRitem->TexTransform, XMMatrixScaling(1.0f, 2.0f, 1.0f));
-	rightGateTowerRitem->ObjCBIndex = objCBIndex++;
-	rightGateTowerRitem->Mat = mMaterials["brickMat"].get();
-	rightGateTowerRitem->Geo = mGeometries["castleGeo"].get();
-	rightGateTowerRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	rightGateTowerRitem->IndexCount = rightGateTowerRitem->Geo->DrawArgs["hexTower"].IndexCount;
-	rightGateTowerRitem->StartIndexLocation = rightGateTowerRitem->Geo->DrawArgs["hexTower"].StartIndexLocation;
-	rightGateTowerRitem->BaseVertexLocation = rightGateTowerRitem->Geo->DrawArgs["hexTower"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(rightGateTowerRitem.get());
-	mAllRitems.push_back(std::move(rightGateTowerRitem));
+	AddSceneObject(pack, "castleGeo", "hexTower", "brickMat", rightGateTowerScale, XMMatrixScaling(1.0f, 2.0f, 1.0f));
 
 	// GATE TOWER ROOFS
 	// Left gate tower cone roof
-	auto leftGateConeRoofRitem = std::make_unique<RenderItem>();
 	XMMATRIX leftGateConeTransform = XMMatrixScaling(0.6f, 1.2f, 1.0f) * XMMatrixTranslation(-8.0f, 13.5f, 31.0f);
-	XMStoreFloat4x4(&leftGateConeRoofRitem->World, leftGateConeTransform);
-	XMStoreFloat4x4(&leftGateConeRoofRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	leftGateConeRoofRitem->ObjCBIndex = objCBIndex++;
-	leftGateConeRoofRitem->Mat = mMaterials["roofMat"].get();
-	leftGateConeRoofRitem->Geo = mGeometries["castleGeo"].get();
-	leftGateConeRoofRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	leftGateConeRoofRitem->IndexCount = leftGateConeRoofRitem->Geo->DrawArgs["keepConeRoof"].IndexCount;
-	leftGateConeRoofRitem->StartIndexLocation = leftGateConeRoofRitem->Geo->DrawArgs["keepConeRoof"].StartIndexLocation;
-	leftGateConeRoofRitem->BaseVertexLocation = leftGateConeRoofRitem->Geo->DrawArgs["keepConeRoof"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(leftGateConeRoofRitem.get());
-	mAllRitems.push_back(std::move(leftGateConeRoofRitem));
+	AddSceneObject(pack, "castleGeo", "keepConeRoof", "roofMat", leftGateConeTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
 
 	// Right gate tower cone roof
-	auto rightGateConeRoofRitem = std::make_unique<RenderItem>();
 	XMMATRIX rightGateConeTransform = XMMatrixScaling(0.6f, 1.2f, 1.0f) * XMMatrixTranslation(8.0f, 13.5f, 31.0f);
-	XMStoreFloat4x4(&rightGateConeRoofRitem->World, rightGateConeTransform);
-	XMStoreFloat4x4(&rightGateConeRoofRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	rightGateConeRoofRitem->ObjCBIndex = objCBIndex++;
-	rightGateConeRoofRitem->Mat = mMaterials["roofMat"].get();
-	rightGateConeRoofRitem->Geo = mGeometries["castleGeo"].get();
-	rightGateConeRoofRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	rightGateConeRoofRitem->IndexCount = rightGateConeRoofRitem->Geo->DrawArgs["keepConeRoof"].IndexCount;
-	rightGateConeRoofRitem->StartIndexLocation = rightGateConeRoofRitem->Geo->DrawArgs["keepConeRoof"].StartIndexLocation;
-	rightGateConeRoofRitem->BaseVertexLocation = rightGateConeRoofRitem->Geo->DrawArgs["keepConeRoof"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(rightGateConeRoofRitem.get());
-	mAllRitems.push_back(std::move(rightGateConeRoofRitem));
+	AddSceneObject(pack, "castleGeo", "keepConeRoof", "roofMat", rightGateConeTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
 
 	// GATE COLUMNS (cylinders flanking gate opening)
 	// Left gate column
-	auto leftGateColumnRitem = std::make_unique<RenderItem>();
 	XMMATRIX leftColumnTransform = XMMatrixScaling(0.5f, 1.0f, 0.5f) * XMMatrixTranslation(-3.0f, 4.0f, 34.0f);
-	XMStoreFloat4x4(&leftGateColumnRitem->World, leftColumnTransform);
-	XMStoreFloat4x4(&leftGateColumnRitem->TexTransform, XMMatrixScaling(0.5f, 1.0f, 0.5f));
-	leftGateColumnRitem->ObjCBIndex = objCBIndex++;
-	leftGateColumnRitem->Mat = mMaterials["stoneMat"].get();
-	leftGateColumnRitem->Geo = mGeometries["castleGeo"].get();
-	leftGateColumnRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	leftGateColumnRitem->IndexCount = leftGateColumnRitem->Geo->DrawArgs["gateColumn"].IndexCount;
-	leftGateColumnRitem->StartIndexLocation = leftGateColumnRitem->Geo->DrawArgs["gateColumn"].StartIndexLocation;
-	leftGateColumnRitem->BaseVertexLocation = leftGateColumnRitem->Geo->DrawArgs["gateColumn"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(leftGateColumnRitem.get());
-	mAllRitems.push_back(std::move(leftGateColumnRitem));
+	AddSceneObject(pack, "castleGeo", "gateColumn", "stoneMat", leftColumnTransform, XMMatrixScaling(0.5f, 1.0f, 0.5f));
 
 	// Right gate column
-	auto rightGateColumnRitem = std::make_unique<RenderItem>();
 	XMMATRIX rightColumnTransform = XMMatrixScaling(0.5f, 1.0f, 0.5f) * XMMatrixTranslation(3.0f, 4.0f, 34.0f);
-	XMStoreFloat4x4(&rightGateColumnRitem->World, rightColumnTransform);
-	XMStoreFloat4x4(&rightGateColumnRitem->TexTransform, XMMatrixScaling(0.5f, 1.0f, 0.5f));
-	rightGateColumnRitem->ObjCBIndex = objCBIndex++;
-	rightGateColumnRitem->Mat = mMaterials["stoneMat"].get();
-	rightGateColumnRitem->Geo = mGeometries["castleGeo"].get();
-	rightGateColumnRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	rightGateColumnRitem->IndexCount = rightGateColumnRitem->Geo->DrawArgs["gateColumn"].IndexCount;
-	rightGateColumnRitem->StartIndexLocation = rightGateColumnRitem->Geo->DrawArgs["gateColumn"].StartIndexLocation;
-	rightGateColumnRitem->BaseVertexLocation = rightGateColumnRitem->Geo->DrawArgs["gateColumn"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(rightGateColumnRitem.get());
-	mAllRitems.push_back(std::move(rightGateColumnRitem));
+	AddSceneObject(pack, "castleGeo", "gateColumn", "stoneMat", rightColumnTransform, XMMatrixScaling(0.5f, 1.0f, 0.5f));
 
 	// ARROW SLITS in gatehouse 
 	// Left arrow slit
-	auto gateArrowSlitLeftRitem = std::make_unique<RenderItem>();
 	XMMATRIX gateArrowLeftTransform = XMMatrixRotationY(0.0f) * XMMatrixTranslation(-5.0f, 7.0f, 31.5f);
-	XMStoreFloat4x4(&gateArrowSlitLeftRitem->World, gateArrowLeftTransform);
-	XMStoreFloat4x4(&gateArrowSlitLeftRitem->TexTransform, XMMatrixScaling(0.5f, 1.0f, 1.0f));
-	gateArrowSlitLeftRitem->ObjCBIndex = objCBIndex++;
-	gateArrowSlitLeftRitem->Mat = mMaterials["darkStoneMat"].get();
-	gateArrowSlitLeftRitem->Geo = mGeometries["castleGeo"].get();
-	gateArrowSlitLeftRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	gateArrowSlitLeftRitem->IndexCount = gateArrowSlitLeftRitem->Geo->DrawArgs["arrowSlit"].IndexCount;
-	gateArrowSlitLeftRitem->StartIndexLocation = gateArrowSlitLeftRitem->Geo->DrawArgs["arrowSlit"].StartIndexLocation;
-	gateArrowSlitLeftRitem->BaseVertexLocation = gateArrowSlitLeftRitem->Geo->DrawArgs["arrowSlit"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(gateArrowSlitLeftRitem.get());
-	mAllRitems.push_back(std::move(gateArrowSlitLeftRitem));
+	AddSceneObject(pack, "castleGeo", "arrowSlit", "darkStoneMat",
+		gateArrowLeftTransform, XMMatrixScaling(0.5f, 1.0f, 1.0f));
 
 	// Right arrow slit
-	auto gateArrowSlitRightRitem = std::make_unique<RenderItem>();
 	XMMATRIX gateArrowRightTransform = XMMatrixRotationY(0.0f) * XMMatrixTranslation(5.0f, 7.0f, 31.5f);
-	XMStoreFloat4x4(&gateArrowSlitRightRitem->World, gateArrowRightTransform);
-	XMStoreFloat4x4(&gateArrowSlitRightRitem->TexTransform, XMMatrixScaling(0.5f, 1.0f, 1.0f));
-	gateArrowSlitRightRitem->ObjCBIndex = objCBIndex++;
-	gateArrowSlitRightRitem->Mat = mMaterials["darkStoneMat"].get();
-	gateArrowSlitRightRitem->Geo = mGeometries["castleGeo"].get();
-	gateArrowSlitRightRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	gateArrowSlitRightRitem->IndexCount = gateArrowSlitRightRitem->Geo->DrawArgs["arrowSlit"].IndexCount;
-	gateArrowSlitRightRitem->StartIndexLocation = gateArrowSlitRightRitem->Geo->DrawArgs["arrowSlit"].StartIndexLocation;
-	gateArrowSlitRightRitem->BaseVertexLocation = gateArrowSlitRightRitem->Geo->DrawArgs["arrowSlit"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(gateArrowSlitRightRitem.get());
-	mAllRitems.push_back(std::move(gateArrowSlitRightRitem));
-
+	AddSceneObject(pack, "castleGeo", "arrowSlit", "darkStoneMat",
+		gateArrowRightTransform, XMMatrixScaling(0.5f, 1.0f, 1.0f));
 }
 
-void ShapesApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
+void ShapesApp::BuildRenderItems()
 {
-	UINT objCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
-	UINT matCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(MaterialConstants));
-
-	auto objectCB = mCurrFrameResource->ObjectCB->Resource();
-	auto matCB = mCurrFrameResource->MaterialCB->Resource();
+	// The maze walls' colliders already exist (LoadScenePack); everything else that is
+	// drawn is spawned here, the static objects from the scene pack.  The maze's entity is
+	// kept for ReloadMaze.
+	const ScenePack::Object* objects = mScenePack.Objects();
+	for (std::uint32_t i = 0; i < mScenePack.ObjectCount(); ++i)
+	{
+		const ScenePack::Object& object = objects[i];
+		std::string geoName = mScenePack.String(mScenePack.Meshes()[object.Mesh].Name);
+		EntityWorld::Entity entity = SpawnPackObject(mScenePack, object, mGeometries[geoName].get());
+		if (geoName == "mazeGeo")
+			mMazeEntity = entity;
+	}
 
-	for (size_t i = 0; i < ritems.size(); ++i)
+	// TREES
+	// One entity per foliage chunk, culled like everything else.  Chunks sit at the
+	// origin and their bounds include the sprites, which no submesh describes.
+	BoundingBox allFoliage;
+	const auto& chunks = mFoliage.Chunks();
+	for (size_t i = 0; i < chunks.size(); ++i)
 	{
-		auto ri = ritems[i];
+		RenderMeshComponent mesh;
+		mesh.Geo = mGeometries["treeGeo"].get();
+		mesh.PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_POINTLIST;
+		mesh.IndexCount = chunks[i].InstanceCount;
+		mesh.StartIndexLocation = chunks[i].FirstInstance;
+		mesh.Layer = RenderLayer::AlphaTestedTreeSprites;
+
+		XMVECTOR vMin = XMVectorSet(chunks[i].Min[0], chunks[i].Min[1], chunks[i].Min[2], 0.0f);
+		XMVECTOR vMax = XMVectorSet(chunks[i].Max[0], chunks[i].Max[1], chunks[i].Max[2], 0.0f);
+		BoundingBox bounds;
+		BoundingBox::CreateFromPoints(bounds, vMin, vMax);
+
+		if (i == 0)
+			allFoliage = bounds;
+		else
+			BoundingBox::CreateMerged(allFoliage, allFoliage, bounds);
 
-		cmdList->IASetVertexBuffers(0, 1, &ri->Geo->VertexBufferView());
-		cmdList->IASetIndexBuffer(&ri->Geo->IndexBufferView());
-		cmdList->IASetPrimitiveTopology(ri->PrimitiveType);
+		SpawnRenderable(mesh, mMaterials["treeMat"].get(), XMMatrixIdentity(), XMMatrixIdentity(), bounds);
+	}
 
-		CD3DX12_GPU_DESCRIPTOR_HANDLE tex(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
-		tex.Offset(ri->Mat->DiffuseSrvHeapIndex, mCbvSrvDescriptorSize);
+	RenderMeshComponent treeQuadMesh;
+	treeQuadMesh.Geo = mTreeQuadGeo.get();
+	treeQuadMesh.IndexCount = 0;
+	treeQuadMesh.Layer = RenderLayer::AlphaTestedTreeSprites;
+	mTreeQuadEntity = SpawnRenderable(treeQuadMesh, mMaterials["treeMat"].get(), XMMatrixIdentity(),
+		XMMatrixIdentity(), allFoliage);
+
+	auto stats = mEntities.GetStats();
+	std::ostringstream oss;
+	oss << "Entities: " << stats.Entities << " (" << mObjectCount << " drawn) in " << stats.Archetypes
+		<< " archetypes, " << stats.Chunks << " chunks\n";
+	OutputDebugStringA(oss.str().c_str());
+}
 
-		D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = objectCB->GetGPUVirtualAddress() + ri->ObjCBIndex * objCBByteSize;
-		D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = matCB->GetGPUVirtualAddress() + ri->Mat->MatCBIndex * matCBByteSize;
+void ShapesApp::RecordDrawItems(CommandStream& stream, const DrawList& items, ID3D12PipelineState* pso,
+	ID3D12PipelineState* lodFadePso, ID3D12PipelineState* virtualTexturePso)
+{
+	UINT objCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
+	UINT matCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(MaterialConstants));
 
-		cmdList->SetGraphicsRootDescriptorTable(0, tex);
-		cmdList->SetGraphicsRootConstantBufferView(1, objCBAddress);
-		cmdList->SetGraphicsRootConstantBufferView(3, matCBAddress);
+	D3D12_GPU_VIRTUAL_ADDRESS objectCBAddress = mCurrFrameResource->ObjectCB->Resource()->GetGPUVirtualAddress();
+	D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = mCurrFrameResource->MaterialCB->Resource()->GetGPUVirtualAddress();
+	D3D12_GPU_VIRTUAL_ADDRESS passCBAddress = mCurrFrameResource->PassCB->Resource()->GetGPUVirtualAddress();
+	UINT64 texStart = mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart().ptr;
+
+	stream.Reset();
+
+	// Each chunk is replayed into a fresh command list, so the prologue sets up everything
+	// a list starts without.
+	CommandChunk& prologue = stream.Prologue();
+	prologue.SetViewport(mScreenViewport.TopLeftX, mScreenViewport.TopLeftY, mScreenViewport.Width,
+		mScreenViewport.Height, mScreenViewport.MinDepth, mScreenViewport.MaxDepth);
+	prologue.SetScissor(mScissorRect.left, mScissorRect.top, mScissorRect.right, mScissorRect.bottom);
+	prologue.SetRenderTarget(SceneColorView().ptr, DepthStencilView().ptr);
+	prologue.SetDescriptorHeap((UINT64)mSrvDescriptorHeap.Get());
+	prologue.SetRootSignature((UINT64)mRootSignature.Get());
+	prologue.SetPipeline((UINT64)pso);
+	prologue.SetConstantBuffer(2, passCBAddress);
+	prologue.SetShaderResource(4, mCurrFrameResource->SceneLights->Resource()->GetGPUVirtualAddress());
+	prologue.SetShaderResource(5, mCurrFrameResource->ClusterRanges->Resource()->GetGPUVirtualAddress());
+	prologue.SetShaderResource(6, mCurrFrameResource->ClusterLightIndices->Resource()->GetGPUVirtualAddress());
+	prologue.SetShaderResource(7, mBakedLighting->GetGPUVirtualAddress());
+	prologue.SetDescriptorTable(8, texStart + (UINT64)mEnvironmentSrvIndex * mCbvSrvDescriptorSize);
+	prologue.SetDescriptorTable(10, texStart + (UINT64)mGroundVirtualTextureSrvIndex * mCbvSrvDescriptorSize);
+
+	stream.Record((UINT)items.size(), gMaxRecordChunks, gMinDrawsPerChunk, [&](CommandChunk& chunk, UINT begin, UINT end)
+	{
+		for (UINT i = begin; i < end; ++i)
+		{
+			const RenderMeshComponent& mesh = items[i].Mesh;
+			const Material* mat = items[i].Mat;
+
+			D3D12_VERTEX_BUFFER_VIEW vbv = mesh.Geo->VertexBufferView();
+			D3D12_INDEX_BUFFER_VIEW ibv = mesh.Geo->IndexBufferView();
+			chunk.SetVertexBuffer(vbv.BufferLocation, vbv.SizeInBytes, vbv.StrideInBytes);
+			chunk.SetIndexBuffer(ibv.BufferLocation, ibv.SizeInBytes, (UINT)ibv.Format);
+			chunk.SetTopology((UINT)mesh.PrimitiveType);
+
+			chunk.SetDescriptorTable(0, texStart + (UINT64)mat->DiffuseSrvHeapIndex * mCbvSrvDescriptorSize);
+			chunk.SetConstantBuffer(1, objectCBAddress + (UINT64)mesh.ObjCBIndex * objCBByteSize);
+			chunk.SetConstantBuffer(3, matCBAddress + (UINT64)mat->MatCBIndex * matCBByteSize);
+
+			// Items fading between levels of detail dither and the ground samples its virtual
+			// texture, if the layer has a pipeline for it.
+			DrawConstants draw;
+			draw.BakedLightingOffset = mesh.BakedLightingOffset;
+			if (lodFadePso != nullptr && items[i].LodFade != 0.0f)
+			{
+				draw.LodFade = items[i].LodFade;
+				chunk.SetPipeline((UINT64)lodFadePso);
+			}
+			else if (virtualTexturePso != nullptr && mat == mGroundMaterial)
+			{
+				chunk.SetPipeline((UINT64)virtualTexturePso);
+			}
+			else
+			{
+				chunk.SetPipeline((UINT64)pso);
+			}
+			UINT fadeBits;
+			memcpy(&fadeBits, &draw.LodFade, sizeof(fadeBits));
+			chunk.SetRootConstants(9, draw.BakedLightingOffset, fadeBits);
 
-		cmdList->DrawIndexedInstanced(ri->IndexCount, 1, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
-	}
+			chunk.DrawIndexed(mesh.IndexCount, mesh.StartIndexLocation, mesh.BaseVertexLocation);
+		}
+	});
 }
 
 std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> ShapesApp::GetStaticSamplers()
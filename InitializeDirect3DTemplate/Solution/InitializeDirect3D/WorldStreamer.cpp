@@ -0,0 +1,268 @@
+//***************************************************************************************
+// WorldStreamer.cpp
+//***************************************************************************************
+
+#include "WorldStreamer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using uint32 = WorldStreamer::uint32;
+using uint64 = WorldStreamer::uint64;
+
+namespace
+{
+	// Distance on the ground plane from (x, z) to the bounds of a cell; zero inside.
+	float CellDistance(const ScenePack::Cell& cell, float x, float z)
+	{
+		float dx = std::max(std::max(cell.Min[0] - x, x - cell.Max[0]), 0.0f);
+		float dz = std::max(std::max(cell.Min[1] - z, z - cell.Max[1]), 0.0f);
+		return std::sqrt(dx * dx + dz * dz);
+	}
+}
+
+WorldStreamer::~WorldStreamer()
+{
+	Stop();
+}
+
+void WorldStreamer::Start(const ScenePack& pack, const Desc& desc)
+{
+	Stop();
+
+	mDesc = desc;
+	mCells.clear();
+	mUnloads.clear();
+	mStats = Stats();
+
+	for (uint32 i = 0; i < pack.CellCount(); ++i)
+	{
+		CellSlot slot;
+		slot.Info = pack.Cells()[i];
+		slot.Path = pack.String(slot.Info.Path);
+		mCells.push_back(std::move(slot));
+	}
+	mStats.Cells = (uint32)mCells.size();
+
+	mStop = false;
+	if (!mCells.empty())
+		mThread = std::thread(&WorldStreamer::Run, this);
+}
+
+void WorldStreamer::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mWake.notify_all();
+	if (mThread.joinable())
+		mThread.join();
+}
+
+void WorldStreamer::Update(float x, float z)
+{
+	bool queued = false;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (uint32 i = 0; i < (uint32)mCells.size(); ++i)
+		{
+			CellSlot& slot = mCells[i];
+			slot.Distance = CellDistance(slot.Info, x, z);
+			bool inRange = slot.Distance <= mDesc.LoadRadius;
+			bool outOfRange = slot.Distance > mDesc.UnloadRadius;
+
+			switch (slot.State)
+			{
+			case CellState::Unloaded:
+				if (inRange)
+				{
+					slot.State = CellState::Queued;
+					queued = true;
+				}
+				break;
+			case CellState::Queued:
+				if (outOfRange)
+				{
+					slot.State = CellState::Unloaded;
+					mStats.Cancelled++;
+				}
+				break;
+			case CellState::Loading:
+				// The IO thread drops the result when it is done.
+				slot.Cancel = outOfRange;
+				break;
+			case CellState::Loaded:
+				if (outOfRange)
+				{
+					slot.Data.reset();
+					slot.State = CellState::Unloaded;
+					mStats.Cancelled++;
+				}
+				break;
+			case CellState::Resident:
+				if (outOfRange)
+				{
+					slot.State = CellState::Unloaded;
+					mStats.Resident--;
+					mStats.ResidentBytes -= slot.Info.UploadBytes;
+					mStats.Unloads++;
+					mUnloads.push_back(i);
+				}
+				break;
+			case CellState::Failed:
+				break;
+			}
+		}
+	}
+
+	if (queued)
+		mWake.notify_all();
+}
+
+void WorldStreamer::TakeLoaded(uint64 uploadBudget, std::vector<std::unique_ptr<CellData>>& out)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	mLoaded.clear();
+	for (uint32 i = 0; i < (uint32)mCells.size(); ++i)
+	{
+		if (mCells[i].State == CellState::Loaded)
+			mLoaded.push_back(i);
+	}
+	std::sort(mLoaded.begin(), mLoaded.end(),
+		[this](uint32 a, uint32 b) { return mCells[a].Distance < mCells[b].Distance; });
+
+	uint64 bytes = 0;
+	for (uint32 i : mLoaded)
+	{
+		CellSlot& slot = mCells[i];
+		if (bytes > 0 && bytes + slot.Data->UploadBytes > uploadBudget)
+			break;
+
+		bytes += slot.Data->UploadBytes;
+		slot.State = CellState::Resident;
+		mStats.Resident++;
+		mStats.ResidentBytes += slot.Info.UploadBytes;
+		out.push_back(std::move(slot.Data));
+	}
+}
+
+void WorldStreamer::TakeUnloads(std::vector<uint32>& out)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	out.insert(out.end(), mUnloads.begin(), mUnloads.end());
+	mUnloads.clear();
+}
+
+void WorldStreamer::Flush()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mIdle.wait(lock, [this]
+	{
+		return std::none_of(mCells.begin(), mCells.end(), [](const CellSlot& slot)
+		{
+			return slot.State == CellState::Queued || slot.State == CellState::Loading;
+		});
+	});
+}
+
+WorldStreamer::CellState WorldStreamer::GetState(uint32 cell)const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mCells[cell].State;
+}
+
+WorldStreamer::Stats WorldStreamer::GetStats()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Stats stats = mStats;
+	stats.Pending = (uint32)std::count_if(mCells.begin(), mCells.end(), [](const CellSlot& slot)
+	{
+		return slot.State == CellState::Queued || slot.State == CellState::Loading || slot.State == CellState::Loaded;
+	});
+	return stats;
+}
+
+void WorldStreamer::Run()
+{
+	using Clock = std::chrono::steady_clock;
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	for (;;)
+	{
+		// The nearest queued cell, by the distances of the latest update.
+		auto next = mCells.end();
+		for (auto it = mCells.begin(); it != mCells.end(); ++it)
+		{
+			if (it->State == CellState::Queued && (next == mCells.end() || it->Distance < next->Distance))
+				next = it;
+		}
+
+		if (mStop)
+			break;
+		if (next == mCells.end())
+		{
+			mIdle.notify_all();
+			mWake.wait(lock);
+			continue;
+		}
+
+		CellSlot& slot = *next;
+		slot.State = CellState::Loading;
+		slot.Cancel = false;
+		lock.unlock();
+
+		Clock::time_point start = Clock::now();
+		std::unique_ptr<CellData> data = Load(slot);
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		lock.lock();
+		mStats.LoadSeconds += seconds;
+		if (!data)
+		{
+			slot.State = CellState::Failed;
+			mStats.Failed++;
+		}
+		else if (slot.Cancel)
+		{
+			slot.State = CellState::Unloaded;
+			mStats.Cancelled++;
+		}
+		else
+		{
+			data->Cell = (uint32)(next - mCells.begin());
+			slot.Data = std::move(data);
+			slot.State = CellState::Loaded;
+			mStats.Loads++;
+		}
+	}
+
+	mIdle.notify_all();
+}
+
+std::unique_ptr<WorldStreamer::CellData> WorldStreamer::Load(const CellSlot& slot)const
+{
+	auto data = std::make_unique<CellData>();
+
+	// A pack cooked along with another main pack belongs to another scene.
+	if (!data->Pack.Open(slot.Path, mDesc.ContentKey, mDesc.SrvCount) || data->Pack.ContentHash() != slot.Info.ContentHash)
+		return nullptr;
+
+	uint64 decodedBytes = 0;
+	data->Meshes.resize(data->Pack.MeshCount());
+	for (uint32 i = 0; i < data->Pack.MeshCount(); ++i)
+	{
+		LoadedMesh& mesh = data->Meshes[i];
+		mesh.Mesh = &data->Pack.Meshes()[i];
+		if (!data->Pack.ReadMesh(*mesh.Mesh, mesh.Vertices, mesh.Indices, mesh.VertexStorage, mesh.IndexStorage))
+			return nullptr;
+
+		data->UploadBytes += mesh.Mesh->VertexBytes + mesh.Mesh->IndexBytes;
+		decodedBytes += mesh.VertexStorage.size() + mesh.IndexStorage.size();
+	}
+
+	data->Memory = TrackedMemory(MemoryTag::Geometry, decodedBytes);
+	return data;
+}
@@ -0,0 +1,145 @@
+//***************************************************************************************
+// WorldStreamer.h
+//
+// Keeps the world cells of a scene pack (see ScenePackWriter::SplitCells) loaded around
+// the camera.  A cell is queued once the camera comes within the load radius and let go
+// once it is past the unload radius, which is larger so a camera on the border does not
+// make it come and go.  An IO thread opens the queued cells, nearest first, and decodes
+// their geometry; the caller takes the loaded cells a few at a time so the uploads of
+// one frame stay within a budget.  A cell that goes out of range before it was taken is
+// dropped, or left unread if the thread had not started on it.
+//
+// This class only reads files and makes the decisions, it does not touch the GPU, so it
+// has no Direct3D dependency.
+//***************************************************************************************
+
+#pragma once
+
+#include "MemoryTracker.h"
+#include "ScenePack.h"
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class WorldStreamer
+{
+public:
+
+	using uint8 = std::uint8_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	struct Desc
+	{
+		float LoadRadius = 80.0f;
+		float UnloadRadius = 96.0f;
+		uint64 ContentKey = 0;          // the cell packs are opened with it
+		uint32 SrvCount = 0;            // and with this many SRVs for their materials
+	};
+
+	enum class CellState : uint32
+	{
+		Unloaded = 0,
+		Queued,
+		Loading,
+		Loaded,         // waiting to be taken
+		Resident,       // taken; the caller owns its data
+		Failed          // missing or stale file, not tried again
+	};
+
+	// Decoded buffers of one mesh; they point into the pack when it stores them raw.
+	struct LoadedMesh
+	{
+		const ScenePack::Mesh* Mesh = nullptr;
+		const uint8* Vertices = nullptr;
+		const uint8* Indices = nullptr;
+		std::vector<uint8> VertexStorage;
+		std::vector<uint8> IndexStorage;
+	};
+
+	struct CellData
+	{
+		uint32 Cell = 0;
+		ScenePack Pack;
+		std::vector<LoadedMesh> Meshes;    // one per mesh of the pack
+		uint64 UploadBytes = 0;
+		TrackedMemory Memory;              // the decoded buffers
+	};
+
+	struct Stats
+	{
+		uint32 Cells = 0;
+		uint32 Resident = 0;
+		uint32 Pending = 0;             // queued, loading or loaded
+		uint64 Loads = 0;
+		uint64 Cancelled = 0;
+		uint64 Failed = 0;
+		uint64 Unloads = 0;
+		uint64 ResidentBytes = 0;       // upload bytes of the resident cells
+		double LoadSeconds = 0.0;       // IO thread time spent opening and decoding
+	};
+
+public:
+	WorldStreamer() = default;
+	WorldStreamer(const WorldStreamer& rhs) = delete;
+	WorldStreamer& operator=(const WorldStreamer& rhs) = delete;
+	~WorldStreamer();
+
+	// Registers the cells of pack and starts the IO thread.
+	void Start(const ScenePack& pack, const Desc& desc);
+	void Stop();
+
+	// Queues and cancels cells for a camera at (x, z) on the ground plane.
+	void Update(float x, float z);
+
+	///<summary>
+	/// Moves loaded cells to out, nearest first, while their upload bytes stay within
+	/// uploadBudget; one cell is always taken so a large one cannot stall.  The cells are
+	/// resident until TakeUnloads hands them back.
+	///</summary>
+	void TakeLoaded(uint64 uploadBudget, std::vector<std::unique_ptr<CellData>>& out);
+
+	// Appends the resident cells that went out of range; they count as unloaded now.
+	void TakeUnloads(std::vector<uint32>& out);
+
+	// Blocks until no cell is queued or loading.
+	void Flush();
+
+	uint32 CellCount()const { return (uint32)mCells.size(); }
+	const ScenePack::Cell& GetCell(uint32 cell)const { return mCells[cell].Info; }
+	CellState GetState(uint32 cell)const;
+
+	Stats GetStats()const;
+
+private:
+	struct CellSlot
+	{
+		ScenePack::Cell Info;
+		std::string Path;
+		CellState State = CellState::Unloaded;
+		float Distance = 0.0f;
+		bool Cancel = false;
+		std::unique_ptr<CellData> Data;
+	};
+
+	void Run();
+	std::unique_ptr<CellData> Load(const CellSlot& slot)const;
+
+private:
+	Desc mDesc;
+	std::vector<CellSlot> mCells;
+	std::vector<uint32> mUnloads;
+	std::vector<uint32> mLoaded;        // TakeLoaded's scratch, kept for its capacity
+
+	mutable std::mutex mMutex;
+	std::condition_variable mWake;
+	std::condition_variable mIdle;
+	std::thread mThread;
+	bool mStop = false;
+
+	Stats mStats;
+};